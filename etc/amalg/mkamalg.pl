@@ -22,14 +22,26 @@ my @cfiles =
     (
       "lib/util.h",
       "lib/util.c",
+      "lib/cpu.h",
+      "lib/cpu.c",
+      "lib/thread.h",
+      "lib/thread.c",
+      "lib/mem.h",
+      "lib/mem.c",
       "lib/randombytes.h",
       "lib/randombytes.c",
+      "lib/sha512.h",
+      "lib/sha512.c",
       "lib/ed25519.h",
       "lib/ed25519.c",
       "lib/scrypt.h",
       "lib/scrypt.c",
       "lib/blake2.h",
       "lib/blake2.c",
+      "lib/argon2.h",
+      "lib/argon2.c",
+      "lib/kdf.h",
+      "lib/kdf.c",
       "lib/keypair.h",
       "lib/keypair.c",
       "lib/sign.h",
@@ -83,7 +95,7 @@ sub slurp_includes {
         close CFILE;
     }
 
-    @sysinc = grep { $_ !~ /(fcntl|stdint|windows|wincrypt|sys\/endian|sys\/stat|sys\/mman|sys\/types|unistd)/ } sort(uniq(@sysincludes));
+    @sysinc = grep { $_ !~ /(fcntl|stdint|windows|wincrypt|sys\/endian|sys\/stat|sys\/mman|sys\/syscall|sys\/types|unistd|pthread|cpuid|immintrin)/ } sort(uniq(@sysincludes));
     foreach (@sysinc) { say; }
 
     # Special case some headers
@@ -97,8 +109,19 @@ sub slurp_includes {
     say "#include <sys/types.h>";
     say "#include <sys/mman.h>";
     say "#include <unistd.h>";
+    say "#include <pthread.h>";
+    say "#if defined(__linux__)";
+    say "#include <sys/syscall.h>";
+    say "#endif";
     say "#endif /* !WINDOWS */\n";
 
+    # x86 SIMD headers, only where edsign-private.h will use them
+    say "#if (defined(__amd64__) || defined(__amd64) || defined(__x86_64__ ) || defined(_M_X64)) && \\";
+    say "    (defined(__clang__) || defined(__GNUC__)) && !defined(EDSIGN_NO_SIMD)";
+    say "#include <cpuid.h>";
+    say "#include <immintrin.h>";
+    say "#endif\n";
+
     # Ensure we notify that we're using the amalgamation.
     say "#define EDSIGN_AMALGAMATION 1\n";
 };
@@ -0,0 +1,615 @@
+/*
+** Argon2id key derivation function.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+**
+** Written from RFC 9106; the SIMD compression functions follow the
+** layout of the optimized Argon2 reference code, released under CC0.
+*/
+
+#include "edsign-private.h"
+#include "cpu.h"
+#include "thread.h"
+#include "mem.h"
+#include "blake2.h"
+#include "argon2.h"
+#include "util.h"
+
+#define ARGON2_VERSION       0x13 /* Version 1.3 */
+#define ARGON2_TYPE_ID       2    /* Argon2id */
+#define ARGON2_BLOCK_BYTES   1024
+#define ARGON2_QWORDS        (ARGON2_BLOCK_BYTES / 8)
+#define ARGON2_PREHASH_BYTES 64
+#define ARGON2_SYNC_POINTS   4
+#define ARGON2_MAX_LANES     0xffffffU
+
+/* How many blocks a lane fills between polls of its stop condition:
+** about a quarter of a millisecond's worth. */
+#define ARGON2_STOP_INTERVAL 256
+
+typedef struct ALIGNED(64) argon2_block {
+  uint64_t v[ARGON2_QWORDS];
+} argon2_block;
+
+/* A compression function: next = G(prev, ref), or next ^= G(prev,
+** ref) if ${with_xor}. ${ref} and ${next} may be the same block. */
+typedef void (*argon2_fill_fn)(const argon2_block* prev,
+                               const argon2_block* ref,
+                               argon2_block* next, int with_xor);
+
+/* The state of one computation, shared by the threads filling its
+** lanes. Each slice is filled by all lanes in parallel, and the
+** threads are joined between slices, which is the synchronization
+** Argon2 requires: a lane may only refer to the blocks of other lanes
+** filled in previous slices. */
+struct argon2_instance {
+  argon2_block* memory;
+  uint32_t passes;
+  uint32_t lanes;
+  uint32_t lane_length;
+  uint32_t segment_length;
+  uint32_t memory_blocks;
+  uint32_t pass;  /* The slice being filled */
+  uint32_t slice;
+  argon2_fill_fn fill;
+  const struct argon2_stop* S;
+  uint32_t stopped; /* Set once any lane sees ${S} say stop */
+};
+
+static inline uint64_t
+argon2_le64dec(const uint8_t* p)
+{
+  return ((uint64_t)(p[0])       | ((uint64_t)(p[1]) << 8) |
+          ((uint64_t)(p[2]) << 16) | ((uint64_t)(p[3]) << 24) |
+          ((uint64_t)(p[4]) << 32) | ((uint64_t)(p[5]) << 40) |
+          ((uint64_t)(p[6]) << 48) | ((uint64_t)(p[7]) << 56));
+}
+
+static inline void
+argon2_le64enc(uint8_t* p, uint64_t x)
+{
+  uint32_t i;
+  for (i = 0; i < 8; ++i) p[i] = (uint8_t)(x >> (8 * i));
+}
+
+static void
+argon2_block_dec(argon2_block* B, const uint8_t* in)
+{
+  uint32_t i;
+  for (i = 0; i < ARGON2_QWORDS; ++i) B->v[i] = argon2_le64dec(in + 8 * i);
+}
+
+static void
+argon2_block_enc(uint8_t* out, const argon2_block* B)
+{
+  uint32_t i;
+  for (i = 0; i < ARGON2_QWORDS; ++i) argon2_le64enc(out + 8 * i, B->v[i]);
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Compression ----------------------------------------------------------- */
+
+/* The BlaMka multiply-add of Argon2: x + y + 2 * lo32(x) * lo32(y) */
+static inline uint64_t
+argon2_fBlaMka(uint64_t x, uint64_t y)
+{
+  const uint64_t m = 0xffffffffULL;
+  return x + y + 2 * ((x & m) * (y & m));
+}
+
+static inline uint64_t
+argon2_rotr64(uint64_t w, unsigned c)
+{
+  return (w >> c) | (w << (64 - c));
+}
+
+#define ARGON2_GB(a, b, c, d)                                   \
+  do {                                                          \
+    a = argon2_fBlaMka(a, b); d = argon2_rotr64(d ^ a, 32);     \
+    c = argon2_fBlaMka(c, d); b = argon2_rotr64(b ^ c, 24);     \
+    a = argon2_fBlaMka(a, b); d = argon2_rotr64(d ^ a, 16);     \
+    c = argon2_fBlaMka(c, d); b = argon2_rotr64(b ^ c, 63);     \
+  } while (0)
+
+#define ARGON2_P(v0, v1, v2,  v3,  v4,  v5,  v6,  v7,           \
+                 v8, v9, v10, v11, v12, v13, v14, v15)          \
+  do {                                                          \
+    ARGON2_GB(v0, v4, v8,  v12); ARGON2_GB(v1, v5, v9,  v13);   \
+    ARGON2_GB(v2, v6, v10, v14); ARGON2_GB(v3, v7, v11, v15);   \
+    ARGON2_GB(v0, v5, v10, v15); ARGON2_GB(v1, v6, v11, v12);   \
+    ARGON2_GB(v2, v7, v8,  v13); ARGON2_GB(v3, v4, v9,  v14);   \
+  } while (0)
+
+/* The compression function G in portable C: the permutation P is
+** applied to the eight rows of 16 words of R = prev ^ ref, then to
+** its eight columns of pairs of words. */
+static void
+argon2_fill_block_ref(const argon2_block* prev, const argon2_block* ref,
+                      argon2_block* next, int with_xor)
+{
+  argon2_block R, T;
+  uint32_t i;
+
+  for (i = 0; i < ARGON2_QWORDS; ++i) {
+    R.v[i] = prev->v[i] ^ ref->v[i];
+    T.v[i] = with_xor ? R.v[i] ^ next->v[i] : R.v[i];
+  }
+
+  for (i = 0; i < 8; ++i) {
+    uint64_t* v = &R.v[16 * i];
+    ARGON2_P(v[0], v[1], v[2],  v[3],  v[4],  v[5],  v[6],  v[7],
+             v[8], v[9], v[10], v[11], v[12], v[13], v[14], v[15]);
+  }
+  for (i = 0; i < 8; ++i) {
+    uint64_t* v = &R.v[2 * i];
+    ARGON2_P(v[0],  v[1],  v[16], v[17], v[32], v[33], v[48],  v[49],
+             v[64], v[65], v[80], v[81], v[96], v[97], v[112], v[113]);
+  }
+
+  for (i = 0; i < ARGON2_QWORDS; ++i) next->v[i] = T.v[i] ^ R.v[i];
+}
+
+#undef ARGON2_GB
+#undef ARGON2_P
+
+#if defined(EDSIGN_X86_SIMD)
+
+/* -- SSE2: two words per register, a row in eight registers -- */
+
+static inline FORCE_INLINE __m128i
+argon2_fBlaMka_sse2(__m128i x, __m128i y)
+{
+  __m128i z = _mm_mul_epu32(x, y);
+  return _mm_add_epi64(_mm_add_epi64(x, y), _mm_add_epi64(z, z));
+}
+
+static inline FORCE_INLINE void
+argon2_gb_sse2(__m128i* a, __m128i* b, __m128i* c, __m128i* d)
+{
+  *a = argon2_fBlaMka_sse2(*a, *b);
+  *d = _mm_shuffle_epi32(_mm_xor_si128(*d, *a), _MM_SHUFFLE(2, 3, 0, 1));
+  *c = argon2_fBlaMka_sse2(*c, *d);
+  *b = _mm_xor_si128(*b, *c);
+  *b = _mm_or_si128(_mm_srli_epi64(*b, 24), _mm_slli_epi64(*b, 40));
+  *a = argon2_fBlaMka_sse2(*a, *b);
+  *d = _mm_xor_si128(*d, *a);
+  *d = _mm_or_si128(_mm_srli_epi64(*d, 16), _mm_slli_epi64(*d, 48));
+  *c = argon2_fBlaMka_sse2(*c, *d);
+  *b = _mm_xor_si128(*b, *c);
+  *b = _mm_or_si128(_mm_srli_epi64(*b, 63), _mm_add_epi64(*b, *b));
+}
+
+/* The high word of ${a} and the low word of ${b} */
+static inline FORCE_INLINE __m128i
+argon2_hilo_sse2(__m128i a, __m128i b)
+{
+  return _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(a),
+                                         _mm_castsi128_pd(b), 1));
+}
+
+/* P on the 16 words held in pairs by ${r}[0], ..., ${r}[7] */
+static inline FORCE_INLINE void
+argon2_p_sse2(__m128i* r0, __m128i* r1, __m128i* r2, __m128i* r3,
+              __m128i* r4, __m128i* r5, __m128i* r6, __m128i* r7)
+{
+  __m128i b0, b1, d0, d1;
+
+  argon2_gb_sse2(r0, r2, r4, r6);
+  argon2_gb_sse2(r1, r3, r5, r7);
+
+  /* Diagonalize: (v5, v6), (v7, v4), (v15, v12), and (v13, v14) */
+  b0 = argon2_hilo_sse2(*r2, *r3);
+  b1 = argon2_hilo_sse2(*r3, *r2);
+  d0 = argon2_hilo_sse2(*r7, *r6);
+  d1 = argon2_hilo_sse2(*r6, *r7);
+
+  argon2_gb_sse2(r0, &b0, r5, &d0);
+  argon2_gb_sse2(r1, &b1, r4, &d1);
+
+  *r2 = argon2_hilo_sse2(b1, b0);
+  *r3 = argon2_hilo_sse2(b0, b1);
+  *r6 = argon2_hilo_sse2(d0, d1);
+  *r7 = argon2_hilo_sse2(d1, d0);
+}
+
+static void
+argon2_fill_block_sse2(const argon2_block* prev, const argon2_block* ref,
+                       argon2_block* next, int with_xor)
+{
+  const __m128i* p = (const __m128i*)prev->v;
+  const __m128i* q = (const __m128i*)ref->v;
+  __m128i* n = (__m128i*)next->v;
+  __m128i R[64], T[64];
+  uint32_t i;
+
+  for (i = 0; i < 64; ++i) {
+    R[i] = _mm_xor_si128(_mm_load_si128(&p[i]), _mm_load_si128(&q[i]));
+    T[i] = with_xor ? _mm_xor_si128(R[i], _mm_load_si128(&n[i])) : R[i];
+  }
+
+  for (i = 0; i < 8; ++i)
+    argon2_p_sse2(&R[8 * i + 0], &R[8 * i + 1], &R[8 * i + 2], &R[8 * i + 3],
+                  &R[8 * i + 4], &R[8 * i + 5], &R[8 * i + 6], &R[8 * i + 7]);
+  for (i = 0; i < 8; ++i)
+    argon2_p_sse2(&R[i +  0], &R[i +  8], &R[i + 16], &R[i + 24],
+                  &R[i + 32], &R[i + 40], &R[i + 48], &R[i + 56]);
+
+  for (i = 0; i < 64; ++i) _mm_store_si128(&n[i], _mm_xor_si128(T[i], R[i]));
+}
+
+/* -- AVX2: four words per register, a row in four registers -- */
+
+static inline FORCE_INLINE __m256i TARGET("avx2")
+argon2_fBlaMka_avx2(__m256i x, __m256i y)
+{
+  __m256i z = _mm256_mul_epu32(x, y);
+  return _mm256_add_epi64(_mm256_add_epi64(x, y), _mm256_add_epi64(z, z));
+}
+
+static inline FORCE_INLINE void TARGET("avx2")
+argon2_gb_avx2(__m256i* a, __m256i* b, __m256i* c, __m256i* d)
+{
+  const __m256i rot24 = _mm256_setr_epi8(
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+  const __m256i rot16 = _mm256_setr_epi8(
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+
+  *a = argon2_fBlaMka_avx2(*a, *b);
+  *d = _mm256_shuffle_epi32(_mm256_xor_si256(*d, *a), _MM_SHUFFLE(2, 3, 0, 1));
+  *c = argon2_fBlaMka_avx2(*c, *d);
+  *b = _mm256_shuffle_epi8(_mm256_xor_si256(*b, *c), rot24);
+  *a = argon2_fBlaMka_avx2(*a, *b);
+  *d = _mm256_shuffle_epi8(_mm256_xor_si256(*d, *a), rot16);
+  *c = argon2_fBlaMka_avx2(*c, *d);
+  *b = _mm256_xor_si256(*b, *c);
+  *b = _mm256_or_si256(_mm256_srli_epi64(*b, 63), _mm256_add_epi64(*b, *b));
+}
+
+/* P on the 16 words held four each by ${a}, ${b}, ${c}, and ${d} */
+static inline FORCE_INLINE void TARGET("avx2")
+argon2_p_avx2(__m256i* a, __m256i* b, __m256i* c, __m256i* d)
+{
+  argon2_gb_avx2(a, b, c, d);
+
+  *b = _mm256_permute4x64_epi64(*b, _MM_SHUFFLE(0, 3, 2, 1));
+  *c = _mm256_permute4x64_epi64(*c, _MM_SHUFFLE(1, 0, 3, 2));
+  *d = _mm256_permute4x64_epi64(*d, _MM_SHUFFLE(2, 1, 0, 3));
+
+  argon2_gb_avx2(a, b, c, d);
+
+  *b = _mm256_permute4x64_epi64(*b, _MM_SHUFFLE(2, 1, 0, 3));
+  *c = _mm256_permute4x64_epi64(*c, _MM_SHUFFLE(1, 0, 3, 2));
+  *d = _mm256_permute4x64_epi64(*d, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+static void TARGET("avx2")
+argon2_fill_block_avx2(const argon2_block* prev, const argon2_block* ref,
+                       argon2_block* next, int with_xor)
+{
+  const __m256i* p = (const __m256i*)prev->v;
+  const __m256i* q = (const __m256i*)ref->v;
+  __m256i* n = (__m256i*)next->v;
+  __m256i R[32], T[32];
+  uint32_t i;
+
+  for (i = 0; i < 32; ++i) {
+    R[i] = _mm256_xor_si256(_mm256_load_si256(&p[i]),
+                            _mm256_load_si256(&q[i]));
+    T[i] = with_xor ? _mm256_xor_si256(R[i], _mm256_load_si256(&n[i])) : R[i];
+  }
+
+  for (i = 0; i < 8; ++i)
+    argon2_p_avx2(&R[4 * i], &R[4 * i + 1], &R[4 * i + 2], &R[4 * i + 3]);
+
+  /* A column is a pair of words from each row, so each register holds
+  ** halves of two columns; gather columns ${i} and ${i} + 1 into two
+  ** sets of four registers, and scatter them back. */
+  for (i = 0; i < 4; ++i) {
+    __m256i a0 = _mm256_permute2x128_si256(R[i],      R[i +  4], 0x20);
+    __m256i a1 = _mm256_permute2x128_si256(R[i],      R[i +  4], 0x31);
+    __m256i b0 = _mm256_permute2x128_si256(R[i +  8], R[i + 12], 0x20);
+    __m256i b1 = _mm256_permute2x128_si256(R[i +  8], R[i + 12], 0x31);
+    __m256i c0 = _mm256_permute2x128_si256(R[i + 16], R[i + 20], 0x20);
+    __m256i c1 = _mm256_permute2x128_si256(R[i + 16], R[i + 20], 0x31);
+    __m256i d0 = _mm256_permute2x128_si256(R[i + 24], R[i + 28], 0x20);
+    __m256i d1 = _mm256_permute2x128_si256(R[i + 24], R[i + 28], 0x31);
+
+    argon2_p_avx2(&a0, &b0, &c0, &d0);
+    argon2_p_avx2(&a1, &b1, &c1, &d1);
+
+    R[i]      = _mm256_permute2x128_si256(a0, a1, 0x20);
+    R[i +  4] = _mm256_permute2x128_si256(a0, a1, 0x31);
+    R[i +  8] = _mm256_permute2x128_si256(b0, b1, 0x20);
+    R[i + 12] = _mm256_permute2x128_si256(b0, b1, 0x31);
+    R[i + 16] = _mm256_permute2x128_si256(c0, c1, 0x20);
+    R[i + 20] = _mm256_permute2x128_si256(c0, c1, 0x31);
+    R[i + 24] = _mm256_permute2x128_si256(d0, d1, 0x20);
+    R[i + 28] = _mm256_permute2x128_si256(d0, d1, 0x31);
+  }
+
+  for (i = 0; i < 32; ++i)
+    _mm256_store_si256(&n[i], _mm256_xor_si256(T[i], R[i]));
+}
+
+#endif /* !EDSIGN_X86_SIMD */
+
+/* The fastest compression function this CPU supports */
+static argon2_fill_fn
+argon2_fill_select(void)
+{
+#if defined(EDSIGN_X86_SIMD)
+  uint32_t cpu = edsign_cpu_features();
+
+  if (cpu & EDSIGN_CPU_AVX2) return argon2_fill_block_avx2;
+  if (cpu & EDSIGN_CPU_SSE2) return argon2_fill_block_sse2;
+#endif
+  return argon2_fill_block_ref;
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Memory filling -------------------------------------------------------- */
+
+/* Whether ${I} should stop: polled by every lane, and remembered once
+** true so the other lanes stop at their next poll too. */
+static int
+argon2_stopped(struct argon2_instance* I)
+{
+  if (I->S == NULL) return 0;
+
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+  if (__atomic_load_n(&I->stopped, __ATOMIC_RELAXED)) return 1;
+  if (!I->S->fn(I->S->arg)) return 0;
+  __atomic_store_n(&I->stopped, 1, __ATOMIC_RELAXED);
+#else
+  if (*(volatile uint32_t*)&I->stopped) return 1;
+  if (!I->S->fn(I->S->arg)) return 0;
+  *(volatile uint32_t*)&I->stopped = 1;
+#endif
+  return 1;
+}
+
+/* The next block of pseudo-random addresses of data-independent
+** addressing: G(0, G(0, ${input})), after bumping its counter. */
+static void
+argon2_next_addresses(const struct argon2_instance* I, argon2_block* addr,
+                      argon2_block* input, const argon2_block* zero)
+{
+  input->v[6]++;
+  I->fill(zero, input, addr, 0);
+  I->fill(zero, addr, addr, 0);
+}
+
+/* The index in its lane of the block referred to by the block at
+** ${index} in the current segment, from the low 32 bits ${pseudo} of
+** its pseudo-random value: any block of the reference set, biased
+** towards the most recent ones. */
+static uint32_t
+argon2_index_alpha(const struct argon2_instance* I, uint32_t index,
+                   uint32_t pseudo, int same_lane)
+{
+  uint32_t area, start = 0;
+  uint64_t rel;
+
+  if (I->pass == 0) {
+    /* Only the slices before this one, and this segment so far */
+    if (I->slice == 0)
+      area = index - 1;
+    else if (same_lane)
+      area = I->slice * I->segment_length + index - 1;
+    else
+      area = I->slice * I->segment_length - (index == 0 ? 1 : 0);
+  }
+  else {
+    /* All but the segment about to be overwritten */
+    if (same_lane)
+      area = I->lane_length - I->segment_length + index - 1;
+    else
+      area = I->lane_length - I->segment_length - (index == 0 ? 1 : 0);
+  }
+
+  rel = pseudo;
+  rel = (rel * rel) >> 32;
+  rel = area - 1 - (((uint64_t)area * rel) >> 32);
+
+  if (I->pass != 0 && I->slice != ARGON2_SYNC_POINTS - 1)
+    start = (I->slice + 1) * I->segment_length;
+
+  return (uint32_t)((start + rel) % I->lane_length);
+}
+
+/* Fill the segment of lane ${lane} in the current slice of ${I}. */
+static void
+argon2_fill_segment(struct argon2_instance* I, uint32_t lane)
+{
+  argon2_block addr, input, zero;
+  uint32_t i, start = 0, curr, prev, ref_lane, ref_index;
+  uint64_t pseudo;
+  /* Argon2id: data-independent addressing in the first half of the
+  ** first pass, to resist side channels; data-dependent from then on,
+  ** to resist time-memory tradeoffs. */
+  int indep = (I->pass == 0 && I->slice < ARGON2_SYNC_POINTS / 2);
+
+  if (indep) {
+    memset(&zero,  0, sizeof(zero));
+    memset(&input, 0, sizeof(input));
+    input.v[0] = I->pass;
+    input.v[1] = lane;
+    input.v[2] = I->slice;
+    input.v[3] = I->memory_blocks;
+    input.v[4] = I->passes;
+    input.v[5] = ARGON2_TYPE_ID;
+  }
+
+  /* The first two blocks of each lane come from the password */
+  if (I->pass == 0 && I->slice == 0) {
+    start = 2;
+    if (indep) argon2_next_addresses(I, &addr, &input, &zero);
+  }
+
+  curr = lane * I->lane_length + I->slice * I->segment_length + start;
+  prev = (curr % I->lane_length == 0) ? curr + I->lane_length - 1 : curr - 1;
+
+  for (i = start; i < I->segment_length; ++i, ++curr, ++prev) {
+    if (curr % I->lane_length == 1) prev = curr - 1;
+    if (i % ARGON2_STOP_INTERVAL == 0 && argon2_stopped(I)) return;
+
+    if (indep) {
+      if (i % ARGON2_QWORDS == 0)
+        argon2_next_addresses(I, &addr, &input, &zero);
+      pseudo = addr.v[i % ARGON2_QWORDS];
+    }
+    else {
+      pseudo = I->memory[prev].v[0];
+    }
+
+    ref_lane = (uint32_t)((pseudo >> 32) % I->lanes);
+    if (I->pass == 0 && I->slice == 0) ref_lane = lane;
+    ref_index = argon2_index_alpha(I, i, (uint32_t)pseudo, ref_lane == lane);
+
+    /* Version 1.3 XORs into the blocks it overwrites */
+    I->fill(&I->memory[prev],
+            &I->memory[(uint64_t)ref_lane * I->lane_length + ref_index],
+            &I->memory[curr], I->pass != 0);
+  }
+
+  if (indep) edsign_bzero((uint8_t*)&addr, sizeof(addr));
+}
+
+static void
+argon2_lane_task(void* arg, uint32_t worker, uint64_t item)
+{
+  (void)worker;
+  argon2_fill_segment(arg, (uint32_t)item);
+}
+
+/**
+ * crypto_argon2id_memory(m, p):
+ * Return the bytes of working memory crypto_argon2id allocates for
+ * ${m} KiB of memory and ${p} lanes, or 0 if they are invalid.
+ */
+EDSIGN_STATIC uint64_t
+crypto_argon2id_memory(uint32_t m, uint32_t p)
+{
+  uint64_t blocks;
+
+  if (p == 0 || p > ARGON2_MAX_LANES || m < 8 * (uint64_t)p) return 0;
+
+  /* Rounded down to a whole number of blocks in every segment */
+  blocks = m - m % (4 * (uint64_t)p);
+  return blocks * ARGON2_BLOCK_BYTES;
+}
+
+/**
+ * crypto_argon2id(pass, passlen, salt, saltlen, t, m, p, out, outlen, S):
+ * Compute Argon2id version 1.3 (RFC 9106) of the password ${pass} and
+ * salt ${salt}, with ${t} passes over ${m} KiB of memory split into
+ * ${p} lanes, and write the ${outlen} byte tag to ${out}. The lanes of
+ * each slice are computed in parallel, on up to as many threads as
+ * edsign_set_threads allows. If ${S} is not NULL, it is polled from
+ * every lane, and the computation stops early once it says so. Return
+ * 0 on success, or -1 on error or if stopped.
+ */
+EDSIGN_STATIC int
+crypto_argon2id(const uint8_t* pass, size_t passlen,
+                const uint8_t* salt, size_t saltlen,
+                uint32_t t, uint32_t m, uint32_t p,
+                uint8_t* out, size_t outlen, const struct argon2_stop* S)
+{
+  struct argon2_instance I;
+  edsign_region R;
+  uint8_t params[24], lens[16];
+  uint8_t seed[ARGON2_PREHASH_BYTES + 8];
+  uint8_t bytes[ARGON2_BLOCK_BYTES];
+  const uint8_t* parts[8];
+  uint64_t partlens[8];
+  uint64_t mem = crypto_argon2id_memory(m, p);
+  argon2_block C;
+  uint32_t nthreads, l, k;
+  int rc = -1;
+
+  /* The limits of RFC 9106, section 3.1 */
+  if (mem == 0 || t == 0 || outlen < 4 || outlen > 0xffffffffUL) return -1;
+  if (saltlen < 8 || saltlen > 0xffffffffUL) return -1;
+  if ((uint64_t)passlen > 0xffffffffUL) return -1;
+  if (mem > SIZE_MAX) return -1;
+
+  I.passes         = t;
+  I.lanes          = p;
+  I.memory_blocks  = (uint32_t)(mem / ARGON2_BLOCK_BYTES);
+  I.lane_length    = I.memory_blocks / p;
+  I.segment_length = I.lane_length / ARGON2_SYNC_POINTS;
+  I.fill           = argon2_fill_select();
+  I.S              = S;
+  I.stopped        = 0;
+
+  if ((I.memory = edsign_region_alloc(&R, (size_t)mem)) == NULL) return -1;
+
+  /* H0: the parameters, then the password and salt, each prefixed by
+  ** its length; there is no secret or associated data. */
+  edsign_le32enc(&params[0],  p);
+  edsign_le32enc(&params[4],  (uint32_t)outlen);
+  edsign_le32enc(&params[8],  m);
+  edsign_le32enc(&params[12], t);
+  edsign_le32enc(&params[16], ARGON2_VERSION);
+  edsign_le32enc(&params[20], ARGON2_TYPE_ID);
+  edsign_le32enc(&lens[0],    (uint32_t)passlen);
+  edsign_le32enc(&lens[4],    (uint32_t)saltlen);
+  edsign_le32enc(&lens[8],    0);
+  edsign_le32enc(&lens[12],   0);
+
+  parts[0] = params;   partlens[0] = sizeof(params);
+  parts[1] = &lens[0]; partlens[1] = 4;
+  parts[2] = pass;     partlens[2] = passlen;
+  parts[3] = &lens[4]; partlens[3] = 4;
+  parts[4] = salt;     partlens[4] = saltlen;
+  parts[5] = &lens[8]; partlens[5] = 8;
+  crypto_hash_blake2b_parts(seed, ARGON2_PREHASH_BYTES, parts, partlens, 6);
+
+  /* The first two blocks of each lane: H'(H0 || j || lane) */
+  for (l = 0; l < p; ++l) {
+    for (k = 0; k < 2; ++k) {
+      edsign_le32enc(&seed[ARGON2_PREHASH_BYTES],     k);
+      edsign_le32enc(&seed[ARGON2_PREHASH_BYTES + 4], l);
+      crypto_hash_blake2b_long(bytes, sizeof(bytes), seed, sizeof(seed));
+      argon2_block_dec(&I.memory[(uint64_t)l * I.lane_length + k], bytes);
+    }
+  }
+
+  /* Fill memory a slice at a time, with the lanes in parallel */
+  nthreads = edsign_thread_limit();
+  for (I.pass = 0; I.pass < t; ++I.pass) {
+    for (I.slice = 0; I.slice < ARGON2_SYNC_POINTS; ++I.slice) {
+      edsign_parallel_for(nthreads, p, argon2_lane_task, &I);
+      if (I.stopped) goto done;
+    }
+  }
+
+  /* The tag: H' of the XOR of the last block of every lane */
+  memcpy(&C, &I.memory[I.lane_length - 1], sizeof(C));
+  for (l = 1; l < p; ++l) {
+    const argon2_block* B = &I.memory[(uint64_t)l * I.lane_length +
+                                      I.lane_length - 1];
+    for (k = 0; k < ARGON2_QWORDS; ++k) C.v[k] ^= B->v[k];
+  }
+  argon2_block_enc(bytes, &C);
+  crypto_hash_blake2b_long(out, outlen, bytes, sizeof(bytes));
+  edsign_bzero((uint8_t*)&C, sizeof(C));
+  rc = 0;
+
+ done:
+  edsign_bzero(seed, sizeof(seed));
+  edsign_bzero(bytes, sizeof(bytes));
+  if (edsign_region_free(&R)) rc = -1;
+  return rc;
+}
+
+#undef ARGON2_VERSION
+#undef ARGON2_TYPE_ID
+#undef ARGON2_BLOCK_BYTES
+#undef ARGON2_QWORDS
+#undef ARGON2_PREHASH_BYTES
+#undef ARGON2_SYNC_POINTS
+#undef ARGON2_MAX_LANES
+#undef ARGON2_STOP_INTERVAL
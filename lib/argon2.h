@@ -0,0 +1,48 @@
+/*
+** Argon2id key derivation function.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#ifndef _EDSIGN_ARGON2_H_
+#define _EDSIGN_ARGON2_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A condition crypto_argon2id polls, to stop early once fn(arg) != 0. */
+struct argon2_stop {
+  int (*fn)(void*);
+  void* arg;
+};
+
+/**
+ * crypto_argon2id_memory(m, p):
+ * Return the bytes of working memory crypto_argon2id allocates for
+ * ${m} KiB of memory and ${p} lanes, or 0 if they are invalid.
+ */
+EDSIGN_STATIC uint64_t
+crypto_argon2id_memory(uint32_t m, uint32_t p);
+
+/**
+ * crypto_argon2id(pass, passlen, salt, saltlen, t, m, p, out, outlen, S):
+ * Compute Argon2id version 1.3 (RFC 9106) of the password ${pass} and
+ * salt ${salt}, with ${t} passes over ${m} KiB of memory split into
+ * ${p} lanes, and write the ${outlen} byte tag to ${out}. The lanes of
+ * each slice are computed in parallel, on up to as many threads as
+ * edsign_set_threads allows. If ${S} is not NULL, it is polled from
+ * every lane, and the computation stops early once it says so. Return
+ * 0 on success, or -1 on error or if stopped.
+ */
+EDSIGN_STATIC int
+crypto_argon2id(const uint8_t* pass, size_t passlen,
+                const uint8_t* salt, size_t saltlen,
+                uint32_t t, uint32_t m, uint32_t p,
+                uint8_t* out, size_t outlen, const struct argon2_stop* S);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* !_EDSIGN_ARGON2_H_ */
@@ -50,16 +50,6 @@
     uint8_t  personal[BLAKE2S_PERSONALBYTES];  // 32
   } blake2s_param;
 
-  ALIGN( 64 ) typedef struct __blake2s_state
-  {
-    uint32_t h[8];
-    uint32_t t[2];
-    uint32_t f[2];
-    uint8_t  buf[2 * BLAKE2S_BLOCKBYTES];
-    size_t   buflen;
-    uint8_t  last_node;
-  } blake2s_state ;
-
   typedef struct __blake2b_param
   {
     uint8_t  digest_length; // 1
@@ -74,13 +64,30 @@
     uint8_t  salt[BLAKE2B_SALTBYTES]; // 48
     uint8_t  personal[BLAKE2B_PERSONALBYTES];  // 64
   } blake2b_param;
+#pragma pack(pop)
+
+  /* Only the parameter blocks above are byte-packed: the states below
+  ** are aligned, and arrays of them need their natural padding. */
 
-  ALIGN( 64 ) typedef struct __blake2b_state
+  typedef struct ALIGN( 64 ) __blake2s_state
+  {
+    uint32_t h[8];
+    uint32_t t[2];
+    uint32_t f[2];
+    uint8_t  buf[2 * BLAKE2S_BLOCKBYTES];
+    size_t   buflen;
+    uint8_t  last_node;
+  } blake2s_state ;
+
+  /* The buffer holds at most one block: full blocks are compressed
+  ** straight out of the caller's input by blake2b_update, and only the
+  ** trailing (possibly full) block is kept back for blake2b_final. */
+  typedef struct ALIGN( 64 ) __blake2b_state
   {
     uint64_t h[8];
     uint64_t t[2];
     uint64_t f[2];
-    uint8_t  buf[2 * BLAKE2B_BLOCKBYTES];
+    uint8_t  buf[BLAKE2B_BLOCKBYTES];
     size_t   buflen;
     uint8_t  last_node;
   } blake2b_state;
@@ -100,7 +107,6 @@
     uint8_t buf[4 * BLAKE2B_BLOCKBYTES];
     size_t  buflen;
   } blake2bp_state;
-#pragma pack(pop)
 
 
 static inline uint64_t
@@ -369,52 +375,54 @@ blake2b_compress( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
 static int
 blake2b_update( blake2b_state *S, const uint8_t *in, uint64_t inlen )
 {
-  while( inlen > 0 )
-  {
-    size_t left = S->buflen;
-    size_t fill = 2 * BLAKE2B_BLOCKBYTES - left;
+  size_t left = S->buflen;
+  size_t fill = BLAKE2B_BLOCKBYTES - left;
 
-    if( inlen > fill )
-    {
-      memcpy( S->buf + left, in, fill ); // Fill buffer
-      S->buflen += fill;
-      blake2b_increment_counter( S, BLAKE2B_BLOCKBYTES );
-      blake2b_compress( S, S->buf ); // Compress
-      memcpy( S->buf, S->buf + BLAKE2B_BLOCKBYTES, BLAKE2B_BLOCKBYTES ); // Shift buffer left
-      S->buflen -= BLAKE2B_BLOCKBYTES;
-      in += fill;
-      inlen -= fill;
-    }
-    else // inlen <= fill
+  if( inlen == 0 ) return 0;
+
+  if( left > 0 )
+  {
+    if( inlen <= fill )
     {
       memcpy( S->buf + left, in, inlen );
       S->buflen += inlen; // Be lazy, do not compress
-      in += inlen;
-      inlen -= inlen;
+      return 0;
     }
+
+    /* Complete the buffered block and compress it */
+    memcpy( S->buf + left, in, fill );
+    blake2b_increment_counter( S, BLAKE2B_BLOCKBYTES );
+    blake2b_compress( S, S->buf );
+    S->buflen = 0;
+    in += fill;
+    inlen -= fill;
+  }
+
+  /* Compress full blocks directly from the input, always keeping the
+  ** final block back: it might be the last one, which must be
+  ** compressed with the finalization flag set by blake2b_final. */
+  while( inlen > BLAKE2B_BLOCKBYTES )
+  {
+    blake2b_increment_counter( S, BLAKE2B_BLOCKBYTES );
+    blake2b_compress( S, in );
+    in += BLAKE2B_BLOCKBYTES;
+    inlen -= BLAKE2B_BLOCKBYTES;
   }
 
+  memcpy( S->buf, in, inlen );
+  S->buflen = inlen;
   return 0;
 }
 
-/* Is this correct? */
 static int
 blake2b_final( blake2b_state *S, uint8_t *out, uint8_t outlen )
 {
   int i;
   uint8_t buffer[BLAKE2B_OUTBYTES];
 
-  if( S->buflen > BLAKE2B_BLOCKBYTES )
-  {
-    blake2b_increment_counter( S, BLAKE2B_BLOCKBYTES );
-    blake2b_compress( S, S->buf );
-    S->buflen -= BLAKE2B_BLOCKBYTES;
-    memcpy( S->buf, S->buf + BLAKE2B_BLOCKBYTES, S->buflen );
-  }
-
   blake2b_increment_counter( S, S->buflen );
   blake2b_set_lastblock( S );
-  memset( S->buf + S->buflen, 0, 2 * BLAKE2B_BLOCKBYTES - S->buflen ); /* Padding */
+  memset( S->buf + S->buflen, 0, BLAKE2B_BLOCKBYTES - S->buflen ); /* Padding */
   blake2b_compress( S, S->buf );
 
   for( i = 0; i < 8; ++i ) /* Output full hash to temp buffer */
@@ -451,8 +459,135 @@ blake2b( uint8_t *out, const void *in, const void *key, const uint8_t outlen, co
   return 0;
 }
 
+/* blake2b_IV XOR the parameter block of an unkeyed, sequential hash
+** with a 64-byte digest (digest_length = 64, fanout = depth = 1): only
+** the first word of the parameter block is non-zero. */
+static const uint64_t blake2b_IV_out64[8] =
+{
+  0x6a09e667f3bcc908ULL ^ 0x0000000001010040ULL, 0xbb67ae8584caa73bULL,
+  0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+  0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+/* Hash at most one block into a 64-byte digest. This skips the
+** parameter block, streaming buffer and padding of the generic path,
+** and is inlined so that a constant ${inlen} specializes it. */
+static inline FORCE_INLINE void
+blake2b_oneblock( uint8_t *out, const uint8_t *in, const size_t inlen )
+{
+  blake2b_state S[1];
+  int i;
+
+  for( i = 0; i < 8; ++i ) S->h[i] = blake2b_IV_out64[i];
+  S->t[0] = inlen;
+  S->t[1] = 0;
+  S->f[0] = ~0ULL;
+  S->f[1] = 0;
+
+  memcpy( S->buf, in, inlen );
+  memset( S->buf + inlen, 0, BLAKE2B_BLOCKBYTES - inlen );
+  blake2b_compress( S, S->buf );
+
+  for( i = 0; i < 8; ++i )
+    store64( out + sizeof( S->h[i] ) * i, S->h[i] );
+
+  secure_zero_memory( S->buf, BLAKE2B_BLOCKBYTES );
+}
+
 EDSIGN_STATIC int
 crypto_hash_blake2b(uint8_t *out, const uint8_t *in, uint64_t inlen)
 {
+  if (in == NULL || out == NULL) return -1;
+  if (inlen <= BLAKE2B_BLOCKBYTES) {
+    blake2b_oneblock(out, in, inlen);
+    return 0;
+  }
+
   return blake2b(out, in, NULL, BLAKE2B_OUTBYTES, inlen, 0);
 }
+
+/**
+ * crypto_hash_blake2b_64(out, in):
+ * Compute the 64-byte BLAKE2b digest of exactly 64 bytes of input
+ * ${in}, and store it in ${out}. This is the same digest as
+ * crypto_hash_blake2b(out, in, 64), specialized for the fixed-size key
+ * digests computed around every signature.
+ */
+EDSIGN_STATIC int
+crypto_hash_blake2b_64(uint8_t *out, const uint8_t *in)
+{
+  blake2b_oneblock(out, in, 64);
+  return 0;
+}
+
+/**
+ * crypto_hash_blake2b_parts(out, outlen, in, inlen, n):
+ * Compute the ${outlen}-byte BLAKE2b digest of the concatenation of
+ * the ${n} inputs ${in}[i], each ${inlen}[i] bytes long, and store it
+ * in ${out}. ${outlen} must be between 1 and 64.
+ */
+EDSIGN_STATIC int
+crypto_hash_blake2b_parts(uint8_t *out, size_t outlen,
+                          const uint8_t *const *in, const uint64_t *inlen,
+                          size_t n)
+{
+  blake2b_state S[1];
+  size_t i;
+
+  if (out == NULL) return -1;
+  if (blake2b_init(S, (uint8_t)outlen) < 0 || outlen > BLAKE2B_OUTBYTES)
+    return -1;
+
+  for (i = 0; i < n; ++i) blake2b_update(S, in[i], inlen[i]);
+  blake2b_final(S, out, (uint8_t)outlen);
+
+  secure_zero_memory(S, sizeof(S));
+  return 0;
+}
+
+/**
+ * crypto_hash_blake2b_long(out, outlen, in, inlen):
+ * Compute the variable-length hash H' of Argon2 (RFC 9106, section
+ * 3.3) of the ${inlen} bytes ${in}, and store its ${outlen} bytes in
+ * ${out}: BLAKE2b of the length and input if ${outlen} is at most 64,
+ * or else the first halves of a chain of 64-byte BLAKE2b digests.
+ */
+EDSIGN_STATIC int
+crypto_hash_blake2b_long(uint8_t *out, size_t outlen,
+                         const uint8_t *in, uint64_t inlen)
+{
+  uint8_t len[4];
+  uint8_t V[BLAKE2B_OUTBYTES];
+  const uint8_t *parts[2];
+  uint64_t lens[2];
+
+  if (out == NULL || in == NULL || outlen == 0 || outlen > 0xffffffffUL)
+    return -1;
+
+  store32(len, (uint32_t)outlen);
+  parts[0] = len; lens[0] = sizeof(len);
+  parts[1] = in;  lens[1] = inlen;
+
+  if (outlen <= BLAKE2B_OUTBYTES)
+    return crypto_hash_blake2b_parts(out, outlen, parts, lens, 2);
+
+  crypto_hash_blake2b_parts(V, BLAKE2B_OUTBYTES, parts, lens, 2);
+  memcpy(out, V, BLAKE2B_OUTBYTES / 2);
+  out += BLAKE2B_OUTBYTES / 2;
+  outlen -= BLAKE2B_OUTBYTES / 2;
+
+  while (outlen > BLAKE2B_OUTBYTES) {
+    blake2b_oneblock(V, V, BLAKE2B_OUTBYTES);
+    memcpy(out, V, BLAKE2B_OUTBYTES / 2);
+    out += BLAKE2B_OUTBYTES / 2;
+    outlen -= BLAKE2B_OUTBYTES / 2;
+  }
+
+  /* The last digest is as long as what is left */
+  parts[0] = V; lens[0] = BLAKE2B_OUTBYTES;
+  crypto_hash_blake2b_parts(out, outlen, parts, lens, 1);
+
+  secure_zero_memory(V, sizeof(V));
+  return 0;
+}
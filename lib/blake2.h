@@ -21,6 +21,38 @@ extern "C" {
 EDSIGN_STATIC int
 crypto_hash_blake2b(uint8_t* out, const uint8_t* in, uint64_t inlen);
 
+/**
+ * crypto_hash_blake2b_64(out, in):
+ * Compute the 64-byte BLAKE2b digest of exactly 64 bytes of input
+ * ${in}, and store it in ${out}. This is the same digest as
+ * crypto_hash_blake2b(out, in, 64), specialized for the fixed-size key
+ * digests computed around every signature.
+ */
+EDSIGN_STATIC int
+crypto_hash_blake2b_64(uint8_t* out, const uint8_t* in);
+
+/**
+ * crypto_hash_blake2b_parts(out, outlen, in, inlen, n):
+ * Compute the ${outlen}-byte BLAKE2b digest of the concatenation of
+ * the ${n} inputs ${in}[i], each ${inlen}[i] bytes long, and store it
+ * in ${out}. ${outlen} must be between 1 and 64.
+ */
+EDSIGN_STATIC int
+crypto_hash_blake2b_parts(uint8_t* out, size_t outlen,
+                          const uint8_t* const* in, const uint64_t* inlen,
+                          size_t n);
+
+/**
+ * crypto_hash_blake2b_long(out, outlen, in, inlen):
+ * Compute the variable-length hash H' of Argon2 (RFC 9106, section
+ * 3.3) of the ${inlen} bytes ${in}, and store its ${outlen} bytes in
+ * ${out}: BLAKE2b of the length and input if ${outlen} is at most 64,
+ * or else the first halves of a chain of 64-byte BLAKE2b digests.
+ */
+EDSIGN_STATIC int
+crypto_hash_blake2b_long(uint8_t* out, size_t outlen,
+                         const uint8_t* in, uint64_t inlen);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,98 @@
+/*
+** Runtime CPU feature detection.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#include "edsign-private.h"
+#include "cpu.h"
+
+#if defined(EDSIGN_X86_SIMD)
+
+/* Read the extended control register XCR0, which tells us which
+** register states the OS saves and restores on context switches. */
+static uint64_t
+cpu_xgetbv(void)
+{
+  uint32_t lo, hi;
+  __asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static uint32_t
+cpu_detect(void)
+{
+  uint32_t a, b, c, d;
+  uint32_t c1, b7 = 0;
+  uint32_t max;
+  uint32_t res = EDSIGN_CPU_SSE2;
+
+  max = __get_cpuid_max(0, NULL);
+  if (max < 1) return res;
+
+  __cpuid(1, a, b, c, d);
+  c1 = c;
+
+  if (max >= 7) __cpuid_count(7, 0, a, b7, c, d);
+
+  /* The SHA extensions only touch XMM state, so unlike AVX2 they need
+  ** no OS support beyond SSE; the kernel also uses SSSE3 (bit 9) and
+  ** SSE4.1 (bit 19) shuffles. */
+  if ((b7 & (1 << 29)) && (c1 & (1 << 9)) && (c1 & (1 << 19)))
+    res |= EDSIGN_CPU_SHA;
+
+  /* AVX2 needs OSXSAVE (bit 27), AVX (bit 28), and the OS to save
+  ** both the XMM and YMM register state in XCR0. */
+  if ((c1 & (1 << 27)) == 0 || (c1 & (1 << 28)) == 0) return res;
+  if ((cpu_xgetbv() & 6) != 6) return res;
+
+  if (b7 & (1 << 5)) res |= EDSIGN_CPU_AVX2;
+
+  return res;
+}
+
+#else
+
+static uint32_t
+cpu_detect(void)
+{
+  return 0;
+}
+
+#endif /* !EDSIGN_X86_SIMD */
+
+/* The detected flags, plus a bit saying detection has run, in a single
+** word: racing threads all compute and store the same value, so the
+** cache needs no locking, only untorn loads and stores. */
+#define CPU_CACHED (1U << 31)
+static uint32_t edsign_cpu_cache = 0;
+
+/**
+ * edsign_cpu_features():
+ * Return the set of EDSIGN_CPU_* flags describing the SIMD extensions
+ * which are both supported by the running CPU and usable by this build
+ * of the library. The result is computed once and cached.
+ */
+EDSIGN_STATIC uint32_t
+edsign_cpu_features(void)
+{
+  uint32_t res;
+
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+  res = __atomic_load_n(&edsign_cpu_cache, __ATOMIC_RELAXED);
+  if (unlikely(!(res & CPU_CACHED))) {
+    res = cpu_detect() | CPU_CACHED;
+    __atomic_store_n(&edsign_cpu_cache, res, __ATOMIC_RELAXED);
+  }
+#else
+  res = *(volatile uint32_t*)&edsign_cpu_cache;
+  if (unlikely(!(res & CPU_CACHED))) {
+    res = cpu_detect() | CPU_CACHED;
+    *(volatile uint32_t*)&edsign_cpu_cache = res;
+  }
+#endif
+
+  return res & ~CPU_CACHED;
+}
+
+#undef CPU_CACHED
@@ -0,0 +1,31 @@
+/*
+** Runtime CPU feature detection.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#ifndef _EDSIGN_CPU_H_
+#define _EDSIGN_CPU_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EDSIGN_CPU_SSE2 (1 << 0) /* Always set on x86_64 */
+#define EDSIGN_CPU_AVX2 (1 << 1) /* AVX2, with OS support for YMM state */
+#define EDSIGN_CPU_SHA  (1 << 2) /* SHA extensions, with SSSE3 and SSE4.1 */
+
+/**
+ * edsign_cpu_features():
+ * Return the set of EDSIGN_CPU_* flags describing the SIMD extensions
+ * which are both supported by the running CPU and usable by this build
+ * of the library. The result is computed once and cached.
+ */
+EDSIGN_STATIC uint32_t
+edsign_cpu_features(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* !_EDSIGN_CPU_H_ */
@@ -8,13 +8,14 @@
 */
 
 #include "edsign-private.h"
+#include "util.h"
 #include "randombytes.h"
+#include "sha512.h"
 #include "ed25519.h"
 
 /* -------------------------------------------------------------------------- */
 /* -- Types ----------------------------------------------------------------- */
 
-typedef struct { uint32_t v[32]; } sc25519;
 typedef struct { uint32_t v[16]; } shortsc25519;
 typedef struct { uint32_t v[32]; } fe25519;
 
@@ -88,317 +89,6 @@ crypto_verify_32(const uint8_t* x, const uint8_t* y)
   return (1 & ((dbits - 1) >> 8)) - 1;
 }
 
-/* -------------------------------------------------------------------------- */
-/* -- SHA-512 --------------------------------------------------------------- */
-
-static uint64_t
-load_bigendian(const uint8_t* x)
-{
-  return
-      (uint64_t) (x[7]) \
-  | (((uint64_t) (x[6])) << 8) \
-  | (((uint64_t) (x[5])) << 16) \
-  | (((uint64_t) (x[4])) << 24) \
-  | (((uint64_t) (x[3])) << 32) \
-  | (((uint64_t) (x[2])) << 40) \
-  | (((uint64_t) (x[1])) << 48) \
-  | (((uint64_t) (x[0])) << 56);
-}
-
-static void
-store_bigendian(uint8_t* x, uint64_t u)
-{
-  x[7] = u; u >>= 8;
-  x[6] = u; u >>= 8;
-  x[5] = u; u >>= 8;
-  x[4] = u; u >>= 8;
-  x[3] = u; u >>= 8;
-  x[2] = u; u >>= 8;
-  x[1] = u; u >>= 8;
-  x[0] = u;
-}
-
-#define SHR(x,c) ((x) >> (c))
-#define ROTR(x,c) (((x) >> (c)) | ((x) << (64 - (c))))
-
-#define Ch(x,y,z) ((x & y) ^ (~x & z))
-#define Maj(x,y,z) ((x & y) ^ (x & z) ^ (y & z))
-#define Sigma0(x) (ROTR(x,28) ^ ROTR(x,34) ^ ROTR(x,39))
-#define Sigma1(x) (ROTR(x,14) ^ ROTR(x,18) ^ ROTR(x,41))
-#define sigma0(x) (ROTR(x, 1) ^ ROTR(x, 8) ^ SHR(x,7))
-#define sigma1(x) (ROTR(x,19) ^ ROTR(x,61) ^ SHR(x,6))
-
-#define M(w0,w14,w9,w1) w0 = sigma1(w14) + w9 + sigma0(w1) + w0;
-
-#define EXPAND \
-  M(w0 ,w14,w9 ,w1 ) \
-  M(w1 ,w15,w10,w2 ) \
-  M(w2 ,w0 ,w11,w3 ) \
-  M(w3 ,w1 ,w12,w4 ) \
-  M(w4 ,w2 ,w13,w5 ) \
-  M(w5 ,w3 ,w14,w6 ) \
-  M(w6 ,w4 ,w15,w7 ) \
-  M(w7 ,w5 ,w0 ,w8 ) \
-  M(w8 ,w6 ,w1 ,w9 ) \
-  M(w9 ,w7 ,w2 ,w10) \
-  M(w10,w8 ,w3 ,w11) \
-  M(w11,w9 ,w4 ,w12) \
-  M(w12,w10,w5 ,w13) \
-  M(w13,w11,w6 ,w14) \
-  M(w14,w12,w7 ,w15) \
-  M(w15,w13,w8 ,w0 )
-
-#define F(w,k) \
-  T1 = h + Sigma1(e) + Ch(e,f,g) + k + w; \
-  T2 = Sigma0(a) + Maj(a,b,c); \
-  h = g; \
-  g = f; \
-  f = e; \
-  e = d + T1; \
-  d = c; \
-  c = b; \
-  b = a; \
-  a = T1 + T2;
-
-static int
-crypto_hashblocks_sha512(uint8_t* statebytes, const uint8_t* in, uint64_t inlen)
-{
-  uint64_t state[8];
-  uint64_t a;
-  uint64_t b;
-  uint64_t c;
-  uint64_t d;
-  uint64_t e;
-  uint64_t f;
-  uint64_t g;
-  uint64_t h;
-  uint64_t T1;
-  uint64_t T2;
-
-  a = load_bigendian(statebytes +  0); state[0] = a;
-  b = load_bigendian(statebytes +  8); state[1] = b;
-  c = load_bigendian(statebytes + 16); state[2] = c;
-  d = load_bigendian(statebytes + 24); state[3] = d;
-  e = load_bigendian(statebytes + 32); state[4] = e;
-  f = load_bigendian(statebytes + 40); state[5] = f;
-  g = load_bigendian(statebytes + 48); state[6] = g;
-  h = load_bigendian(statebytes + 56); state[7] = h;
-
-  while (inlen >= 128) {
-    uint64_t w0  = load_bigendian(in +   0);
-    uint64_t w1  = load_bigendian(in +   8);
-    uint64_t w2  = load_bigendian(in +  16);
-    uint64_t w3  = load_bigendian(in +  24);
-    uint64_t w4  = load_bigendian(in +  32);
-    uint64_t w5  = load_bigendian(in +  40);
-    uint64_t w6  = load_bigendian(in +  48);
-    uint64_t w7  = load_bigendian(in +  56);
-    uint64_t w8  = load_bigendian(in +  64);
-    uint64_t w9  = load_bigendian(in +  72);
-    uint64_t w10 = load_bigendian(in +  80);
-    uint64_t w11 = load_bigendian(in +  88);
-    uint64_t w12 = load_bigendian(in +  96);
-    uint64_t w13 = load_bigendian(in + 104);
-    uint64_t w14 = load_bigendian(in + 112);
-    uint64_t w15 = load_bigendian(in + 120);
-
-    F(w0 ,0x428a2f98d728ae22ULL)
-    F(w1 ,0x7137449123ef65cdULL)
-    F(w2 ,0xb5c0fbcfec4d3b2fULL)
-    F(w3 ,0xe9b5dba58189dbbcULL)
-    F(w4 ,0x3956c25bf348b538ULL)
-    F(w5 ,0x59f111f1b605d019ULL)
-    F(w6 ,0x923f82a4af194f9bULL)
-    F(w7 ,0xab1c5ed5da6d8118ULL)
-    F(w8 ,0xd807aa98a3030242ULL)
-    F(w9 ,0x12835b0145706fbeULL)
-    F(w10,0x243185be4ee4b28cULL)
-    F(w11,0x550c7dc3d5ffb4e2ULL)
-    F(w12,0x72be5d74f27b896fULL)
-    F(w13,0x80deb1fe3b1696b1ULL)
-    F(w14,0x9bdc06a725c71235ULL)
-    F(w15,0xc19bf174cf692694ULL)
-
-    EXPAND
-
-    F(w0 ,0xe49b69c19ef14ad2ULL)
-    F(w1 ,0xefbe4786384f25e3ULL)
-    F(w2 ,0x0fc19dc68b8cd5b5ULL)
-    F(w3 ,0x240ca1cc77ac9c65ULL)
-    F(w4 ,0x2de92c6f592b0275ULL)
-    F(w5 ,0x4a7484aa6ea6e483ULL)
-    F(w6 ,0x5cb0a9dcbd41fbd4ULL)
-    F(w7 ,0x76f988da831153b5ULL)
-    F(w8 ,0x983e5152ee66dfabULL)
-    F(w9 ,0xa831c66d2db43210ULL)
-    F(w10,0xb00327c898fb213fULL)
-    F(w11,0xbf597fc7beef0ee4ULL)
-    F(w12,0xc6e00bf33da88fc2ULL)
-    F(w13,0xd5a79147930aa725ULL)
-    F(w14,0x06ca6351e003826fULL)
-    F(w15,0x142929670a0e6e70ULL)
-
-    EXPAND
-
-    F(w0 ,0x27b70a8546d22ffcULL)
-    F(w1 ,0x2e1b21385c26c926ULL)
-    F(w2 ,0x4d2c6dfc5ac42aedULL)
-    F(w3 ,0x53380d139d95b3dfULL)
-    F(w4 ,0x650a73548baf63deULL)
-    F(w5 ,0x766a0abb3c77b2a8ULL)
-    F(w6 ,0x81c2c92e47edaee6ULL)
-    F(w7 ,0x92722c851482353bULL)
-    F(w8 ,0xa2bfe8a14cf10364ULL)
-    F(w9 ,0xa81a664bbc423001ULL)
-    F(w10,0xc24b8b70d0f89791ULL)
-    F(w11,0xc76c51a30654be30ULL)
-    F(w12,0xd192e819d6ef5218ULL)
-    F(w13,0xd69906245565a910ULL)
-    F(w14,0xf40e35855771202aULL)
-    F(w15,0x106aa07032bbd1b8ULL)
-
-    EXPAND
-
-    F(w0 ,0x19a4c116b8d2d0c8ULL)
-    F(w1 ,0x1e376c085141ab53ULL)
-    F(w2 ,0x2748774cdf8eeb99ULL)
-    F(w3 ,0x34b0bcb5e19b48a8ULL)
-    F(w4 ,0x391c0cb3c5c95a63ULL)
-    F(w5 ,0x4ed8aa4ae3418acbULL)
-    F(w6 ,0x5b9cca4f7763e373ULL)
-    F(w7 ,0x682e6ff3d6b2b8a3ULL)
-    F(w8 ,0x748f82ee5defb2fcULL)
-    F(w9 ,0x78a5636f43172f60ULL)
-    F(w10,0x84c87814a1f0ab72ULL)
-    F(w11,0x8cc702081a6439ecULL)
-    F(w12,0x90befffa23631e28ULL)
-    F(w13,0xa4506cebde82bde9ULL)
-    F(w14,0xbef9a3f7b2c67915ULL)
-    F(w15,0xc67178f2e372532bULL)
-
-    EXPAND
-
-    F(w0 ,0xca273eceea26619cULL)
-    F(w1 ,0xd186b8c721c0c207ULL)
-    F(w2 ,0xeada7dd6cde0eb1eULL)
-    F(w3 ,0xf57d4f7fee6ed178ULL)
-    F(w4 ,0x06f067aa72176fbaULL)
-    F(w5 ,0x0a637dc5a2c898a6ULL)
-    F(w6 ,0x113f9804bef90daeULL)
-    F(w7 ,0x1b710b35131c471bULL)
-    F(w8 ,0x28db77f523047d84ULL)
-    F(w9 ,0x32caab7b40c72493ULL)
-    F(w10,0x3c9ebe0a15c9bebcULL)
-    F(w11,0x431d67c49c100d4cULL)
-    F(w12,0x4cc5d4becb3e42b6ULL)
-    F(w13,0x597f299cfc657e2aULL)
-    F(w14,0x5fcb6fab3ad6faecULL)
-    F(w15,0x6c44198c4a475817ULL)
-
-    a += state[0];
-    b += state[1];
-    c += state[2];
-    d += state[3];
-    e += state[4];
-    f += state[5];
-    g += state[6];
-    h += state[7];
-
-    state[0] = a;
-    state[1] = b;
-    state[2] = c;
-    state[3] = d;
-    state[4] = e;
-    state[5] = f;
-    state[6] = g;
-    state[7] = h;
-
-    in += 128;
-    inlen -= 128;
-  }
-
-  store_bigendian(statebytes +  0,state[0]);
-  store_bigendian(statebytes +  8,state[1]);
-  store_bigendian(statebytes + 16,state[2]);
-  store_bigendian(statebytes + 24,state[3]);
-  store_bigendian(statebytes + 32,state[4]);
-  store_bigendian(statebytes + 40,state[5]);
-  store_bigendian(statebytes + 48,state[6]);
-  store_bigendian(statebytes + 56,state[7]);
-
-  return inlen;
-}
-
-static const uint8_t iv[64] = {
-  0x6a,0x09,0xe6,0x67,0xf3,0xbc,0xc9,0x08,
-  0xbb,0x67,0xae,0x85,0x84,0xca,0xa7,0x3b,
-  0x3c,0x6e,0xf3,0x72,0xfe,0x94,0xf8,0x2b,
-  0xa5,0x4f,0xf5,0x3a,0x5f,0x1d,0x36,0xf1,
-  0x51,0x0e,0x52,0x7f,0xad,0xe6,0x82,0xd1,
-  0x9b,0x05,0x68,0x8c,0x2b,0x3e,0x6c,0x1f,
-  0x1f,0x83,0xd9,0xab,0xfb,0x41,0xbd,0x6b,
-  0x5b,0xe0,0xcd,0x19,0x13,0x7e,0x21,0x79
-};
-
-static int
-crypto_hash_sha512(uint8_t* out, const uint8_t* in, uint64_t inlen)
-{
-  uint8_t h[64];
-  uint8_t padded[256];
-  uint64_t i;
-  uint64_t bytes = inlen;
-
-  for (i = 0;i < 64;++i) h[i] = iv[i];
-
-  crypto_hashblocks_sha512(h,in,inlen);
-  in += inlen;
-  inlen &= 127;
-  in -= inlen;
-
-  for (i = 0;i < inlen;++i) padded[i] = in[i];
-  padded[inlen] = 0x80;
-
-  if (inlen < 112) {
-    for (i = inlen + 1;i < 119;++i) padded[i] = 0;
-    padded[119] = bytes >> 61;
-    padded[120] = bytes >> 53;
-    padded[121] = bytes >> 45;
-    padded[122] = bytes >> 37;
-    padded[123] = bytes >> 29;
-    padded[124] = bytes >> 21;
-    padded[125] = bytes >> 13;
-    padded[126] = bytes >> 5;
-    padded[127] = bytes << 3;
-    crypto_hashblocks_sha512(h,padded,128);
-  } else {
-    for (i = inlen + 1;i < 247;++i) padded[i] = 0;
-    padded[247] = bytes >> 61;
-    padded[248] = bytes >> 53;
-    padded[249] = bytes >> 45;
-    padded[250] = bytes >> 37;
-    padded[251] = bytes >> 29;
-    padded[252] = bytes >> 21;
-    padded[253] = bytes >> 13;
-    padded[254] = bytes >> 5;
-    padded[255] = bytes << 3;
-    crypto_hashblocks_sha512(h,padded,256);
-  }
-
-  for (i = 0;i < 64;++i) out[i] = h[i];
-
-  return 0;
-}
-
-#undef SHR
-#undef ROTR
-#undef Ch
-#undef Maj
-#undef Sigma0
-#undef Sigma1
-#undef sigma0
-#undef sigma1
-#undef M
-
 /* -------------------------------------------------------------------------- */
 /* -- Ed25519 --------------------------------------------------------------- */
 
@@ -2016,6 +1706,37 @@ ge25519_pack(uint8_t r[32], const ge25519_p3* p)
   r[31] ^= fe25519_getparity(&tx) << 7;
 }
 
+/* Pack the ${n} points ${p} into ${r}[i], as ge25519_pack would, with
+** one field inversion in all: the products z0...zi are inverted once,
+** and each 1/zi peeled off them going backwards. ${acc} is scratch
+** space for ${n} field elements. */
+static void
+ge25519_pack_batch(uint8_t* const* r, const ge25519_p3* p, fe25519* acc,
+                   uint64_t n)
+{
+  fe25519 tx, ty, zi, inv;
+  uint64_t i;
+
+  if (n == 0) return;
+
+  acc[0] = p[0].z;
+  for (i = 1; i < n; ++i) fe25519_mul(&acc[i], &acc[i-1], &p[i].z);
+  fe25519_invert(&inv, &acc[n-1]);
+
+  for (i = n; i-- > 0;) {
+    if (i > 0) {
+      fe25519_mul(&zi, &inv, &acc[i-1]);
+      fe25519_mul(&inv, &inv, &p[i].z);
+    }
+    else zi = inv;
+
+    fe25519_mul(&tx, &p[i].x, &zi);
+    fe25519_mul(&ty, &p[i].y, &zi);
+    fe25519_pack(r[i], &ty);
+    r[i][31] ^= fe25519_getparity(&tx) << 7;
+  }
+}
+
 /* computes [s1]p1 + [s2]p2 */
 static void
 ge25519_double_scalarmult_vartime(ge25519_p3* r, const ge25519_p3* p1, const sc25519* s1, const ge25519_p3* p2, const sc25519* s2)
@@ -2104,101 +1825,390 @@ crypto_sign_ed25519_keypair(uint8_t* pk, uint8_t* sk)
   return 0;
 }
 
-EDSIGN_STATIC int
-crypto_sign_ed25519(
-  uint8_t* sm, uint64_t* smlen,
-  const uint8_t* m, uint64_t mlen,
-  const uint8_t* sk
-  )
+/**
+ * crypto_sign_ed25519_expand(k, sk):
+ * Expand the secret key ${sk} into ${k}: the clamped scalar a and the
+ * nonce prefix z from SHA-512 of the 32-byte seed, and the public key
+ * A from the second half of ${sk}.
+ */
+EDSIGN_STATIC void
+crypto_sign_ed25519_expand(crypto_sign_ed25519_expanded* k,
+                           const uint8_t* sk)
 {
-  uint8_t pk[32];
   uint8_t az[64];
-  uint8_t nonce[64];
-  uint8_t hram[64];
-  sc25519 sck, scs, scsk;
-  ge25519 ger;
-
-  memmove(pk,sk + 32,32);
-  /* pk: 32-byte public key A */
 
   crypto_hash_sha512(az,sk,32);
   az[0] &= 248;
   az[31] &= 127;
   az[31] |= 64;
-  /* az: 32-byte scalar a, 32-byte randomizer z */
 
-  *smlen = mlen + 64;
-  memmove(sm + 64,m,mlen);
-  memmove(sm + 32,az + 32,32);
-  /* sm: 32-byte uninit, 32-byte z, mlen-byte m */
+  sc25519_from32bytes(&k->a, az);
+  memcpy(k->z, az + 32, 32);
+  memcpy(k->pk, sk + 32, 32);
+  edsign_bzero(az, sizeof(az));
+}
 
-  crypto_hash_sha512(nonce, sm+32, mlen+32);
-  /* nonce: 64-byte H(z,m) */
+/**
+ * crypto_sign_ed25519_make_nonce(n, k, rnd, ctr):
+ * Make a hedged nonce ${n} for the expanded key ${k}, with r from
+ * SHA-512 of the prefix z, the 32 random bytes ${rnd}, and the counter
+ * ${ctr}. Any r gives a valid signature, so r need not depend on the
+ * message, but it must never be used twice.
+ */
+EDSIGN_STATIC void
+crypto_sign_ed25519_make_nonce(crypto_sign_ed25519_nonce* n,
+                               const crypto_sign_ed25519_expanded* k,
+                               const uint8_t* rnd, uint64_t ctr)
+{
+  crypto_hash_sha512_state hs;
+  uint8_t buf[8];
+  uint8_t nonce[64];
+  ge25519 ger;
+
+  edsign_le32enc(buf, (uint32_t)ctr);
+  edsign_le32enc(buf + 4, (uint32_t)(ctr >> 32));
 
-  sc25519_from64bytes(&sck, nonce);
-  ge25519_scalarmult_base(&ger, &sck);
-  ge25519_pack(sm, &ger);
-  /* sm: 32-byte R, 32-byte z, mlen-byte m */
+  crypto_hash_sha512_init(&hs);
+  crypto_hash_sha512_update(&hs, k->z, 32);
+  crypto_hash_sha512_update(&hs, rnd, 32);
+  crypto_hash_sha512_update(&hs, buf, sizeof(buf));
+  crypto_hash_sha512_final(&hs, nonce);
+  /* nonce: 64-byte H(z,rnd,ctr) */
+
+  sc25519_from64bytes(&n->r, nonce);
+  ge25519_scalarmult_base(&ger, &n->r);
+  ge25519_pack(n->R, &ger);
+  edsign_bzero(nonce, sizeof(nonce));
+}
+
+/**
+ * crypto_sign_ed25519_detached_nonce(sig, m, mlen, k, n):
+ * As crypto_sign_ed25519_detached_expanded, using the precomputed
+ * nonce ${n} rather than one derived from ${m}, so that only H(R,A,M)
+ * and S = r + H(R,A,M)a are left to compute.
+ */
+EDSIGN_STATIC int
+crypto_sign_ed25519_detached_nonce(
+  uint8_t* sig,
+  const uint8_t* m, uint64_t mlen,
+  const crypto_sign_ed25519_expanded* k,
+  const crypto_sign_ed25519_nonce* n
+  )
+{
+  crypto_hash_sha512_state hs;
+  uint8_t hram[64];
+  sc25519 scs;
 
-  memmove(sm + 32,pk,32);
-  /* sm: 32-byte R, 32-byte A, mlen-byte m */
+  memcpy(sig, n->R, 32);
+  /* sig: 32-byte R */
 
-  crypto_hash_sha512(hram,sm,mlen + 64);
+  crypto_hash_sha512_init(&hs);
+  crypto_hash_sha512_update(&hs, sig, 32);
+  crypto_hash_sha512_update(&hs, k->pk, 32);
+  crypto_hash_sha512_update(&hs, m, mlen);
+  crypto_hash_sha512_final(&hs, hram);
   /* hram: 64-byte H(R,A,m) */
 
   sc25519_from64bytes(&scs, hram);
-  sc25519_from32bytes(&scsk, az);
-  sc25519_mul(&scs, &scs, &scsk);
-  sc25519_add(&scs, &scs, &sck);
+  sc25519_mul(&scs, &scs, &k->a);
+  sc25519_add(&scs, &scs, &n->r);
   /* scs: S = nonce + H(R,A,m)a */
 
-  sc25519_to32bytes(sm + 32,&scs);
-  /* sm: 32-byte R, 32-byte S, mlen-byte m */
+  sc25519_to32bytes(sig + 32,&scs);
+  /* sig: 32-byte R, 32-byte S */
 
   return 0;
 }
 
+/**
+ * crypto_sign_ed25519_detached_expanded(sig, m, mlen, k):
+ * As crypto_sign_ed25519_detached, with the secret key given as its
+ * expansion ${k} (see crypto_sign_ed25519_expand). Only H(z,M), [r]B
+ * and H(R,A,M) are left to compute.
+ */
 EDSIGN_STATIC int
-crypto_sign_ed25519_open(
-  uint8_t *m, uint64_t *mlen,
-  const uint8_t *sm, uint64_t smlen,
-  const uint8_t *pk
+crypto_sign_ed25519_detached_expanded(
+  uint8_t* sig,
+  const uint8_t* m, uint64_t mlen,
+  const crypto_sign_ed25519_expanded* k
   )
 {
-  uint8_t pkcopy[32];
-  uint8_t rcopy[32];
-  uint8_t hram[64];
-  uint8_t rcheck[32];
-  ge25519 get1, get2;
-  sc25519 schram, scs;
+  crypto_hash_sha512_state hs;
+  crypto_sign_ed25519_nonce n;
+  uint8_t nonce[64];
+  ge25519 ger;
+  int res;
+
+  crypto_hash_sha512_init(&hs);
+  crypto_hash_sha512_update(&hs, k->z, 32);
+  crypto_hash_sha512_update(&hs, m, mlen);
+  crypto_hash_sha512_final(&hs, nonce);
+  /* nonce: 64-byte H(z,m) */
+
+  sc25519_from64bytes(&n.r, nonce);
+  ge25519_scalarmult_base(&ger, &n.r);
+  ge25519_pack(n.R, &ger);
+
+  res = crypto_sign_ed25519_detached_nonce(sig, m, mlen, k, &n);
+  edsign_bzero(nonce, sizeof(nonce));
+  edsign_bzero((uint8_t*)&n, sizeof(n));
+  return res;
+}
+
+/**
+ * crypto_sign_ed25519_detached(sig, m, mlen, sk):
+ * Sign the ${mlen} byte message ${m} with the secret key ${sk}, and
+ * store the 64-byte signature R || S in ${sig}, which must not overlap
+ * ${m}. The message is hashed in place, so it can be of any length.
+ */
+EDSIGN_STATIC int
+crypto_sign_ed25519_detached(
+  uint8_t* sig,
+  const uint8_t* m, uint64_t mlen,
+  const uint8_t* sk
+  )
+{
+  crypto_sign_ed25519_expanded k;
+
+  crypto_sign_ed25519_expand(&k, sk);
+  return crypto_sign_ed25519_detached_expanded(sig, m, mlen, &k);
+}
+
+/* Points computed together by the batch functions below */
+#define SIGN_BATCH_POINTS 16
+
+/**
+ * crypto_sign_ed25519_detached_batch(sigs, ms, n, k):
+ * Sign the ${n} 64-byte messages ms[i] with the expanded key ${k}, and
+ * store their signatures in sigs[i], exactly as
+ * crypto_sign_ed25519_detached_expanded would. Both hashes of each
+ * signature are computed four at a time with crypto_hash_sha512_x4,
+ * and the nonce points R of up to 16 signatures at a time are packed
+ * with a single field inversion.
+ */
+EDSIGN_STATIC void
+crypto_sign_ed25519_detached_batch(uint8_t* const* sigs,
+  const uint8_t* const* ms, uint64_t n,
+  const crypto_sign_ed25519_expanded* k
+  )
+{
+  uint8_t hin[SIGN_BATCH_POINTS][128];
+  uint8_t hout[SIGN_BATCH_POINTS][64];
+  const uint8_t* pin[SIGN_BATCH_POINTS];
+  uint8_t* pout[SIGN_BATCH_POINTS];
+  sc25519 sck[SIGN_BATCH_POINTS];
+  ge25519 ger[SIGN_BATCH_POINTS];
+  fe25519 acc[SIGN_BATCH_POINTS];
+  sc25519 scs;
+  uint64_t i, j, c;
+
+  for (j = 0; j < SIGN_BATCH_POINTS; ++j) {
+    pin[j]  = hin[j];
+    pout[j] = hout[j];
+  }
+
+  for (i = 0; i < n; i += c) {
+    c = (n - i < SIGN_BATCH_POINTS) ? (n - i) : SIGN_BATCH_POINTS;
+
+    /* hin: 32-byte z, 64-byte m */
+    for (j = 0; j < c; ++j) {
+      memcpy(hin[j],      k->z,    32);
+      memcpy(hin[j] + 32, ms[i+j], 64);
+    }
+    for (j = 0; j + 4 <= c; j += 4)
+      crypto_hash_sha512_x4(&pout[j], &pin[j], 96);
+    for (; j < c; ++j)
+      crypto_hash_sha512(hout[j], hin[j], 96);
+    /* hout: 64-byte H(z,m) */
+
+    for (j = 0; j < c; ++j) {
+      sc25519_from64bytes(&sck[j], hout[j]);
+      ge25519_scalarmult_base(&ger[j], &sck[j]);
+    }
+    ge25519_pack_batch(&sigs[i], ger, acc, c);
+    /* sigs: 32-byte R */
+
+    /* hin: 32-byte R, 32-byte A, 64-byte m */
+    for (j = 0; j < c; ++j) {
+      memcpy(hin[j],      sigs[i+j], 32);
+      memcpy(hin[j] + 32, k->pk,     32);
+      memcpy(hin[j] + 64, ms[i+j],   64);
+    }
+    for (j = 0; j + 4 <= c; j += 4)
+      crypto_hash_sha512_x4(&pout[j], &pin[j], 128);
+    for (; j < c; ++j)
+      crypto_hash_sha512(hout[j], hin[j], 128);
+    /* hout: 64-byte H(R,A,m) */
+
+    for (j = 0; j < c; ++j) {
+      sc25519_from64bytes(&scs, hout[j]);
+      sc25519_mul(&scs, &scs, &k->a);
+      sc25519_add(&scs, &scs, &sck[j]);
+      sc25519_to32bytes(sigs[i+j] + 32, &scs);
+    }
+    /* sigs: 32-byte R, 32-byte S */
+  }
+
+  edsign_bzero((uint8_t*)sck, sizeof(sck));
+  edsign_bzero((uint8_t*)hout, sizeof(hout));
+}
+
+/**
+ * crypto_sign_ed25519_keypair_batch(pks, sks, n):
+ * Complete the ${n} key pairs whose 32-byte random seeds are in the
+ * first half of sks[i]: store each public key in pks[i] and in the
+ * second half of sks[i], as crypto_sign_ed25519_keypair would. The
+ * seeds are hashed four at a time with crypto_hash_sha512_x4, and the
+ * public keys of up to 16 pairs at a time are packed with a single
+ * field inversion.
+ */
+EDSIGN_STATIC void
+crypto_sign_ed25519_keypair_batch(uint8_t* const* pks,
+  uint8_t* const* sks, uint64_t n
+  )
+{
+  uint8_t az[SIGN_BATCH_POINTS][64];
+  uint8_t* paz[SIGN_BATCH_POINTS];
+  const uint8_t* pseed[4];
+  sc25519 scsk;
+  ge25519 gepk[SIGN_BATCH_POINTS];
+  fe25519 acc[SIGN_BATCH_POINTS];
+  uint64_t i, j, c;
+
+  for (j = 0; j < SIGN_BATCH_POINTS; ++j) paz[j] = az[j];
 
-  if (smlen < 64) goto badsig;
-  if (sm[63] & 224) goto badsig;
-  if (ge25519_unpackneg_vartime(&get1,pk)) goto badsig;
+  for (i = 0; i < n; i += c) {
+    c = (n - i < SIGN_BATCH_POINTS) ? (n - i) : SIGN_BATCH_POINTS;
 
-  memmove(pkcopy,pk,32);
-  memmove(rcopy,sm,32);
+    for (j = 0; j + 4 <= c; j += 4) {
+      pseed[0] = sks[i+j];   pseed[1] = sks[i+j+1];
+      pseed[2] = sks[i+j+2]; pseed[3] = sks[i+j+3];
+      crypto_hash_sha512_x4(&paz[j], pseed, 32);
+    }
+    for (; j < c; ++j)
+      crypto_hash_sha512(az[j], sks[i+j], 32);
 
-  sc25519_from32bytes(&scs, sm+32);
+    for (j = 0; j < c; ++j) {
+      az[j][0] &= 248;
+      az[j][31] &= 127;
+      az[j][31] |= 64;
 
-  memmove(m,sm,smlen);
-  memmove(m + 32,pkcopy,32);
-  crypto_hash_sha512(hram,m,smlen);
+      sc25519_from32bytes(&scsk, az[j]);
+      ge25519_scalarmult_base(&gepk[j], &scsk);
+    }
+    ge25519_pack_batch(&pks[i], gepk, acc, c);
 
+    for (j = 0; j < c; ++j) memmove(sks[i+j] + 32, pks[i+j], 32);
+  }
+
+  edsign_bzero((uint8_t*)az, sizeof(az));
+  edsign_bzero((uint8_t*)&scsk, sizeof(scsk));
+}
+
+/* Check the signature ${sig} (R || S) against the digest ${hram} of
+** H(R,A,M) and the unpacked, negated public key ${negA}: the signature
+** is valid iff [S]B - [H(R,A,M)]A == R. Returns 0 if so, -1 if not. */
+static int
+ed25519_verify_hram(const uint8_t* sig, const uint8_t* hram,
+                    const ge25519* negA)
+{
+  uint8_t rcheck[32];
+  ge25519 get2;
+  sc25519 schram, scs;
+
+  sc25519_from32bytes(&scs, sig+32);
   sc25519_from64bytes(&schram, hram);
 
-  ge25519_double_scalarmult_vartime(&get2, &get1, &schram, &ge25519_base, &scs);
+  ge25519_double_scalarmult_vartime(&get2, negA, &schram, &ge25519_base, &scs);
   ge25519_pack(rcheck, &get2);
 
-  if (crypto_verify_32(rcopy,rcheck) == 0) {
-    memmove(m,m + 64,smlen - 64);
-    memset(m + smlen - 64,0,64);
-    *mlen = smlen - 64;
-    return 0;
+  return crypto_verify_32(sig, rcheck);
+}
+
+/**
+ * crypto_sign_ed25519_verify_detached(sig, m, mlen, pk):
+ * Check the 64-byte signature ${sig} (R || S) over the ${mlen} byte
+ * message ${m} against the public key ${pk}. The message is hashed in
+ * place, so it can be of any length.
+ *
+ * Returns 0 if the signature is valid, or -1 otherwise.
+ */
+EDSIGN_STATIC int
+crypto_sign_ed25519_verify_detached(
+  const uint8_t* sig,
+  const uint8_t* m, uint64_t mlen,
+  const uint8_t* pk
+  )
+{
+  crypto_hash_sha512_state hs;
+  uint8_t hram[64];
+  ge25519 get1;
+
+  if (sig[63] & 224) return -1;
+  if (ge25519_unpackneg_vartime(&get1,pk)) return -1;
+
+  crypto_hash_sha512_init(&hs);
+  crypto_hash_sha512_update(&hs, sig, 32);
+  crypto_hash_sha512_update(&hs, pk, 32);
+  crypto_hash_sha512_update(&hs, m, mlen);
+  crypto_hash_sha512_final(&hs, hram);
+  /* hram: 64-byte H(R,A,m) */
+
+  return ed25519_verify_hram(sig, hram, &get1);
+}
+
+/**
+ * crypto_sign_ed25519_verify_batch(res, sigs, ms, pks, n):
+ * Check the ${n} detached signatures sigs[i] (64 bytes, R || S) over
+ * the 64-byte messages ms[i] against the public keys pks[i], and set
+ * res[i] to 0 if the signature is valid, or -1 if it is not. The
+ * 128-byte H(R,A,M) inputs are hashed four at a time with
+ * crypto_hash_sha512_x4.
+ *
+ * Returns 0 if every signature is valid, or -1 otherwise.
+ */
+EDSIGN_STATIC int
+crypto_sign_ed25519_verify_batch(int* res,
+  const uint8_t* const* sigs, const uint8_t* const* ms,
+  const uint8_t* const* pks, uint64_t n
+  )
+{
+  uint8_t hin[4][128];
+  uint8_t hram[4][64];
+  const uint8_t* pin[4] = { hin[0], hin[1], hin[2], hin[3] };
+  uint8_t* pout[4] = { hram[0], hram[1], hram[2], hram[3] };
+  ge25519 negA[4];
+  uint64_t i, j, k;
+  int ret = 0;
+
+  for (i = 0; i < n; i += k) {
+    k = (n - i < 4) ? (n - i) : 4;
+
+    /* hin: 32-byte R, 32-byte A, 64-byte m */
+    for (j = 0; j < k; ++j) {
+      res[i+j] = 0;
+      if (sigs[i+j][63] & 224) res[i+j] = -1;
+      else if (ge25519_unpackneg_vartime(&negA[j], pks[i+j])) res[i+j] = -1;
+
+      memcpy(hin[j],      sigs[i+j], 32);
+      memcpy(hin[j] + 32, pks[i+j],  32);
+      memcpy(hin[j] + 64, ms[i+j],   64);
+    }
+
+    if (k == 4) crypto_hash_sha512_x4(pout, pin, sizeof(hin[0]));
+    else {
+      for (j = 0; j < k; ++j)
+        crypto_hash_sha512(hram[j], hin[j], sizeof(hin[0]));
+    }
+
+    for (j = 0; j < k; ++j) {
+      if (res[i+j] == 0)
+        res[i+j] = ed25519_verify_hram(sigs[i+j], hram[j], &negA[j]);
+      ret |= res[i+j];
+    }
   }
 
-badsig:
-  *mlen = (uint64_t) -1;
-  memset(m,0,smlen);
-  return -1;
+  return ret;
 }
+
+#undef SIGN_BATCH_POINTS
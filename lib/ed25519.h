@@ -18,29 +18,154 @@
 #define crypto_sign_ed25519_SECRETKEYBYTES 64
 #define crypto_sign_ed25519_BYTES          64
 
-#define crypto_sign_keypair crypto_sign_ed25519_keypair
-#define crypto_sign         crypto_sign_ed25519
-#define crypto_sign_open    crypto_sign_ed25519_open
+#define crypto_sign_keypair         crypto_sign_ed25519_keypair
+#define crypto_sign_detached        crypto_sign_ed25519_detached
+#define crypto_sign_verify_detached crypto_sign_ed25519_verify_detached
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* A scalar modulo the group order, one byte per limb. */
+typedef struct { uint32_t v[32]; } sc25519;
+
+/* A secret key expanded for signing: the clamped scalar a, already
+** reduced, the nonce prefix z, and the packed public key A. */
+typedef struct {
+  sc25519 a;
+  uint8_t z[32];
+  uint8_t pk[crypto_sign_ed25519_PUBLICKEYBYTES];
+} crypto_sign_ed25519_expanded;
+
+/* A nonce for one signature: the scalar r, and the packed R = [r]B. */
+typedef struct {
+  sc25519 r;
+  uint8_t R[32];
+} crypto_sign_ed25519_nonce;
+
 EDSIGN_STATIC int
 crypto_sign_ed25519_keypair(uint8_t* pk, uint8_t* sk);
 
+/**
+ * crypto_sign_ed25519_detached(sig, m, mlen, sk):
+ * Sign the ${mlen} byte message ${m} with the secret key ${sk}, and
+ * store the 64-byte signature R || S in ${sig}, which must not overlap
+ * ${m}. The message is hashed in place, so it can be of any length.
+ */
 EDSIGN_STATIC int
-crypto_sign_ed25519(
-  uint8_t* sm, uint64_t* smlen,
+crypto_sign_ed25519_detached(
+  uint8_t* sig,
   const uint8_t* m, uint64_t mlen,
   const uint8_t* sk
             );
 
+/**
+ * crypto_sign_ed25519_expand(k, sk):
+ * Expand the secret key ${sk} into ${k}: the clamped scalar a and the
+ * nonce prefix z from SHA-512 of the 32-byte seed, and the public key
+ * A from the second half of ${sk}.
+ */
+EDSIGN_STATIC void
+crypto_sign_ed25519_expand(crypto_sign_ed25519_expanded* k,
+                           const uint8_t* sk);
+
+/**
+ * crypto_sign_ed25519_detached_expanded(sig, m, mlen, k):
+ * As crypto_sign_ed25519_detached, with the secret key given as its
+ * expansion ${k} (see crypto_sign_ed25519_expand). Only H(z,M), [r]B
+ * and H(R,A,M) are left to compute.
+ */
+EDSIGN_STATIC int
+crypto_sign_ed25519_detached_expanded(
+  uint8_t* sig,
+  const uint8_t* m, uint64_t mlen,
+  const crypto_sign_ed25519_expanded* k
+            );
+
+/**
+ * crypto_sign_ed25519_detached_batch(sigs, ms, n, k):
+ * Sign the ${n} 64-byte messages ms[i] with the expanded key ${k}, and
+ * store their signatures in sigs[i], exactly as
+ * crypto_sign_ed25519_detached_expanded would. Both hashes of each
+ * signature are computed four at a time with crypto_hash_sha512_x4,
+ * and the nonce points R of up to 16 signatures at a time are packed
+ * with a single field inversion.
+ */
+EDSIGN_STATIC void
+crypto_sign_ed25519_detached_batch(uint8_t* const* sigs,
+  const uint8_t* const* ms, uint64_t n,
+  const crypto_sign_ed25519_expanded* k
+            );
+
+/**
+ * crypto_sign_ed25519_keypair_batch(pks, sks, n):
+ * Complete the ${n} key pairs whose 32-byte random seeds are in the
+ * first half of sks[i]: store each public key in pks[i] and in the
+ * second half of sks[i], as crypto_sign_ed25519_keypair would. The
+ * seeds are hashed four at a time with crypto_hash_sha512_x4, and the
+ * public keys of up to 16 pairs at a time are packed with a single
+ * field inversion.
+ */
+EDSIGN_STATIC void
+crypto_sign_ed25519_keypair_batch(uint8_t* const* pks,
+  uint8_t* const* sks, uint64_t n
+            );
+
+/**
+ * crypto_sign_ed25519_make_nonce(n, k, rnd, ctr):
+ * Make a hedged nonce ${n} for the expanded key ${k}, with r from
+ * SHA-512 of the prefix z, the 32 random bytes ${rnd}, and the counter
+ * ${ctr}. Any r gives a valid signature, so r need not depend on the
+ * message, but it must never be used twice.
+ */
+EDSIGN_STATIC void
+crypto_sign_ed25519_make_nonce(crypto_sign_ed25519_nonce* n,
+                               const crypto_sign_ed25519_expanded* k,
+                               const uint8_t* rnd, uint64_t ctr);
+
+/**
+ * crypto_sign_ed25519_detached_nonce(sig, m, mlen, k, n):
+ * As crypto_sign_ed25519_detached_expanded, using the precomputed
+ * nonce ${n} rather than one derived from ${m}, so that only H(R,A,M)
+ * and S = r + H(R,A,M)a are left to compute.
+ */
+EDSIGN_STATIC int
+crypto_sign_ed25519_detached_nonce(
+  uint8_t* sig,
+  const uint8_t* m, uint64_t mlen,
+  const crypto_sign_ed25519_expanded* k,
+  const crypto_sign_ed25519_nonce* n
+            );
+
+/**
+ * crypto_sign_ed25519_verify_detached(sig, m, mlen, pk):
+ * Check the 64-byte signature ${sig} (R || S) over the ${mlen} byte
+ * message ${m} against the public key ${pk}. The message is hashed in
+ * place, so it can be of any length.
+ *
+ * Returns 0 if the signature is valid, or -1 otherwise.
+ */
+EDSIGN_STATIC int
+crypto_sign_ed25519_verify_detached(
+  const uint8_t* sig,
+  const uint8_t* m, uint64_t mlen,
+  const uint8_t* pk
+                 );
+
+/**
+ * crypto_sign_ed25519_verify_batch(res, sigs, ms, pks, n):
+ * Check the ${n} detached signatures sigs[i] (64 bytes, R || S) over
+ * the 64-byte messages ms[i] against the public keys pks[i], and set
+ * res[i] to 0 if the signature is valid, or -1 if it is not. The
+ * 128-byte H(R,A,M) inputs are hashed four at a time with
+ * crypto_hash_sha512_x4.
+ *
+ * Returns 0 if every signature is valid, or -1 otherwise.
+ */
 EDSIGN_STATIC int
-crypto_sign_ed25519_open(
-  uint8_t *m, uint64_t *mlen,
-  const uint8_t *sm, uint64_t smlen,
-  const uint8_t *pk
+crypto_sign_ed25519_verify_batch(int* res,
+  const uint8_t* const* sigs, const uint8_t* const* ms,
+  const uint8_t* const* pks, uint64_t n
                  );
 
 #ifdef __cplusplus
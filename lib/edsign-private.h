@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #if defined(_WIN32) || defined(_WIN64) || defined(__TOS_WIN__) || defined(__WINDOWS__)
 #include <windows.h>
@@ -27,6 +28,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 #endif /* !WINDOWS */
 
 #include "edsign.h"
@@ -117,6 +122,23 @@
       #endif
 #endif
 
+/* -- SIMD support ---------------------------------------------------------- */
+
+/* x86 SIMD kernels are compiled with per-function target attributes
+** and selected at runtime (see cpu.c), so the rest of the library is
+** still built for the baseline instruction set. */
+#if defined(CPU_X86_64) && !defined(EDSIGN_NO_SIMD)
+      #if defined(COMPILER_CLANG) || \
+          (defined(COMPILER_GCC) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+            #define EDSIGN_X86_SIMD
+      #endif
+#endif
+
+#if defined(EDSIGN_X86_SIMD)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif /* !EDSIGN_X86_SIMD */
+
 /* -------------------------------------------------------------------------- */
 /* -- Macros ---------------------------------------------------------------- */
 
@@ -132,6 +154,8 @@
 
 #define FORCE_INLINE     __attribute__((always_inline))
 #define UNUSED           __attribute__((unused))
+#define TARGET(x)        __attribute__((target(x)))
+#define ALIGNED(x)       __attribute__((aligned(x)))
 #define PRINTF_ATTR(x,y) __attribute__((format(printf, x, y)))
 
 #ifndef CTASSERT
@@ -99,13 +99,15 @@ extern "C" {
 /* -------------------------------------------------------------------------- */
 /* -- Return codes ---------------------------------------------------------- */
 
-#define EDSIGN_OK      0 /* Successful result */
+#define EDSIGN_OK        0 /* Successful result */
 /* -- Error codes below -- */
-#define EDSIGN_ERROR   1 /* Internal/unknown error */
-#define EDSIGN_EINVAL  2 /* Invalid argument */
-#define EDSIGN_EPASSWD 3 /* Invalid password */
-#define EDSIGN_EKEY    4 /* Wrong public key */
-#define EDSIGN_ESIG    5 /* Signature verification failure */
+#define EDSIGN_ERROR     1 /* Internal/unknown error */
+#define EDSIGN_EINVAL    2 /* Invalid argument */
+#define EDSIGN_EPASSWD   3 /* Invalid password */
+#define EDSIGN_EKEY      4 /* Wrong public key */
+#define EDSIGN_ESIG      5 /* Signature verification failure */
+#define EDSIGN_EBUSY     6 /* KDF memory budget or nonce pool exhausted */
+#define EDSIGN_ECANCELED 7 /* Key derivation cancelled or out of time */
 
 /* -------------------------------------------------------------------------- */
 /* -- Public API ------------------------------------------------------------ */
@@ -114,6 +116,9 @@ extern "C" {
 #define edsign_SECRETKEYBYTES 112
 #define edsign_sign_BYTES 74
 #define edsign_fingerprint_BYTES 8
+#define edsign_digest_BYTES 64
+
+#define EDSIGN_MAX_THREADS 64
 
 /**
  * edsign_keypair(pass, passlen, N, r, p, pk, sk):
@@ -129,12 +134,17 @@ extern "C" {
  * ${p}. Memory usage of scrypt is approximately 128*${r}*(2^${N})
  * bytes. For example, for N = 14, r = 8, and p = 1, memory usage is
  * 128*8*(2^14) = 16 megabytes. ${p} may be used to independently tune
- * running time.
+ * running time. When ${p} > 1, up to four lanes per thread (see
+ * edsign_set_threads and edsign_set_interleave) are computed together
+ * to hide memory latency, each needing that much memory, so the peak
+ * is at most ${p} times it.
  *
  * The public key ${pk} must be at least edsign_PUBLICKEYBYTES in size.
  * The secret key ${sk} must be at least edsign_SECRETKEYBYTES in size.
  *
  * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
  * - Returns EDSIGN_OK under normal circumstances
  */
 int edsign_keypair(const uint8_t* pass, const uint64_t passlen,
@@ -151,11 +161,14 @@ int edsign_keypair(const uint8_t* pass, const uint64_t passlen,
  *
  * If ${oldpass} is NULL, it is assumed there was no prior
  * password. If ${newpass} is NULL, the password is removed, and ${N},
- * ${r}, and ${p} are ignored.
+ * ${r}, and ${p} are ignored. ${so} may have been encrypted with
+ * scrypt or with Argon2id (see edsign_keypair_argon2id).
  *
  * The secret key ${sn} must be at least edsign_SECRETKEYBYTES in size.
  *
  * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
  * - Returns EDSIGN_EPASSWD if the password is invalid
  * - Returns EDSIGN_OK under normal circumstances
  */
@@ -169,11 +182,15 @@ int edsign_rekey_priv(const uint8_t* oldpass, const uint64_t oldpasslen,
  *
  * Sign a message ${msg} with the secret key ${sk} (optionally
  * encrypted using ${pass}) and return the signature ${sig} of the
- * resulting message. ${msg}, ${sk} and ${sig} can not be NULL.
+ * resulting message. ${msg}, ${sk} and ${sig} can not be NULL. The
+ * key derivation function ${sk} was encrypted with, scrypt or
+ * Argon2id, is read from ${sk} itself.
  *
  * The signature ${sig} must be at least edsign_sign_BYTES in size.
  *
  * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
  * - Returns EDSIGN_EPASSWD if the password is invalid
  * - Returns EDSIGN_OK under normal circumstances
  */
@@ -182,6 +199,39 @@ int edsign_sign(const uint8_t* pass, const uint64_t passlen,
                 const uint8_t* msg, const uint64_t msglen,
                 uint8_t* sig);
 
+/**
+ * edsign_digest(msg, msglen, digest):
+ *
+ * Compute the digest of the message ${msg} (of size ${msglen}) that
+ * edsign_sign and edsign_verify sign and verify, the unkeyed
+ * BLAKE2b-512 hash of ${msg}, and store it in ${digest}, which must be
+ * at least edsign_digest_BYTES in size. ${msg} and ${digest} can not
+ * be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_digest(const uint8_t* msg, const uint64_t msglen, uint8_t* digest);
+
+/**
+ * edsign_sign_digest(pass, passlen, sk, digest, sig):
+ *
+ * As edsign_sign, but for a message whose digest ${digest} (see
+ * edsign_digest) is already known: the signature is the one
+ * edsign_sign makes for the message itself. ${digest}, ${sk} and
+ * ${sig} can not be NULL, and ${digest} must be edsign_digest_BYTES
+ * in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_EPASSWD if the password is invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_sign_digest(const uint8_t* pass, const uint64_t passlen,
+                       const uint8_t* sk, const uint8_t* digest,
+                       uint8_t* sig);
+
 /**
  * edsign_verify(pk, sig, msg, msglen):
  *
@@ -197,6 +247,66 @@ int edsign_sign(const uint8_t* pass, const uint64_t passlen,
 int edsign_verify(const uint8_t* pk, const uint8_t *sig,
                   const uint8_t* msg,  const uint64_t msglen);
 
+/**
+ * edsign_verify_digest(pk, sig, digest):
+ *
+ * As edsign_verify, but for a message whose digest ${digest} (see
+ * edsign_digest) is already known, without reading the message
+ * itself. ${digest}, ${pk} and ${sig} can not be NULL, and ${digest}
+ * must be edsign_digest_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EKEY if ${pk} is an incorrect public key for the signature
+ * - Returns EDSIGN_ESIG if the ${sig} and ${digest} failed to verify
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_verify_digest(const uint8_t* pk, const uint8_t* sig,
+                         const uint8_t* digest);
+
+/**
+ * edsign_verify_batch(pks, sigs, msgs, msglens, n, results):
+ *
+ * Verify ${n} messages at once: for each i, check that the message
+ * ${msgs}[i] (of size ${msglens}[i]) with signature ${sigs}[i] was
+ * signed by the public key ${pks}[i], and store the result that
+ * edsign_verify would return for it in ${results}[i]. The same key may
+ * appear any number of times. The messages are verified in chunks of
+ * 64, spread over as many threads as edsign_set_threads allows; the
+ * results do not depend on how many there are. The arrays can not be
+ * NULL if ${n} is not zero, and ${results} must have room for ${n}
+ * entries.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ESIG if any of the messages failed to verify
+ * - Returns EDSIGN_OK if every message verified
+ */
+int edsign_verify_batch(const uint8_t* const* pks, const uint8_t* const* sigs,
+                        const uint8_t* const* msgs, const uint64_t* msglens,
+                        const uint64_t n, int* results);
+
+/**
+ * edsign_verify_policy(pks, npks, k, sigs, nsigs, msg, msglen):
+ *
+ * Verify that at least ${k} of the ${npks} public keys in ${pks} signed
+ * the message ${msg} (of size ${msglen}), given the ${nsigs} signatures
+ * in ${sigs}. The message is hashed once, each signature is checked
+ * only against the keys whose fingerprint it carries, and checking
+ * stops as soon as ${k} keys have signed or too few are left to reach
+ * ${k}. A key which appears several times, even under different
+ * fingerprints, or signed several times, counts once, and signatures
+ * by keys not in ${pks} or with a bad header are ignored. The arrays
+ * can not be NULL if their size is not zero, and ${k} can not be
+ * greater than ${npks}.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ESIG if fewer than ${k} keys signed ${msg}
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_verify_policy(const uint8_t* const* pks, const uint64_t npks,
+                         const uint64_t k,
+                         const uint8_t* const* sigs, const uint64_t nsigs,
+                         const uint8_t* msg, const uint64_t msglen);
+
 /**
  * edsign_pubkey_fingerprint(pk, fprint):
  *
@@ -239,6 +349,612 @@ int edsign_secretkey_fingerprint(const uint8_t* sk, uint8_t* out);
  */
 int edsign_signature_fingerprint(const uint8_t* sig, uint8_t* out);
 
+/**
+ * edsign_set_threads(nthreads):
+ *
+ * Set the maximum number of threads, ${nthreads}, that a single call
+ * into the library may use for work that can run in parallel, such
+ * as the ${p} independent lanes of scrypt, or the chunks of 64
+ * messages edsign_sign_batch and edsign_verify_batch split their
+ * work into. Each thread interleaves as many scrypt lanes as the CPU
+ * and edsign_set_interleave allow, each needing its own
+ * 128*${r}*(2^${N}) bytes of memory, so this also bounds the memory
+ * used by a call. The threads are started for each
+ * call, unless an executor is set with edsign_set_executor. The
+ * default is 1, i.e. no extra threads.
+ *
+ * - Returns EDSIGN_EINVAL if ${nthreads} is 0 or above EDSIGN_MAX_THREADS
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_set_threads(const uint32_t nthreads);
+
+/**
+ * edsign_set_interleave(lanes):
+ *
+ * Set the most scrypt lanes, ${lanes}, that a thread interleaves to
+ * hide memory latency. Each interleaved lane needs its own
+ * 128*${r}*(2^${N}) bytes of memory, so with ${p} > 1 this trades
+ * peak memory for speed. Lanes are only interleaved where the CPU has
+ * the instructions for it: up to 4 with AVX2, 2 with SSE2, and none
+ * otherwise. The default is 4, i.e. as many as the CPU allows; 1
+ * keeps one lane in memory per thread (see edsign_set_threads).
+ *
+ * - Returns EDSIGN_EINVAL if ${lanes} is 0 or above 4
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_set_interleave(const uint32_t lanes);
+
+/* A job handed to an executor, to be run as fn(job) */
+typedef void (*edsign_job_fn)(void* job);
+
+/* Arrange for fn(job) to run once on some thread of ${executor}, and
+** return 0, or return nonzero if it can not */
+typedef int (*edsign_submit_fn)(void* executor, edsign_job_fn fn,
+                                void* job);
+
+/**
+ * edsign_set_executor(submit, executor):
+ *
+ * Run the extra workers of parallel calls (see edsign_set_threads) on
+ * the caller's own thread pool instead of threads of the library's
+ * own: each worker a call wants is handed to submit(${executor}, fn,
+ * job), which must arrange for fn(job) to be called once, on any
+ * thread, and return 0, or return nonzero if it can not. A call never
+ * waits for a worker to start: the calling thread processes whatever
+ * work no worker has taken, so a busy or single-threaded executor
+ * only makes the call slower. A job which starts after its call has
+ * returned finds nothing left to do. A ${submit} of NULL goes back to
+ * threads of the library's own. On Windows, there are no executors,
+ * and only a ${submit} of NULL is accepted.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_set_executor(edsign_submit_fn submit, void* executor);
+
+#define EDSIGN_MEM_HUGEPAGES  0x1 /* Back working memory with huge pages */
+#define EDSIGN_MEM_NUMA_LOCAL 0x2 /* Prefer the caller's NUMA node for it */
+#define EDSIGN_MEM_DEFAULT    EDSIGN_MEM_HUGEPAGES
+
+/**
+ * edsign_set_memory_flags(flags):
+ *
+ * Set how the large working memory of scrypt (128*${r}*(2^${N}) bytes
+ * per lane) is allocated, as a combination of:
+ *
+ * - EDSIGN_MEM_HUGEPAGES: back it with 2MB huge pages, from the
+ *   reserved hugetlbfs pool if there is one, or else by asking for
+ *   transparent huge pages. This cuts the TLB misses of the random
+ *   reads scrypt makes, which dominate once the memory reaches tens
+ *   of megabytes.
+ *
+ * - EDSIGN_MEM_NUMA_LOCAL: prefer the NUMA node of the calling
+ *   thread for it, rather than the node first touching each page.
+ *
+ * Each is only a preference: where the OS does not support it or has
+ * no memory to spare, regular pages are used instead. The default is
+ * EDSIGN_MEM_DEFAULT, i.e. EDSIGN_MEM_HUGEPAGES.
+ *
+ * - Returns EDSIGN_EINVAL if ${flags} has unknown bits set
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_set_memory_flags(const uint32_t flags);
+
+/* How many working memory regions were allocated along each path */
+typedef struct edsign_memory_stats {
+  uint64_t hugetlb;    /* Huge pages from the hugetlbfs pool */
+  uint64_t thp;        /* Transparent huge pages, as far as the kernel can */
+  uint64_t small;      /* Regular pages */
+  uint64_t heap;       /* The C heap, where memory can not be mapped */
+  uint64_t numa_local; /* Of the above, those placed on the caller's node */
+} edsign_memory_stats;
+
+/**
+ * edsign_get_memory_stats(stats):
+ *
+ * Store in ${stats} how many working memory regions have been
+ * allocated along each path since the library was loaded, which
+ * tells whether huge pages and NUMA placement are taking effect.
+ * ${stats} can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_get_memory_stats(edsign_memory_stats* stats);
+
+/* -------------------------------------------------------------------------- */
+/* -- Key derivation contexts ----------------------------------------------- */
+
+typedef struct edsign_kdf_ctx edsign_kdf_ctx;
+
+/**
+ * edsign_kdf_ctx_new(N, r, p):
+ *
+ * Create a key derivation context owning the working memory for
+ * scrypt with parameters up to ${N}, ${r}, and ${p} (as given to
+ * edsign_keypair), for as many threads as edsign_set_threads
+ * currently allows. All of the memory is allocated and faulted in
+ * up front, and is wiped and reused by every call the context is
+ * passed to, so repeated unlocks of password-protected keys do not
+ * pay for allocation, page faults, or unmapping each time.
+ *
+ * A context may be passed to edsign_keypair_ctx, edsign_keypair_batch,
+ * edsign_sign_ctx, and edsign_rekey_priv_ctx, by one call at a time,
+ * which reuses it for every key it derives. Calls with parameters
+ * the context is too small for still work, allocating memory of their
+ * own as the plain functions do. If ${N}, ${r}, and ${p} are all 0, the
+ * context has no memory of its own, and only serves to give calls a
+ * time limit or cancel them (see edsign_kdf_ctx_set_timeout). Keys
+ * encrypted with Argon2id, through edsign_keypair_argon2id and
+ * edsign_rekey_priv_argon2id, always use memory of their own, and
+ * only the time limit and cancellation of a context, as does
+ * edsign_rekey_batch.
+ *
+ * - Returns NULL if the parameters are invalid or memory runs out
+ * - Returns a new context under normal circumstances
+ */
+edsign_kdf_ctx* edsign_kdf_ctx_new(const uint32_t N, const uint32_t r,
+                                   const uint32_t p);
+
+/**
+ * edsign_kdf_ctx_set_timeout(ctx, ms):
+ *
+ * Give every key derivation made with ${ctx} at most ${ms}
+ * milliseconds from when it starts, including any time spent waiting
+ * for the budget of edsign_set_kdf_limits. A derivation which runs out
+ * of time stops within a millisecond or so, frees its working memory,
+ * and fails with EDSIGN_ECANCELED. A call which derives two keys, like
+ * edsign_rekey_priv_ctx, gives each of them ${ms}. A ${ms} of 0, the
+ * default, means no limit. ${ctx} can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_kdf_ctx_set_timeout(edsign_kdf_ctx* ctx, const uint32_t ms);
+
+/**
+ * edsign_kdf_ctx_cancel(ctx, cancel):
+ *
+ * If ${cancel} is nonzero, cancel the key derivations made with
+ * ${ctx}: one running or waiting for memory now stops as if out of
+ * time (see edsign_kdf_ctx_set_timeout), and later ones fail at once
+ * with EDSIGN_ECANCELED, until this is called again with ${cancel} 0.
+ * Unlike the other uses of ${ctx}, this may be called from any thread
+ * at any time, so a thread waiting on a call can give up on it.
+ * ${ctx} can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_kdf_ctx_cancel(edsign_kdf_ctx* ctx, const int cancel);
+
+/**
+ * edsign_kdf_ctx_free(ctx):
+ *
+ * Free the key derivation context ${ctx} and its working memory.
+ * ${ctx} may be NULL.
+ */
+void edsign_kdf_ctx_free(edsign_kdf_ctx* ctx);
+
+/**
+ * edsign_kdf_cost(N, r, p, ms, bytes):
+ *
+ * Estimate what deriving a key with the scrypt parameters ${N}, ${r},
+ * and ${p} (as given to edsign_keypair) costs on this machine: the
+ * time in milliseconds, stored in ${ms}, and the peak working memory
+ * in bytes, stored in ${bytes}. Both account for the threads allowed
+ * by edsign_set_threads. ${ms} and ${bytes} can not be NULL.
+ *
+ * The time comes from benchmarks of scrypt with 1MB and 16MB of
+ * memory per lane, run the first time they are needed (by this
+ * function or by edsign_kdf_calibrate), which take about half a
+ * second. Like any benchmark, they vary with the load on the
+ * machine, and they are extrapolated to other parameters, so the
+ * estimates are good to within a fifth or so.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ERROR if the benchmarks could not allocate memory
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_kdf_cost(const uint32_t N, const uint32_t r, const uint32_t p,
+                    uint64_t* ms, uint64_t* bytes);
+
+/**
+ * edsign_kdf_calibrate(max_ms, max_bytes, N, r, p):
+ *
+ * Pick the strongest scrypt parameters which, by the estimates of
+ * edsign_kdf_cost, take at most ${max_ms} milliseconds and
+ * ${max_bytes} bytes of memory on this machine, and store them in
+ * ${N}, ${r}, and ${p} for edsign_keypair or edsign_rekey_priv. As in
+ * scrypt's own parameter selection, ${r} is 8. The strongest choice
+ * is the one costing an attacker the most, i.e. with the largest
+ * product of time and memory per lane, 2^(2*${N}) * ${p}: when time
+ * is the limit, that is the largest ${N} which fits, and when memory
+ * is, a smaller ${N} run over more lanes. Time budgets below what
+ * N = 10, r = 8, p = 1 takes are raised to that. ${N}, ${r}, and ${p}
+ * can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid, or if even
+ *   the smallest parameters need more than ${max_bytes}
+ * - Returns EDSIGN_ERROR if the benchmarks could not allocate memory
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_kdf_calibrate(const uint32_t max_ms, const uint64_t max_bytes,
+                         uint32_t* N, uint32_t* r, uint32_t* p);
+
+/**
+ * edsign_set_kdf_limits(max_bytes, max_waiting):
+ *
+ * Limit the working memory that key derivations running at the same
+ * time may use in total to ${max_bytes}, so that many concurrent
+ * calls with password-protected keys queue up rather than push the
+ * machine into swap. Each derivation needs the peak memory reported
+ * by edsign_kdf_cost, or for Argon2id its ${m} KiB. One which does
+ * not fit in what is left of the budget waits, in order of arrival,
+ * for earlier ones to finish; but if ${max_waiting} derivations are
+ * already waiting, or it would not fit even in the whole budget, it
+ * fails at once with EDSIGN_EBUSY.
+ *
+ * A ${max_bytes} of 0, the default, means no limit. Derivations using
+ * a context from edsign_kdf_ctx_new which is big enough for them do
+ * not count against the budget, since their memory was allocated
+ * when the context was. Waiting derivations are woken up when the
+ * limits change. On Windows, where the library runs everything on
+ * the calling thread, only a ${max_bytes} of 0 is accepted.
+ *
+ * - Returns EDSIGN_EINVAL if the limits are not supported
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_set_kdf_limits(const uint64_t max_bytes,
+                          const uint32_t max_waiting);
+
+/* The state of the key derivation memory budget */
+typedef struct edsign_kdf_stats {
+  uint64_t bytes_in_use; /* Working memory counted against the budget */
+  uint32_t running;      /* Derivations running, counted or not */
+  uint32_t waiting;      /* Derivations queued for memory */
+  uint64_t rejected;     /* Derivations failed with EDSIGN_EBUSY so far */
+} edsign_kdf_stats;
+
+/**
+ * edsign_get_kdf_stats(stats):
+ *
+ * Store in ${stats} a snapshot of how much of the budget set with
+ * edsign_set_kdf_limits is in use, and how many key derivations are
+ * running and waiting for it. ${stats} can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_get_kdf_stats(edsign_kdf_stats* stats);
+
+/**
+ * edsign_keypair_ctx(ctx, pass, passlen, N, r, p, pk, sk):
+ *
+ * As edsign_keypair, but deriving the key with the working memory,
+ * time limit, and cancellation of ${ctx} (see edsign_kdf_ctx_new). If
+ * ${ctx} is NULL, this is exactly edsign_keypair.
+ *
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ */
+int edsign_keypair_ctx(edsign_kdf_ctx* ctx,
+                       const uint8_t* pass, const uint64_t passlen,
+                       const uint32_t N, const uint32_t r, const uint32_t p,
+                       uint8_t* pkout, uint8_t* skout);
+
+/**
+ * edsign_rekey_priv_ctx(ctx, oldpass, oldpasslen, newpass, newpasslen, N, r, p, so, sn):
+ *
+ * As edsign_rekey_priv, but deriving both keys with the working memory,
+ * time limit, and cancellation of ${ctx} (see edsign_kdf_ctx_new). If
+ * ${ctx} is NULL, this is exactly edsign_rekey_priv.
+ *
+ * - Returns EDSIGN_ECANCELED if a derivation was cancelled or ran out
+ *   of time
+ */
+int edsign_rekey_priv_ctx(edsign_kdf_ctx* ctx,
+                          const uint8_t* oldpass, const uint64_t oldpasslen,
+                          const uint8_t* newpass, const uint64_t newpasslen,
+                          const uint32_t N, const uint32_t r, const uint32_t p,
+                          uint8_t* so, uint8_t* sn);
+
+/**
+ * edsign_keypair_argon2id(ctx, pass, passlen, t, m, p, pk, sk):
+ *
+ * As edsign_keypair_ctx, but encrypting the secret key with Argon2id
+ * (RFC 9106) rather than scrypt: ${t} passes over ${m} KiB of memory,
+ * split into ${p} lanes. The lanes of each quarter of a pass are
+ * computed in parallel, on as many threads as edsign_set_threads
+ * allows, so ${p} can make use of several cores without costing more
+ * memory; ${t} raises the running time alone. ${m} must be at least
+ * 8*${p}, and is rounded down to a multiple of 4*${p}. For example,
+ * t = 3, m = 65536, and p = 4 uses 64 megabytes. edsign_sign and
+ * edsign_rekey_priv tell from ${sk} how it was encrypted. If ${pass}
+ * is NULL, the secret key is unencrypted, exactly as with
+ * edsign_keypair_ctx.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_keypair_argon2id(edsign_kdf_ctx* ctx,
+                            const uint8_t* pass, const uint64_t passlen,
+                            const uint32_t t, const uint32_t m,
+                            const uint32_t p, uint8_t* pkout, uint8_t* skout);
+
+/**
+ * edsign_keypair_batch(ctx, pass, passlen, N, r, p, n, pks, sks):
+ *
+ * Generate ${n} key pairs at once, storing each in ${pks}[i] and
+ * ${sks}[i] as edsign_keypair_ctx would, with every secret key
+ * encrypted under the same password ${pass}, or unencrypted if it is
+ * NULL. The randomness for 64 key pairs at a time is read at once,
+ * their public keys are computed and encoded together, and these
+ * chunks are spread over as many threads as edsign_set_threads
+ * allows. With a password, the secret keys are then encrypted one
+ * after the other on the calling thread, each with its own salt but
+ * all reusing the working memory of ${ctx} (see edsign_kdf_ctx_new);
+ * this is most of the cost. The arrays can not be NULL if ${n} is not
+ * zero. On error, every key pair is wiped.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_ECANCELED if a derivation was cancelled or ran out
+ *   of time
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_keypair_batch(edsign_kdf_ctx* ctx,
+                         const uint8_t* pass, const uint64_t passlen,
+                         const uint32_t N, const uint32_t r, const uint32_t p,
+                         const uint64_t n,
+                         uint8_t* const* pks, uint8_t* const* sks);
+
+/**
+ * edsign_rekey_priv_argon2id(ctx, oldpass, oldpasslen, newpass, newpasslen, t, m, p, so, sn):
+ *
+ * As edsign_rekey_priv_ctx, but encrypting the new secret key with
+ * Argon2id with the parameters ${t}, ${m}, and ${p} (see
+ * edsign_keypair_argon2id). ${so} may be encrypted with either
+ * scrypt or Argon2id, so this also moves keys from one to the other.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_ECANCELED if a derivation was cancelled or ran out
+ *   of time
+ * - Returns EDSIGN_EPASSWD if the password is invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_rekey_priv_argon2id(edsign_kdf_ctx* ctx,
+                               const uint8_t* oldpass,
+                               const uint64_t oldpasslen,
+                               const uint8_t* newpass,
+                               const uint64_t newpasslen,
+                               const uint32_t t, const uint32_t m,
+                               const uint32_t p, uint8_t* so, uint8_t* sn);
+
+/**
+ * edsign_rekey_batch(ctx, oldpass, oldpasslen, newpass, newpasslen, N, r, p, n, sos, sns, results):
+ *
+ * Rekey ${n} secret keys at once: for each i, rekey ${sos}[i] as
+ * edsign_rekey_priv_ctx would, from the old password ${oldpass} to the
+ * new password ${newpass} with the scrypt parameters ${N}, ${r}, and
+ * ${p}, store it in ${sns}[i], and store the result in ${results}[i].
+ * A key which fails is left as it was in ${sns}, which may be ${sos}
+ * itself.
+ *
+ * The derivations are spread over as many threads as
+ * edsign_set_threads allows, and those of the old and the new
+ * password of each key run at the same time, so the new one is made
+ * even if the old password turns out to be wrong. Each thread has
+ * working memory of its own, allocated once for the whole call and
+ * big enough for the largest scrypt parameters among the keys, and
+ * sets as much aside as the largest Argon2id key needs. All of this
+ * counts against the budget of edsign_set_kdf_limits; with no room
+ * for it, or with other derivations waiting for the budget, fewer
+ * threads are used, and with none, a single thread makes the
+ * derivations one by one, each waiting for the budget as
+ * edsign_rekey_priv does. Only the time limit and cancellation of
+ * ${ctx}, which may be NULL, are used. The arrays can not be NULL if
+ * ${n} is not zero. If the call fails before trying the keys, each
+ * result is set to its error, where ${results} is not NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ERROR if memory could not be allocated
+ * - Returns the first error in ${results}, if any key failed
+ * - Returns EDSIGN_OK if every key was rekeyed
+ */
+int edsign_rekey_batch(edsign_kdf_ctx* ctx,
+                       const uint8_t* oldpass, const uint64_t oldpasslen,
+                       const uint8_t* newpass, const uint64_t newpasslen,
+                       const uint32_t N, const uint32_t r, const uint32_t p,
+                       const uint64_t n,
+                       const uint8_t* const* sos, uint8_t* const* sns,
+                       int* results);
+
+/**
+ * edsign_sign_ctx(ctx, pass, passlen, sk, msg, msglen, sig):
+ *
+ * As edsign_sign, but unlocking ${sk} with the working memory, time
+ * limit, and cancellation of ${ctx} (see edsign_kdf_ctx_new). If
+ * ${ctx} is NULL, this is exactly edsign_sign.
+ *
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ */
+int edsign_sign_ctx(edsign_kdf_ctx* ctx,
+                    const uint8_t* pass, const uint64_t passlen,
+                    const uint8_t* sk,
+                    const uint8_t* msg, const uint64_t msglen,
+                    uint8_t* sig);
+
+/**
+ * edsign_sign_digest_ctx(ctx, pass, passlen, sk, digest, sig):
+ *
+ * As edsign_sign_digest, but unlocking ${sk} with the working memory,
+ * time limit, and cancellation of ${ctx} (see edsign_kdf_ctx_new), as
+ * edsign_sign_ctx does. If ${ctx} is NULL, this is exactly
+ * edsign_sign_digest.
+ *
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ */
+int edsign_sign_digest_ctx(edsign_kdf_ctx* ctx,
+                           const uint8_t* pass, const uint64_t passlen,
+                           const uint8_t* sk, const uint8_t* digest,
+                           uint8_t* sig);
+
+/* -------------------------------------------------------------------------- */
+/* -- Unlocked secret keys -------------------------------------------------- */
+
+typedef struct edsign_sk edsign_sk;
+
+/**
+ * edsign_sk_unlock(ctx, pass, passlen, sk, handle):
+ *
+ * Decrypt the secret key ${sk} with the password ${pass} once, and
+ * store in ${handle} a handle for edsign_sign_with, which signs
+ * without deriving the key again. The handle holds the decrypted key
+ * and its expansion in memory locked into RAM where the OS allows (so
+ * it is not swapped out) until edsign_sk_lock wipes and frees it. The
+ * key is derived as by edsign_sign_ctx, with ${ctx} if it is not NULL.
+ * ${sk} and ${handle} can not be NULL; on error, ${handle} is set to
+ * NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ * - Returns EDSIGN_EPASSWD if the password is invalid
+ * - Returns EDSIGN_ERROR if memory could not be allocated
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_sk_unlock(edsign_kdf_ctx* ctx,
+                     const uint8_t* pass, const uint64_t passlen,
+                     const uint8_t* sk, edsign_sk** handle);
+
+/**
+ * edsign_sign_with(handle, msg, msglen, sig):
+ *
+ * Sign a message ${msg} with the secret key unlocked in ${handle} by
+ * edsign_sk_unlock, and return the signature ${sig}, exactly as
+ * edsign_sign would with the key and its password. The key is kept
+ * expanded in the handle, so neither the key digest nor its SHA-512
+ * expansion is recomputed: each signature costs two hashes and one
+ * base point multiplication. This makes handles worthwhile even for
+ * unencrypted keys. If the handle has a nonce pool (see edsign_sk_pool),
+ * the signature uses the next nonce from it instead, which leaves only
+ * the hashes. Several threads may sign with the same handle at once.
+ * ${handle}, ${msg} and ${sig} can not be NULL.
+ *
+ * The signature ${sig} must be at least edsign_sign_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the nonce pool is empty, and was set up
+ *   with EDSIGN_POOL_FAIL
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_sign_with(const edsign_sk* handle,
+                     const uint8_t* msg, const uint64_t msglen,
+                     uint8_t* sig);
+
+/**
+ * edsign_sign_batch(handle, msgs, msglens, n, sigs):
+ *
+ * Sign ${n} messages at once with the secret key unlocked in ${handle}:
+ * for each i, store in ${sigs}[i] the signature of the message
+ * ${msgs}[i] (of size ${msglens}[i]) that edsign_sign_with would make
+ * without a nonce pool. The key is set up once for all of them, their
+ * hashes are computed several messages at a time, and the points of
+ * their signatures are encoded together, which makes this faster than
+ * signing them one by one. The messages are signed in chunks of 64,
+ * spread over as many threads as edsign_set_threads allows. The nonce
+ * pool of ${handle}, if any, is not used. The arrays can not be NULL
+ * if ${n} is not zero, and each ${sigs}[i] must be at least
+ * edsign_sign_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_sign_batch(const edsign_sk* handle,
+                      const uint8_t* const* msgs, const uint64_t* msglens,
+                      const uint64_t n, uint8_t* const* sigs);
+
+/**
+ * edsign_sign_multi(handles, n, msg, msglen, sigs):
+ *
+ * Sign the one message ${msg} (of size ${msglen}) with each of the ${n}
+ * secret keys unlocked in ${handles}, and store in ${sigs}[i] the
+ * signature edsign_sign_with would make with ${handles}[i] without a
+ * nonce pool. The message is hashed once for all of them, so signing
+ * a large message with several keys costs little more than with one;
+ * the signatures are spread over as many threads as edsign_set_threads
+ * allows. The arrays can not be NULL if ${n} is not zero, and each
+ * ${sigs}[i] must be at least edsign_sign_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_sign_multi(const edsign_sk* const* handles, const uint64_t n,
+                      const uint8_t* msg, const uint64_t msglen,
+                      uint8_t* const* sigs);
+
+#define EDSIGN_POOL_WAIT   0 /* Wait for the next nonce */
+#define EDSIGN_POOL_INLINE 1 /* Sign without the pool */
+#define EDSIGN_POOL_FAIL   2 /* Fail with EDSIGN_EBUSY */
+
+/**
+ * edsign_sk_pool(handle, size, refill, when_empty):
+ *
+ * Give the unlocked key ${handle} a pool of ${size} nonces, which a
+ * background thread precomputes from fresh randomness, the key, and a
+ * counter, and refills whenever only ${refill} are left. edsign_sign_with
+ * then makes each signature with the next nonce from the pool, so that
+ * only hashing is left to do while signing; each nonce is used once,
+ * and is wiped as it is taken. The pool is kept in memory locked into
+ * RAM like the key. Signatures made this way are valid, but no longer
+ * deterministic: signing the same message twice gives two different
+ * signatures. When the pool is empty, ${when_empty} says what
+ * edsign_sign_with does:
+ *
+ * - EDSIGN_POOL_WAIT: wait for the thread to make the next nonce.
+ *
+ * - EDSIGN_POOL_INLINE: sign without the pool, as edsign_sign would.
+ *
+ * - EDSIGN_POOL_FAIL: fail with EDSIGN_EBUSY.
+ *
+ * Any pool ${handle} had before is stopped and wiped first, and a
+ * ${size} of 0 leaves it with none; edsign_sk_lock stops it as well.
+ * A child process never uses the pool it inherits through fork(),
+ * whose nonces its parent hands out too: edsign_sign_with signs there
+ * as edsign_sign would, until edsign_sk_pool gives the handle a pool
+ * of the child's own.
+ * This can not be called while other threads sign with ${handle}.
+ * ${handle} can not be NULL, and ${refill} must be less than ${size}.
+ * On Windows, there are no pools, and only a ${size} of 0 is accepted.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ERROR if memory could not be allocated or the
+ *   thread could not be started
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int edsign_sk_pool(edsign_sk* handle, const uint32_t size,
+                   const uint32_t refill, const uint32_t when_empty);
+
+/**
+ * edsign_sk_lock(handle):
+ *
+ * Wipe the key unlocked in ${handle}, and its nonce pool if it has
+ * one, and free the handle. ${handle} may be NULL.
+ */
+void edsign_sk_lock(edsign_sk* handle);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,879 @@
+/*
+** Password-based key derivation for secret keys.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#include "edsign-private.h"
+#include "thread.h"
+#include "scrypt.h"
+#include "argon2.h"
+#include "kdf.h"
+#include "util.h"
+
+struct edsign_kdf_ctx {
+  struct scrypt_mem* mem; /* Prefaulted scrypt working memory, or NULL */
+  uint32_t timeout_ms;    /* Time limit of each derivation, or 0 */
+  uint32_t cancel;        /* Set by edsign_kdf_ctx_cancel, from any thread */
+  const edsign_kdf_ctx* parent; /* Also cancels this context, or NULL */
+  uint64_t reserved;      /* Bytes counted against the budget, if any */
+  uint64_t spare;         /* Of which for derivations outside ${mem} */
+};
+
+static void kdf_unreserve(const uint64_t bytes);
+
+/* Nanoseconds since some fixed point, preferring a monotonic clock */
+static uint64_t
+kdf_now_ns(void)
+{
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+  return (uint64_t)((double)clock() * 1e9 / CLOCKS_PER_SEC);
+}
+
+/**
+ * edsign_kdf_ctx_new(N, r, p):
+ *
+ * Create a key derivation context owning the working memory for
+ * scrypt with parameters up to ${N}, ${r}, and ${p} (as given to
+ * edsign_keypair), for as many threads as edsign_set_threads
+ * currently allows. All of the memory is allocated and faulted in
+ * up front, and is wiped and reused by every call the context is
+ * passed to, so repeated unlocks of password-protected keys do not
+ * pay for allocation, page faults, or unmapping each time.
+ *
+ * A context may be passed to edsign_keypair_ctx, edsign_keypair_batch,
+ * edsign_sign_ctx, and edsign_rekey_priv_ctx, by one call at a time,
+ * which reuses it for every key it derives. Calls with parameters
+ * the context is too small for still work, allocating memory of their
+ * own as the plain functions do. If ${N}, ${r}, and ${p} are all 0, the
+ * context has no memory of its own, and only serves to give calls a
+ * time limit or cancel them (see edsign_kdf_ctx_set_timeout). Keys
+ * encrypted with Argon2id, through edsign_keypair_argon2id and
+ * edsign_rekey_priv_argon2id, always use memory of their own, and
+ * only the time limit and cancellation of a context, as does
+ * edsign_rekey_batch.
+ *
+ * - Returns NULL if the parameters are invalid or memory runs out
+ * - Returns a new context under normal circumstances
+ */
+edsign_kdf_ctx*
+edsign_kdf_ctx_new(const uint32_t N, const uint32_t r, const uint32_t p)
+{
+  edsign_kdf_ctx* ctx;
+  int none = (N == 0 && r == 0 && p == 0);
+
+  if (!none && (N >= 64 || r == 0 || p == 0)) return NULL;
+
+  ctx = malloc(sizeof(edsign_kdf_ctx));
+  if (ctx == NULL) return NULL;
+
+  ctx->mem = NULL;
+  ctx->timeout_ms = 0;
+  ctx->cancel = 0;
+  ctx->parent = NULL;
+  ctx->reserved = 0;
+  ctx->spare = 0;
+
+  if (!none) {
+    ctx->mem = crypto_scrypt_mem_new(((uint64_t)1) << N, r, p);
+    if (ctx->mem == NULL) {
+      free(ctx);
+      return NULL;
+    }
+  }
+
+  return ctx;
+}
+
+/**
+ * edsign_kdf_ctx_free(ctx):
+ *
+ * Free the key derivation context ${ctx} and its working memory.
+ * ${ctx} may be NULL.
+ */
+void
+edsign_kdf_ctx_free(edsign_kdf_ctx* ctx)
+{
+  if (ctx == NULL) return;
+
+  crypto_scrypt_mem_free(ctx->mem);
+  kdf_unreserve(ctx->reserved);
+  free(ctx);
+}
+
+/**
+ * edsign_kdf_ctx_set_timeout(ctx, ms):
+ *
+ * Give every key derivation made with ${ctx} at most ${ms}
+ * milliseconds from when it starts, including any time spent waiting
+ * for the budget of edsign_set_kdf_limits. A derivation which runs out
+ * of time stops within a millisecond or so, frees its working memory,
+ * and fails with EDSIGN_ECANCELED. A call which derives two keys, like
+ * edsign_rekey_priv_ctx, gives each of them ${ms}. A ${ms} of 0, the
+ * default, means no limit. ${ctx} can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_kdf_ctx_set_timeout(edsign_kdf_ctx* ctx, const uint32_t ms)
+{
+  if (ctx == NULL) return EDSIGN_EINVAL;
+
+  ctx->timeout_ms = ms;
+  return EDSIGN_OK;
+}
+
+/* Whether derivations with ${ctx}, which may be NULL, are cancelled,
+** through it or its parent */
+static int
+kdf_cancelled(const edsign_kdf_ctx* ctx)
+{
+  for (; ctx != NULL; ctx = ctx->parent) {
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+    if (__atomic_load_n(&ctx->cancel, __ATOMIC_RELAXED) != 0) return 1;
+#else
+    if (*(volatile const uint32_t*)&ctx->cancel != 0) return 1;
+#endif
+  }
+  return 0;
+}
+
+/* What stops one derivation: cancellation of its context, or passing
+** ${deadline} on the clock of kdf_now_ns, unless that is 0. */
+struct kdf_stop {
+  const edsign_kdf_ctx* ctx;
+  uint64_t deadline;
+};
+
+/* Whether the derivation of the kdf_stop ${arg} should stop; polled
+** from every thread running its lanes. */
+static int
+kdf_stopped(void* arg)
+{
+  const struct kdf_stop* K = arg;
+
+  if (kdf_cancelled(K->ctx)) return 1;
+  return K->deadline != 0 && kdf_now_ns() >= K->deadline;
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Admission control ----------------------------------------------------- */
+
+#if !defined(OS_WINDOWS)
+
+/* A derivation waiting for the budget, in a queue on its stack */
+struct kdf_waiter {
+  struct kdf_waiter* next;
+};
+
+/* The budget set with edsign_set_kdf_limits, and the derivations it
+** admitted. Derivations which have to wait join a queue, and are
+** admitted strictly in order from its head, so a large one is not
+** starved by a stream of smaller ones arriving after it. */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  uint64_t max_bytes;   /* The budget, or 0 for none */
+  uint32_t max_waiting; /* The most derivations which may wait */
+  uint64_t in_use;      /* Bytes admitted and not yet released */
+  uint32_t running;
+  uint32_t waiting;
+  uint64_t rejected;
+  struct kdf_waiter* head;
+  struct kdf_waiter* tail;
+} edsign_kdf_sched = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+  0, 0, 0, 0, 0, 0, NULL, NULL
+};
+
+/* Whether ${bytes} more would go over the budget */
+static int
+kdf_over_budget(const uint64_t bytes)
+{
+  uint64_t max = edsign_kdf_sched.max_bytes;
+  uint64_t use = edsign_kdf_sched.in_use;
+
+  return max != 0 && (use > max || bytes > max - use);
+}
+
+/* Wait on the budget until woken up, or until the deadline of ${K}
+** if it has one. The lock must be held. */
+static void
+kdf_wait(const struct kdf_stop* K)
+{
+#if defined(CLOCK_REALTIME)
+  struct timespec ts;
+  uint64_t now, left;
+
+  /* The condition variable waits on the real time clock */
+  if (K->deadline != 0 && clock_gettime(CLOCK_REALTIME, &ts) == 0) {
+    now  = kdf_now_ns();
+    left = (K->deadline > now) ? K->deadline - now : 0;
+    left += (uint64_t)ts.tv_nsec;
+    ts.tv_sec += (time_t)(left / 1000000000);
+    ts.tv_nsec = (long)(left % 1000000000);
+    pthread_cond_timedwait(&edsign_kdf_sched.cond, &edsign_kdf_sched.lock,
+                           &ts);
+    return;
+  }
+#else
+  (void)K;
+#endif
+
+  pthread_cond_wait(&edsign_kdf_sched.cond, &edsign_kdf_sched.lock);
+}
+
+/* Admit a derivation needing ${bytes} of working memory against the
+** budget, waiting for its turn if need be; derivations needing none
+** are only counted. Return EDSIGN_OK once admitted, to be followed by
+** kdf_release; EDSIGN_EBUSY if the budget refuses the derivation; or
+** EDSIGN_ECANCELED if ${K} stops it while it waits. */
+static int
+kdf_admit(const uint64_t bytes, struct kdf_stop* K)
+{
+  int res = EDSIGN_OK;
+  struct kdf_waiter self, *prev, *q;
+
+  pthread_mutex_lock(&edsign_kdf_sched.lock);
+
+  if (bytes != 0 &&
+      (edsign_kdf_sched.head != NULL || kdf_over_budget(bytes))) {
+    uint64_t max = edsign_kdf_sched.max_bytes;
+
+    if (max != 0 && (bytes > max ||
+                     edsign_kdf_sched.waiting >= edsign_kdf_sched.max_waiting)) {
+      res = EDSIGN_EBUSY;
+    }
+    else {
+      self.next = NULL;
+      if (edsign_kdf_sched.tail != NULL) edsign_kdf_sched.tail->next = &self;
+      else edsign_kdf_sched.head = &self;
+      edsign_kdf_sched.tail = &self;
+      edsign_kdf_sched.waiting++;
+
+      /* The budget may shrink while we wait, even below ${bytes} */
+      for (;;) {
+        if (kdf_stopped(K)) {
+          res = EDSIGN_ECANCELED;
+          break;
+        }
+        if (edsign_kdf_sched.head == &self) {
+          max = edsign_kdf_sched.max_bytes;
+          if (max != 0 && bytes > max) {
+            res = EDSIGN_EBUSY;
+            break;
+          }
+          if (!kdf_over_budget(bytes)) break;
+        }
+        kdf_wait(K);
+      }
+
+      /* Leave the queue, from wherever we are in it, and let the next
+      ** at its head check the budget */
+      for (prev = NULL, q = edsign_kdf_sched.head; q != &self; q = q->next)
+        prev = q;
+      if (prev != NULL) prev->next = self.next;
+      else edsign_kdf_sched.head = self.next;
+      if (edsign_kdf_sched.tail == &self) edsign_kdf_sched.tail = prev;
+      edsign_kdf_sched.waiting--;
+      pthread_cond_broadcast(&edsign_kdf_sched.cond);
+    }
+  }
+
+  if (res == EDSIGN_OK) {
+    edsign_kdf_sched.in_use += bytes;
+    edsign_kdf_sched.running++;
+  }
+  else if (res == EDSIGN_EBUSY) {
+    edsign_kdf_sched.rejected++;
+  }
+
+  pthread_mutex_unlock(&edsign_kdf_sched.lock);
+  return res;
+}
+
+/* Wake up the derivations waiting for the budget, to check on it and
+** on whether they were cancelled. */
+static void
+kdf_wake(void)
+{
+  pthread_mutex_lock(&edsign_kdf_sched.lock);
+  pthread_cond_broadcast(&edsign_kdf_sched.cond);
+  pthread_mutex_unlock(&edsign_kdf_sched.lock);
+}
+
+/* Return the ${bytes} a derivation was admitted with to the budget. */
+static void
+kdf_release(const uint64_t bytes)
+{
+  pthread_mutex_lock(&edsign_kdf_sched.lock);
+  edsign_kdf_sched.in_use -= bytes;
+  edsign_kdf_sched.running--;
+  if (edsign_kdf_sched.waiting > 0)
+    pthread_cond_broadcast(&edsign_kdf_sched.cond);
+  pthread_mutex_unlock(&edsign_kdf_sched.lock);
+}
+
+/* Set ${bytes} of working memory aside against the budget for as long
+** as a context holds it, if the budget has room for it now and nobody
+** is waiting; return EDSIGN_OK if so, or EDSIGN_EBUSY. Setting nothing
+** aside always succeeds. */
+static int
+kdf_reserve(const uint64_t bytes)
+{
+  int res = EDSIGN_EBUSY;
+
+  if (bytes == 0) return EDSIGN_OK;
+
+  pthread_mutex_lock(&edsign_kdf_sched.lock);
+  if (edsign_kdf_sched.head == NULL && !kdf_over_budget(bytes)) {
+    edsign_kdf_sched.in_use += bytes;
+    res = EDSIGN_OK;
+  }
+  pthread_mutex_unlock(&edsign_kdf_sched.lock);
+  return res;
+}
+
+/* Return the ${bytes} set aside by kdf_reserve to the budget. */
+static void
+kdf_unreserve(const uint64_t bytes)
+{
+  if (bytes == 0) return;
+
+  pthread_mutex_lock(&edsign_kdf_sched.lock);
+  edsign_kdf_sched.in_use -= bytes;
+  if (edsign_kdf_sched.waiting > 0)
+    pthread_cond_broadcast(&edsign_kdf_sched.cond);
+  pthread_mutex_unlock(&edsign_kdf_sched.lock);
+}
+
+/**
+ * edsign_set_kdf_limits(max_bytes, max_waiting):
+ *
+ * Limit the working memory that key derivations running at the same
+ * time may use in total to ${max_bytes}, so that many concurrent
+ * calls with password-protected keys queue up rather than push the
+ * machine into swap. Each derivation needs the peak memory reported
+ * by edsign_kdf_cost, or for Argon2id its ${m} KiB. One which does
+ * not fit in what is left of the budget waits, in order of arrival,
+ * for earlier ones to finish; but if ${max_waiting} derivations are
+ * already waiting, or it would not fit even in the whole budget, it
+ * fails at once with EDSIGN_EBUSY.
+ *
+ * A ${max_bytes} of 0, the default, means no limit. Derivations using
+ * a context from edsign_kdf_ctx_new which is big enough for them do
+ * not count against the budget, since their memory was allocated
+ * when the context was. Waiting derivations are woken up when the
+ * limits change. On Windows, where the library runs everything on
+ * the calling thread, only a ${max_bytes} of 0 is accepted.
+ *
+ * - Returns EDSIGN_EINVAL if the limits are not supported
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_set_kdf_limits(const uint64_t max_bytes, const uint32_t max_waiting)
+{
+  pthread_mutex_lock(&edsign_kdf_sched.lock);
+  edsign_kdf_sched.max_bytes   = max_bytes;
+  edsign_kdf_sched.max_waiting = max_waiting;
+  pthread_cond_broadcast(&edsign_kdf_sched.cond);
+  pthread_mutex_unlock(&edsign_kdf_sched.lock);
+  return EDSIGN_OK;
+}
+
+/**
+ * edsign_get_kdf_stats(stats):
+ *
+ * Store in ${stats} a snapshot of how much of the budget set with
+ * edsign_set_kdf_limits is in use, and how many key derivations are
+ * running and waiting for it. ${stats} can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_get_kdf_stats(edsign_kdf_stats* stats)
+{
+  if (stats == NULL) return EDSIGN_EINVAL;
+
+  pthread_mutex_lock(&edsign_kdf_sched.lock);
+  stats->bytes_in_use = edsign_kdf_sched.in_use;
+  stats->running      = edsign_kdf_sched.running;
+  stats->waiting      = edsign_kdf_sched.waiting;
+  stats->rejected     = edsign_kdf_sched.rejected;
+  pthread_mutex_unlock(&edsign_kdf_sched.lock);
+  return EDSIGN_OK;
+}
+
+#else
+
+/* Everything runs on the calling thread, so there is nothing to wait
+** for, and only the default of no limit is accepted. */
+static void
+kdf_wake(void)
+{
+}
+
+static int
+kdf_admit(const uint64_t bytes, struct kdf_stop* K)
+{
+  (void)bytes;
+  (void)K;
+  return EDSIGN_OK;
+}
+
+static void
+kdf_release(const uint64_t bytes)
+{
+  (void)bytes;
+}
+
+static int
+kdf_reserve(const uint64_t bytes)
+{
+  (void)bytes;
+  return EDSIGN_OK;
+}
+
+static void
+kdf_unreserve(const uint64_t bytes)
+{
+  (void)bytes;
+}
+
+int
+edsign_set_kdf_limits(const uint64_t max_bytes, const uint32_t max_waiting)
+{
+  (void)max_waiting;
+  return (max_bytes == 0) ? EDSIGN_OK : EDSIGN_EINVAL;
+}
+
+int
+edsign_get_kdf_stats(edsign_kdf_stats* stats)
+{
+  if (stats == NULL) return EDSIGN_EINVAL;
+
+  memset(stats, 0, sizeof(edsign_kdf_stats));
+  return EDSIGN_OK;
+}
+
+#endif /* !OS_WINDOWS */
+
+/**
+ * edsign_kdf_ctx_cancel(ctx, cancel):
+ *
+ * If ${cancel} is nonzero, cancel the key derivations made with
+ * ${ctx}: one running or waiting for memory now stops as if out of
+ * time (see edsign_kdf_ctx_set_timeout), and later ones fail at once
+ * with EDSIGN_ECANCELED, until this is called again with ${cancel} 0.
+ * Unlike the other uses of ${ctx}, this may be called from any thread
+ * at any time, so a thread waiting on a call can give up on it.
+ * ${ctx} can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_kdf_ctx_cancel(edsign_kdf_ctx* ctx, const int cancel)
+{
+  uint32_t v = (cancel != 0);
+
+  if (ctx == NULL) return EDSIGN_EINVAL;
+
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+  __atomic_store_n(&ctx->cancel, v, __ATOMIC_RELAXED);
+#else
+  *(volatile uint32_t*)&ctx->cancel = v;
+#endif
+  if (v) kdf_wake();
+  return EDSIGN_OK;
+}
+
+/**
+ * edsign_kdf_ctx_worker(ctx, N, r, p, spare):
+ * Create a context for one of the workers of a batch call, owning the
+ * working memory for scrypt with parameters up to ${N}, ${r}, and ${p}
+ * as edsign_kdf_ctx_new does, or none if they are all 0, and setting
+ * ${spare} more bytes aside for derivations which allocate their own,
+ * like Argon2id. Both count against the budget of
+ * edsign_set_kdf_limits until the context is freed with
+ * edsign_kdf_ctx_free, and derivations with the context never wait for
+ * the budget, which only the rest of the batch might free: those which
+ * fit in neither fail with EDSIGN_EBUSY. The context has the time
+ * limit of ${ctx}, which may be NULL, and is cancelled along with it.
+ * Return NULL, without waiting, if the budget has no room for all of
+ * this now, or if memory runs out; with nothing to set aside, only the
+ * latter.
+ */
+EDSIGN_STATIC edsign_kdf_ctx*
+edsign_kdf_ctx_worker(const edsign_kdf_ctx* ctx,
+                      const uint32_t N, const uint32_t r, const uint32_t p,
+                      const uint64_t spare)
+{
+  edsign_kdf_ctx* w;
+  uint64_t bytes = 0;
+
+  if (N != 0 || r != 0 || p != 0) {
+    if (N >= 64 || r == 0 || p == 0) return NULL;
+    bytes = crypto_scrypt_memory(((uint64_t)1) << N, r, p);
+  }
+  if (spare > UINT64_MAX - bytes) return NULL;
+  bytes += spare;
+  if (kdf_reserve(bytes) != EDSIGN_OK) return NULL;
+
+  if ((w = edsign_kdf_ctx_new(N, r, p)) == NULL) {
+    kdf_unreserve(bytes);
+    return NULL;
+  }
+  w->parent     = ctx;
+  w->timeout_ms = (ctx == NULL) ? 0 : ctx->timeout_ms;
+  w->reserved   = bytes;
+  w->spare      = spare;
+  return w;
+}
+
+/**
+ * edsign_kdf_known(alg):
+ * Return nonzero if the 2 byte tag ${alg} names a key derivation
+ * function edsign_kdf supports.
+ */
+EDSIGN_STATIC int
+edsign_kdf_known(const uint8_t* alg)
+{
+  return 0 == edsign_memcmp(alg, (uint8_t*)KDFALG_SCRYPT, 2) ||
+         0 == edsign_memcmp(alg, (uint8_t*)KDFALG_ARGON2ID, 2);
+}
+
+/**
+ * edsign_kdf(ctx, alg, pass, passlen, salt, params, out, outlen):
+ * Derive ${outlen} bytes of keystream into ${out} from the password
+ * ${pass} and the 16 byte ${salt}, using the key derivation function
+ * tagged ${alg} with the three parameters ${params} stored alongside
+ * it: for KDFALG_SCRYPT, scrypt with 2^N, r, and p; for
+ * KDFALG_ARGON2ID, Argon2id with t passes over m KiB in p lanes. The
+ * working memory of ${ctx} is used for scrypt if it is not NULL and
+ * is big enough; otherwise memory is allocated for the call, once the
+ * budget of edsign_set_kdf_limits admits it, or at once if it fits in
+ * what a context from edsign_kdf_ctx_worker set aside. The time limit
+ * and cancellation of ${ctx}, if any, apply throughout.
+ *
+ * Return EDSIGN_OK on success; EDSIGN_EBUSY if the budget refused the
+ * call; EDSIGN_ECANCELED if it was cancelled or ran out of time; or
+ * EDSIGN_EINVAL on any other error.
+ */
+EDSIGN_STATIC int
+edsign_kdf(edsign_kdf_ctx* ctx, const uint8_t* alg,
+           const uint8_t* pass, const uint64_t passlen,
+           const uint8_t* salt, const uint32_t* params,
+           uint8_t* out, const size_t outlen)
+{
+  struct scrypt_mem* mem = (ctx == NULL) ? NULL : ctx->mem;
+  int argon2 = (0 == edsign_memcmp(alg, (uint8_t*)KDFALG_ARGON2ID, 2));
+  struct kdf_stop K;
+  struct scrypt_stop S;
+  struct argon2_stop A;
+  uint64_t n = 0, bytes = 0;
+  int res, rc;
+
+  if (!edsign_kdf_known(alg)) return EDSIGN_EINVAL;
+
+  if (argon2) {
+    bytes = crypto_argon2id_memory(params[1], params[2]);
+    if (params[0] == 0 || bytes == 0) return EDSIGN_EINVAL;
+  }
+  else {
+    if (params[0] >= 64 || params[1] == 0 || params[2] == 0)
+      return EDSIGN_EINVAL;
+    n = ((uint64_t)1) << params[0];
+    if (!crypto_scrypt_mem_fits(mem, n, params[1], params[2]))
+      bytes = crypto_scrypt_memory(n, params[1], params[2]);
+  }
+
+  K.ctx = ctx;
+  K.deadline = 0;
+  if (ctx != NULL && ctx->timeout_ms != 0)
+    K.deadline = kdf_now_ns() + (uint64_t)ctx->timeout_ms * 1000000;
+  S.fn  = A.fn  = kdf_stopped;
+  S.arg = A.arg = &K;
+  if (kdf_stopped(&K)) return EDSIGN_ECANCELED;
+
+  /* A worker context has its memory counted already, and must not wait
+  ** for memory only the rest of its batch could free */
+  if (ctx != NULL && ctx->reserved != 0) {
+    if (bytes > ctx->spare) return EDSIGN_EBUSY;
+    bytes = 0;
+  }
+  if ((res = kdf_admit(bytes, &K)) != EDSIGN_OK) return res;
+
+  if (argon2)
+    rc = crypto_argon2id(pass, (size_t)passlen, salt, 16,
+                         params[0], params[1], params[2], out, outlen, &A);
+  else if (ctx == NULL)
+    rc = crypto_scrypt(pass, (size_t)passlen, salt, 16,
+                       n, params[1], params[2], out, outlen);
+  else
+    rc = crypto_scrypt_mem(mem, pass, (size_t)passlen, salt, 16,
+                           n, params[1], params[2], out, outlen, &S);
+  if (rc != 0)
+    res = kdf_stopped(&K) ? EDSIGN_ECANCELED : EDSIGN_EINVAL;
+
+  kdf_release(bytes);
+  return res;
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Parameter selection --------------------------------------------------- */
+
+/* The benchmarks: SMix with r = 8 and N = 2^10 or 2^14, i.e. 1MB of V
+** per lane, which fits in most caches, and 16MB, which is past most. */
+#define KDF_BENCH_SMALL 10
+#define KDF_BENCH_LARGE 14
+#define KDF_BENCH_R     8
+
+/* The largest r * p scrypt allows */
+#define KDF_MAX_RP ((1U << 30) - 1)
+
+/* Nanoseconds one thread takes to run SMix on a group of w = 1 ... 4
+** interleaved lanes with the benchmark parameters, as measured by
+** kdf_bench: element w for the small benchmark, element 4 + w for the
+** large one. Element 9 is the nanoseconds it takes to allocate, fault
+** in, and free each megabyte of working memory, as measured with the
+** large benchmark, and element 0 is set once the rest are. */
+static uint64_t edsign_kdf_ns[10];
+
+/* Return the timings of edsign_kdf_ns, measuring them on the calling
+** thread the first time: about half a second in all. Racing
+** threads each measure and store similar values. Return NULL if memory
+** could not be allocated for all four lanes. */
+static const uint64_t*
+kdf_bench(void)
+{
+  const uint32_t logN[2] = { KDF_BENCH_SMALL, KDF_BENCH_LARGE };
+  struct scrypt_mem* M;
+  uint64_t ns[10];
+  uint64_t start, alloc, bytes;
+  uint32_t i, w;
+
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+  if (likely(__atomic_load_n(&edsign_kdf_ns[0], __ATOMIC_ACQUIRE)))
+    return edsign_kdf_ns;
+#else
+  if (likely(*(volatile uint64_t*)&edsign_kdf_ns[0])) return edsign_kdf_ns;
+#endif
+
+  for (i = 0; i < 2; ++i) {
+    uint64_t N = ((uint64_t)1) << logN[i];
+    uint64_t* t = &ns[4 * i];
+
+    start = kdf_now_ns();
+    M = crypto_scrypt_mem_bench(N, KDF_BENCH_R, &bytes);
+    if (M == NULL) return NULL;
+    alloc = kdf_now_ns() - start;
+
+    /* Warm up, then time groups of 1, 2, and 4 lanes; groups of 3 run
+    ** as a pair then a single lane. The best of a few runs, as many as
+    ** take about as long as one of the large benchmark, smooths out
+    ** noise in the short ones. */
+    crypto_scrypt_mem_smix(M, 1);
+    for (w = 1; w <= 4; w *= 2) {
+      uint32_t k, reps = 1U << (KDF_BENCH_LARGE - logN[i]);
+
+      t[w] = UINT64_MAX;
+      for (k = 0; k < reps; ++k) {
+        uint64_t dt;
+        start = kdf_now_ns();
+        /* Short of memory, M may have fewer than four slots */
+        if (crypto_scrypt_mem_smix(M, w) != 0) {
+          crypto_scrypt_mem_free(M);
+          return NULL;
+        }
+        dt = kdf_now_ns() - start + 1;
+        if (dt < t[w]) t[w] = dt;
+      }
+    }
+    t[3] = t[2] + t[1];
+
+    start = kdf_now_ns();
+    crypto_scrypt_mem_free(M);
+    alloc += kdf_now_ns() - start;
+    if (logN[i] == KDF_BENCH_LARGE)
+      ns[9] = (uint64_t)(alloc * 1048576.0 / bytes);
+  }
+
+  for (w = 1; w <= 9; ++w) {
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+    __atomic_store_n(&edsign_kdf_ns[w], ns[w], __ATOMIC_RELAXED);
+#else
+    *(volatile uint64_t*)&edsign_kdf_ns[w] = ns[w];
+#endif
+  }
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+  __atomic_store_n(&edsign_kdf_ns[0], 1, __ATOMIC_RELEASE);
+#else
+  *(volatile uint64_t*)&edsign_kdf_ns[0] = 1;
+#endif
+
+  return edsign_kdf_ns;
+}
+
+/* Estimated milliseconds scrypt takes with 2^${N}, ${r}, and ${p},
+** given the timings ${ns}. crypto_scrypt allocates its memory, then
+** splits the lanes into groups of equal width, which run in rounds of
+** one per thread. A group costs 4 * 2^N * r salsa20/8 cores per lane,
+** each costing more the larger V is: as benchmarked up to 1MB,
+** interpolated between the benchmarks, and, as random reads miss the
+** caches and TLB more and more often, about 10% more for every
+** doubling past 16MB. */
+static double
+kdf_ms(const uint64_t* ns, const uint32_t N, const uint32_t r,
+       const uint32_t p)
+{
+  const double span = KDF_BENCH_LARGE - KDF_BENCH_SMALL;
+  uint32_t nthreads = edsign_thread_limit();
+  uint32_t nslots = nthreads * crypto_scrypt_interleave();
+  uint32_t width, groups, rounds;
+  double cores, small, large, core, alloc, v, d = 0;
+
+  if (nthreads > p) nthreads = p;
+  if (nslots > p)   nslots = p;
+  width  = nslots / nthreads;
+  groups = (p + width - 1) / width;
+  rounds = (groups + nthreads - 1) / nthreads;
+
+  /* Cost per core at both benchmark sizes, for groups this wide */
+  small = ns[width] /
+    (4.0 * width * (((uint64_t)1) << KDF_BENCH_SMALL) * KDF_BENCH_R);
+  large = ns[4 + width] /
+    (4.0 * width * (((uint64_t)1) << KDF_BENCH_LARGE) * KDF_BENCH_R);
+
+  /* How many times V is larger than in the small benchmark */
+  cores = 4.0 * (double)(((uint64_t)1) << N) * r;
+  for (v = cores / (4.0 * (((uint64_t)1) << KDF_BENCH_SMALL) * KDF_BENCH_R);
+       v > 1.0; v /= 2)
+    d += 1;
+
+  if (d <= span)
+    core = small + (large - small) * d / span;
+  else
+    core = large * (1.0 + (d - span) / 10);
+
+  alloc = (double)crypto_scrypt_memory(((uint64_t)1) << N, r, p) / 1048576.0;
+
+  return ((double)rounds * width * cores * core + alloc * ns[9]) / 1e6;
+}
+
+/**
+ * edsign_kdf_cost(N, r, p, ms, bytes):
+ *
+ * Estimate what deriving a key with the scrypt parameters ${N}, ${r},
+ * and ${p} (as given to edsign_keypair) costs on this machine: the
+ * time in milliseconds, stored in ${ms}, and the peak working memory
+ * in bytes, stored in ${bytes}. Both account for the threads allowed
+ * by edsign_set_threads. ${ms} and ${bytes} can not be NULL.
+ *
+ * The time comes from benchmarks of scrypt with 1MB and 16MB of
+ * memory per lane, run the first time they are needed (by this
+ * function or by edsign_kdf_calibrate), which take about half a
+ * second. Like any benchmark, they vary with the load on the
+ * machine, and they are extrapolated to other parameters, so the
+ * estimates are good to within a fifth or so.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ERROR if the benchmarks could not allocate memory
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_kdf_cost(const uint32_t N, const uint32_t r, const uint32_t p,
+                uint64_t* ms, uint64_t* bytes)
+{
+  const uint64_t* ns;
+  double t;
+
+  if (ms == NULL || bytes == NULL) return EDSIGN_EINVAL;
+  if (N == 0 || N >= 64 || r == 0 || p == 0) return EDSIGN_EINVAL;
+  if ((uint64_t)r * p > KDF_MAX_RP) return EDSIGN_EINVAL;
+
+  if ((ns = kdf_bench()) == NULL) return EDSIGN_ERROR;
+
+  t = kdf_ms(ns, N, r, p);
+  *ms    = (t >= 18446744073709551615.0) ? UINT64_MAX : (uint64_t)(t + 0.999);
+  *bytes = crypto_scrypt_memory(((uint64_t)1) << N, r, p);
+  return EDSIGN_OK;
+}
+
+/**
+ * edsign_kdf_calibrate(max_ms, max_bytes, N, r, p):
+ *
+ * Pick the strongest scrypt parameters which, by the estimates of
+ * edsign_kdf_cost, take at most ${max_ms} milliseconds and
+ * ${max_bytes} bytes of memory on this machine, and store them in
+ * ${N}, ${r}, and ${p} for edsign_keypair or edsign_rekey_priv. As in
+ * scrypt's own parameter selection, ${r} is 8. The strongest choice
+ * is the one costing an attacker the most, i.e. with the largest
+ * product of time and memory per lane, 2^(2*${N}) * ${p}: when time
+ * is the limit, that is the largest ${N} which fits, and when memory
+ * is, a smaller ${N} run over more lanes. Time budgets below what
+ * N = 10, r = 8, p = 1 takes are raised to that. ${N}, ${r}, and ${p}
+ * can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid, or if even
+ *   the smallest parameters need more than ${max_bytes}
+ * - Returns EDSIGN_ERROR if the benchmarks could not allocate memory
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_kdf_calibrate(const uint32_t max_ms, const uint64_t max_bytes,
+                     uint32_t* N, uint32_t* r, uint32_t* p)
+{
+  const uint32_t rr = 8;
+  const uint64_t* ns;
+  uint32_t logN;
+  double budget = max_ms;
+  double best = 0;
+
+  if (N == NULL || r == NULL || p == NULL) return EDSIGN_EINVAL;
+  if ((ns = kdf_bench()) == NULL) return EDSIGN_ERROR;
+
+  if (budget < kdf_ms(ns, 10, rr, 1)) budget = kdf_ms(ns, 10, rr, 1);
+
+  for (logN = 1; logN < 63; ++logN) {
+    uint64_t n = ((uint64_t)1) << logN;
+    uint64_t lo = 1, hi = KDF_MAX_RP / rr;
+    double cost;
+
+    /* One lane must fit both budgets ... */
+    if (kdf_ms(ns, logN, rr, 1) > budget) break;
+    if (crypto_scrypt_memory(n, rr, 1) > max_bytes) break;
+
+    /* ... and then as many lanes as do */
+    while (lo < hi) {
+      uint64_t mid = lo + (hi - lo + 1) / 2;
+      if (kdf_ms(ns, logN, rr, mid) <= budget &&
+          crypto_scrypt_memory(n, rr, mid) <= max_bytes)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+
+    /* On ties, the larger N, whose memory is harder to trade away */
+    cost = (double)n * n * lo;
+    if (cost >= best) {
+      best = cost;
+      *N = logN;
+      *r = rr;
+      *p = (uint32_t)lo;
+    }
+  }
+
+  return (best > 0) ? EDSIGN_OK : EDSIGN_EINVAL;
+}
+
+#undef KDF_BENCH_SMALL
+#undef KDF_BENCH_LARGE
+#undef KDF_BENCH_R
+#undef KDF_MAX_RP
@@ -0,0 +1,100 @@
+/*
+** Password-based key derivation for secret keys.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#ifndef _EDSIGN_KDF_H_
+#define _EDSIGN_KDF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+edsign_kdf_ctx*
+edsign_kdf_ctx_new(const uint32_t N, const uint32_t r, const uint32_t p);
+
+void
+edsign_kdf_ctx_free(edsign_kdf_ctx* ctx);
+
+int
+edsign_kdf_ctx_set_timeout(edsign_kdf_ctx* ctx, const uint32_t ms);
+
+int
+edsign_kdf_ctx_cancel(edsign_kdf_ctx* ctx, const int cancel);
+
+int
+edsign_kdf_cost(const uint32_t N, const uint32_t r, const uint32_t p,
+                uint64_t* ms, uint64_t* bytes);
+
+int
+edsign_kdf_calibrate(const uint32_t max_ms, const uint64_t max_bytes,
+                     uint32_t* N, uint32_t* r, uint32_t* p);
+
+int
+edsign_set_kdf_limits(const uint64_t max_bytes, const uint32_t max_waiting);
+
+int
+edsign_get_kdf_stats(edsign_kdf_stats* stats);
+
+/* The tags of the key derivation functions in the secret key format */
+#define KDFALG_SCRYPT   "SK"
+#define KDFALG_ARGON2ID "A2"
+
+/**
+ * edsign_kdf_known(alg):
+ * Return nonzero if the 2 byte tag ${alg} names a key derivation
+ * function edsign_kdf supports.
+ */
+EDSIGN_STATIC int
+edsign_kdf_known(const uint8_t* alg);
+
+/**
+ * edsign_kdf_ctx_worker(ctx, N, r, p, spare):
+ * Create a context for one of the workers of a batch call, owning the
+ * working memory for scrypt with parameters up to ${N}, ${r}, and ${p}
+ * as edsign_kdf_ctx_new does, or none if they are all 0, and setting
+ * ${spare} more bytes aside for derivations which allocate their own,
+ * like Argon2id. Both count against the budget of
+ * edsign_set_kdf_limits until the context is freed with
+ * edsign_kdf_ctx_free, and derivations with the context never wait for
+ * the budget, which only the rest of the batch might free: those which
+ * fit in neither fail with EDSIGN_EBUSY. The context has the time
+ * limit of ${ctx}, which may be NULL, and is cancelled along with it.
+ * Return NULL, without waiting, if the budget has no room for all of
+ * this now, or if memory runs out; with nothing to set aside, only the
+ * latter.
+ */
+EDSIGN_STATIC edsign_kdf_ctx*
+edsign_kdf_ctx_worker(const edsign_kdf_ctx* ctx,
+                      const uint32_t N, const uint32_t r, const uint32_t p,
+                      const uint64_t spare);
+
+/**
+ * edsign_kdf(ctx, alg, pass, passlen, salt, params, out, outlen):
+ * Derive ${outlen} bytes of keystream into ${out} from the password
+ * ${pass} and the 16 byte ${salt}, using the key derivation function
+ * tagged ${alg} with the three parameters ${params} stored alongside
+ * it: for KDFALG_SCRYPT, scrypt with 2^N, r, and p; for
+ * KDFALG_ARGON2ID, Argon2id with t passes over m KiB in p lanes. The
+ * working memory of ${ctx} is used for scrypt if it is not NULL and
+ * is big enough; otherwise memory is allocated for the call, once the
+ * budget of edsign_set_kdf_limits admits it, or at once if it fits in
+ * what a context from edsign_kdf_ctx_worker set aside. The time limit
+ * and cancellation of ${ctx}, if any, apply throughout.
+ *
+ * Return EDSIGN_OK on success; EDSIGN_EBUSY if the budget refused the
+ * call; EDSIGN_ECANCELED if it was cancelled or ran out of time; or
+ * EDSIGN_EINVAL on any other error.
+ */
+EDSIGN_STATIC int
+edsign_kdf(edsign_kdf_ctx* ctx, const uint8_t* alg,
+           const uint8_t* pass, const uint64_t passlen,
+           const uint8_t* salt, const uint32_t* params,
+           uint8_t* out, const size_t outlen);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* !_EDSIGN_KDF_H_ */
@@ -10,13 +10,114 @@
 #include "edsign-private.h"
 #include "randombytes.h"
 #include "ed25519.h"
-#include "scrypt.h"
+#include "kdf.h"
 #include "blake2.h"
 #include "keypair.h"
 #include "util.h"
+#include "thread.h"
+#include "argon2.h"
 
 #define PKALG "Ed"
-#define KDFALG "SK"
+
+/* Number of key pairs edsign_keypair_batch generates at once, with a
+** single read of randomness */
+#define KEYPAIR_BATCH_CHUNK 64
+
+/* Random bytes each key pair needs: salt, fingerprint, and seed */
+#define KEYPAIR_RANDOM_BYTES (16 + 8 + 32)
+
+/* Where the salt and the key lie in a secret key */
+#define SK_SALT_OFFSET 16
+#define SK_KEY_OFFSET  48
+
+/* Number of secret keys whose keystreams edsign_rekey_batch holds at
+** once */
+#define REKEY_BATCH_CHUNK 64
+
+/* Write the public key ${pkout} and the header of the secret key
+** ${skout} for the key pair ${pk}, ${sk}, with the ${salt} and
+** ${fingerprint} given, and return where its key goes in ${skout}. */
+static uint8_t*
+keypair_encode(const char* alg, const uint8_t* pass, const uint32_t* params,
+               const uint8_t* salt, const uint8_t* fingerprint,
+               const uint8_t* pk, const uint8_t* sk,
+               uint8_t* pkout, uint8_t* skout)
+{
+  uint8_t digest[crypto_hash_blake2b_BYTES];
+  uint8_t* pp;
+  uint64_t i;
+
+  crypto_hash_blake2b_64(digest, sk); /* Key digest */
+
+  /* -- Public key -- */
+  pp = pkout;
+  memcpy(pp, PKALG, 2); pp += 2;
+  memcpy(pp, fingerprint, 8); pp += 8;
+  memcpy(pp, pk, crypto_sign_ed25519_PUBLICKEYBYTES);
+
+  /* -- Secret key -- */
+  pp = skout;
+  memcpy(pp, PKALG, 2); pp += 2;
+  memcpy(pp, (pass == NULL) ? KDFALG_SCRYPT : alg, 2); pp += 2;
+  /* Note: encode zeroes if we have no password */
+  for (i = 0; i < 3; ++i) {
+    edsign_le32enc(pp, (pass == NULL) ? 0 : params[i]); pp += 4;
+  }
+  memcpy(pp, salt, 16); pp += 16;
+  memcpy(pp, digest, 8); pp += 8;
+  memcpy(pp, fingerprint, 8); pp += 8;
+
+  edsign_bzero(digest, sizeof(digest));
+  return pp;
+}
+
+/* Generate a key pair, encrypting the secret key with the key
+** derivation function tagged ${alg} and its ${params}. Keys without a
+** password are always stored with scrypt's tag and zero parameters. */
+static int
+keypair_kdf(edsign_kdf_ctx* ctx, const char* alg,
+            const uint8_t* pass, const uint64_t passlen,
+            const uint32_t* params, uint8_t* pkout, uint8_t* skout)
+{
+  uint8_t pk[crypto_sign_ed25519_PUBLICKEYBYTES];
+  uint8_t sk[crypto_sign_ed25519_SECRETKEYBYTES];
+  uint8_t fingerprint[8];
+  uint8_t salt[16];
+  uint8_t* pp;
+  uint64_t i;
+  int res = EDSIGN_ERROR;
+
+  if (pkout == NULL) return EDSIGN_EINVAL;
+  if (skout == NULL) return EDSIGN_EINVAL;
+
+  edsign_randombytes(salt, sizeof(salt));
+  edsign_randombytes(fingerprint, sizeof(fingerprint));
+  crypto_sign_ed25519_keypair(pk, sk);
+  pp = keypair_encode(alg, pass, params, salt, fingerprint, pk, sk,
+                      pkout, skout);
+
+  /* Users can optionally specify a password. */
+  if (pass != NULL) {
+    res = edsign_kdf(ctx, (uint8_t*)alg, pass, passlen, salt, params,
+                     pp, crypto_sign_ed25519_SECRETKEYBYTES);
+    /* We need to carefully clear key material and *then* bail */
+    if (res != EDSIGN_OK) {
+      edsign_bzero(pkout, edsign_PUBLICKEYBYTES);
+      edsign_bzero(skout, edsign_SECRETKEYBYTES);
+      goto exit;
+    }
+  }
+  else {
+    edsign_bzero(pp, crypto_sign_ed25519_SECRETKEYBYTES);
+  }
+
+  /* Emit key material, then finish */
+  for (i = 0; i < sizeof(sk); ++i) pp[i] ^= sk[i];
+  res = EDSIGN_OK;
+ exit:
+  edsign_bzero(sk, sizeof(sk));
+  return res;
+}
 
 /**
  * edsign_keypair(pass, passlen, N, r, p, pk, sk):
@@ -32,12 +133,17 @@
  * ${p}. Memory usage of scrypt is approximately 128*${r}*(2^${N})
  * bytes. For example, for N = 14, r = 8, and p = 1, memory usage is
  * 128*8*(2^14) = 16 megabytes. ${p} may be used to independently tune
- * running time.
+ * running time. When ${p} > 1, up to four lanes per thread (see
+ * edsign_set_threads and edsign_set_interleave) are computed together
+ * to hide memory latency, each needing that much memory, so the peak
+ * is at most ${p} times it.
  *
  * The public key ${pk} must be at least edsign_PUBLICKEYBYTES in size.
  * The secret key ${sk} must be at least edsign_SECRETKEYBYTES in size.
  *
  * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
  * - Returns EDSIGN_OK under normal circumstances
  */
 int
@@ -45,65 +151,315 @@ edsign_keypair(const uint8_t* pass, const uint64_t passlen,
                const uint32_t N, const uint32_t r, const uint32_t p,
                uint8_t* pkout, uint8_t* skout)
 {
-  uint8_t pk[crypto_sign_ed25519_PUBLICKEYBYTES];
-  uint8_t sk[crypto_sign_ed25519_SECRETKEYBYTES];
-  uint8_t digest[crypto_hash_blake2b_BYTES];
-  uint8_t fingerprint[8];
-  uint8_t salt[16];
+  return edsign_keypair_ctx(NULL, pass, passlen, N, r, p, pkout, skout);
+}
+
+/**
+ * edsign_keypair_ctx(ctx, pass, passlen, N, r, p, pk, sk):
+ *
+ * As edsign_keypair, but deriving the key with the working memory,
+ * time limit, and cancellation of ${ctx} (see edsign_kdf_ctx_new). If
+ * ${ctx} is NULL, this is exactly edsign_keypair.
+ *
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ */
+int
+edsign_keypair_ctx(edsign_kdf_ctx* ctx,
+                   const uint8_t* pass, const uint64_t passlen,
+                   const uint32_t N, const uint32_t r, const uint32_t p,
+                   uint8_t* pkout, uint8_t* skout)
+{
+  const uint32_t params[3] = { N, r, p };
+  return keypair_kdf(ctx, KDFALG_SCRYPT, pass, passlen, params, pkout, skout);
+}
+
+/**
+ * edsign_keypair_argon2id(ctx, pass, passlen, t, m, p, pk, sk):
+ *
+ * As edsign_keypair_ctx, but encrypting the secret key with Argon2id
+ * (RFC 9106) rather than scrypt: ${t} passes over ${m} KiB of memory,
+ * split into ${p} lanes. The lanes of each quarter of a pass are
+ * computed in parallel, on as many threads as edsign_set_threads
+ * allows, so ${p} can make use of several cores without costing more
+ * memory; ${t} raises the running time alone. ${m} must be at least
+ * 8*${p}, and is rounded down to a multiple of 4*${p}. For example,
+ * t = 3, m = 65536, and p = 4 uses 64 megabytes. edsign_sign and
+ * edsign_rekey_priv tell from ${sk} how it was encrypted. If ${pass}
+ * is NULL, the secret key is unencrypted, exactly as with
+ * edsign_keypair_ctx.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_keypair_argon2id(edsign_kdf_ctx* ctx,
+                        const uint8_t* pass, const uint64_t passlen,
+                        const uint32_t t, const uint32_t m, const uint32_t p,
+                        uint8_t* pkout, uint8_t* skout)
+{
+  const uint32_t params[3] = { t, m, p };
+  return keypair_kdf(ctx, KDFALG_ARGON2ID, pass, passlen, params,
+                     pkout, skout);
+}
+
+/* The arguments of one edsign_keypair_batch call, split into chunks
+** of KEYPAIR_BATCH_CHUNK key pairs for edsign_parallel_for */
+struct keypair_batch {
+  const uint8_t* pass;
+  const uint32_t* params;
+  uint64_t n;
+  uint8_t* const* pks;
+  uint8_t* const* sks;
+};
+
+/* Generate chunk ${chunk} of ${arg}, a struct keypair_batch, leaving
+** the secret keys unencrypted for now */
+static void
+keypair_batch_chunk(void* arg, uint32_t worker, uint64_t chunk)
+{
+  const struct keypair_batch* B = arg;
+  uint8_t rnd[KEYPAIR_BATCH_CHUNK][KEYPAIR_RANDOM_BYTES];
+  uint8_t pk[KEYPAIR_BATCH_CHUNK][crypto_sign_ed25519_PUBLICKEYBYTES];
+  uint8_t sk[KEYPAIR_BATCH_CHUNK][crypto_sign_ed25519_SECRETKEYBYTES];
+  uint8_t* ppk[KEYPAIR_BATCH_CHUNK];
+  uint8_t* psk[KEYPAIR_BATCH_CHUNK];
   uint8_t* pp;
+  uint64_t i, j, k;
+
+  (void)worker;
+  i = chunk * KEYPAIR_BATCH_CHUNK;
+  k = (B->n - i < KEYPAIR_BATCH_CHUNK) ? (B->n - i) : KEYPAIR_BATCH_CHUNK;
+
+  /* rnd: 16-byte salt, 8-byte fingerprint, 32-byte seed */
+  edsign_randombytes(rnd[0], k * KEYPAIR_RANDOM_BYTES);
+  for (j = 0; j < k; ++j) {
+    memcpy(sk[j], rnd[j] + 24, 32);
+    ppk[j] = pk[j];
+    psk[j] = sk[j];
+  }
+  crypto_sign_ed25519_keypair_batch(ppk, psk, k);
+
+  for (j = 0; j < k; ++j) {
+    pp = keypair_encode(KDFALG_SCRYPT, B->pass, B->params, rnd[j],
+                        rnd[j] + 16, pk[j], sk[j],
+                        B->pks[i+j], B->sks[i+j]);
+    memcpy(pp, sk[j], crypto_sign_ed25519_SECRETKEYBYTES);
+  }
+
+  edsign_bzero(rnd[0], sizeof(rnd));
+  edsign_bzero(sk[0], sizeof(sk));
+}
+
+/**
+ * edsign_keypair_batch(ctx, pass, passlen, N, r, p, n, pks, sks):
+ *
+ * Generate ${n} key pairs at once, storing each in ${pks}[i] and
+ * ${sks}[i] as edsign_keypair_ctx would, with every secret key
+ * encrypted under the same password ${pass}, or unencrypted if it is
+ * NULL. The randomness for 64 key pairs at a time is read at once,
+ * their public keys are computed and encoded together, and these
+ * chunks are spread over as many threads as edsign_set_threads
+ * allows. With a password, the secret keys are then encrypted one
+ * after the other on the calling thread, each with its own salt but
+ * all reusing the working memory of ${ctx} (see edsign_kdf_ctx_new);
+ * this is most of the cost. The arrays can not be NULL if ${n} is not
+ * zero. On error, every key pair is wiped.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_ECANCELED if a derivation was cancelled or ran out
+ *   of time
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_keypair_batch(edsign_kdf_ctx* ctx,
+                     const uint8_t* pass, const uint64_t passlen,
+                     const uint32_t N, const uint32_t r, const uint32_t p,
+                     const uint64_t n,
+                     uint8_t* const* pks, uint8_t* const* sks)
+{
+  const uint32_t params[3] = { N, r, p };
+  uint8_t ks[crypto_sign_ed25519_SECRETKEYBYTES];
+  struct keypair_batch B;
+  uint64_t i, j;
+  int res = EDSIGN_OK;
+
+  if (n == 0) return EDSIGN_OK;
+  if (pks == NULL || sks == NULL) return EDSIGN_EINVAL;
+  for (i = 0; i < n; ++i)
+    if (pks[i] == NULL || sks[i] == NULL) return EDSIGN_EINVAL;
+
+  B.pass   = pass;
+  B.params = params;
+  B.n      = n;
+  B.pks    = pks;
+  B.sks    = sks;
+  edsign_parallel_for(edsign_thread_limit(),
+                      (n + KEYPAIR_BATCH_CHUNK - 1) / KEYPAIR_BATCH_CHUNK,
+                      keypair_batch_chunk, &B);
+  if (pass == NULL) return EDSIGN_OK;
+
+  for (i = 0; i < n; ++i) {
+    res = edsign_kdf(ctx, (uint8_t*)KDFALG_SCRYPT, pass, passlen,
+                     sks[i] + SK_SALT_OFFSET, params, ks, sizeof(ks));
+    if (res != EDSIGN_OK) break;
+    for (j = 0; j < sizeof(ks); ++j) sks[i][SK_KEY_OFFSET + j] ^= ks[j];
+  }
+  edsign_bzero(ks, sizeof(ks));
+
+  /* We need to carefully clear key material and *then* bail */
+  if (res != EDSIGN_OK) {
+    for (i = 0; i < n; ++i) {
+      edsign_bzero(pks[i], edsign_PUBLICKEYBYTES);
+      edsign_bzero(sks[i], edsign_SECRETKEYBYTES);
+    }
+  }
+  return res;
+}
+
+/* A secret key as read by rekey_decode, before it is rekeyed */
+struct rekey_in {
+  uint8_t alg[2];        /* Tag of the old key derivation function */
+  uint32_t params[3];    /* Its parameters, all 0 if there is none */
+  uint8_t salt[16];
+  uint8_t digest[8];
+  uint8_t fp[8];         /* fingerprint */
+  const uint8_t* enckey; /* The encrypted key, inside the secret key */
+};
+
+/* Decode the secret key ${skin}, which may be encrypted with any key
+** derivation function, into ${in}. */
+static int
+rekey_decode(const uint8_t* skin, struct rekey_in* in)
+{
+  const uint8_t* pp = skin;
   uint64_t i;
-  int res = EDSIGN_ERROR;
 
-  if (pkout == NULL) return EDSIGN_EINVAL;
-  if (skout == NULL) return EDSIGN_EINVAL;
+  if (skin == NULL) return EDSIGN_EINVAL;
 
-  edsign_randombytes(salt, sizeof(salt));
-  edsign_randombytes(fingerprint, sizeof(fingerprint));
-  crypto_sign_ed25519_keypair(pk, sk);
-  crypto_hash_blake2b(digest, sk, sizeof(sk)); /* Key digest */
+  /* Basics: verification, decoding parameters */
+  if (0 != edsign_memcmp(pp, (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
+  pp += 2;
 
-  /* -- Public key -- */
-  pp = pkout;
-  memcpy(pp, PKALG, 2); pp += 2;
-  memcpy(pp, fingerprint, sizeof(fingerprint)); pp += sizeof(fingerprint);
-  memcpy(pp, pk, crypto_sign_ed25519_PUBLICKEYBYTES);
+  if (!edsign_kdf_known(pp)) return EDSIGN_EINVAL;
+  memcpy(in->alg, pp, 2); pp += 2;
 
-  /* -- Secret key -- */
-  pp = skout;
-  memcpy(pp, PKALG, 2);  pp += 2;
-  memcpy(pp, KDFALG, 2); pp += 2;
+  for (i = 0; i < 3; ++i) {
+    in->params[i] = edsign_le32dec(pp); pp += 4;
+  }
+
+  memcpy(in->salt, pp, 16);  pp += 16;
+  memcpy(in->digest, pp, 8); pp += 8;
+  memcpy(in->fp, pp, 8);     pp += 8;
+  in->enckey = pp;
+
+  return EDSIGN_OK;
+}
+
+/* Whether the key ${in} has to be derived with the old password
+** ${oldpass}: iff there are no KDF parameters, then there was no
+** password, and without ${oldpass} it is taken to be unencrypted. */
+static int
+rekey_needs_kdf(const struct rekey_in* in, const uint8_t* oldpass)
+{
+  return oldpass != NULL &&
+         in->params[0] != 0 && in->params[1] != 0 && in->params[2] != 0;
+}
+
+/* Decrypt the key ${in} with the keystream in ${key}, in place, and
+** check it against its digest. */
+static int
+rekey_open(const struct rekey_in* in, uint8_t* key)
+{
+  uint8_t hash[crypto_hash_blake2b_BYTES];
+  uint64_t i;
+  int res = EDSIGN_OK;
+
+  for (i = 0; i < crypto_sign_ed25519_SECRETKEYBYTES; ++i)
+    key[i] ^= in->enckey[i];
+  crypto_hash_blake2b_64(hash, key);
+
+  if (0 != edsign_memcmp(hash, in->digest, 8)) res = EDSIGN_EPASSWD;
+
+  edsign_bzero(hash, sizeof(hash));
+  return res;
+}
+
+/* Write to ${skout} the decrypted key ${key} of ${in}, encrypted with
+** the keystream ${ks} derived from the new password ${newpass}, the
+** key derivation function tagged ${alg}, its ${params}, and ${salt}. */
+static void
+rekey_encode(const struct rekey_in* in, const char* alg,
+             const uint8_t* newpass, const uint32_t* params,
+             const uint8_t* salt, const uint8_t* ks, const uint8_t* key,
+             uint8_t* skout)
+{
+  uint8_t* pp = skout;
+  uint64_t i;
+
+  memcpy(pp, PKALG, 2); pp += 2;
+  memcpy(pp, (newpass == NULL) ? KDFALG_SCRYPT : alg, 2); pp += 2;
   /* Note: encode zeroes if we have no password */
-  edsign_le32enc(pp, (pass == NULL) ? 0 : N); pp += 4;
-  edsign_le32enc(pp, (pass == NULL) ? 0 : r); pp += 4;
-  edsign_le32enc(pp, (pass == NULL) ? 0 : p); pp += 4;
-  memcpy(pp, salt, sizeof(salt)); pp += sizeof(salt);
-  memcpy(pp, digest, 8); pp += 8;
-  memcpy(pp, fingerprint, sizeof(fingerprint)); pp += sizeof(fingerprint);
+  for (i = 0; i < 3; ++i) {
+    edsign_le32enc(pp, (newpass == NULL) ? 0 : params[i]); pp += 4;
+  }
+  memcpy(pp, salt, 16); pp += 16;
+  memcpy(pp, in->digest, 8); pp += 8;
+  memcpy(pp, in->fp, 8); pp += 8;
 
-  edsign_bzero(digest, sizeof(digest));
+  /* Emit key material */
+  for (i = 0; i < crypto_sign_ed25519_SECRETKEYBYTES; ++i)
+    pp[i] = ks[i] ^ key[i];
+}
 
-  /* Users can optionally specify a password. */
-  if (pass != NULL) {
-    uint64_t pow2N = ((uint64_t)1) << N;
-    res = crypto_scrypt(pass, passlen, salt, sizeof(salt), pow2N, r, p,
-                        pp, crypto_sign_ed25519_SECRETKEYBYTES);
-    /* We need to carefully clear key material and *then* bail */
-    if (res != 0) {
-      res = EDSIGN_EINVAL;
-      edsign_bzero(pkout, edsign_PUBLICKEYBYTES);
-      edsign_bzero(skout, edsign_SECRETKEYBYTES);
-      goto exit;
-    }
+/* Rekey the secret key ${skin}, which may be encrypted with any key
+** derivation function, under the new password with the key derivation
+** function tagged ${alg} and its ${params}. */
+static int
+rekey_kdf(edsign_kdf_ctx* ctx, const char* alg,
+          const uint8_t* oldpass, const uint64_t oldpasslen,
+          const uint8_t* newpass, const uint64_t newpasslen,
+          const uint32_t* params, uint8_t* skin, uint8_t* skout)
+{
+  struct rekey_in in;
+  uint8_t key[crypto_sign_ed25519_SECRETKEYBYTES];
+  uint8_t ks[crypto_sign_ed25519_SECRETKEYBYTES];
+  uint8_t newsalt[16];
+  int res = EDSIGN_ERROR;
+
+  if (skout == NULL) return EDSIGN_EINVAL;
+  if ((res = rekey_decode(skin, &in)) != EDSIGN_OK) return res;
+
+  edsign_randombytes(newsalt, 16);
+  edsign_bzero(key, sizeof(key));
+  edsign_bzero(ks, sizeof(ks));
+
+  /* Derive the old key, and validate it */
+  if (rekey_needs_kdf(&in, oldpass)) {
+    res = edsign_kdf(ctx, in.alg, oldpass, oldpasslen, in.salt, in.params,
+                     key, sizeof(key));
+    if (res != EDSIGN_OK) goto exit;
   }
-  else {
-    edsign_bzero(pp, crypto_sign_ed25519_SECRETKEYBYTES);
+  if ((res = rekey_open(&in, key)) != EDSIGN_OK) goto exit;
+
+  /* Users can optionally specify a password. */
+  if (newpass != NULL) {
+    res = edsign_kdf(ctx, (uint8_t*)alg, newpass, newpasslen, newsalt, params,
+                     ks, sizeof(ks));
+    if (res != EDSIGN_OK) goto exit;
   }
 
-  /* Emit key material, then finish */
-  for (i = 0; i < sizeof(sk); ++i) pp[i] ^= sk[i];
+  rekey_encode(&in, alg, newpass, params, newsalt, ks, key, skout);
   res = EDSIGN_OK;
  exit:
-  edsign_bzero(sk, sizeof(sk));
+  edsign_bzero(key, sizeof(key));
+  edsign_bzero(ks, sizeof(ks));
   return res;
 }
 
@@ -117,11 +473,14 @@ edsign_keypair(const uint8_t* pass, const uint64_t passlen,
  *
  * If ${oldpass} is NULL, it is assumed there was no prior
  * password. If ${newpass} is NULL, the password is removed, and ${N},
- * ${r}, and ${p} are ignored.
+ * ${r}, and ${p} are ignored. ${so} may have been encrypted with
+ * scrypt or with Argon2id (see edsign_keypair_argon2id).
  *
  * The secret key ${sn} must be at least edsign_SECRETKEYBYTES in size.
  *
  * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
  * - Returns EDSIGN_EPASSWD if the password is invalid
  * - Returns EDSIGN_OK under normal circumstances
  */
@@ -131,105 +490,241 @@ edsign_rekey_priv(const uint8_t* oldpass, const uint64_t oldpasslen,
                   const uint32_t N, const uint32_t r, const uint32_t p,
                   uint8_t* skin, uint8_t* skout)
 {
-  uint32_t Nold, rold, pold;
-  uint8_t* pp;
-  uint8_t* salt;
-  uint8_t* digest;
-  uint8_t* fp; /* fingerprint */
-  uint8_t* enckey;
-  uint8_t key[crypto_sign_ed25519_SECRETKEYBYTES];
-  uint8_t hash[crypto_hash_blake2b_BYTES];
-  uint8_t newsalt[16];
-  uint64_t i;
-  int res = EDSIGN_ERROR;
-
-  if (skin == NULL)  return EDSIGN_EINVAL;
-  if (skout == NULL) return EDSIGN_EINVAL;
+  return edsign_rekey_priv_ctx(NULL, oldpass, oldpasslen, newpass, newpasslen,
+                               N, r, p, skin, skout);
+}
 
-  edsign_randombytes(newsalt, 16);
-  pp = (uint8_t*)skin;
+/**
+ * edsign_rekey_priv_ctx(ctx, oldpass, oldpasslen, newpass, newpasslen, N, r, p, so, sn):
+ *
+ * As edsign_rekey_priv, but deriving both keys with the working memory,
+ * time limit, and cancellation of ${ctx} (see edsign_kdf_ctx_new). If
+ * ${ctx} is NULL, this is exactly edsign_rekey_priv.
+ *
+ * - Returns EDSIGN_ECANCELED if a derivation was cancelled or ran out
+ *   of time
+ */
+int
+edsign_rekey_priv_ctx(edsign_kdf_ctx* ctx,
+                      const uint8_t* oldpass, const uint64_t oldpasslen,
+                      const uint8_t* newpass, const uint64_t newpasslen,
+                      const uint32_t N, const uint32_t r, const uint32_t p,
+                      uint8_t* skin, uint8_t* skout)
+{
+  const uint32_t params[3] = { N, r, p };
+  return rekey_kdf(ctx, KDFALG_SCRYPT, oldpass, oldpasslen,
+                   newpass, newpasslen, params, skin, skout);
+}
 
-  /* Basics: verification, decoding parameters */
-  if (0 != edsign_memcmp(pp, (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
-  pp += 2;
+/**
+ * edsign_rekey_priv_argon2id(ctx, oldpass, oldpasslen, newpass, newpasslen, t, m, p, so, sn):
+ *
+ * As edsign_rekey_priv_ctx, but encrypting the new secret key with
+ * Argon2id with the parameters ${t}, ${m}, and ${p} (see
+ * edsign_keypair_argon2id). ${so} may be encrypted with either
+ * scrypt or Argon2id, so this also moves keys from one to the other.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_ECANCELED if a derivation was cancelled or ran out
+ *   of time
+ * - Returns EDSIGN_EPASSWD if the password is invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_rekey_priv_argon2id(edsign_kdf_ctx* ctx,
+                           const uint8_t* oldpass, const uint64_t oldpasslen,
+                           const uint8_t* newpass, const uint64_t newpasslen,
+                           const uint32_t t, const uint32_t m,
+                           const uint32_t p, uint8_t* skin, uint8_t* skout)
+{
+  const uint32_t params[3] = { t, m, p };
+  return rekey_kdf(ctx, KDFALG_ARGON2ID, oldpass, oldpasslen,
+                   newpass, newpasslen, params, skin, skout);
+}
 
-  if (0 != edsign_memcmp(pp, (uint8_t*)KDFALG, 2)) return EDSIGN_EINVAL;
-  pp += 2;
+/* The state of one edsign_rekey_batch call, for a chunk of up to
+** REKEY_BATCH_CHUNK keys at a time. Item 2*j of edsign_parallel_for
+** derives the keystream of key j from the old password, and item
+** 2*j+1 the one from the new password, each on the context of the
+** worker running it. */
+struct rekey_batch {
+  const uint8_t* oldpass;
+  uint64_t oldpasslen;
+  const uint8_t* newpass;
+  uint64_t newpasslen;
+  const uint32_t* params;
+  edsign_kdf_ctx* const* ctxs;
+  struct rekey_in in[REKEY_BATCH_CHUNK];
+  int decoded[REKEY_BATCH_CHUNK];
+  uint8_t salt[REKEY_BATCH_CHUNK][16];
+  uint8_t ks[REKEY_BATCH_CHUNK][2][crypto_sign_ed25519_SECRETKEYBYTES];
+  int res[REKEY_BATCH_CHUNK][2];
+};
 
-  Nold = edsign_le32dec(pp); pp += 4;
-  rold = edsign_le32dec(pp); pp += 4;
-  pold = edsign_le32dec(pp); pp += 4;
+/* Make derivation ${item} of ${arg}, a struct rekey_batch */
+static void
+rekey_batch_derive(void* arg, uint32_t worker, uint64_t item)
+{
+  struct rekey_batch* B = arg;
+  const struct rekey_in* in = &B->in[item / 2];
+  uint8_t* ks = B->ks[item / 2][item % 2];
+  int* res = &B->res[item / 2][item % 2];
 
-  salt   = pp; pp += 16;
-  digest = pp; pp += 8;
-  fp     = pp; pp += 8;
-  enckey = pp;
+  if (B->decoded[item / 2] != EDSIGN_OK) return;
 
-  /* Iff there are no scrypt parameters, then there was no. Rekey. */
-  if (Nold == 0 || rold == 0 || pold == 0) {
-    edsign_bzero(key, sizeof(key));
-    goto rekey;
+  if (item % 2 == 0) {
+    if (rekey_needs_kdf(in, B->oldpass))
+      *res = edsign_kdf(B->ctxs[worker], in->alg, B->oldpass, B->oldpasslen,
+                        in->salt, in->params,
+                        ks, crypto_sign_ed25519_SECRETKEYBYTES);
   }
+  else if (B->newpass != NULL) {
+    *res = edsign_kdf(B->ctxs[worker], (uint8_t*)KDFALG_SCRYPT,
+                      B->newpass, B->newpasslen, B->salt[item / 2],
+                      B->params, ks, crypto_sign_ed25519_SECRETKEYBYTES);
+  }
+}
 
-  /* Derive key */
-  if (oldpass != NULL) {
-    uint64_t pow2N = ((uint64_t)1) << Nold;
-    res = crypto_scrypt(oldpass, oldpasslen, salt, 16, pow2N, rold, pold,
-                        key, sizeof(key));
-    if (res != 0) {
-      res = EDSIGN_EINVAL;
-      goto exit;
-    }
+/**
+ * edsign_rekey_batch(ctx, oldpass, oldpasslen, newpass, newpasslen, N, r, p, n, sos, sns, results):
+ *
+ * Rekey ${n} secret keys at once: for each i, rekey ${sos}[i] as
+ * edsign_rekey_priv_ctx would, from the old password ${oldpass} to the
+ * new password ${newpass} with the scrypt parameters ${N}, ${r}, and
+ * ${p}, store it in ${sns}[i], and store the result in ${results}[i].
+ * A key which fails is left as it was in ${sns}, which may be ${sos}
+ * itself.
+ *
+ * The derivations are spread over as many threads as
+ * edsign_set_threads allows, and those of the old and the new
+ * password of each key run at the same time, so the new one is made
+ * even if the old password turns out to be wrong. Each thread has
+ * working memory of its own, allocated once for the whole call and
+ * big enough for the largest scrypt parameters among the keys, and
+ * sets as much aside as the largest Argon2id key needs. All of this
+ * counts against the budget of edsign_set_kdf_limits; with no room
+ * for it, or with other derivations waiting for the budget, fewer
+ * threads are used, and with none, a single thread makes the
+ * derivations one by one, each waiting for the budget as
+ * edsign_rekey_priv does. Only the time limit and cancellation of
+ * ${ctx}, which may be NULL, are used. The arrays can not be NULL if
+ * ${n} is not zero. If the call fails before trying the keys, each
+ * result is set to its error, where ${results} is not NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ERROR if memory could not be allocated
+ * - Returns the first error in ${results}, if any key failed
+ * - Returns EDSIGN_OK if every key was rekeyed
+ */
+int
+edsign_rekey_batch(edsign_kdf_ctx* ctx,
+                   const uint8_t* oldpass, const uint64_t oldpasslen,
+                   const uint8_t* newpass, const uint64_t newpasslen,
+                   const uint32_t N, const uint32_t r, const uint32_t p,
+                   const uint64_t n,
+                   const uint8_t* const* sos, uint8_t* const* sns,
+                   int* results)
+{
+  const uint32_t params[3] = { N, r, p };
+  edsign_kdf_ctx* ctxs[EDSIGN_MAX_THREADS];
+  struct rekey_batch B;
+  struct rekey_in in;
+  uint32_t mN = 0, mr = 0, mp = 0;
+  uint64_t spare = 0;
+  uint32_t nworkers, w;
+  uint64_t i, j, k;
+  int res = EDSIGN_OK;
+
+  if (n == 0) return EDSIGN_OK;
+  res = EDSIGN_EINVAL;
+  if (sos == NULL || sns == NULL || results == NULL) goto fail;
+  for (i = 0; i < n; ++i)
+    if (sos[i] == NULL || sns[i] == NULL) goto fail;
+  if (newpass != NULL && (N >= 64 || r == 0 || p == 0)) goto fail;
+  res = EDSIGN_OK;
+
+  /* Size the memory of the workers for the largest scrypt derivation,
+  ** and set aside enough for the largest Argon2id one */
+  if (newpass != NULL) {
+    mN = N;
+    mr = r;
+    mp = p;
   }
-  else {
-    edsign_bzero(key, sizeof(key));
+  for (i = 0; i < n; ++i) {
+    if (rekey_decode(sos[i], &in) != EDSIGN_OK) continue;
+    if (!rekey_needs_kdf(&in, oldpass)) continue;
+    if (0 == edsign_memcmp(in.alg, (uint8_t*)KDFALG_ARGON2ID, 2)) {
+      if (crypto_argon2id_memory(in.params[1], in.params[2]) > spare)
+        spare = crypto_argon2id_memory(in.params[1], in.params[2]);
+      continue;
+    }
+    if (0 != edsign_memcmp(in.alg, (uint8_t*)KDFALG_SCRYPT, 2)) continue;
+    if (in.params[0] >= 64) continue;
+    if (in.params[0] > mN) mN = in.params[0];
+    if (in.params[1] > mr) mr = in.params[1];
+    if (in.params[2] > mp) mp = in.params[2];
   }
 
- rekey:
-  /* First, validate the key */
-  for (i = 0; i < sizeof(key); ++i) key[i] ^= enckey[i];
-  crypto_hash_blake2b(hash, key, sizeof(key));
-
-  if (0 != edsign_memcmp(hash, digest, 8)) {
-    res = EDSIGN_EPASSWD;
-    goto exit;
+  /* One context per worker, as many as the budget has room for; with
+  ** room for none, a single one without memory of its own, which holds
+  ** nothing back from the budget its derivations wait for */
+  nworkers = edsign_thread_limit();
+  if (nworkers > 2 * n) nworkers = (uint32_t)(2 * n);
+  for (w = 0; w < nworkers; ++w)
+    if ((ctxs[w] = edsign_kdf_ctx_worker(ctx, mN, mr, mp, spare)) == NULL)
+      break;
+  if (w == 0 && (ctxs[0] = edsign_kdf_ctx_worker(ctx, 0, 0, 0, 0)) != NULL)
+    w = 1;
+  if (w == 0) {
+    res = EDSIGN_ERROR;
+    goto fail;
   }
+  nworkers = w;
 
-  /* Rekey based on given inputs */
-  pp = (uint8_t*)skout;
+  B.oldpass    = oldpass;
+  B.oldpasslen = oldpasslen;
+  B.newpass    = newpass;
+  B.newpasslen = newpasslen;
+  B.params     = params;
+  B.ctxs       = ctxs;
 
-  memcpy(pp, PKALG, 2);  pp += 2;
-  memcpy(pp, KDFALG, 2); pp += 2;
-  /* Note: encode zeroes if we have no password */
-  edsign_le32enc(pp, (newpass == NULL) ? 0 : N); pp += 4;
-  edsign_le32enc(pp, (newpass == NULL) ? 0 : r); pp += 4;
-  edsign_le32enc(pp, (newpass == NULL) ? 0 : p); pp += 4;
-  memcpy(pp, newsalt, sizeof(newsalt)); pp += sizeof(newsalt);
-  memcpy(pp, hash, 8); pp += 8;
-  memcpy(pp, fp, 8); pp += 8;
+  for (i = 0; i < n; i += k) {
+    k = (n - i < REKEY_BATCH_CHUNK) ? (n - i) : REKEY_BATCH_CHUNK;
 
-  /* Users can optionally specify a password. */
-  if (newpass != NULL) {
-    uint64_t pow2N = ((uint64_t)1) << N;
-    res = crypto_scrypt(newpass, newpasslen, newsalt, sizeof(newsalt),
-                        pow2N, r, p, pp, crypto_sign_ed25519_SECRETKEYBYTES);
-    if (res != 0) {
-      res = EDSIGN_EINVAL;
-      goto exit;
+    edsign_randombytes(B.salt[0], k * 16);
+    edsign_bzero(B.ks[0][0], sizeof(B.ks));
+    for (j = 0; j < k; ++j) {
+      B.decoded[j] = rekey_decode(sos[i+j], &B.in[j]);
+      B.res[j][0]  = B.res[j][1] = EDSIGN_OK;
+    }
+    edsign_parallel_for(nworkers, 2 * k, rekey_batch_derive, &B);
+
+    /* Check and encode the keys, in the order edsign_rekey_priv would
+    ** fail on them */
+    for (j = 0; j < k; ++j) {
+      results[i+j] = B.decoded[j];
+      if (results[i+j] == EDSIGN_OK) results[i+j] = B.res[j][0];
+      if (results[i+j] == EDSIGN_OK)
+        results[i+j] = rekey_open(&B.in[j], B.ks[j][0]);
+      if (results[i+j] == EDSIGN_OK) results[i+j] = B.res[j][1];
+      if (results[i+j] == EDSIGN_OK)
+        rekey_encode(&B.in[j], KDFALG_SCRYPT, newpass, params, B.salt[j],
+                     B.ks[j][1], B.ks[j][0], sns[i+j]);
+      else if (res == EDSIGN_OK)
+        res = results[i+j];
     }
-  }
-  else {
-    edsign_bzero(pp, crypto_sign_ed25519_SECRETKEYBYTES);
   }
 
-  /* Emit key material, then finish */
-  for (i = 0; i < crypto_sign_ed25519_SECRETKEYBYTES; ++i)
-    pp[i] ^= key[i];
+  edsign_bzero(B.ks[0][0], sizeof(B.ks));
+  for (w = 0; w < nworkers; ++w) edsign_kdf_ctx_free(ctxs[w]);
+  return res;
 
-  res = EDSIGN_OK;
- exit:
-  edsign_bzero(key, sizeof(key));
-  edsign_bzero(hash, sizeof(hash));
+fail:
+  /* Before any key was tried, every key fails the same way */
+  if (results != NULL)
+    for (i = 0; i < n; ++i) results[i] = res;
   return res;
 }
 
@@ -273,12 +768,16 @@ edsign_secretkey_fingerprint(const uint8_t* sk, uint8_t* out)
 {
   if (sk  == NULL) return EDSIGN_EINVAL;
   if (out == NULL) return EDSIGN_EINVAL;
-  if (0 != edsign_memcmp(sk,   (uint8_t*)PKALG, 2))  return EDSIGN_EINVAL;
-  if (0 != edsign_memcmp(sk+2, (uint8_t*)KDFALG, 2)) return EDSIGN_EINVAL;
+  if (0 != edsign_memcmp(sk, (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
+  if (!edsign_kdf_known(sk+2)) return EDSIGN_EINVAL;
 
   memcpy(out, sk+40, edsign_fingerprint_BYTES);
   return EDSIGN_OK;
 }
 
 #undef PKALG
-#undef KDFALG
+#undef KEYPAIR_BATCH_CHUNK
+#undef KEYPAIR_RANDOM_BYTES
+#undef SK_SALT_OFFSET
+#undef SK_KEY_OFFSET
+#undef REKEY_BATCH_CHUNK
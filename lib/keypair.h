@@ -25,6 +25,48 @@ edsign_rekey_priv(const uint8_t* oldpass, const uint64_t oldpasslen,
                   const uint32_t N, const uint32_t r, const uint32_t p,
                   uint8_t* skin, uint8_t* skout);
 
+int
+edsign_keypair_ctx(edsign_kdf_ctx* ctx,
+                   const uint8_t* pass, const uint64_t passlen,
+                   const uint32_t N, const uint32_t r, const uint32_t p,
+                   uint8_t* pkout, uint8_t* skout);
+
+int
+edsign_rekey_priv_ctx(edsign_kdf_ctx* ctx,
+                      const uint8_t* oldpass, const uint64_t oldpasslen,
+                      const uint8_t* newpass, const uint64_t newpasslen,
+                      const uint32_t N, const uint32_t r, const uint32_t p,
+                      uint8_t* skin, uint8_t* skout);
+
+int
+edsign_keypair_argon2id(edsign_kdf_ctx* ctx,
+                        const uint8_t* pass, const uint64_t passlen,
+                        const uint32_t t, const uint32_t m, const uint32_t p,
+                        uint8_t* pkout, uint8_t* skout);
+
+int
+edsign_keypair_batch(edsign_kdf_ctx* ctx,
+                     const uint8_t* pass, const uint64_t passlen,
+                     const uint32_t N, const uint32_t r, const uint32_t p,
+                     const uint64_t n,
+                     uint8_t* const* pks, uint8_t* const* sks);
+
+int
+edsign_rekey_priv_argon2id(edsign_kdf_ctx* ctx,
+                           const uint8_t* oldpass, const uint64_t oldpasslen,
+                           const uint8_t* newpass, const uint64_t newpasslen,
+                           const uint32_t t, const uint32_t m,
+                           const uint32_t p, uint8_t* skin, uint8_t* skout);
+
+int
+edsign_rekey_batch(edsign_kdf_ctx* ctx,
+                   const uint8_t* oldpass, const uint64_t oldpasslen,
+                   const uint8_t* newpass, const uint64_t newpasslen,
+                   const uint32_t N, const uint32_t r, const uint32_t p,
+                   const uint64_t n,
+                   const uint8_t* const* sos, uint8_t* const* sns,
+                   int* results);
+
 int
 edsign_pubkey_fingerprint(const uint8_t* pk, uint8_t* out);
 
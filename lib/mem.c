@@ -0,0 +1,301 @@
+/*
+** Allocation of large working memory.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#include "edsign-private.h"
+#include "mem.h"
+#include "util.h"
+
+/* Huge pages we ask for: 2MB, the size x86-64 and most arm64 systems
+** use for both hugetlbfs and transparent huge pages. */
+#define MEM_HUGE_LOG2 21
+#define MEM_HUGE      ((size_t)1 << MEM_HUGE_LOG2)
+
+/* MPOL_PREFERRED from <linux/mempolicy.h>, which we avoid depending on */
+#define MEM_MPOL_PREFERRED 1
+
+/* Written by edsign_set_memory_flags and read at every allocation, so
+** a racing update takes effect at the next one. */
+static volatile uint32_t edsign_mem_flags = EDSIGN_MEM_DEFAULT;
+
+/* Counters behind edsign_get_memory_stats, in the order of its fields */
+static uint64_t edsign_mem_counts[5];
+
+#define MEM_HUGETLB    0
+#define MEM_THP        1
+#define MEM_SMALL      2
+#define MEM_HEAP       3
+#define MEM_NUMA_LOCAL 4
+
+static void
+mem_count(int which)
+{
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+  __atomic_fetch_add(&edsign_mem_counts[which], 1, __ATOMIC_RELAXED);
+#else
+  ((volatile uint64_t*)edsign_mem_counts)[which]++;
+#endif
+}
+
+/**
+ * edsign_set_memory_flags(flags):
+ *
+ * Set how the large working memory of scrypt (128*${r}*(2^${N}) bytes
+ * per lane) is allocated, as a combination of:
+ *
+ * - EDSIGN_MEM_HUGEPAGES: back it with 2MB huge pages, from the
+ *   reserved hugetlbfs pool if there is one, or else by asking for
+ *   transparent huge pages. This cuts the TLB misses of the random
+ *   reads scrypt makes, which dominate once the memory reaches tens
+ *   of megabytes.
+ *
+ * - EDSIGN_MEM_NUMA_LOCAL: prefer the NUMA node of the calling
+ *   thread for it, rather than the node first touching each page.
+ *
+ * Each is only a preference: where the OS does not support it or has
+ * no memory to spare, regular pages are used instead. The default is
+ * EDSIGN_MEM_DEFAULT, i.e. EDSIGN_MEM_HUGEPAGES.
+ *
+ * - Returns EDSIGN_EINVAL if ${flags} has unknown bits set
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_set_memory_flags(const uint32_t flags)
+{
+  if (flags & ~(EDSIGN_MEM_HUGEPAGES | EDSIGN_MEM_NUMA_LOCAL))
+    return EDSIGN_EINVAL;
+
+  edsign_mem_flags = flags;
+  return EDSIGN_OK;
+}
+
+/**
+ * edsign_get_memory_stats(stats):
+ *
+ * Store in ${stats} how many working memory regions have been
+ * allocated along each path since the library was loaded, which
+ * tells whether huge pages and NUMA placement are taking effect.
+ * ${stats} can not be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_get_memory_stats(edsign_memory_stats* stats)
+{
+  uint64_t c[5];
+  int i;
+
+  if (stats == NULL) return EDSIGN_EINVAL;
+
+  for (i = 0; i < 5; ++i) {
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+    c[i] = __atomic_load_n(&edsign_mem_counts[i], __ATOMIC_RELAXED);
+#else
+    c[i] = ((volatile uint64_t*)edsign_mem_counts)[i];
+#endif
+  }
+
+  stats->hugetlb    = c[MEM_HUGETLB];
+  stats->thp        = c[MEM_THP];
+  stats->small      = c[MEM_SMALL];
+  stats->heap       = c[MEM_HEAP];
+  stats->numa_local = c[MEM_NUMA_LOCAL];
+  return EDSIGN_OK;
+}
+
+#if defined(MAP_ANON)
+
+/* Prefer the NUMA node the calling thread runs on for the ${len} bytes
+** at ${p}, which must not have been touched yet. Return 0 on success. */
+static int
+mem_numa_local(void* p, size_t len)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu)
+  unsigned int cpu, node;
+  unsigned long mask;
+
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return -1;
+  /* The kernel reads one bit fewer than maxnode says */
+  if (node >= sizeof(mask) * 8 - 1) return -1;
+
+  mask = 1UL << node;
+  if (syscall(SYS_mbind, p, len, MEM_MPOL_PREFERRED,
+              &mask, sizeof(mask) * 8, 0) != 0)
+    return -1;
+
+  return 0;
+#else
+  (void)p; (void)len;
+  return -1;
+#endif
+}
+
+/* Map ${len} bytes of anonymous memory with the extra mmap ${flags},
+** or return NULL. */
+static void*
+mem_map(size_t len, int flags)
+{
+  void* p;
+
+#ifdef MAP_NOCORE
+  flags |= MAP_NOCORE;
+#endif
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+           MAP_ANON | MAP_PRIVATE | flags, -1, 0);
+
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+/* Try to map ${len} bytes on huge pages into ${R}: explicitly from the
+** hugetlbfs pool, or else as a 2MB aligned mapping the kernel is asked
+** to back with transparent huge pages. Return 0 on success. */
+static int
+mem_map_huge(edsign_region* R, size_t len)
+{
+  size_t hlen = (len + MEM_HUGE - 1) & ~(MEM_HUGE - 1);
+  uint8_t* p;
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+  p = mem_map(hlen, MAP_HUGETLB | (MEM_HUGE_LOG2 << MAP_HUGE_SHIFT));
+  if (p != NULL) {
+    R->base = p;
+    R->len  = hlen;
+    mem_count(MEM_HUGETLB);
+    return 0;
+  }
+#endif
+
+#if defined(MADV_HUGEPAGE)
+  /* Over-map by a huge page, then trim to a 2MB aligned start, so the
+  ** kernel can back all of the region with huge pages. */
+  p = mem_map(hlen + MEM_HUGE, 0);
+  if (p != NULL) {
+    uint8_t* a = (uint8_t*)(((uintptr_t)p + MEM_HUGE - 1) & ~(MEM_HUGE - 1));
+    size_t head = a - p;
+
+    if (head > 0) munmap(p, head);
+    munmap(a + hlen, MEM_HUGE - head);
+
+    R->base = a;
+    R->len  = hlen;
+    if (madvise(a, hlen, MADV_HUGEPAGE) == 0) mem_count(MEM_THP);
+    else                                      mem_count(MEM_SMALL);
+    return 0;
+  }
+#endif
+
+  (void)hlen; (void)p;
+  return -1;
+}
+
+#endif /* !MAP_ANON */
+
+/**
+ * edsign_region_alloc(R, len):
+ * Allocate ${len} bytes, aligned to at least 64 bytes, for large and
+ * randomly accessed working memory, such as the V array of scrypt,
+ * and describe the allocation in ${R}. Depending on the flags set
+ * with edsign_set_memory_flags, the memory is backed by huge pages
+ * and placed on the caller's NUMA node where the OS allows, falling
+ * back to regular pages otherwise. Return NULL on error.
+ */
+EDSIGN_STATIC void*
+edsign_region_alloc(edsign_region* R, size_t len)
+{
+#if defined(MAP_ANON)
+  uint32_t flags = edsign_mem_flags;
+  uint8_t* p;
+
+  if (!(flags & EDSIGN_MEM_HUGEPAGES) || len < MEM_HUGE ||
+      len > SIZE_MAX - 2 * MEM_HUGE || mem_map_huge(R, len) != 0) {
+    if ((p = mem_map(len, 0)) == NULL) return NULL;
+    R->base = p;
+    R->len  = len;
+    mem_count(MEM_SMALL);
+  }
+
+  if ((flags & EDSIGN_MEM_NUMA_LOCAL) && mem_numa_local(R->base, R->len) == 0)
+    mem_count(MEM_NUMA_LOCAL);
+
+  return R->base;
+#else
+  if ((R->base = malloc(len + 63)) == NULL) return NULL;
+  R->len = len;
+  mem_count(MEM_HEAP);
+
+  return (void*)(((uintptr_t)R->base + 63) & ~(uintptr_t)63);
+#endif
+}
+
+/**
+ * edsign_region_free(R):
+ * Free the region ${R} from edsign_region_alloc. Return 0 on success,
+ * or -1 if unmapping failed.
+ */
+EDSIGN_STATIC int
+edsign_region_free(edsign_region* R)
+{
+#if defined(MAP_ANON)
+  return (munmap(R->base, R->len) == 0) ? 0 : -1;
+#else
+  free(R->base);
+  return 0;
+#endif
+}
+
+/**
+ * edsign_secure_alloc(R, len):
+ * Allocate ${len} bytes for long-lived secret key material, and
+ * describe the allocation in ${R}. Where the OS allows, the memory is
+ * locked into RAM, so it is never written to swap, and left out of
+ * core dumps; if the limit on locked memory is reached, it is used
+ * unlocked. Return NULL on error.
+ */
+EDSIGN_STATIC void*
+edsign_secure_alloc(edsign_region* R, size_t len)
+{
+#if defined(MAP_ANON)
+  if ((R->base = mem_map(len, 0)) == NULL) return NULL;
+  R->len = len;
+
+  (void)mlock(R->base, len);
+#if defined(MADV_DONTDUMP)
+  (void)madvise(R->base, len, MADV_DONTDUMP);
+#endif
+  return R->base;
+#else
+  if ((R->base = malloc(len)) == NULL) return NULL;
+  R->len = len;
+  return R->base;
+#endif
+}
+
+/**
+ * edsign_secure_free(R):
+ * Wipe and free the region ${R} from edsign_secure_alloc.
+ */
+EDSIGN_STATIC void
+edsign_secure_free(edsign_region* R)
+{
+  edsign_region r = *R; /* ${R} may lie in the region itself */
+
+  edsign_bzero(r.base, r.len);
+#if defined(MAP_ANON)
+  (void)munlock(r.base, r.len);
+  (void)munmap(r.base, r.len);
+#else
+  free(r.base);
+#endif
+}
+
+#undef MEM_HUGE_LOG2
+#undef MEM_HUGE
+#undef MEM_MPOL_PREFERRED
+#undef MEM_HUGETLB
+#undef MEM_THP
+#undef MEM_SMALL
+#undef MEM_HEAP
+#undef MEM_NUMA_LOCAL
@@ -0,0 +1,63 @@
+/*
+** Allocation of large working memory.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#ifndef _EDSIGN_MEM_H_
+#define _EDSIGN_MEM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A region from edsign_region_alloc: the address and length to hand
+** back to the OS, which may cover more than was asked for. */
+typedef struct edsign_region {
+  void*  base;
+  size_t len;
+} edsign_region;
+
+/**
+ * edsign_region_alloc(R, len):
+ * Allocate ${len} bytes, aligned to at least 64 bytes, for large and
+ * randomly accessed working memory, such as the V array of scrypt,
+ * and describe the allocation in ${R}. Depending on the flags set
+ * with edsign_set_memory_flags, the memory is backed by huge pages
+ * and placed on the caller's NUMA node where the OS allows, falling
+ * back to regular pages otherwise. Return NULL on error.
+ */
+EDSIGN_STATIC void*
+edsign_region_alloc(edsign_region* R, size_t len);
+
+/**
+ * edsign_region_free(R):
+ * Free the region ${R} from edsign_region_alloc. Return 0 on success,
+ * or -1 if unmapping failed.
+ */
+EDSIGN_STATIC int
+edsign_region_free(edsign_region* R);
+
+/**
+ * edsign_secure_alloc(R, len):
+ * Allocate ${len} bytes for long-lived secret key material, and
+ * describe the allocation in ${R}. Where the OS allows, the memory is
+ * locked into RAM, so it is never written to swap, and left out of
+ * core dumps; if the limit on locked memory is reached, it is used
+ * unlocked. Return NULL on error.
+ */
+EDSIGN_STATIC void*
+edsign_secure_alloc(edsign_region* R, size_t len);
+
+/**
+ * edsign_secure_free(R):
+ * Wipe and free the region ${R} from edsign_secure_alloc.
+ */
+EDSIGN_STATIC void
+edsign_secure_free(edsign_region* R);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* !_EDSIGN_MEM_H_ */
@@ -29,25 +29,53 @@ edsign_randombytes(uint8_t *x, uint64_t xlen)
 
 #else
 static int edsign_randomfd = -1;
+
+/* Return the descriptor of /dev/urandom, opening it on first use.
+** Threads racing to open it agree on the first one stored. */
+static int
+randomfd(void)
+{
+  int fd, expected = -1;
+
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+  fd = __atomic_load_n(&edsign_randomfd, __ATOMIC_ACQUIRE);
+#else
+  fd = *(volatile int*)&edsign_randomfd;
+#endif
+  if (fd != -1) return fd;
+
+  for (;;) {
+    fd = open("/dev/urandom",O_RDONLY);
+    if (fd != -1) break;
+    sleep(1);
+  }
+
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+  if (!__atomic_compare_exchange_n(&edsign_randomfd, &expected, fd, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    close(fd);
+    fd = expected;
+  }
+#else
+  (void)expected;
+  edsign_randomfd = fd;
+#endif
+  return fd;
+}
+
 EDSIGN_STATIC void
 edsign_randombytes(uint8_t *x, uint64_t xlen)
 {
-  int i;
+  int i, fd;
   if (xlen == 0) return;
   if (x == NULL) return;
 
-  if (edsign_randomfd == -1) {
-    for (;;) {
-      edsign_randomfd = open("/dev/urandom",O_RDONLY);
-      if (edsign_randomfd != -1) break;
-      sleep(1);
-    }
-  }
+  fd = randomfd();
 
   while (xlen > 0) {
     if (xlen < 1048576) i = xlen; else i = 1048576;
 
-    i = read(edsign_randomfd,x,i);
+    i = read(fd,x,i);
     if (i < 1) {
       sleep(1);
       continue;
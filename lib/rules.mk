@@ -1,3 +1,3 @@
-SRCS=util.c randombytes.c ed25519.c scrypt.c blake2.c keypair.c sign.c verify.c
+SRCS=util.c cpu.c thread.c mem.c randombytes.c sha512.c ed25519.c scrypt.c blake2.c argon2.c kdf.c keypair.c sign.c verify.c
 
 $(eval $(call c-objs,lib,$(SRCS)))
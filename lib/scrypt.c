@@ -8,6 +8,9 @@
 */
 
 #include "edsign-private.h"
+#include "cpu.h"
+#include "thread.h"
+#include "mem.h"
 #include "scrypt.h"
 
 static inline uint32_t
@@ -117,7 +120,7 @@ scrypt_be32dec_vect(uint32_t *dst, const unsigned char *src, size_t len)
  * the 512-bit input block to produce a new state.
  */
 static void
-scrypt_SHA256_Transform(uint32_t * state, const unsigned char block[64])
+scrypt_SHA256_Transform_ref(uint32_t * state, const unsigned char block[64])
 {
 	uint32_t W[64];
 	uint32_t S[8];
@@ -208,6 +211,129 @@ scrypt_SHA256_Transform(uint32_t * state, const unsigned char block[64])
 	t0 = t1 = 0;
 }
 
+#if defined(EDSIGN_X86_SIMD)
+
+/* SHA256 round constants, for the SHA extensions kernel below. */
+static const uint32_t scrypt_SHA256_K[64] ALIGNED(16) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* Four rounds i * 4 ... i * 4 + 3, using the message words in M. */
+#define QRND(M, i)							\
+	do {								\
+		T = _mm_add_epi32(M, _mm_load_si128(			\
+		    (const __m128i *)&scrypt_SHA256_K[4 * (i)]));	\
+		S1 = _mm_sha256rnds2_epu32(S1, S0, T);			\
+		T = _mm_shuffle_epi32(T, 0x0E);				\
+		S0 = _mm_sha256rnds2_epu32(S0, S1, T);			\
+	} while (0)
+
+/* Replace W[i .. i + 3] in M0 with W[i + 16 .. i + 19]. */
+#define QSCHED(M0, M1, M2, M3)						\
+	M0 = _mm_sha256msg2_epu32(_mm_add_epi32(			\
+	    _mm_sha256msg1_epu32(M0, M1), _mm_alignr_epi8(M3, M2, 4)), M3)
+
+/*
+ * SHA256 block compression function using the SHA extensions.  The
+ * sha256rnds2 instruction keeps the state as the halves ABEF and CDGH,
+ * so the state is shuffled into that order on entry and back on exit.
+ */
+static void TARGET("sha,sse4.1")
+scrypt_SHA256_Transform_shani(uint32_t * state,
+    const unsigned char block[64])
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i S0, S1, S0_save, S1_save, T;
+	__m128i M0, M1, M2, M3;
+
+	/* Load the state as ABEF and CDGH. */
+	T = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]),
+	    0xB1);
+	S1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]),
+	    0x1B);
+	S0 = _mm_alignr_epi8(T, S1, 8);
+	S1 = _mm_blend_epi16(S1, T, 0xF0);
+	S0_save = S0;
+	S1_save = S1;
+
+	/* Load the big-endian message words. */
+	M0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&block[0]),
+	    bswap);
+	M1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&block[16]),
+	    bswap);
+	M2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&block[32]),
+	    bswap);
+	M3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&block[48]),
+	    bswap);
+
+	/* 64 rounds, extending the message schedule as we go. */
+	QRND(M0, 0);
+	QRND(M1, 1);
+	QRND(M2, 2);
+	QRND(M3, 3);
+	QSCHED(M0, M1, M2, M3); QRND(M0, 4);
+	QSCHED(M1, M2, M3, M0); QRND(M1, 5);
+	QSCHED(M2, M3, M0, M1); QRND(M2, 6);
+	QSCHED(M3, M0, M1, M2); QRND(M3, 7);
+	QSCHED(M0, M1, M2, M3); QRND(M0, 8);
+	QSCHED(M1, M2, M3, M0); QRND(M1, 9);
+	QSCHED(M2, M3, M0, M1); QRND(M2, 10);
+	QSCHED(M3, M0, M1, M2); QRND(M3, 11);
+	QSCHED(M0, M1, M2, M3); QRND(M0, 12);
+	QSCHED(M1, M2, M3, M0); QRND(M1, 13);
+	QSCHED(M2, M3, M0, M1); QRND(M2, 14);
+	QSCHED(M3, M0, M1, M2); QRND(M3, 15);
+
+	/* Mix into the state, and store it back as ABCD and EFGH. */
+	S0 = _mm_add_epi32(S0, S0_save);
+	S1 = _mm_add_epi32(S1, S1_save);
+	T = _mm_shuffle_epi32(S0, 0x1B);
+	S1 = _mm_shuffle_epi32(S1, 0xB1);
+	S0 = _mm_blend_epi16(T, S1, 0xF0);
+	S1 = _mm_alignr_epi8(S1, T, 8);
+	_mm_storeu_si128((__m128i *)&state[0], S0);
+	_mm_storeu_si128((__m128i *)&state[4], S1);
+}
+
+#undef QRND
+#undef QSCHED
+
+#endif /* !EDSIGN_X86_SIMD */
+
+/*
+ * SHA256 block compression function, using the SHA extensions where the
+ * CPU has them.
+ */
+static void
+scrypt_SHA256_Transform(uint32_t * state, const unsigned char block[64])
+{
+
+#if defined(EDSIGN_X86_SIMD)
+	if (edsign_cpu_features() & EDSIGN_CPU_SHA) {
+		scrypt_SHA256_Transform_shani(state, block);
+		return;
+	}
+#endif
+
+	scrypt_SHA256_Transform_ref(state, block);
+}
+
 static unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -390,7 +516,7 @@ static void
 scrypt_PBKDF2_SHA256(const uint8_t * passwd, size_t passwdlen, const uint8_t * salt,
     size_t saltlen, uint64_t c, uint8_t * buf, size_t dkLen)
 {
-	scrypt_HMAC_SHA256_CTX PShctx, hctx;
+	scrypt_HMAC_SHA256_CTX Phctx, PShctx, hctx;
 	size_t i;
 	uint8_t ivec[4];
 	uint8_t U[32];
@@ -399,8 +525,12 @@ scrypt_PBKDF2_SHA256(const uint8_t * passwd, size_t passwdlen, const uint8_t * s
 	int k;
 	size_t clen;
 
-	/* Compute HMAC state after processing P and S. */
-	scrypt_HMAC_SHA256_Init(&PShctx, passwd, passwdlen);
+	/*
+	 * Compute HMAC state after processing P, which every U_j for j > 1
+	 * starts from, and after processing P and S, which U_1 starts from.
+	 */
+	scrypt_HMAC_SHA256_Init(&Phctx, passwd, passwdlen);
+	memcpy(&PShctx, &Phctx, sizeof(scrypt_HMAC_SHA256_CTX));
 	scrypt_HMAC_SHA256_Update(&PShctx, salt, saltlen);
 
 	/* Iterate through the blocks. */
@@ -418,7 +548,7 @@ scrypt_PBKDF2_SHA256(const uint8_t * passwd, size_t passwdlen, const uint8_t * s
 
 		for (j = 2; j <= c; j++) {
 			/* Compute U_j. */
-			scrypt_HMAC_SHA256_Init(&hctx, passwd, passwdlen);
+			memcpy(&hctx, &Phctx, sizeof(scrypt_HMAC_SHA256_CTX));
 			scrypt_HMAC_SHA256_Update(&hctx, U, 32);
 			scrypt_HMAC_SHA256_Final(U, &hctx);
 
@@ -434,7 +564,8 @@ scrypt_PBKDF2_SHA256(const uint8_t * passwd, size_t passwdlen, const uint8_t * s
 		memcpy(&buf[i * 32], T, clen);
 	}
 
-	/* Clean PShctx, since we never called _Final on it. */
+	/* Clean Phctx and PShctx, since we never called _Final on them. */
+	memset(&Phctx, 0, sizeof(scrypt_HMAC_SHA256_CTX));
 	memset(&PShctx, 0, sizeof(scrypt_HMAC_SHA256_CTX));
 }
 
@@ -454,7 +585,26 @@ static void blkxor(void *, void *, size_t);
 static void salsa20_8(uint32_t[16]);
 static void blockmix_salsa8(uint32_t *, uint32_t *, uint32_t *, size_t);
 static uint64_t integerify(void *, size_t);
-static void smix(uint8_t *, size_t, uint64_t, uint32_t *, uint32_t *);
+static void smix_ref(uint8_t *, size_t, uint64_t, uint32_t *, uint32_t *,
+    const struct scrypt_stop *);
+static void smix(uint8_t *, size_t, uint64_t, uint32_t *, uint32_t *,
+    const struct scrypt_stop *);
+
+/* How many BlockMix calls the smix loops make between polls of ${S}. */
+#define SCRYPT_STOP_INTERVAL 256
+
+/**
+ * scrypt_stopped(S, i):
+ * Return nonzero if ${S} is not NULL, iteration ${i} of an smix loop is due
+ * to poll it, and it asks for the computation to stop.
+ */
+static inline int
+scrypt_stopped(const struct scrypt_stop * S, uint64_t i)
+{
+
+	return ((S != NULL) && ((i & (SCRYPT_STOP_INTERVAL - 1)) == 0) &&
+	    S->fn(S->arg));
+}
 
 static void
 blkcpy(void * dest, void * src, size_t len)
@@ -571,15 +721,17 @@ integerify(void * B, size_t r)
 }
 
 /**
- * smix(B, r, N, V, XY):
+ * smix_ref(B, r, N, V, XY):
  * Compute B = SMix_r(B, N).  The input B must be 128r bytes in length;
  * the temporary storage V must be 128rN bytes in length; the temporary
  * storage XY must be 256r + 64 bytes in length.  The value N must be a
  * power of 2 greater than 1.  The arrays B, V, and XY must be aligned to a
- * multiple of 64 bytes.
+ * multiple of 64 bytes.  If ${S} asks to stop, return early, leaving B
+ * undefined.
  */
 static void
-smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
+smix_ref(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY,
+    const struct scrypt_stop * S)
 {
 	uint32_t * X = XY;
 	uint32_t * Y = &XY[32 * r];
@@ -594,6 +746,9 @@ smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
 
 	/* 2: for i = 0 to N - 1 do */
 	for (i = 0; i < N; i += 2) {
+		if (scrypt_stopped(S, i))
+			return;
+
 		/* 3: V_i <-- X */
 		blkcpy(&V[i * (32 * r)], X, 128 * r);
 
@@ -609,6 +764,9 @@ smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
 
 	/* 6: for i = 0 to N - 1 do */
 	for (i = 0; i < N; i += 2) {
+		if (scrypt_stopped(S, i))
+			return;
+
 		/* 7: j <-- Integerify(X) mod N */
 		j = integerify(X, r) & (N - 1);
 
@@ -629,40 +787,853 @@ smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
 		scrypt_le32enc(&B[4 * k], X[k]);
 }
 
-/**
- * crypto_scrypt(passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen):
- * Compute scrypt(passwd[0 .. passwdlen - 1], salt[0 .. saltlen - 1], N, r,
- * p, buflen) and write the result into buf.  The parameters r, p, and buflen
- * must satisfy r * p < 2^30 and buflen <= (2^32 - 1) * 32.  The parameter N
- * must be a power of 2 greater than 1.
+/* -------------------------------------------------------------------------- */
+/* -- SIMD ------------------------------------------------------------------ */
+
+#if defined(EDSIGN_X86_SIMD)
+
+/*
+ * The SIMD kernels keep every 64-byte salsa20 block in the diagonal
+ * order used by crypto_scrypt-sse.c in scrypt 1.1.6: position m of a
+ * block holds word (m * 5) mod 16.  The column and row rounds of
+ * salsa20/8 then work on whole rows of four words, with a shuffle in
+ * between.  smix_simd_enter converts B into this layout and
+ * smix_simd_leave converts it back.
  *
- * Return 0 on success; or -1 on error.
+ * A single salsa20/8 chain is bound by the latency of its rounds, and
+ * the random reads of V_j in the second smix loop stall on memory.
+ * Both are hidden by running several independent lanes at once: the
+ * x2 kernels interleave two chains of 128-bit rows, and the AVX2 x4
+ * kernel packs two lanes into each 256-bit row and interleaves two
+ * such chains.  Once every lane knows its next j, the whole of each
+ * V_j is prefetched, so the misses of all lanes overlap.
+ *
+ * The 128-bit kernels are written with SSE2 intrinsics and inlined
+ * into an SSE2 and an AVX2 entry point.  In the AVX2 one the compiler
+ * emits three-operand VEX code, which avoids the register copies the
+ * SSE2 encoding needs between the rotate halves.
  */
-EDSIGN_STATIC int
-crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
-    const uint8_t * salt, size_t saltlen, uint64_t N, uint32_t r, uint32_t p,
-    uint8_t * buf, size_t buflen)
+
+/* Row operations of the salsa20/8 double round below, for 128-bit rows
+** holding one lane and 256-bit rows holding two. */
+#define v128_add  _mm_add_epi32
+#define v128_xor  _mm_xor_si128
+#define v128_sll  _mm_slli_epi32
+#define v128_srl  _mm_srli_epi32
+#define v128_shuf _mm_shuffle_epi32
+#define v256_add  _mm256_add_epi32
+#define v256_xor  _mm256_xor_si256
+#define v256_sll  _mm256_slli_epi32
+#define v256_srl  _mm256_srli_epi32
+#define v256_shuf _mm256_shuffle_epi32
+
+/* x ^= t <<< c */
+#define SALSA_R(V,x,t,c) \
+	x = V##_xor(x, V##_sll(t, c)); \
+	x = V##_xor(x, V##_srl(t, 32 - (c)));
+
+/* One salsa20 double round on the shuffled rows X0 ... X3. */
+#define SALSA_DOUBLEROUND(V,X0,X1,X2,X3,T) \
+	/* Operate on "columns". */ \
+	T = V##_add(X0, X3); SALSA_R(V, X1, T,  7) \
+	T = V##_add(X1, X0); SALSA_R(V, X2, T,  9) \
+	T = V##_add(X2, X1); SALSA_R(V, X3, T, 13) \
+	T = V##_add(X3, X2); SALSA_R(V, X0, T, 18) \
+	\
+	/* Rearrange data. */ \
+	X1 = V##_shuf(X1, 0x93); \
+	X2 = V##_shuf(X2, 0x4E); \
+	X3 = V##_shuf(X3, 0x39); \
+	\
+	/* Operate on "rows". */ \
+	T = V##_add(X0, X1); SALSA_R(V, X3, T,  7) \
+	T = V##_add(X3, X0); SALSA_R(V, X2, T,  9) \
+	T = V##_add(X2, X3); SALSA_R(V, X1, T, 13) \
+	T = V##_add(X1, X2); SALSA_R(V, X0, T, 18) \
+	\
+	/* Rearrange data. */ \
+	X1 = V##_shuf(X1, 0x39); \
+	X2 = V##_shuf(X2, 0x4E); \
+	X3 = V##_shuf(X3, 0x93);
+
+/**
+ * salsa20_8_simd(X0, X1, X2, X3):
+ * Apply the salsa20/8 core to the shuffled block held in the rows
+ * *X0 ... *X3.  Once inlined the rows stay in registers.
+ */
+static inline FORCE_INLINE void
+salsa20_8_simd(__m128i * X0, __m128i * X1, __m128i * X2, __m128i * X3)
+{
+	__m128i Y0 = *X0, Y1 = *X1, Y2 = *X2, Y3 = *X3;
+	__m128i T;
+	size_t i;
+
+	for (i = 0; i < 8; i += 2) {
+		SALSA_DOUBLEROUND(v128, Y0, Y1, Y2, Y3, T)
+	}
+
+	*X0 = _mm_add_epi32(*X0, Y0);
+	*X1 = _mm_add_epi32(*X1, Y1);
+	*X2 = _mm_add_epi32(*X2, Y2);
+	*X3 = _mm_add_epi32(*X3, Y3);
+}
+
+/**
+ * blockmix_salsa8_simd(Bin, Bxor, Bout, r):
+ * Compute Bout = BlockMix_{salsa20/8, r}(Bin), or BlockMix of
+ * (Bin \xor Bxor) if Bxor is not NULL.  Folding the xor into the
+ * blockmix saves smix a separate pass over the 128r bytes.  X stays in
+ * registers throughout, so no temporary space is needed.
+ */
+static inline FORCE_INLINE void
+blockmix_salsa8_simd(const __m128i * Bin, const __m128i * Bxor,
+    __m128i * Bout, size_t r)
 {
-	void * B0, * V0, * XY0;
+	__m128i X0, X1, X2, X3;
+	const __m128i * P;
+	__m128i * Q;
+	size_t i;
+
+	/* 1: X <-- B_{2r - 1} */
+	P = &Bin[(2 * r - 1) * 4];
+	X0 = P[0];
+	X1 = P[1];
+	X2 = P[2];
+	X3 = P[3];
+	if (Bxor != NULL) {
+		P = &Bxor[(2 * r - 1) * 4];
+		X0 = _mm_xor_si128(X0, P[0]);
+		X1 = _mm_xor_si128(X1, P[1]);
+		X2 = _mm_xor_si128(X2, P[2]);
+		X3 = _mm_xor_si128(X3, P[3]);
+	}
+
+	/* 2: for i = 0 to 2r - 1 do */
+	for (i = 0; i < 2 * r; i++) {
+		/* 3: X <-- H(X \xor B_i) */
+		P = &Bin[i * 4];
+		X0 = _mm_xor_si128(X0, P[0]);
+		X1 = _mm_xor_si128(X1, P[1]);
+		X2 = _mm_xor_si128(X2, P[2]);
+		X3 = _mm_xor_si128(X3, P[3]);
+		if (Bxor != NULL) {
+			P = &Bxor[i * 4];
+			X0 = _mm_xor_si128(X0, P[0]);
+			X1 = _mm_xor_si128(X1, P[1]);
+			X2 = _mm_xor_si128(X2, P[2]);
+			X3 = _mm_xor_si128(X3, P[3]);
+		}
+		salsa20_8_simd(&X0, &X1, &X2, &X3);
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		Q = &Bout[((i / 2) + (i & 1) * r) * 4];
+		Q[0] = X0;
+		Q[1] = X1;
+		Q[2] = X2;
+		Q[3] = X3;
+	}
+}
+
+/**
+ * integerify_simd(B, r):
+ * Return the result of parsing B_{2r-1} as a little-endian integer.
+ * Words 0 and 1 of the shuffled block are at positions 0 and 13.
+ */
+static inline FORCE_INLINE uint64_t
+integerify_simd(const __m128i * B, size_t r)
+{
+	const uint32_t * X = (const void *)&B[(2 * r - 1) * 4];
+
+	return (((uint64_t)(X[13]) << 32) + X[0]);
+}
+
+/**
+ * smix_simd_enter(B, r, X, V):
+ * 1: X <-- B, converting B to the shuffled layout, and store X as V_0.
+ */
+static inline FORCE_INLINE void
+smix_simd_enter(const uint8_t * B, size_t r, __m128i * X, __m128i * V)
+{
+	uint32_t * X32 = (void *)X;
+	size_t k, m;
+
+	for (k = 0; k < 2 * r; k++) {
+		for (m = 0; m < 16; m++) {
+			X32[k * 16 + m] =
+			    scrypt_le32dec(&B[(k * 16 + (m * 5 % 16)) * 4]);
+		}
+	}
+	for (k = 0; k < 8 * r; k++)
+		V[k] = X[k];
+}
+
+/**
+ * smix_simd_leave(B, r, X):
+ * 10: B' <-- X, converting X back to the normal layout.
+ */
+static inline FORCE_INLINE void
+smix_simd_leave(uint8_t * B, size_t r, const __m128i * X)
+{
+	const uint32_t * X32 = (const void *)X;
+	size_t k, m;
+
+	for (k = 0; k < 2 * r; k++) {
+		for (m = 0; m < 16; m++) {
+			scrypt_le32enc(&B[(k * 16 + (m * 5 % 16)) * 4],
+			    X32[k * 16 + m]);
+		}
+	}
+}
+
+/**
+ * prefetch_block(P, r):
+ * Prefetch the 128r bytes at P, one 64-byte cache line at a time.
+ */
+static inline FORCE_INLINE void
+prefetch_block(const __m128i * P, size_t r)
+{
+	size_t k;
+
+	for (k = 0; k < 2 * r; k++)
+		__builtin_prefetch(&P[k * 4]);
+}
+
+/**
+ * smix_simd(B, r, N, V, XY):
+ * Compute B = SMix_r(B, N), with the same requirements on the
+ * arguments as smix_ref.  Each V_i is written by the blockmix that
+ * produces it, and the second loop folds the xor with V_j into the
+ * blockmix, so neither loop copies whole blocks around.
+ */
+static inline FORCE_INLINE void
+smix_simd(uint8_t * B, size_t r, uint64_t N, __m128i * V, __m128i * XY,
+    const struct scrypt_stop * S)
+{
+	__m128i * X = XY;
+	__m128i * Y = &XY[8 * r];
+	uint64_t i;
+	uint64_t j;
+
+	/* 1: X <-- B */
+	smix_simd_enter(B, r, X, V);
+
+	/* 2: for i = 0 to N - 1 do */
+	/* 3: V_i <-- X; 4: X <-- H(X) */
+	for (i = 0; i < N - 1; i++) {
+		if (scrypt_stopped(S, i))
+			return;
+		blockmix_salsa8_simd(&V[i * (8 * r)], NULL,
+		    &V[(i + 1) * (8 * r)], r);
+	}
+	blockmix_salsa8_simd(&V[(N - 1) * (8 * r)], NULL, X, r);
+
+	/* 6: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		if (scrypt_stopped(S, i))
+			return;
+
+		/* 7: j <-- Integerify(X) mod N */
+		j = integerify_simd(X, r) & (N - 1);
+
+		/* 8: X <-- H(X \xor V_j) */
+		blockmix_salsa8_simd(X, &V[j * (8 * r)], Y, r);
+
+		/* 7: j <-- Integerify(X) mod N */
+		j = integerify_simd(Y, r) & (N - 1);
+
+		/* 8: X <-- H(X \xor V_j) */
+		blockmix_salsa8_simd(Y, &V[j * (8 * r)], X, r);
+	}
+
+	/* 10: B' <-- X */
+	smix_simd_leave(B, r, X);
+}
+
+/**
+ * salsa20_8_x2(A0, ..., A3, B0, ..., B3):
+ * Apply the salsa20/8 core to the two independent shuffled blocks held
+ * in the rows *A0 ... *A3 and *B0 ... *B3.
+ */
+static inline FORCE_INLINE void
+salsa20_8_x2(__m128i * A0, __m128i * A1, __m128i * A2, __m128i * A3,
+    __m128i * B0, __m128i * B1, __m128i * B2, __m128i * B3)
+{
+	__m128i X0 = *A0, X1 = *A1, X2 = *A2, X3 = *A3;
+	__m128i Y0 = *B0, Y1 = *B1, Y2 = *B2, Y3 = *B3;
+	__m128i T, U;
+	size_t i;
+
+	for (i = 0; i < 8; i += 2) {
+		SALSA_DOUBLEROUND(v128, X0, X1, X2, X3, T)
+		SALSA_DOUBLEROUND(v128, Y0, Y1, Y2, Y3, U)
+	}
+
+	*A0 = _mm_add_epi32(*A0, X0);
+	*A1 = _mm_add_epi32(*A1, X1);
+	*A2 = _mm_add_epi32(*A2, X2);
+	*A3 = _mm_add_epi32(*A3, X3);
+	*B0 = _mm_add_epi32(*B0, Y0);
+	*B1 = _mm_add_epi32(*B1, Y1);
+	*B2 = _mm_add_epi32(*B2, Y2);
+	*B3 = _mm_add_epi32(*B3, Y3);
+}
+
+/**
+ * blockmix_salsa8_x2(Bin, Bxor, Bout, r):
+ * Run blockmix_salsa8_simd on two independent lanes at once: for each
+ * lane l, compute Bout[l] = BlockMix(Bin[l]), or BlockMix of
+ * (Bin[l] \xor Bxor[l]) if Bxor is not NULL.
+ */
+static inline FORCE_INLINE void
+blockmix_salsa8_x2(const __m128i * const Bin[2],
+    const __m128i * const Bxor[2], __m128i * const Bout[2], size_t r)
+{
+	__m128i A0, A1, A2, A3, B0, B1, B2, B3;
+	const __m128i * P;
+	const __m128i * Q;
+	__m128i * O;
+	size_t i;
+
+	/* 1: X <-- B_{2r - 1} */
+	P = &Bin[0][(2 * r - 1) * 4];
+	Q = &Bin[1][(2 * r - 1) * 4];
+	A0 = P[0]; A1 = P[1]; A2 = P[2]; A3 = P[3];
+	B0 = Q[0]; B1 = Q[1]; B2 = Q[2]; B3 = Q[3];
+	if (Bxor != NULL) {
+		P = &Bxor[0][(2 * r - 1) * 4];
+		Q = &Bxor[1][(2 * r - 1) * 4];
+		A0 = _mm_xor_si128(A0, P[0]); A1 = _mm_xor_si128(A1, P[1]);
+		A2 = _mm_xor_si128(A2, P[2]); A3 = _mm_xor_si128(A3, P[3]);
+		B0 = _mm_xor_si128(B0, Q[0]); B1 = _mm_xor_si128(B1, Q[1]);
+		B2 = _mm_xor_si128(B2, Q[2]); B3 = _mm_xor_si128(B3, Q[3]);
+	}
+
+	/* 2: for i = 0 to 2r - 1 do */
+	for (i = 0; i < 2 * r; i++) {
+		/* 3: X <-- H(X \xor B_i) */
+		P = &Bin[0][i * 4];
+		Q = &Bin[1][i * 4];
+		A0 = _mm_xor_si128(A0, P[0]); A1 = _mm_xor_si128(A1, P[1]);
+		A2 = _mm_xor_si128(A2, P[2]); A3 = _mm_xor_si128(A3, P[3]);
+		B0 = _mm_xor_si128(B0, Q[0]); B1 = _mm_xor_si128(B1, Q[1]);
+		B2 = _mm_xor_si128(B2, Q[2]); B3 = _mm_xor_si128(B3, Q[3]);
+		if (Bxor != NULL) {
+			P = &Bxor[0][i * 4];
+			Q = &Bxor[1][i * 4];
+			A0 = _mm_xor_si128(A0, P[0]); A1 = _mm_xor_si128(A1, P[1]);
+			A2 = _mm_xor_si128(A2, P[2]); A3 = _mm_xor_si128(A3, P[3]);
+			B0 = _mm_xor_si128(B0, Q[0]); B1 = _mm_xor_si128(B1, Q[1]);
+			B2 = _mm_xor_si128(B2, Q[2]); B3 = _mm_xor_si128(B3, Q[3]);
+		}
+		salsa20_8_x2(&A0, &A1, &A2, &A3, &B0, &B1, &B2, &B3);
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		O = &Bout[0][((i / 2) + (i & 1) * r) * 4];
+		O[0] = A0; O[1] = A1; O[2] = A2; O[3] = A3;
+		O = &Bout[1][((i / 2) + (i & 1) * r) * 4];
+		O[0] = B0; O[1] = B1; O[2] = B2; O[3] = B3;
+	}
+}
+
+/**
+ * smix_x2_simd(B, r, N, V, XY):
+ * Compute B[l] = SMix_r(B[l], N) for the two lanes l = 0, 1, using
+ * V[l] and XY[l], interleaving the lanes as described above.
+ */
+static inline FORCE_INLINE void
+smix_x2_simd(uint8_t * const B[2], size_t r, uint64_t N,
+    __m128i * const V[2], __m128i * const XY[2], const struct scrypt_stop * S)
+{
+	__m128i * X[2] = { XY[0], XY[1] };
+	__m128i * Y[2] = { &XY[0][8 * r], &XY[1][8 * r] };
+	const __m128i * Vin[2];
+	__m128i * Vout[2];
+	uint64_t i;
+	size_t l;
+
+	/* 1: X <-- B */
+	for (l = 0; l < 2; l++)
+		smix_simd_enter(B[l], r, X[l], V[l]);
+
+	/* 2: for i = 0 to N - 1 do */
+	/* 3: V_i <-- X; 4: X <-- H(X) */
+	for (i = 0; i < N; i++) {
+		if (scrypt_stopped(S, i))
+			return;
+		for (l = 0; l < 2; l++) {
+			Vin[l] = &V[l][i * (8 * r)];
+			Vout[l] = (i < N - 1) ? &V[l][(i + 1) * (8 * r)] : X[l];
+		}
+		blockmix_salsa8_x2(Vin, NULL, Vout, r);
+	}
+
+	/* 6: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		if (scrypt_stopped(S, i))
+			return;
+
+		/* 7: j <-- Integerify(X) mod N */
+		for (l = 0; l < 2; l++) {
+			Vin[l] = &V[l][(integerify_simd(X[l], r) & (N - 1)) * (8 * r)];
+			prefetch_block(Vin[l], r);
+		}
+
+		/* 8: X <-- H(X \xor V_j) */
+		blockmix_salsa8_x2((const __m128i * const *)X, Vin, Y, r);
+
+		/* 7: j <-- Integerify(X) mod N */
+		for (l = 0; l < 2; l++) {
+			Vin[l] = &V[l][(integerify_simd(Y[l], r) & (N - 1)) * (8 * r)];
+			prefetch_block(Vin[l], r);
+		}
+
+		/* 8: X <-- H(X \xor V_j) */
+		blockmix_salsa8_x2((const __m128i * const *)Y, Vin, X, r);
+	}
+
+	/* 10: B' <-- X */
+	for (l = 0; l < 2; l++)
+		smix_simd_leave(B[l], r, X[l]);
+}
+
+/* Load row k of the blocks at P and Q into the halves of a 256-bit row,
+** and store it back. */
+#define LOAD2(P,Q,k) \
+	_mm256_inserti128_si256(_mm256_castsi128_si256((P)[k]), (Q)[k], 1)
+#define STORE2(P,Q,k,x) \
+	(P)[k] = _mm256_castsi256_si128(x); \
+	(Q)[k] = _mm256_extracti128_si256(x, 1);
+
+/**
+ * salsa20_8_x4_avx2(A0, ..., A3, B0, ..., B3):
+ * Apply the salsa20/8 core to four independent shuffled blocks, two
+ * held in the 256-bit rows *A0 ... *A3 and two in *B0 ... *B3.
+ */
+static inline FORCE_INLINE void TARGET("avx2")
+salsa20_8_x4_avx2(__m256i * A0, __m256i * A1, __m256i * A2, __m256i * A3,
+    __m256i * B0, __m256i * B1, __m256i * B2, __m256i * B3)
+{
+	__m256i X0 = *A0, X1 = *A1, X2 = *A2, X3 = *A3;
+	__m256i Y0 = *B0, Y1 = *B1, Y2 = *B2, Y3 = *B3;
+	__m256i T, U;
+	size_t i;
+
+	for (i = 0; i < 8; i += 2) {
+		SALSA_DOUBLEROUND(v256, X0, X1, X2, X3, T)
+		SALSA_DOUBLEROUND(v256, Y0, Y1, Y2, Y3, U)
+	}
+
+	*A0 = _mm256_add_epi32(*A0, X0);
+	*A1 = _mm256_add_epi32(*A1, X1);
+	*A2 = _mm256_add_epi32(*A2, X2);
+	*A3 = _mm256_add_epi32(*A3, X3);
+	*B0 = _mm256_add_epi32(*B0, Y0);
+	*B1 = _mm256_add_epi32(*B1, Y1);
+	*B2 = _mm256_add_epi32(*B2, Y2);
+	*B3 = _mm256_add_epi32(*B3, Y3);
+}
+
+/**
+ * blockmix_salsa8_x4_avx2(Bin, Bxor, Bout, r):
+ * Run blockmix_salsa8_simd on four independent lanes at once, with
+ * lanes 0 and 1 in the halves of one set of 256-bit rows and lanes 2
+ * and 3 in another.
+ */
+static inline FORCE_INLINE void TARGET("avx2")
+blockmix_salsa8_x4_avx2(const __m128i * const Bin[4],
+    const __m128i * const Bxor[4], __m128i * const Bout[4], size_t r)
+{
+	__m256i A0, A1, A2, A3, B0, B1, B2, B3;
+	size_t i, o;
+
+	/* 1: X <-- B_{2r - 1} */
+	o = (2 * r - 1) * 4;
+	A0 = LOAD2(&Bin[0][o], &Bin[1][o], 0);
+	A1 = LOAD2(&Bin[0][o], &Bin[1][o], 1);
+	A2 = LOAD2(&Bin[0][o], &Bin[1][o], 2);
+	A3 = LOAD2(&Bin[0][o], &Bin[1][o], 3);
+	B0 = LOAD2(&Bin[2][o], &Bin[3][o], 0);
+	B1 = LOAD2(&Bin[2][o], &Bin[3][o], 1);
+	B2 = LOAD2(&Bin[2][o], &Bin[3][o], 2);
+	B3 = LOAD2(&Bin[2][o], &Bin[3][o], 3);
+	if (Bxor != NULL) {
+		A0 = _mm256_xor_si256(A0, LOAD2(&Bxor[0][o], &Bxor[1][o], 0));
+		A1 = _mm256_xor_si256(A1, LOAD2(&Bxor[0][o], &Bxor[1][o], 1));
+		A2 = _mm256_xor_si256(A2, LOAD2(&Bxor[0][o], &Bxor[1][o], 2));
+		A3 = _mm256_xor_si256(A3, LOAD2(&Bxor[0][o], &Bxor[1][o], 3));
+		B0 = _mm256_xor_si256(B0, LOAD2(&Bxor[2][o], &Bxor[3][o], 0));
+		B1 = _mm256_xor_si256(B1, LOAD2(&Bxor[2][o], &Bxor[3][o], 1));
+		B2 = _mm256_xor_si256(B2, LOAD2(&Bxor[2][o], &Bxor[3][o], 2));
+		B3 = _mm256_xor_si256(B3, LOAD2(&Bxor[2][o], &Bxor[3][o], 3));
+	}
+
+	/* 2: for i = 0 to 2r - 1 do */
+	for (i = 0; i < 2 * r; i++) {
+		/* 3: X <-- H(X \xor B_i) */
+		o = i * 4;
+		A0 = _mm256_xor_si256(A0, LOAD2(&Bin[0][o], &Bin[1][o], 0));
+		A1 = _mm256_xor_si256(A1, LOAD2(&Bin[0][o], &Bin[1][o], 1));
+		A2 = _mm256_xor_si256(A2, LOAD2(&Bin[0][o], &Bin[1][o], 2));
+		A3 = _mm256_xor_si256(A3, LOAD2(&Bin[0][o], &Bin[1][o], 3));
+		B0 = _mm256_xor_si256(B0, LOAD2(&Bin[2][o], &Bin[3][o], 0));
+		B1 = _mm256_xor_si256(B1, LOAD2(&Bin[2][o], &Bin[3][o], 1));
+		B2 = _mm256_xor_si256(B2, LOAD2(&Bin[2][o], &Bin[3][o], 2));
+		B3 = _mm256_xor_si256(B3, LOAD2(&Bin[2][o], &Bin[3][o], 3));
+		if (Bxor != NULL) {
+			A0 = _mm256_xor_si256(A0, LOAD2(&Bxor[0][o], &Bxor[1][o], 0));
+			A1 = _mm256_xor_si256(A1, LOAD2(&Bxor[0][o], &Bxor[1][o], 1));
+			A2 = _mm256_xor_si256(A2, LOAD2(&Bxor[0][o], &Bxor[1][o], 2));
+			A3 = _mm256_xor_si256(A3, LOAD2(&Bxor[0][o], &Bxor[1][o], 3));
+			B0 = _mm256_xor_si256(B0, LOAD2(&Bxor[2][o], &Bxor[3][o], 0));
+			B1 = _mm256_xor_si256(B1, LOAD2(&Bxor[2][o], &Bxor[3][o], 1));
+			B2 = _mm256_xor_si256(B2, LOAD2(&Bxor[2][o], &Bxor[3][o], 2));
+			B3 = _mm256_xor_si256(B3, LOAD2(&Bxor[2][o], &Bxor[3][o], 3));
+		}
+		salsa20_8_x4_avx2(&A0, &A1, &A2, &A3, &B0, &B1, &B2, &B3);
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		o = ((i / 2) + (i & 1) * r) * 4;
+		STORE2(&Bout[0][o], &Bout[1][o], 0, A0)
+		STORE2(&Bout[0][o], &Bout[1][o], 1, A1)
+		STORE2(&Bout[0][o], &Bout[1][o], 2, A2)
+		STORE2(&Bout[0][o], &Bout[1][o], 3, A3)
+		STORE2(&Bout[2][o], &Bout[3][o], 0, B0)
+		STORE2(&Bout[2][o], &Bout[3][o], 1, B1)
+		STORE2(&Bout[2][o], &Bout[3][o], 2, B2)
+		STORE2(&Bout[2][o], &Bout[3][o], 3, B3)
+	}
+}
+
+/**
+ * smix_x4_avx2_body(B, r, N, V, XY):
+ * Compute B[l] = SMix_r(B[l], N) for the four lanes l = 0 ... 3, using
+ * V[l] and XY[l].  This is smix_x2_simd with the x4 blockmix.
+ */
+static inline FORCE_INLINE void TARGET("avx2")
+smix_x4_avx2_body(uint8_t * const B[4], size_t r, uint64_t N,
+    __m128i * const V[4], __m128i * const XY[4], const struct scrypt_stop * S)
+{
+	__m128i * X[4] = { XY[0], XY[1], XY[2], XY[3] };
+	__m128i * Y[4] = { &XY[0][8 * r], &XY[1][8 * r],
+	    &XY[2][8 * r], &XY[3][8 * r] };
+	const __m128i * Vin[4];
+	__m128i * Vout[4];
+	uint64_t i;
+	size_t l;
+
+	/* 1: X <-- B */
+	for (l = 0; l < 4; l++)
+		smix_simd_enter(B[l], r, X[l], V[l]);
+
+	/* 2: for i = 0 to N - 1 do */
+	/* 3: V_i <-- X; 4: X <-- H(X) */
+	for (i = 0; i < N; i++) {
+		if (scrypt_stopped(S, i))
+			return;
+		for (l = 0; l < 4; l++) {
+			Vin[l] = &V[l][i * (8 * r)];
+			Vout[l] = (i < N - 1) ? &V[l][(i + 1) * (8 * r)] : X[l];
+		}
+		blockmix_salsa8_x4_avx2(Vin, NULL, Vout, r);
+	}
+
+	/* 6: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		if (scrypt_stopped(S, i))
+			return;
+
+		/* 7: j <-- Integerify(X) mod N */
+		for (l = 0; l < 4; l++) {
+			Vin[l] = &V[l][(integerify_simd(X[l], r) & (N - 1)) * (8 * r)];
+			prefetch_block(Vin[l], r);
+		}
+
+		/* 8: X <-- H(X \xor V_j) */
+		blockmix_salsa8_x4_avx2((const __m128i * const *)X, Vin, Y, r);
+
+		/* 7: j <-- Integerify(X) mod N */
+		for (l = 0; l < 4; l++) {
+			Vin[l] = &V[l][(integerify_simd(Y[l], r) & (N - 1)) * (8 * r)];
+			prefetch_block(Vin[l], r);
+		}
+
+		/* 8: X <-- H(X \xor V_j) */
+		blockmix_salsa8_x4_avx2((const __m128i * const *)Y, Vin, X, r);
+	}
+
+	/* 10: B' <-- X */
+	for (l = 0; l < 4; l++)
+		smix_simd_leave(B[l], r, X[l]);
+}
+
+#undef LOAD2
+#undef STORE2
+
+/*
+ * The entry points give the compiler a constant r for the usual r = 8
+ * (see edsign_keypair), which lets it unroll the blockmix loops
+ * completely; other values of r take the generic loops.
+ */
+static void
+smix_sse2(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY,
+    const struct scrypt_stop * S)
+{
+	if (r == 8)
+		smix_simd(B, 8, N, (__m128i *)V, (__m128i *)XY, S);
+	else
+		smix_simd(B, r, N, (__m128i *)V, (__m128i *)XY, S);
+}
+
+static void TARGET("avx2")
+smix_avx2(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY,
+    const struct scrypt_stop * S)
+{
+	if (r == 8)
+		smix_simd(B, 8, N, (__m128i *)V, (__m128i *)XY, S);
+	else
+		smix_simd(B, r, N, (__m128i *)V, (__m128i *)XY, S);
+}
+
+static void
+smix_x2_sse2(uint8_t * const B[2], size_t r, uint64_t N,
+    uint32_t * const V[2], uint32_t * const XY[2],
+    const struct scrypt_stop * S)
+{
+	if (r == 8)
+		smix_x2_simd(B, 8, N, (__m128i * const *)V,
+		    (__m128i * const *)XY, S);
+	else
+		smix_x2_simd(B, r, N, (__m128i * const *)V,
+		    (__m128i * const *)XY, S);
+}
+
+static void TARGET("avx2")
+smix_x2_avx2(uint8_t * const B[2], size_t r, uint64_t N,
+    uint32_t * const V[2], uint32_t * const XY[2],
+    const struct scrypt_stop * S)
+{
+	if (r == 8)
+		smix_x2_simd(B, 8, N, (__m128i * const *)V,
+		    (__m128i * const *)XY, S);
+	else
+		smix_x2_simd(B, r, N, (__m128i * const *)V,
+		    (__m128i * const *)XY, S);
+}
+
+static void TARGET("avx2")
+smix_x4_avx2(uint8_t * const B[4], size_t r, uint64_t N,
+    uint32_t * const V[4], uint32_t * const XY[4],
+    const struct scrypt_stop * S)
+{
+	if (r == 8)
+		smix_x4_avx2_body(B, 8, N, (__m128i * const *)V,
+		    (__m128i * const *)XY, S);
+	else
+		smix_x4_avx2_body(B, r, N, (__m128i * const *)V,
+		    (__m128i * const *)XY, S);
+}
+
+#undef SALSA_DOUBLEROUND
+#undef SALSA_R
+#undef v128_add
+#undef v128_xor
+#undef v128_sll
+#undef v128_srl
+#undef v128_shuf
+#undef v256_add
+#undef v256_xor
+#undef v256_sll
+#undef v256_srl
+#undef v256_shuf
+
+#endif /* !EDSIGN_X86_SIMD */
+
+/* -------------------------------------------------------------------------- */
+/* -- Dispatch -------------------------------------------------------------- */
+
+/**
+ * smix(B, r, N, V, XY, S):
+ * Compute B = SMix_r(B, N) with the fastest kernel the CPU supports.
+ * The requirements on the arguments are those of smix_ref.
+ */
+static void
+smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY,
+    const struct scrypt_stop * S)
+{
+#if defined(EDSIGN_X86_SIMD)
+	uint32_t cpu = edsign_cpu_features();
+
+	if (cpu & EDSIGN_CPU_AVX2) {
+		smix_avx2(B, r, N, V, XY, S);
+		return;
+	}
+	if (cpu & EDSIGN_CPU_SSE2) {
+		smix_sse2(B, r, N, V, XY, S);
+		return;
+	}
+#endif
+
+	smix_ref(B, r, N, V, XY, S);
+}
+
+/* Most lanes a single thread interleaves; see smix_lanes. */
+#define SCRYPT_MAX_INTERLEAVE 4
+
+/**
+ * crypto_scrypt_interleave():
+ * Return the number of lanes a thread interleaves: as many as smix_lanes
+ * can on this CPU, up to edsign_interleave_limit().
+ */
+EDSIGN_STATIC uint32_t
+crypto_scrypt_interleave(void)
+{
+	uint32_t width = 1;
+	uint32_t limit = edsign_interleave_limit();
+
+#if defined(EDSIGN_X86_SIMD)
+	uint32_t cpu = edsign_cpu_features();
+
+	if (cpu & EDSIGN_CPU_AVX2)
+		width = 4;
+	else if (cpu & EDSIGN_CPU_SSE2)
+		width = 2;
+#endif
+
+	return (width > limit ? limit : width);
+}
+
+/**
+ * smix_lanes(B, n, r, N, V, XY, S):
+ * Compute B[l] = SMix_r(B[l], N) for the ${n} lanes l = 0 ... n - 1,
+ * each using V[l] and XY[l], on the calling thread.  Where the CPU
+ * allows, up to SCRYPT_MAX_INTERLEAVE lanes are interleaved so that
+ * their computation and memory stalls overlap.  If ${S} asks to stop,
+ * the lanes are left undefined.
+ */
+static void
+smix_lanes(uint8_t * const * B, uint32_t n, size_t r, uint64_t N,
+    uint32_t * const * V, uint32_t * const * XY, const struct scrypt_stop * S)
+{
+#if defined(EDSIGN_X86_SIMD)
+	uint32_t cpu = edsign_cpu_features();
+
+	if (cpu & EDSIGN_CPU_AVX2) {
+		for (; n >= 4; n -= 4, B += 4, V += 4, XY += 4)
+			smix_x4_avx2(B, r, N, V, XY, S);
+		for (; n >= 2; n -= 2, B += 2, V += 2, XY += 2)
+			smix_x2_avx2(B, r, N, V, XY, S);
+	} else if (cpu & EDSIGN_CPU_SSE2) {
+		for (; n >= 2; n -= 2, B += 2, V += 2, XY += 2)
+			smix_x2_sse2(B, r, N, V, XY, S);
+	}
+#endif
+
+	for (; n > 0; n--, B++, V++, XY++)
+		smix(*B, r, N, *V, *XY, S);
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Lanes ----------------------------------------------------------------- */
+
+/**
+ * alloc_aligned(len, base):
+ * Allocate ${len} bytes aligned to a multiple of 64 bytes, and store the
+ * pointer to later pass to free() in ${base}.  Return NULL on error.
+ */
+static void *
+alloc_aligned(size_t len, void ** base)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+	if ((errno = posix_memalign(base, 64, len)) != 0)
+		return (NULL);
+	return (*base);
+#else
+	if ((*base = malloc(len + 63)) == NULL)
+		return (NULL);
+	return ((void *)(((uintptr_t)(*base) + 63) & ~ (uintptr_t)(63)));
+#endif
+}
+
+/* Most V and XY buffers one crypto_scrypt call allocates */
+#define SCRYPT_MAX_SLOTS (EDSIGN_MAX_THREADS * SCRYPT_MAX_INTERLEAVE)
+
+/* Working memory of scrypt: B for up to ${p} lanes, and ${nslots} V and
+** XY buffers, each big enough to run SMix_r with parameters up to ${N}
+** and ${r}.  The pointers to free are kept alongside the aligned ones. */
+struct scrypt_mem {
+	uint64_t N;
+	uint32_t r;
+	uint32_t p;
+	uint32_t nslots;
+	uint8_t * B;
+	uint32_t * V[SCRYPT_MAX_SLOTS];
+	uint32_t * XY[SCRYPT_MAX_SLOTS];
+	void * B0;
+	edsign_region V0[SCRYPT_MAX_SLOTS];
+	void * XY0[SCRYPT_MAX_SLOTS];
+};
+
+/* The p lanes of one crypto_scrypt call, split into groups of up to
+** ${width} consecutive lanes, and the V and XY buffers of each worker
+** running them: worker w owns slots w * width ... (w + 1) * width - 1. */
+struct scrypt_lanes {
 	uint8_t * B;
-	uint32_t * V;
-	uint32_t * XY;
-	uint32_t i;
+	size_t r;
+	uint64_t N;
+	uint32_t p;
+	uint32_t width;
+	uint32_t * const * V;
+	uint32_t * const * XY;
+	const struct scrypt_stop * stop;
+};
+
+/* 3: B_i <-- MF(B_i, N) for the lanes of group ${g}, on the buffers of
+** ${worker}. */
+static void
+smix_group(void * arg, uint32_t worker, uint64_t g)
+{
+	struct scrypt_lanes * L = arg;
+	uint8_t * B[SCRYPT_MAX_INTERLEAVE];
+	uint32_t first = (uint32_t)g * L->width;
+	uint32_t n = L->p - first;
+	uint32_t l;
+
+	if (n > L->width)
+		n = L->width;
+	for (l = 0; l < n; l++)
+		B[l] = &L->B[(size_t)(first + l) * 128 * L->r];
+
+	smix_lanes(B, n, L->r, L->N, &L->V[worker * L->width],
+	    &L->XY[worker * L->width], L->stop);
+}
+
+/**
+ * scrypt_check(N, r, p, buflen):
+ * Check the scrypt parameters, as described for crypto_scrypt.  Return 0
+ * if they are valid, or -1 with errno set otherwise.
+ */
+static int
+scrypt_check(uint64_t N, uint32_t r, uint32_t p, size_t buflen)
+{
 
-	/* Sanity-check parameters. */
 #if SIZE_MAX > UINT32_MAX
 	if (buflen > (((uint64_t)(1) << 32) - 1) * 32) {
 		errno = EFBIG;
-		goto err0;
+		return (-1);
 	}
+#else
+	(void)buflen;
 #endif
 	if ((uint64_t)(r) * (uint64_t)(p) >= (1 << 30)) {
 		errno = EFBIG;
-		goto err0;
+		return (-1);
 	}
 	if (((N & (N - 1)) != 0) || (N == 0)) {
 		errno = EINVAL;
-		goto err0;
+		return (-1);
 	}
 	if ((r > SIZE_MAX / 128 / p) ||
 #if SIZE_MAX / 256 <= UINT32_MAX
@@ -670,77 +1641,429 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 #endif
 	    (N > SIZE_MAX / 128 / r)) {
 		errno = ENOMEM;
-		goto err0;
+		return (-1);
 	}
 
-	/* Allocate memory. */
-#ifdef HAVE_POSIX_MEMALIGN
-	if ((errno = posix_memalign(&B0, 64, 128 * r * p)) != 0)
-		goto err0;
-	B = (uint8_t *)(B0);
-	if ((errno = posix_memalign(&XY0, 64, 256 * r + 64)) != 0)
-		goto err1;
-	XY = (uint32_t *)(XY0);
-#ifndef MAP_ANON
-	if ((errno = posix_memalign(&V0, 64, 128 * r * N)) != 0)
-		goto err2;
-	V = (uint32_t *)(V0);
-#endif
-#else
-	if ((B0 = malloc(128 * r * p + 63)) == NULL)
+	return (0);
+}
+
+/**
+ * scrypt_slots(p):
+ * Return the number of V and XY buffers worth having for ${p} lanes: one
+ * per lane, up to crypto_scrypt_interleave() for each of
+ * edsign_thread_limit() workers.
+ */
+static uint32_t
+scrypt_slots(uint32_t p)
+{
+	uint32_t nslots = edsign_thread_limit() * crypto_scrypt_interleave();
+
+	return (nslots > p ? p : nslots);
+}
+
+/**
+ * scrypt_memory(N, r, p, nslots):
+ * Return the number of bytes of B and ${nslots} V and XY buffers for
+ * parameters ${N}, ${r}, and ${p}, or UINT64_MAX if that does not fit in
+ * 64 bits.
+ */
+static uint64_t
+scrypt_memory(uint64_t N, uint32_t r, uint32_t p, uint64_t nslots)
+{
+	uint64_t V = 128 * (uint64_t)r;
+	uint64_t rest;
+
+	/* Each slot is a V and an XY, and B is shared by all lanes. */
+	if (N > UINT64_MAX / V / nslots)
+		return (UINT64_MAX);
+	V *= N * nslots;
+	rest = (256 * (uint64_t)r + 64) * nslots + 128 * (uint64_t)r * p;
+	if (V > UINT64_MAX - rest)
+		return (UINT64_MAX);
+
+	return (V + rest);
+}
+
+/**
+ * crypto_scrypt_memory(N, r, p):
+ * Return the number of bytes of working memory crypto_scrypt allocates for
+ * valid parameters ${N}, ${r}, and ${p} with the current thread and
+ * interleave limits, or UINT64_MAX if that does not fit in 64 bits.
+ */
+EDSIGN_STATIC uint64_t
+crypto_scrypt_memory(uint64_t N, uint32_t r, uint32_t p)
+{
+
+	return (scrypt_memory(N, r, p, scrypt_slots(p)));
+}
+
+/**
+ * scrypt_mem_init(M, N, r, p, nslots):
+ * Allocate B and up to ${nslots} V and XY buffers in ${M} for parameters
+ * ${N}, ${r}, and ${p}.  Fewer slots are kept if memory runs out.  Return
+ * 0 on success, or -1 if not even one slot could be allocated.
+ */
+static int
+scrypt_mem_init(struct scrypt_mem * M, uint64_t N, uint32_t r, uint32_t p,
+    uint32_t nslots)
+{
+	uint32_t w;
+
+	M->N = N;
+	M->r = r;
+	M->p = p;
+	if ((M->B = alloc_aligned(128 * r * p, &M->B0)) == NULL)
 		goto err0;
-	B = (uint8_t *)(((uintptr_t)(B0) + 63) & ~ (uintptr_t)(63));
-	if ((XY0 = malloc(256 * r + 64 + 63)) == NULL)
+	for (w = 0; w < nslots; w++) {
+		if ((M->XY[w] = alloc_aligned(256 * r + 64, &M->XY0[w])) == NULL)
+			break;
+		M->V[w] = edsign_region_alloc(&M->V0[w], 128 * r * N);
+		if (M->V[w] == NULL) {
+			free(M->XY0[w]);
+			break;
+		}
+	}
+	if (w == 0)
 		goto err1;
-	XY = (uint32_t *)(((uintptr_t)(XY0) + 63) & ~ (uintptr_t)(63));
-#ifndef MAP_ANON
-	if ((V0 = malloc(128 * r * N + 63)) == NULL)
-		goto err2;
-	V = (uint32_t *)(((uintptr_t)(V0) + 63) & ~ (uintptr_t)(63));
-#endif
-#endif
-#ifdef MAP_ANON
-	if ((V0 = mmap(NULL, 128 * r * N, PROT_READ | PROT_WRITE,
-#ifdef MAP_NOCORE
-	    MAP_ANON | MAP_PRIVATE | MAP_NOCORE,
-#else
-	    MAP_ANON | MAP_PRIVATE,
-#endif
-	    -1, 0)) == MAP_FAILED)
-		goto err2;
-	V = (uint32_t *)(V0);
-#endif
+	M->nslots = w;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(M->B0);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * scrypt_mem_done(M):
+ * Free the buffers in ${M}.  Return 0 on success, or -1 if unmapping a V
+ * array failed.
+ */
+static int
+scrypt_mem_done(struct scrypt_mem * M)
+{
+	uint32_t w;
+	int rc = 0;
+
+	for (w = 0; w < M->nslots; w++) {
+		if (edsign_region_free(&M->V0[w]))
+			rc = -1;
+		free(M->XY0[w]);
+	}
+	free(M->B0);
+
+	return (rc);
+}
+
+/**
+ * scrypt_mem_run(M, passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen,
+ *     S, nslots):
+ * Compute scrypt with valid parameters no larger than those ${M} was
+ * allocated for, on the buffers in ${M}, and store the number of slots
+ * used in ${nslots}.  Return 0 on success, or -1 if ${S} asked to stop.
+ */
+static int
+scrypt_mem_run(struct scrypt_mem * M, const uint8_t * passwd,
+    size_t passwdlen, const uint8_t * salt, size_t saltlen, uint64_t N,
+    uint32_t r, uint32_t p, uint8_t * buf, size_t buflen,
+    const struct scrypt_stop * S, uint32_t * nslots_used)
+{
+	struct scrypt_lanes L;
+	uint32_t nworkers, nslots;
+
+	/* Spread the slots we have evenly over the workers. */
+	nworkers = edsign_thread_limit();
+	if (nworkers > p)
+		nworkers = p;
+	nslots = nworkers * crypto_scrypt_interleave();
+	if (nslots > p)
+		nslots = p;
+	if (nslots > M->nslots)
+		nslots = M->nslots;
+	if (nworkers > nslots)
+		nworkers = nslots;
+	L.B = M->B;
+	L.r = r;
+	L.N = N;
+	L.p = p;
+	L.width = nslots / nworkers;
+	L.V = M->V;
+	L.XY = M->XY;
+	L.stop = S;
+	*nslots_used = nworkers * L.width;
 
 	/* 1: (B_0 ... B_{p-1}) <-- PBKDF2(P, S, 1, p * MFLen) */
-	scrypt_PBKDF2_SHA256(passwd, passwdlen, salt, saltlen, 1, B, p*128*r);
+	scrypt_PBKDF2_SHA256(passwd, passwdlen, salt, saltlen, 1, L.B, p*128*r);
 
 	/* 2: for i = 0 to p - 1 do */
-	for (i = 0; i < p; i++) {
-		/* 3: B_i <-- MF(B_i, N) */
-		smix(&B[i * 128 * r], r, N, V, XY);
-	}
+	/* 3: B_i <-- MF(B_i, N) */
+	edsign_parallel_for(nworkers, (p + L.width - 1) / L.width,
+	    smix_group, &L);
+
+	/* Some lanes may have stopped early; ask once more for all of them. */
+	if ((S != NULL) && S->fn(S->arg))
+		return (-1);
 
 	/* 5: DK <-- PBKDF2(P, B, 1, dkLen) */
-	scrypt_PBKDF2_SHA256(passwd, passwdlen, B, p * 128 * r, 1, buf, buflen);
+	scrypt_PBKDF2_SHA256(passwd, passwdlen, L.B, p * 128 * r, 1, buf, buflen);
 
-	/* Free memory. */
-#ifdef MAP_ANON
-	if (munmap(V0, 128 * r * N))
-		goto err2;
-#else
-	free(V0);
+	return (0);
+}
+
+/**
+ * scrypt_alloc_run(passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen, S):
+ * Compute scrypt as crypto_scrypt does, on memory allocated for the call,
+ * stopping early if ${S} asks to.  Return 0 on success; or -1 on error.
+ */
+static int
+scrypt_alloc_run(const uint8_t * passwd, size_t passwdlen,
+    const uint8_t * salt, size_t saltlen, uint64_t N, uint32_t r, uint32_t p,
+    uint8_t * buf, size_t buflen, const struct scrypt_stop * S)
+{
+	struct scrypt_mem M;
+	uint32_t nslots;
+	int rc;
+
+	/* Sanity-check parameters, and allocate memory. */
+	if (scrypt_check(N, r, p, buflen))
+		return (-1);
+	if (scrypt_mem_init(&M, N, r, p, scrypt_slots(p)))
+		return (-1);
+
+	rc = scrypt_mem_run(&M, passwd, passwdlen, salt, saltlen, N, r, p,
+	    buf, buflen, S, &nslots);
+
+	/* Success, unless we were stopped or unmapping failed. */
+	if (scrypt_mem_done(&M))
+		rc = -1;
+	return (rc);
+}
+
+/**
+ * crypto_scrypt(passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen):
+ * Compute scrypt(passwd[0 .. passwdlen - 1], salt[0 .. saltlen - 1], N, r,
+ * p, buflen) and write the result into buf.  The parameters r, p, and buflen
+ * must satisfy r * p < 2^30 and buflen <= (2^32 - 1) * 32.  The parameter N
+ * must be a power of 2 greater than 1.
+ *
+ * The p lanes are independent, and run on up to edsign_thread_limit()
+ * workers at once.  Each worker interleaves up to crypto_scrypt_interleave()
+ * lanes, with a V and XY for each, so at most min(p, workers * that) lanes
+ * are in memory at once.  If memory for all of them can not be
+ * allocated, the lanes share the buffers that could be.
+ *
+ * Return 0 on success; or -1 on error.
+ */
+EDSIGN_STATIC int
+crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
+    const uint8_t * salt, size_t saltlen, uint64_t N, uint32_t r, uint32_t p,
+    uint8_t * buf, size_t buflen)
+{
+
+	return (scrypt_alloc_run(passwd, passwdlen, salt, saltlen, N, r, p,
+	    buf, buflen, NULL));
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Reusable memory ------------------------------------------------------- */
+
+/* Wipe ${len} bytes of possibly secret data at ${p}; the barrier keeps
+** the compiler from dropping the memset as a dead store. */
+static void
+scrypt_wipe(void * p, size_t len)
+{
+
+	memset(p, 0, len);
+#if !defined(COMPILER_COMPCERT)
+	__asm__ __volatile__("" : : "r" (p) : "memory");
 #endif
-	free(XY0);
-	free(B0);
+}
+
+/* Touch every page of the ${len} bytes at ${p}, so that the OS backs them
+** now rather than on first use. */
+static void
+scrypt_prefault(void * p, size_t len)
+{
+	volatile uint8_t * q = p;
+	size_t i;
+
+	for (i = 0; i < len; i += 4096)
+		q[i] = 0;
+	if (len > 0)
+		q[len - 1] = 0;
+}
+
+/**
+ * scrypt_mem_new(N, r, p, nslots):
+ * Allocate working memory as crypto_scrypt_mem_new does, with up to
+ * ${nslots} V and XY buffers, and fault in all of it.  Return NULL on
+ * error.
+ */
+static struct scrypt_mem *
+scrypt_mem_new(uint64_t N, uint32_t r, uint32_t p, uint32_t nslots)
+{
+	struct scrypt_mem * M;
+	uint32_t w;
+
+	if (scrypt_check(N, r, p, 0))
+		goto err0;
+	if ((M = malloc(sizeof(struct scrypt_mem))) == NULL)
+		goto err0;
+	if (scrypt_mem_init(M, N, r, p, nslots))
+		goto err1;
+
+	scrypt_prefault(M->B, 128 * (size_t)r * p);
+	for (w = 0; w < M->nslots; w++) {
+		scrypt_prefault(M->XY[w], 256 * (size_t)r + 64);
+		scrypt_prefault(M->V[w], 128 * (size_t)r * N);
+	}
 
 	/* Success! */
-	return (0);
+	return (M);
 
-err2:
-	free(XY0);
 err1:
-	free(B0);
+	free(M);
 err0:
 	/* Failure! */
-	return (-1);
+	return (NULL);
+}
+
+/**
+ * crypto_scrypt_mem_new(N, r, p):
+ * Allocate working memory for crypto_scrypt_mem with parameters up to
+ * ${N}, ${r}, and ${p}, with as many V arrays as edsign_thread_limit()
+ * workers would use, and fault in all of it.  Return NULL on error.
+ */
+EDSIGN_STATIC struct scrypt_mem *
+crypto_scrypt_mem_new(uint64_t N, uint32_t r, uint32_t p)
+{
+
+	return (scrypt_mem_new(N, r, p, scrypt_slots(p)));
+}
+
+/**
+ * crypto_scrypt_mem_bench(N, r, bytes):
+ * Allocate working memory for crypto_scrypt_mem_smix with parameters ${N}
+ * and ${r} and SCRYPT_MAX_INTERLEAVE lanes, each with a V and XY of its own
+ * whatever the thread and interleave limits, fault in all of it, and store
+ * its size in ${bytes}.  Return NULL on error.
+ */
+EDSIGN_STATIC struct scrypt_mem *
+crypto_scrypt_mem_bench(uint64_t N, uint32_t r, uint64_t * bytes)
+{
+	struct scrypt_mem * M;
+
+	if ((M = scrypt_mem_new(N, r, SCRYPT_MAX_INTERLEAVE,
+	    SCRYPT_MAX_INTERLEAVE)) == NULL)
+		return (NULL);
+	*bytes = scrypt_memory(N, r, M->p, M->nslots);
+
+	return (M);
+}
+
+/**
+ * crypto_scrypt_mem_free(M):
+ * Free the working memory ${M}, which may be NULL.  Return 0 on success,
+ * or -1 if unmapping failed.
+ */
+EDSIGN_STATIC int
+crypto_scrypt_mem_free(struct scrypt_mem * M)
+{
+	int rc;
+
+	if (M == NULL)
+		return (0);
+	rc = scrypt_mem_done(M);
+	free(M);
+
+	return (rc);
+}
+
+/**
+ * crypto_scrypt_mem_fits(M, N, r, p):
+ * Return nonzero if crypto_scrypt_mem can compute scrypt with parameters
+ * ${N}, ${r}, and ${p} on the working memory ${M}, which may be NULL, rather
+ * than falling back to crypto_scrypt.
+ */
+EDSIGN_STATIC int
+crypto_scrypt_mem_fits(const struct scrypt_mem * M, uint64_t N, uint32_t r,
+    uint32_t p)
+{
+
+	return ((M != NULL) && (r <= M->r) &&
+	    ((uint64_t)r * N <= (uint64_t)M->r * M->N) &&
+	    ((uint64_t)r * p <= (uint64_t)M->r * M->p));
+}
+
+/**
+ * crypto_scrypt_mem(M, passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen,
+ *     S):
+ * Compute scrypt as crypto_scrypt does, but on the working memory ${M}
+ * from crypto_scrypt_mem_new, which is wiped again before returning.  If
+ * ${M} is NULL, or its buffers are too small for ${N}, ${r}, and ${p},
+ * fall back to memory allocated for the call.  ${M} may be used by only
+ * one call at a time.  Unless ${S} is NULL, ${S}->fn(${S}->arg) is polled
+ * from every thread running lanes, every SCRYPT_STOP_INTERVAL BlockMix
+ * calls and once all lanes are done; once it returns nonzero, the
+ * computation stops early and fails.
+ *
+ * Return 0 on success; or -1 on error, or if ${S} stopped the computation.
+ */
+EDSIGN_STATIC int
+crypto_scrypt_mem(struct scrypt_mem * M, const uint8_t * passwd,
+    size_t passwdlen, const uint8_t * salt, size_t saltlen, uint64_t N,
+    uint32_t r, uint32_t p, uint8_t * buf, size_t buflen,
+    const struct scrypt_stop * S)
+{
+	uint32_t nslots, w;
+	int rc;
+
+	if (scrypt_check(N, r, p, buflen))
+		return (-1);
+	if (!crypto_scrypt_mem_fits(M, N, r, p))
+		return (scrypt_alloc_run(passwd, passwdlen, salt, saltlen,
+		    N, r, p, buf, buflen, S));
+
+	rc = scrypt_mem_run(M, passwd, passwdlen, salt, saltlen, N, r, p,
+	    buf, buflen, S, &nslots);
+
+	/* Nothing derived from the password may outlive the call. */
+	scrypt_wipe(M->B, 128 * (size_t)r * p);
+	for (w = 0; w < nslots; w++) {
+		scrypt_wipe(M->XY[w], 256 * (size_t)r + 64);
+		scrypt_wipe(M->V[w], 128 * (size_t)r * N);
+	}
+
+	return (rc);
 }
+
+/**
+ * crypto_scrypt_mem_smix(M, n):
+ * Run SMix_r on the first ${n} <= SCRYPT_MAX_INTERLEAVE lanes of B in the
+ * working memory ${M}, with the largest parameters ${M} was allocated for,
+ * on the calling thread, so that one worker's share of a crypto_scrypt call
+ * can be timed.  Return 0 on success, or -1 if ${M} has too few lanes.
+ */
+EDSIGN_STATIC int
+crypto_scrypt_mem_smix(struct scrypt_mem * M, uint32_t n)
+{
+	uint8_t * B[SCRYPT_MAX_INTERLEAVE];
+	uint32_t l;
+
+	if ((n == 0) || (n > SCRYPT_MAX_INTERLEAVE) || (n > M->p) ||
+	    (n > M->nslots))
+		return (-1);
+
+	for (l = 0; l < n; l++)
+		B[l] = &M->B[(size_t)l * 128 * M->r];
+	smix_lanes(B, n, M->r, M->N, M->V, M->XY, NULL);
+
+	return (0);
+}
+
+#undef SCRYPT_MAX_INTERLEAVE
+#undef SCRYPT_MAX_SLOTS
+#undef SCRYPT_STOP_INTERVAL
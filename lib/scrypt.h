@@ -27,6 +27,98 @@ EDSIGN_STATIC int
 crypto_scrypt(const uint8_t *, size_t, const uint8_t *, size_t, uint64_t,
     uint32_t, uint32_t, uint8_t *, size_t);
 
+/**
+ * crypto_scrypt_memory(N, r, p):
+ * Return the number of bytes of working memory crypto_scrypt allocates for
+ * valid parameters ${N}, ${r}, and ${p} with the current thread and
+ * interleave limits, or UINT64_MAX if that does not fit in 64 bits.
+ */
+/**
+ * crypto_scrypt_interleave():
+ * Return the number of lanes a thread interleaves: as many as this CPU
+ * can, up to edsign_interleave_limit().
+ */
+EDSIGN_STATIC uint32_t
+crypto_scrypt_interleave(void);
+
+EDSIGN_STATIC uint64_t
+crypto_scrypt_memory(uint64_t, uint32_t, uint32_t);
+
+/* Reusable working memory for crypto_scrypt_mem. */
+struct scrypt_mem;
+
+/* A condition crypto_scrypt_mem polls, to stop early once fn(arg) != 0. */
+struct scrypt_stop {
+	int (* fn)(void *);
+	void * arg;
+};
+
+/**
+ * crypto_scrypt_mem_new(N, r, p):
+ * Allocate working memory for crypto_scrypt_mem with parameters up to
+ * ${N}, ${r}, and ${p}, with as many V arrays as edsign_thread_limit()
+ * workers would use, and fault in all of it.  Return NULL on error.
+ */
+EDSIGN_STATIC struct scrypt_mem *
+crypto_scrypt_mem_new(uint64_t, uint32_t, uint32_t);
+
+/**
+ * crypto_scrypt_mem_bench(N, r, bytes):
+ * Allocate working memory for crypto_scrypt_mem_smix with parameters ${N}
+ * and ${r} and 4 lanes, each with a V and XY of its own whatever the thread
+ * and interleave limits, fault in all of it, and store its size in
+ * ${bytes}.  Return NULL on error.
+ */
+EDSIGN_STATIC struct scrypt_mem *
+crypto_scrypt_mem_bench(uint64_t, uint32_t, uint64_t *);
+
+/**
+ * crypto_scrypt_mem_free(M):
+ * Free the working memory ${M}, which may be NULL.  Return 0 on success,
+ * or -1 if unmapping failed.
+ */
+EDSIGN_STATIC int
+crypto_scrypt_mem_free(struct scrypt_mem *);
+
+/**
+ * crypto_scrypt_mem_fits(M, N, r, p):
+ * Return nonzero if crypto_scrypt_mem can compute scrypt with parameters
+ * ${N}, ${r}, and ${p} on the working memory ${M}, which may be NULL, rather
+ * than falling back to crypto_scrypt.
+ */
+EDSIGN_STATIC int
+crypto_scrypt_mem_fits(const struct scrypt_mem *, uint64_t, uint32_t,
+    uint32_t);
+
+/**
+ * crypto_scrypt_mem(M, passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen,
+ *     S):
+ * Compute scrypt as crypto_scrypt does, but on the working memory ${M}
+ * from crypto_scrypt_mem_new, which is wiped again before returning.  If
+ * ${M} is NULL, or its buffers are too small for ${N}, ${r}, and ${p},
+ * fall back to memory allocated for the call.  ${M} may be used by only
+ * one call at a time.  Unless ${S} is NULL, ${S}->fn(${S}->arg) is polled
+ * from every thread running lanes, every few hundred BlockMix calls and
+ * once all lanes are done; once it returns nonzero, the computation stops
+ * early and fails.
+ *
+ * Return 0 on success; or -1 on error, or if ${S} stopped the computation.
+ */
+EDSIGN_STATIC int
+crypto_scrypt_mem(struct scrypt_mem *, const uint8_t *, size_t,
+    const uint8_t *, size_t, uint64_t, uint32_t, uint32_t, uint8_t *, size_t,
+    const struct scrypt_stop *);
+
+/**
+ * crypto_scrypt_mem_smix(M, n):
+ * Run SMix_r on the first ${n} <= 4 lanes of B in the working memory ${M},
+ * with the largest parameters ${M} was allocated for, on the calling thread,
+ * so that one worker's share of a crypto_scrypt call can be timed.  Return 0
+ * on success, or -1 if ${M} has too few lanes.
+ */
+EDSIGN_STATIC int
+crypto_scrypt_mem_smix(struct scrypt_mem *, uint32_t);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,708 @@
+/*
+** SHA-512 hash function.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+**
+** Portable code taken verbatim from SUPERCOP sha512 reference
+** implementation, released in public domain. See LICENSE.txt.
+*/
+
+#include "edsign-private.h"
+#include "cpu.h"
+#include "sha512.h"
+#include "util.h"
+
+/* -------------------------------------------------------------------------- */
+/* -- Utilities ------------------------------------------------------------- */
+
+static uint64_t
+load_bigendian(const uint8_t* x)
+{
+  return
+      (uint64_t) (x[7]) \
+  | (((uint64_t) (x[6])) << 8) \
+  | (((uint64_t) (x[5])) << 16) \
+  | (((uint64_t) (x[4])) << 24) \
+  | (((uint64_t) (x[3])) << 32) \
+  | (((uint64_t) (x[2])) << 40) \
+  | (((uint64_t) (x[1])) << 48) \
+  | (((uint64_t) (x[0])) << 56);
+}
+
+static void
+store_bigendian(uint8_t* x, uint64_t u)
+{
+  x[7] = u; u >>= 8;
+  x[6] = u; u >>= 8;
+  x[5] = u; u >>= 8;
+  x[4] = u; u >>= 8;
+  x[3] = u; u >>= 8;
+  x[2] = u; u >>= 8;
+  x[1] = u; u >>= 8;
+  x[0] = u;
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Portable -------------------------------------------------------------- */
+
+#define SHR(x,c) ((x) >> (c))
+#define ROTR(x,c) (((x) >> (c)) | ((x) << (64 - (c))))
+
+#define Ch(x,y,z) ((x & y) ^ (~x & z))
+#define Maj(x,y,z) ((x & y) ^ (x & z) ^ (y & z))
+#define Sigma0(x) (ROTR(x,28) ^ ROTR(x,34) ^ ROTR(x,39))
+#define Sigma1(x) (ROTR(x,14) ^ ROTR(x,18) ^ ROTR(x,41))
+#define sigma0(x) (ROTR(x, 1) ^ ROTR(x, 8) ^ SHR(x,7))
+#define sigma1(x) (ROTR(x,19) ^ ROTR(x,61) ^ SHR(x,6))
+
+#define M(w0,w14,w9,w1) w0 = sigma1(w14) + w9 + sigma0(w1) + w0;
+
+#define EXPAND \
+  M(w0 ,w14,w9 ,w1 ) \
+  M(w1 ,w15,w10,w2 ) \
+  M(w2 ,w0 ,w11,w3 ) \
+  M(w3 ,w1 ,w12,w4 ) \
+  M(w4 ,w2 ,w13,w5 ) \
+  M(w5 ,w3 ,w14,w6 ) \
+  M(w6 ,w4 ,w15,w7 ) \
+  M(w7 ,w5 ,w0 ,w8 ) \
+  M(w8 ,w6 ,w1 ,w9 ) \
+  M(w9 ,w7 ,w2 ,w10) \
+  M(w10,w8 ,w3 ,w11) \
+  M(w11,w9 ,w4 ,w12) \
+  M(w12,w10,w5 ,w13) \
+  M(w13,w11,w6 ,w14) \
+  M(w14,w12,w7 ,w15) \
+  M(w15,w13,w8 ,w0 )
+
+#define F(w,k) \
+  T1 = h + Sigma1(e) + Ch(e,f,g) + k + w; \
+  T2 = Sigma0(a) + Maj(a,b,c); \
+  h = g; \
+  g = f; \
+  f = e; \
+  e = d + T1; \
+  d = c; \
+  c = b; \
+  b = a; \
+  a = T1 + T2;
+
+/* Portable block function: the SUPERCOP reference code, with the
+** message schedule and all 80 rounds fully unrolled. */
+static void
+sha512_blocks_ref(uint64_t state[8], const uint8_t* in, uint64_t nblocks)
+{
+  uint64_t a;
+  uint64_t b;
+  uint64_t c;
+  uint64_t d;
+  uint64_t e;
+  uint64_t f;
+  uint64_t g;
+  uint64_t h;
+  uint64_t T1;
+  uint64_t T2;
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  f = state[5];
+  g = state[6];
+  h = state[7];
+
+  while (nblocks > 0) {
+    uint64_t w0  = load_bigendian(in +   0);
+    uint64_t w1  = load_bigendian(in +   8);
+    uint64_t w2  = load_bigendian(in +  16);
+    uint64_t w3  = load_bigendian(in +  24);
+    uint64_t w4  = load_bigendian(in +  32);
+    uint64_t w5  = load_bigendian(in +  40);
+    uint64_t w6  = load_bigendian(in +  48);
+    uint64_t w7  = load_bigendian(in +  56);
+    uint64_t w8  = load_bigendian(in +  64);
+    uint64_t w9  = load_bigendian(in +  72);
+    uint64_t w10 = load_bigendian(in +  80);
+    uint64_t w11 = load_bigendian(in +  88);
+    uint64_t w12 = load_bigendian(in +  96);
+    uint64_t w13 = load_bigendian(in + 104);
+    uint64_t w14 = load_bigendian(in + 112);
+    uint64_t w15 = load_bigendian(in + 120);
+
+    F(w0 ,0x428a2f98d728ae22ULL)
+    F(w1 ,0x7137449123ef65cdULL)
+    F(w2 ,0xb5c0fbcfec4d3b2fULL)
+    F(w3 ,0xe9b5dba58189dbbcULL)
+    F(w4 ,0x3956c25bf348b538ULL)
+    F(w5 ,0x59f111f1b605d019ULL)
+    F(w6 ,0x923f82a4af194f9bULL)
+    F(w7 ,0xab1c5ed5da6d8118ULL)
+    F(w8 ,0xd807aa98a3030242ULL)
+    F(w9 ,0x12835b0145706fbeULL)
+    F(w10,0x243185be4ee4b28cULL)
+    F(w11,0x550c7dc3d5ffb4e2ULL)
+    F(w12,0x72be5d74f27b896fULL)
+    F(w13,0x80deb1fe3b1696b1ULL)
+    F(w14,0x9bdc06a725c71235ULL)
+    F(w15,0xc19bf174cf692694ULL)
+
+    EXPAND
+
+    F(w0 ,0xe49b69c19ef14ad2ULL)
+    F(w1 ,0xefbe4786384f25e3ULL)
+    F(w2 ,0x0fc19dc68b8cd5b5ULL)
+    F(w3 ,0x240ca1cc77ac9c65ULL)
+    F(w4 ,0x2de92c6f592b0275ULL)
+    F(w5 ,0x4a7484aa6ea6e483ULL)
+    F(w6 ,0x5cb0a9dcbd41fbd4ULL)
+    F(w7 ,0x76f988da831153b5ULL)
+    F(w8 ,0x983e5152ee66dfabULL)
+    F(w9 ,0xa831c66d2db43210ULL)
+    F(w10,0xb00327c898fb213fULL)
+    F(w11,0xbf597fc7beef0ee4ULL)
+    F(w12,0xc6e00bf33da88fc2ULL)
+    F(w13,0xd5a79147930aa725ULL)
+    F(w14,0x06ca6351e003826fULL)
+    F(w15,0x142929670a0e6e70ULL)
+
+    EXPAND
+
+    F(w0 ,0x27b70a8546d22ffcULL)
+    F(w1 ,0x2e1b21385c26c926ULL)
+    F(w2 ,0x4d2c6dfc5ac42aedULL)
+    F(w3 ,0x53380d139d95b3dfULL)
+    F(w4 ,0x650a73548baf63deULL)
+    F(w5 ,0x766a0abb3c77b2a8ULL)
+    F(w6 ,0x81c2c92e47edaee6ULL)
+    F(w7 ,0x92722c851482353bULL)
+    F(w8 ,0xa2bfe8a14cf10364ULL)
+    F(w9 ,0xa81a664bbc423001ULL)
+    F(w10,0xc24b8b70d0f89791ULL)
+    F(w11,0xc76c51a30654be30ULL)
+    F(w12,0xd192e819d6ef5218ULL)
+    F(w13,0xd69906245565a910ULL)
+    F(w14,0xf40e35855771202aULL)
+    F(w15,0x106aa07032bbd1b8ULL)
+
+    EXPAND
+
+    F(w0 ,0x19a4c116b8d2d0c8ULL)
+    F(w1 ,0x1e376c085141ab53ULL)
+    F(w2 ,0x2748774cdf8eeb99ULL)
+    F(w3 ,0x34b0bcb5e19b48a8ULL)
+    F(w4 ,0x391c0cb3c5c95a63ULL)
+    F(w5 ,0x4ed8aa4ae3418acbULL)
+    F(w6 ,0x5b9cca4f7763e373ULL)
+    F(w7 ,0x682e6ff3d6b2b8a3ULL)
+    F(w8 ,0x748f82ee5defb2fcULL)
+    F(w9 ,0x78a5636f43172f60ULL)
+    F(w10,0x84c87814a1f0ab72ULL)
+    F(w11,0x8cc702081a6439ecULL)
+    F(w12,0x90befffa23631e28ULL)
+    F(w13,0xa4506cebde82bde9ULL)
+    F(w14,0xbef9a3f7b2c67915ULL)
+    F(w15,0xc67178f2e372532bULL)
+
+    EXPAND
+
+    F(w0 ,0xca273eceea26619cULL)
+    F(w1 ,0xd186b8c721c0c207ULL)
+    F(w2 ,0xeada7dd6cde0eb1eULL)
+    F(w3 ,0xf57d4f7fee6ed178ULL)
+    F(w4 ,0x06f067aa72176fbaULL)
+    F(w5 ,0x0a637dc5a2c898a6ULL)
+    F(w6 ,0x113f9804bef90daeULL)
+    F(w7 ,0x1b710b35131c471bULL)
+    F(w8 ,0x28db77f523047d84ULL)
+    F(w9 ,0x32caab7b40c72493ULL)
+    F(w10,0x3c9ebe0a15c9bebcULL)
+    F(w11,0x431d67c49c100d4cULL)
+    F(w12,0x4cc5d4becb3e42b6ULL)
+    F(w13,0x597f299cfc657e2aULL)
+    F(w14,0x5fcb6fab3ad6faecULL)
+    F(w15,0x6c44198c4a475817ULL)
+
+    a += state[0];
+    b += state[1];
+    c += state[2];
+    d += state[3];
+    e += state[4];
+    f += state[5];
+    g += state[6];
+    h += state[7];
+
+    state[0] = a;
+    state[1] = b;
+    state[2] = c;
+    state[3] = d;
+    state[4] = e;
+    state[5] = f;
+    state[6] = g;
+    state[7] = h;
+
+    in += 128;
+    nblocks -= 1;
+  }
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- AVX2 ------------------------------------------------------------------ */
+
+#if defined(EDSIGN_X86_SIMD)
+
+static const uint64_t sha512_K[80] ALIGNED(32) = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+#define VROTR(x,c) _mm256_or_si256(_mm256_srli_epi64(x,c), _mm256_slli_epi64(x,64-(c)))
+#define VSHR(x,c)  _mm256_srli_epi64(x,c)
+#define vsigma0(x) _mm256_xor_si256(_mm256_xor_si256(VROTR(x, 1),VROTR(x, 8)),VSHR(x,7))
+#define vsigma1(x) _mm256_xor_si256(_mm256_xor_si256(VROTR(x,19),VROTR(x,61)),VSHR(x,6))
+
+/*
+ * Expand the message schedules of the two blocks ${in0} and ${in1} at
+ * once, and store W[t] + K[t] for each into ${wk0} and ${wk1}. Each
+ * 128-bit half of a YMM register holds two consecutive words of one
+ * block: the low half belongs to ${in0}, the high half to ${in1}. Two
+ * words are produced per step, since W[t] and W[t+1] only depend on
+ * words up to W[t-1].
+ */
+static void TARGET("avx2")
+sha512_schedule_avx2(uint64_t wk0[80], uint64_t wk1[80],
+                     const uint8_t* in0, const uint8_t* in1)
+{
+  const __m256i bswap = _mm256_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+                                         7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+  __m256i X[40];
+  __m256i w15, w7, k, t;
+  __m128i lo, hi;
+  int j;
+
+  /* Load W[0..15] of both blocks, big-endian */
+  for (j = 0; j < 8; j++) {
+    lo = _mm_loadu_si128((const __m128i*)(in0 + 16*j));
+    hi = _mm_loadu_si128((const __m128i*)(in1 + 16*j));
+    t  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    X[j] = _mm256_shuffle_epi8(t, bswap);
+  }
+
+  /* W[t] = sigma1(W[t-2]) + W[t-7] + sigma0(W[t-15]) + W[t-16], where
+  ** X[j] holds (W[2j], W[2j+1]); the odd-offset pairs are realigned
+  ** from their neighbours. */
+  for (j = 8; j < 40; j++) {
+    w15 = _mm256_alignr_epi8(X[j-7], X[j-8], 8);
+    w7  = _mm256_alignr_epi8(X[j-3], X[j-4], 8);
+    X[j] = _mm256_add_epi64(_mm256_add_epi64(X[j-8], vsigma0(w15)),
+                            _mm256_add_epi64(w7, vsigma1(X[j-1])));
+  }
+
+  /* Add the round constants and split the two schedules */
+  for (j = 0; j < 40; j++) {
+    lo = _mm_load_si128((const __m128i*)&sha512_K[2*j]);
+    k  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), lo, 1);
+    t  = _mm256_add_epi64(X[j], k);
+    _mm_storeu_si128((__m128i*)&wk0[2*j], _mm256_castsi256_si128(t));
+    _mm_storeu_si128((__m128i*)&wk1[2*j], _mm256_extracti128_si256(t, 1));
+  }
+}
+
+#undef VROTR
+#undef VSHR
+#undef vsigma0
+#undef vsigma1
+
+#define RND(a,b,c,d,e,f,g,h,i) \
+  T1 = h + Sigma1(e) + Ch(e,f,g) + wk[i]; \
+  d += T1; \
+  h = T1 + Sigma0(a) + Maj(a,b,c);
+
+/* Run the 80 rounds over a precomputed W + K schedule, eight rounds
+** at a time with the working variables renamed instead of shifted. */
+static inline void
+sha512_rounds(uint64_t state[8], const uint64_t wk[80])
+{
+  uint64_t a = state[0];
+  uint64_t b = state[1];
+  uint64_t c = state[2];
+  uint64_t d = state[3];
+  uint64_t e = state[4];
+  uint64_t f = state[5];
+  uint64_t g = state[6];
+  uint64_t h = state[7];
+  uint64_t T1;
+  int i;
+
+  for (i = 0; i < 80; i += 8) {
+    RND(a,b,c,d,e,f,g,h,i+0)
+    RND(h,a,b,c,d,e,f,g,i+1)
+    RND(g,h,a,b,c,d,e,f,i+2)
+    RND(f,g,h,a,b,c,d,e,i+3)
+    RND(e,f,g,h,a,b,c,d,i+4)
+    RND(d,e,f,g,h,a,b,c,i+5)
+    RND(c,d,e,f,g,h,a,b,i+6)
+    RND(b,c,d,e,f,g,h,a,i+7)
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+#undef RND
+
+/* AVX2 block function: schedules are expanded two blocks at a time,
+** and the rounds (which are inherently serial) run on scalar code. */
+static void TARGET("avx2")
+sha512_blocks_avx2(uint64_t state[8], const uint8_t* in, uint64_t nblocks)
+{
+  uint64_t wk[2][80] ALIGNED(32);
+
+  while (nblocks >= 2) {
+    sha512_schedule_avx2(wk[0], wk[1], in, in + 128);
+    sha512_rounds(state, wk[0]);
+    sha512_rounds(state, wk[1]);
+    in += 256;
+    nblocks -= 2;
+  }
+
+  if (nblocks == 1) {
+    sha512_schedule_avx2(wk[0], wk[1], in, in);
+    sha512_rounds(state, wk[0]);
+  }
+
+  /* The schedule is derived from the (possibly secret) input */
+  edsign_bzero((uint8_t*)wk, sizeof(wk));
+}
+
+#define VROTR(x,c)  _mm256_or_si256(_mm256_srli_epi64(x,c), _mm256_slli_epi64(x,64-(c)))
+#define VSHR(x,c)   _mm256_srli_epi64(x,c)
+#define VXOR3(x,y,z) _mm256_xor_si256(_mm256_xor_si256(x,y),z)
+#define VADD(x,y)   _mm256_add_epi64(x,y)
+#define vCh(x,y,z)  _mm256_xor_si256(_mm256_and_si256(x,y),_mm256_andnot_si256(x,z))
+#define vMaj(x,y,z) _mm256_or_si256(_mm256_and_si256(x,y),_mm256_and_si256(z,_mm256_or_si256(x,y)))
+#define vSigma0(x)  VXOR3(VROTR(x,28),VROTR(x,34),VROTR(x,39))
+#define vSigma1(x)  VXOR3(VROTR(x,14),VROTR(x,18),VROTR(x,41))
+#define vsigma0(x)  VXOR3(VROTR(x, 1),VROTR(x, 8),VSHR(x,7))
+#define vsigma1(x)  VXOR3(VROTR(x,19),VROTR(x,61),VSHR(x,6))
+
+/*
+ * Multi-buffer block function: compress ${nblocks} blocks of each of
+ * the four independent messages in[0] ... in[3] into the four states
+ * held in ${state}, where state[i][j] is word i of lane j. Every YMM
+ * register carries the same variable for all four lanes, so the rounds
+ * themselves run four-wide, not only the message schedule.
+ */
+static void TARGET("avx2")
+sha512_blocks_x4_avx2(uint64_t state[8][4], const uint8_t* const in[4],
+                      uint64_t nblocks)
+{
+  __m256i a, b, c, d, e, f, g, h, T1, T2;
+  __m256i W[16];
+  uint64_t off;
+  int t;
+
+  for (off = 0; off < nblocks * 128; off += 128) {
+    for (t = 0; t < 16; t++)
+      W[t] = _mm256_set_epi64x(load_bigendian(in[3] + off + 8*t),
+                               load_bigendian(in[2] + off + 8*t),
+                               load_bigendian(in[1] + off + 8*t),
+                               load_bigendian(in[0] + off + 8*t));
+
+    a = _mm256_loadu_si256((const __m256i*)state[0]);
+    b = _mm256_loadu_si256((const __m256i*)state[1]);
+    c = _mm256_loadu_si256((const __m256i*)state[2]);
+    d = _mm256_loadu_si256((const __m256i*)state[3]);
+    e = _mm256_loadu_si256((const __m256i*)state[4]);
+    f = _mm256_loadu_si256((const __m256i*)state[5]);
+    g = _mm256_loadu_si256((const __m256i*)state[6]);
+    h = _mm256_loadu_si256((const __m256i*)state[7]);
+
+    for (t = 0; t < 80; t++) {
+      /* Expand the schedule in place, in a ring of 16 words */
+      if (t >= 16)
+        W[t & 15] = VADD(VADD(W[t & 15], vsigma1(W[(t - 2) & 15])),
+                         VADD(W[(t - 7) & 15], vsigma0(W[(t - 15) & 15])));
+
+      T1 = VADD(VADD(h, vSigma1(e)),
+                VADD(vCh(e,f,g), VADD(_mm256_set1_epi64x(sha512_K[t]), W[t & 15])));
+      T2 = VADD(vSigma0(a), vMaj(a,b,c));
+      h = g;
+      g = f;
+      f = e;
+      e = VADD(d, T1);
+      d = c;
+      c = b;
+      b = a;
+      a = VADD(T1, T2);
+    }
+
+#define FOLD(i, x) \
+    _mm256_storeu_si256((__m256i*)state[i], \
+      VADD(_mm256_loadu_si256((const __m256i*)state[i]), x))
+    FOLD(0, a); FOLD(1, b); FOLD(2, c); FOLD(3, d);
+    FOLD(4, e); FOLD(5, f); FOLD(6, g); FOLD(7, h);
+#undef FOLD
+  }
+}
+
+#undef VROTR
+#undef VSHR
+#undef VXOR3
+#undef VADD
+#undef vCh
+#undef vMaj
+#undef vSigma0
+#undef vSigma1
+#undef vsigma0
+#undef vsigma1
+
+#endif /* !EDSIGN_X86_SIMD */
+
+/* -------------------------------------------------------------------------- */
+/* -- Dispatch -------------------------------------------------------------- */
+
+/* Compress ${nblocks} 128-byte blocks at ${in} into ${state}. */
+static void
+sha512_blocks(uint64_t state[8], const uint8_t* in, uint64_t nblocks)
+{
+#if defined(EDSIGN_X86_SIMD)
+  if (edsign_cpu_features() & EDSIGN_CPU_AVX2) {
+    sha512_blocks_avx2(state, in, nblocks);
+    return;
+  }
+#endif
+
+  sha512_blocks_ref(state, in, nblocks);
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Public API ------------------------------------------------------------ */
+
+static const uint64_t sha512_iv[8] = {
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+  0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+  0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+/*
+ * Pad the final ${inlen} (less than 128) bytes of a ${bytes} byte long
+ * message at ${in} into ${padded}, and return the number of blocks
+ * (one or two) the padding occupies.
+ */
+static uint64_t
+sha512_pad(uint8_t padded[256], const uint8_t* in, uint64_t inlen,
+           uint64_t bytes)
+{
+  uint64_t i;
+
+  for (i = 0;i < inlen;++i) padded[i] = in[i];
+  padded[inlen] = 0x80;
+
+  if (inlen < 112) {
+    for (i = inlen + 1;i < 119;++i) padded[i] = 0;
+    padded[119] = bytes >> 61;
+    padded[120] = bytes >> 53;
+    padded[121] = bytes >> 45;
+    padded[122] = bytes >> 37;
+    padded[123] = bytes >> 29;
+    padded[124] = bytes >> 21;
+    padded[125] = bytes >> 13;
+    padded[126] = bytes >> 5;
+    padded[127] = bytes << 3;
+    return 1;
+  } else {
+    for (i = inlen + 1;i < 247;++i) padded[i] = 0;
+    padded[247] = bytes >> 61;
+    padded[248] = bytes >> 53;
+    padded[249] = bytes >> 45;
+    padded[250] = bytes >> 37;
+    padded[251] = bytes >> 29;
+    padded[252] = bytes >> 21;
+    padded[253] = bytes >> 13;
+    padded[254] = bytes >> 5;
+    padded[255] = bytes << 3;
+    return 2;
+  }
+}
+
+/**
+ * crypto_hash_sha512(out, in, inlen):
+ * Compute the SHA-512 digest of the ${inlen} bytes at ${in}, and store
+ * it in ${out}. The block function is picked at runtime: an AVX2
+ * message schedule where the CPU supports it, or the portable, fully
+ * unrolled reference code otherwise.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512(uint8_t* out, const uint8_t* in, uint64_t inlen)
+{
+  uint64_t h[8];
+  uint8_t padded[256];
+  uint64_t i, npad;
+
+  for (i = 0;i < 8;++i) h[i] = sha512_iv[i];
+
+  sha512_blocks(h, in, inlen / 128);
+  npad = sha512_pad(padded, in + (inlen & ~(uint64_t)127), inlen & 127, inlen);
+  sha512_blocks(h, padded, npad);
+
+  for (i = 0;i < 8;++i) store_bigendian(out + 8*i, h[i]);
+
+  return 0;
+}
+
+/**
+ * crypto_hash_sha512_init(st):
+ * Initialize the incremental SHA-512 state ${st}.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512_init(crypto_hash_sha512_state* st)
+{
+  uint64_t i;
+
+  for (i = 0;i < 8;++i) st->state[i] = sha512_iv[i];
+  st->count = 0;
+
+  return 0;
+}
+
+/**
+ * crypto_hash_sha512_update(st, in, inlen):
+ * Absorb the ${inlen} bytes at ${in} into ${st}. Full blocks are
+ * compressed directly from ${in}; only a trailing partial block is
+ * copied into the state.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512_update(crypto_hash_sha512_state* st,
+                          const uint8_t* in, uint64_t inlen)
+{
+  uint64_t used = st->count & 127;
+  uint64_t fill = 128 - used;
+
+  st->count += inlen;
+
+  /* Complete a buffered partial block first */
+  if (used > 0) {
+    if (inlen < fill) {
+      memcpy(st->buf + used, in, inlen);
+      return 0;
+    }
+    memcpy(st->buf + used, in, fill);
+    sha512_blocks(st->state, st->buf, 1);
+    in += fill;
+    inlen -= fill;
+  }
+
+  if (inlen >= 128) {
+    sha512_blocks(st->state, in, inlen / 128);
+    in += inlen & ~(uint64_t)127;
+    inlen &= 127;
+  }
+
+  memcpy(st->buf, in, inlen);
+  return 0;
+}
+
+/**
+ * crypto_hash_sha512_final(st, out):
+ * Pad and finish the hash held in ${st}, store the 64-byte digest in
+ * ${out}, and wipe ${st}.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512_final(crypto_hash_sha512_state* st, uint8_t* out)
+{
+  uint8_t padded[256];
+  uint64_t i, npad;
+
+  npad = sha512_pad(padded, st->buf, st->count & 127, st->count);
+  sha512_blocks(st->state, padded, npad);
+
+  for (i = 0;i < 8;++i) store_bigendian(out + 8*i, st->state[i]);
+
+  /* The inputs may be secret (e.g. nonce derivation) */
+  edsign_bzero(padded, sizeof(padded));
+  edsign_bzero((uint8_t*)st, sizeof(*st));
+  return 0;
+}
+
+/**
+ * crypto_hash_sha512_x4(out, in, inlen):
+ * Compute the SHA-512 digests of the four messages in[0] ... in[3],
+ * which all have the same length ${inlen}, and store them in out[0]
+ * ... out[3]. With AVX2 the four messages are hashed in parallel, one
+ * per 64-bit lane; otherwise this is four calls to crypto_hash_sha512.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512_x4(uint8_t* const out[4], const uint8_t* const in[4],
+                      uint64_t inlen)
+{
+  int i;
+
+#if defined(EDSIGN_X86_SIMD)
+  if (edsign_cpu_features() & EDSIGN_CPU_AVX2) {
+    uint64_t h[8][4];
+    uint8_t padded[4][256];
+    const uint8_t* tail[4];
+    uint64_t npad = 0;
+    int j;
+
+    for (i = 0; i < 8; ++i)
+      for (j = 0; j < 4; ++j) h[i][j] = sha512_iv[i];
+
+    sha512_blocks_x4_avx2(h, in, inlen / 128);
+    for (j = 0; j < 4; ++j) {
+      npad = sha512_pad(padded[j], in[j] + (inlen & ~(uint64_t)127),
+                        inlen & 127, inlen);
+      tail[j] = padded[j];
+    }
+    sha512_blocks_x4_avx2(h, tail, npad);
+
+    for (j = 0; j < 4; ++j)
+      for (i = 0; i < 8; ++i) store_bigendian(out[j] + 8*i, h[i][j]);
+
+    /* The inputs may be secret (e.g. nonce derivation) */
+    edsign_bzero(padded[0], sizeof(padded));
+    return 0;
+  }
+#endif
+
+  for (i = 0; i < 4; ++i) crypto_hash_sha512(out[i], in[i], inlen);
+  return 0;
+}
+
+#undef SHR
+#undef ROTR
+#undef Ch
+#undef Maj
+#undef Sigma0
+#undef Sigma1
+#undef sigma0
+#undef sigma1
+#undef M
+#undef EXPAND
+#undef F
@@ -0,0 +1,77 @@
+/*
+** SHA-512 hash function.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+**
+** Portable code taken verbatim from SUPERCOP sha512 reference
+** implementation, released in public domain. See LICENSE.txt.
+*/
+
+#ifndef _EDSIGN_SHA512_H_
+#define _EDSIGN_SHA512_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define crypto_hash_sha512_BYTES 64
+
+/* Incremental SHA-512 state: the chaining value, the total number of
+** bytes absorbed so far, and the partial block not yet compressed. */
+typedef struct crypto_hash_sha512_state {
+  uint64_t state[8];
+  uint64_t count;
+  uint8_t  buf[128];
+} crypto_hash_sha512_state;
+
+/**
+ * crypto_hash_sha512(out, in, inlen):
+ * Compute the SHA-512 digest of the ${inlen} bytes at ${in}, and store
+ * it in ${out}. The block function is picked at runtime: an AVX2
+ * message schedule where the CPU supports it, or the portable, fully
+ * unrolled reference code otherwise.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512(uint8_t* out, const uint8_t* in, uint64_t inlen);
+
+/**
+ * crypto_hash_sha512_init(st):
+ * Initialize the incremental SHA-512 state ${st}.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512_init(crypto_hash_sha512_state* st);
+
+/**
+ * crypto_hash_sha512_update(st, in, inlen):
+ * Absorb the ${inlen} bytes at ${in} into ${st}. Full blocks are
+ * compressed directly from ${in}; only a trailing partial block is
+ * copied into the state.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512_update(crypto_hash_sha512_state* st,
+                          const uint8_t* in, uint64_t inlen);
+
+/**
+ * crypto_hash_sha512_final(st, out):
+ * Pad and finish the hash held in ${st}, store the 64-byte digest in
+ * ${out}, and wipe ${st}.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512_final(crypto_hash_sha512_state* st, uint8_t* out);
+
+/**
+ * crypto_hash_sha512_x4(out, in, inlen):
+ * Compute the SHA-512 digests of the four messages in[0] ... in[3],
+ * which all have the same length ${inlen}, and store them in out[0]
+ * ... out[3]. With AVX2 the four messages are hashed in parallel, one
+ * per 64-bit lane; otherwise this is four calls to crypto_hash_sha512.
+ */
+EDSIGN_STATIC int
+crypto_hash_sha512_x4(uint8_t* const out[4], const uint8_t* const in[4],
+                      uint64_t inlen);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* !_EDSIGN_SHA512_H_ */
@@ -10,51 +10,41 @@
 #include "edsign-private.h"
 #include "randombytes.h"
 #include "ed25519.h"
-#include "scrypt.h"
+#include "kdf.h"
 #include "blake2.h"
 #include "keypair.h"
 #include "util.h"
+#include "mem.h"
+#include "thread.h"
 
 #define PKALG "Ed"
-#define KDFALG "SK"
 
-/**
- * edsign_sign(pass, passlen, sk, msg, msglen, sig):
- *
- * Sign a message ${msg} with the secret key ${sk} (optionally
- * encrypted using ${pass}) and return the signature ${sig} of the
- * resulting message. ${msg}, ${sk} and ${sig} can not be NULL.
- *
- * The signature ${sig} must be at least edsign_sign_BYTES in size.
- *
- * - Returns EDSIGN_EINVAL if the arguments are invalid
- * - Returns EDSIGN_EPASSWD if the password is invalid
- * - Returns EDSIGN_OK under normal circumstances
- */
-int
-edsign_sign(const uint8_t* pass, const uint64_t passlen,
-            const uint8_t* sk,
-            const uint8_t* msg, const uint64_t msglen,
-            uint8_t* out)
+/* Where the fingerprint lies in a secret key */
+#define SK_FP_OFFSET 40
+
+/* Number of messages whose digests are held at once by
+** edsign_sign_batch */
+#define SIGN_BATCH_CHUNK 64
+
+/* Decrypt the secret key ${sk} with the password ${pass}, if it is
+** not NULL, into ${key}, deriving the keystream with ${ctx}, and check
+** the result against the key digest. Return EDSIGN_OK, or the error
+** edsign_sign_ctx fails with. */
+static int
+sign_open(edsign_kdf_ctx* ctx, const uint8_t* pass, const uint64_t passlen,
+          const uint8_t* sk, uint8_t* key)
 {
-  uint32_t N, r, p;
+  uint32_t params[3];
   uint8_t* pp;
-  uint8_t* pout;
+  uint8_t* alg;
   uint8_t* salt;
   uint8_t* digest;
-  uint8_t* fp; /* fingerprint */
   uint8_t* enckey;
-  uint8_t key[crypto_sign_ed25519_SECRETKEYBYTES];
   uint8_t hash[crypto_hash_blake2b_BYTES];
-  uint8_t sig[crypto_hash_blake2b_BYTES + crypto_sign_ed25519_BYTES];
-  uint64_t siglen;
   uint64_t i;
   int res = EDSIGN_ERROR;
 
-  /* All arguments must be valid */
-  if (msg == NULL) return EDSIGN_EINVAL;
-  if (out == NULL) return EDSIGN_EINVAL;
-  if (sk  == NULL) return EDSIGN_EINVAL;
+  if (sk == NULL) return EDSIGN_EINVAL;
 
   pp = (uint8_t*)sk;
 
@@ -62,66 +52,749 @@ edsign_sign(const uint8_t* pass, const uint64_t passlen,
   if (0 != edsign_memcmp(pp, (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
   pp += 2;
 
-  if (0 != edsign_memcmp(pp, (uint8_t*)KDFALG, 2)) return EDSIGN_EINVAL;
-  pp += 2;
+  if (!edsign_kdf_known(pp)) return EDSIGN_EINVAL;
+  alg = pp; pp += 2;
 
-  /* scrypt parameters */
-  N = edsign_le32dec(pp); pp += 4;
-  r = edsign_le32dec(pp); pp += 4;
-  p = edsign_le32dec(pp); pp += 4;
+  /* Key derivation parameters */
+  for (i = 0; i < 3; ++i) {
+    params[i] = edsign_le32dec(pp); pp += 4;
+  }
 
-  /* Key parameters */
+  /* Key parameters; the fingerprint follows the digest */
   salt   = pp; pp += 16;
-  digest = pp; pp += 8;
-  fp     = pp; pp += 8;
+  digest = pp; pp += 8 + 8;
   enckey = pp;
 
   /* Derive keystream from passphrase if provided. */
   if (pass != NULL) {
-    uint64_t pow2N = ((uint64_t)1) << N;
-    res = crypto_scrypt(pass, passlen, salt, 16, pow2N, r, p,
-                        key, sizeof(key));
-    if (res != 0) {
-      res = EDSIGN_EINVAL;
+    res = edsign_kdf(ctx, alg, pass, passlen, salt, params,
+                     key, crypto_sign_ed25519_SECRETKEYBYTES);
+    if (res != EDSIGN_OK) {
       goto exit;
     }
   }
   else {
     /* If there's no key, zero the keystream buffer. */
-    edsign_bzero(key, sizeof(key));
+    edsign_bzero(key, crypto_sign_ed25519_SECRETKEYBYTES);
   }
 
   /* Decrypt secret key (iff password was provided) */
-  for (i = 0; i < sizeof(key); ++i) key[i] ^= enckey[i];
+  for (i = 0; i < crypto_sign_ed25519_SECRETKEYBYTES; ++i)
+    key[i] ^= enckey[i];
 
   /* Compute and check secret key digest */
-  crypto_hash_blake2b(hash, key, sizeof(key));
+  crypto_hash_blake2b_64(hash, key);
   if (0 != edsign_memcmp(hash, digest, 8)) {
     res = EDSIGN_EPASSWD;
     goto exit;
   }
 
-  /* Hash the message and sign the hash. */
-  crypto_hash_blake2b(hash, msg, msglen);
-  /* Note: the first 64 bytes of a signed Ed25519 message constitute
-  ** the signature by itself. See memcpy below. */
-  crypto_sign_ed25519(sig, &siglen, hash, sizeof(hash), key);
-  assert(siglen == sizeof(sig));
+  res = EDSIGN_OK;
+ exit:
+  edsign_bzero(hash, sizeof(hash));
+  return res;
+}
 
-  /* Write signature */
+/* Unlock ${sk} with ${pass}, through ${ctx}, and write to ${out} the
+** signature of the message whose digest is ${hash}. */
+static int
+sign_hash(edsign_kdf_ctx* ctx,
+          const uint8_t* pass, const uint64_t passlen,
+          const uint8_t* sk, const uint8_t* hash,
+          uint8_t* out)
+{
+  uint8_t key[crypto_sign_ed25519_SECRETKEYBYTES];
+  uint8_t* fp; /* fingerprint */
+  uint8_t* pout;
+  int res;
+
+  res = sign_open(ctx, pass, passlen, sk, key);
+  if (res != EDSIGN_OK) goto exit;
+  fp = (uint8_t*)sk + SK_FP_OFFSET;
+
+  /* Write signature: header, then sign the hash straight into ${out} */
   pout = out;
   memcpy(pout, PKALG, 2); pout += 2;
   memcpy(pout, fp, 8);    pout += 8;
-  memcpy(pout, sig, 64);
+  crypto_sign_ed25519_detached(pout, hash, crypto_hash_blake2b_BYTES, key);
 
-  edsign_bzero(sig, sizeof(sig));
   res = EDSIGN_OK;
  exit:
   edsign_bzero(key, sizeof(key));
+  return res;
+}
+
+/**
+ * edsign_sign(pass, passlen, sk, msg, msglen, sig):
+ *
+ * Sign a message ${msg} with the secret key ${sk} (optionally
+ * encrypted using ${pass}) and return the signature ${sig} of the
+ * resulting message. ${msg}, ${sk} and ${sig} can not be NULL. The
+ * key derivation function ${sk} was encrypted with, scrypt or
+ * Argon2id, is read from ${sk} itself.
+ *
+ * The signature ${sig} must be at least edsign_sign_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_EPASSWD if the password is invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_sign(const uint8_t* pass, const uint64_t passlen,
+            const uint8_t* sk,
+            const uint8_t* msg, const uint64_t msglen,
+            uint8_t* out)
+{
+  return edsign_sign_ctx(NULL, pass, passlen, sk, msg, msglen, out);
+}
+
+/**
+ * edsign_sign_ctx(ctx, pass, passlen, sk, msg, msglen, sig):
+ *
+ * As edsign_sign, but unlocking ${sk} with the working memory, time
+ * limit, and cancellation of ${ctx} (see edsign_kdf_ctx_new). If
+ * ${ctx} is NULL, this is exactly edsign_sign.
+ *
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ */
+int
+edsign_sign_ctx(edsign_kdf_ctx* ctx,
+                const uint8_t* pass, const uint64_t passlen,
+                const uint8_t* sk,
+                const uint8_t* msg, const uint64_t msglen,
+                uint8_t* out)
+{
+  uint8_t hash[crypto_hash_blake2b_BYTES];
+  int res;
+
+  /* All arguments must be valid */
+  if (msg == NULL) return EDSIGN_EINVAL;
+  if (out == NULL) return EDSIGN_EINVAL;
+
+  /* Hash the message, and sign the hash */
+  crypto_hash_blake2b(hash, msg, msglen);
+  res = sign_hash(ctx, pass, passlen, sk, hash, out);
+
   edsign_bzero(hash, sizeof(hash));
   return res;
 }
 
+/**
+ * edsign_digest(msg, msglen, digest):
+ *
+ * Compute the digest of the message ${msg} (of size ${msglen}) that
+ * edsign_sign and edsign_verify sign and verify, the unkeyed
+ * BLAKE2b-512 hash of ${msg}, and store it in ${digest}, which must be
+ * at least edsign_digest_BYTES in size. ${msg} and ${digest} can not
+ * be NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_digest(const uint8_t* msg, const uint64_t msglen, uint8_t* digest)
+{
+  if (msg    == NULL) return EDSIGN_EINVAL;
+  if (digest == NULL) return EDSIGN_EINVAL;
+
+  crypto_hash_blake2b(digest, msg, msglen);
+  return EDSIGN_OK;
+}
+
+/**
+ * edsign_sign_digest(pass, passlen, sk, digest, sig):
+ *
+ * As edsign_sign, but for a message whose digest ${digest} (see
+ * edsign_digest) is already known: the signature is the one
+ * edsign_sign makes for the message itself. ${digest}, ${sk} and
+ * ${sig} can not be NULL, and ${digest} must be edsign_digest_BYTES
+ * in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_EPASSWD if the password is invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_sign_digest(const uint8_t* pass, const uint64_t passlen,
+                   const uint8_t* sk, const uint8_t* digest,
+                   uint8_t* out)
+{
+  return edsign_sign_digest_ctx(NULL, pass, passlen, sk, digest, out);
+}
+
+/**
+ * edsign_sign_digest_ctx(ctx, pass, passlen, sk, digest, sig):
+ *
+ * As edsign_sign_digest, but unlocking ${sk} with the working memory,
+ * time limit, and cancellation of ${ctx} (see edsign_kdf_ctx_new), as
+ * edsign_sign_ctx does. If ${ctx} is NULL, this is exactly
+ * edsign_sign_digest.
+ *
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ */
+int
+edsign_sign_digest_ctx(edsign_kdf_ctx* ctx,
+                       const uint8_t* pass, const uint64_t passlen,
+                       const uint8_t* sk, const uint8_t* digest,
+                       uint8_t* out)
+{
+  if (digest == NULL) return EDSIGN_EINVAL;
+  if (out    == NULL) return EDSIGN_EINVAL;
+
+  return sign_hash(ctx, pass, passlen, sk, digest, out);
+}
+
+/* -------------------------------------------------------------------------- */
+/* -- Nonce pools ----------------------------------------------------------- */
+
+#if !defined(OS_WINDOWS)
+
+/* Nonces precomputed for one unlocked key by a background thread,
+** which refills the ring ${n} whenever it runs down to ${refill}
+** entries. Each nonce is handed out once and wiped from the ring as it
+** is taken. The pool lives in memory from edsign_secure_alloc, like
+** the key, with the ring on pages of its own after it, which a child
+** process gets wiped where the OS allows. A child never uses the pool
+** it inherits anyway, since it would hand out the nonces its parent
+** does, and has no thread to refill it. */
+struct sk_pool {
+  edsign_region R;
+  pthread_mutex_t lock;
+  pthread_cond_t  more; /* Signalled when nonces are added */
+  pthread_cond_t  less; /* Signalled when the ring needs refilling */
+  pthread_t tid;
+  const crypto_sign_ed25519_expanded* k;
+  uint32_t size;        /* Entries in the ring */
+  uint32_t refill;      /* Refill once this few are left */
+  uint32_t when_empty;  /* One of EDSIGN_POOL_* */
+  uint32_t head;        /* The next nonce to hand out */
+  uint32_t count;       /* Nonces left in the ring */
+  uint64_t ctr;         /* Nonces made so far */
+  pid_t pid;            /* The process which started the pool */
+  int stop;
+  crypto_sign_ed25519_nonce* n;
+};
+
+static void*
+sk_pool_thread(void* p)
+{
+  struct sk_pool* P = p;
+  crypto_sign_ed25519_nonce n;
+  uint8_t rnd[32];
+  uint64_t ctr;
+
+  pthread_mutex_lock(&P->lock);
+  while (!P->stop) {
+    if (P->count > P->refill) {
+      pthread_cond_wait(&P->less, &P->lock);
+      continue;
+    }
+
+    /* Only this thread adds nonces, so there is still room for the
+       one made outside the lock once it is done */
+    while (!P->stop && P->count < P->size) {
+      ctr = P->ctr++;
+      pthread_mutex_unlock(&P->lock);
+      edsign_randombytes(rnd, sizeof(rnd));
+      crypto_sign_ed25519_make_nonce(&n, P->k, rnd, ctr);
+      pthread_mutex_lock(&P->lock);
+
+      P->n[(P->head + P->count) % P->size] = n;
+      P->count++;
+      pthread_cond_broadcast(&P->more);
+    }
+  }
+  pthread_mutex_unlock(&P->lock);
+
+  edsign_bzero((uint8_t*)&n, sizeof(n));
+  edsign_bzero(rnd, sizeof(rnd));
+  return NULL;
+}
+
+/* Whether ${P} was inherited from the parent of a forked process */
+static int
+sk_pool_forked(const struct sk_pool* P)
+{
+  return P->pid != getpid();
+}
+
+/* Take the next nonce of ${P} into ${n}, waiting for one if it is empty
+** and should be waited for. Return EDSIGN_OK, or EDSIGN_EBUSY if the
+** pool is empty. */
+static int
+sk_pool_take(struct sk_pool* P, crypto_sign_ed25519_nonce* n)
+{
+  int res = EDSIGN_OK;
+
+  pthread_mutex_lock(&P->lock);
+  if (P->when_empty == EDSIGN_POOL_WAIT)
+    while (P->count == 0) pthread_cond_wait(&P->more, &P->lock);
+
+  if (P->count == 0) res = EDSIGN_EBUSY;
+  else {
+    *n = P->n[P->head];
+    edsign_bzero((uint8_t*)&P->n[P->head], sizeof(*n));
+    P->head = (P->head + 1) % P->size;
+    if (--P->count <= P->refill) pthread_cond_signal(&P->less);
+  }
+  pthread_mutex_unlock(&P->lock);
+
+  return res;
+}
+
+/* Start a pool of ${size} nonces for ${k}. Return it, or NULL if it
+** could not be allocated or its thread not started. */
+static struct sk_pool*
+sk_pool_start(const crypto_sign_ed25519_expanded* k, const uint32_t size,
+              const uint32_t refill, const uint32_t when_empty)
+{
+  edsign_region R;
+  struct sk_pool* P;
+  uint64_t mem, ring, page;
+  long pg = sysconf(_SC_PAGESIZE);
+
+  page = (pg > 0) ? (uint64_t)pg : 4096;
+  ring = (sizeof(struct sk_pool) + page - 1) / page * page;
+  mem  = ring + (uint64_t)size * sizeof(crypto_sign_ed25519_nonce);
+  if (mem > SIZE_MAX) return NULL;
+  if ((P = edsign_secure_alloc(&R, (size_t)mem)) == NULL) return NULL;
+#if defined(MADV_WIPEONFORK)
+  (void)madvise((uint8_t*)P + ring, (size_t)(mem - ring), MADV_WIPEONFORK);
+#endif
+
+  P->R          = R;
+  P->k          = k;
+  P->size       = size;
+  P->refill     = refill;
+  P->when_empty = when_empty;
+  P->head       = 0;
+  P->count      = 0;
+  P->ctr        = 0;
+  P->pid        = getpid();
+  P->stop       = 0;
+  P->n          = (crypto_sign_ed25519_nonce*)((uint8_t*)P + ring);
+
+  if (pthread_mutex_init(&P->lock, NULL) != 0) goto free;
+  if (pthread_cond_init(&P->more, NULL) != 0) goto mutex;
+  if (pthread_cond_init(&P->less, NULL) != 0) goto more;
+  if (pthread_create(&P->tid, NULL, sk_pool_thread, P) != 0) goto less;
+  return P;
+
+ less:
+  pthread_cond_destroy(&P->less);
+ more:
+  pthread_cond_destroy(&P->more);
+ mutex:
+  pthread_mutex_destroy(&P->lock);
+ free:
+  edsign_secure_free(&P->R);
+  return NULL;
+}
+
+/* Stop the thread of ${P}, and wipe and free it. In a child process
+** the thread and the state of the lock belong to the parent, and the
+** pool is only wiped and freed. */
+static void
+sk_pool_stop(struct sk_pool* P)
+{
+  if (sk_pool_forked(P)) {
+    edsign_secure_free(&P->R);
+    return;
+  }
+
+  pthread_mutex_lock(&P->lock);
+  P->stop = 1;
+  pthread_cond_signal(&P->less);
+  pthread_mutex_unlock(&P->lock);
+  pthread_join(P->tid, NULL);
+
+  pthread_cond_destroy(&P->less);
+  pthread_cond_destroy(&P->more);
+  pthread_mutex_destroy(&P->lock);
+  edsign_secure_free(&P->R);
+}
+
+#else
+
+/* Without threads to fill them, there are no pools */
+static int
+sk_pool_forked(const struct sk_pool* P)
+{
+  (void)P;
+  return 0;
+}
+
+static int
+sk_pool_take(struct sk_pool* P, crypto_sign_ed25519_nonce* n)
+{
+  (void)P;
+  (void)n;
+  return EDSIGN_EBUSY;
+}
+
+static struct sk_pool*
+sk_pool_start(const crypto_sign_ed25519_expanded* k, const uint32_t size,
+              const uint32_t refill, const uint32_t when_empty)
+{
+  (void)k;
+  (void)size;
+  (void)refill;
+  (void)when_empty;
+  return NULL;
+}
+
+static void
+sk_pool_stop(struct sk_pool* P)
+{
+  (void)P;
+}
+
+#endif /* !OS_WINDOWS */
+
+/* -------------------------------------------------------------------------- */
+/* -- Unlocked secret keys -------------------------------------------------- */
+
+/* An unlocked secret key, living in memory from edsign_secure_alloc.
+** Only edsign_sk_pool writes to it after edsign_sk_unlock, so any
+** number of threads may sign with it at once. */
+struct edsign_sk {
+  edsign_region R; /* The memory holding this handle */
+  crypto_sign_ed25519_expanded k; /* Scalar a, nonce prefix z, and A */
+  uint8_t fp[8];                  /* Fingerprint */
+  struct sk_pool* pool;           /* Precomputed nonces, or NULL */
+};
+
+/**
+ * edsign_sk_unlock(ctx, pass, passlen, sk, handle):
+ *
+ * Decrypt the secret key ${sk} with the password ${pass} once, and
+ * store in ${handle} a handle for edsign_sign_with, which signs
+ * without deriving the key again. The handle holds the decrypted key
+ * and its expansion in memory locked into RAM where the OS allows (so
+ * it is not swapped out) until edsign_sk_lock wipes and frees it. The
+ * key is derived as by edsign_sign_ctx, with ${ctx} if it is not NULL.
+ * ${sk} and ${handle} can not be NULL; on error, ${handle} is set to
+ * NULL.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the memory budget of edsign_set_kdf_limits
+ *   is exhausted
+ * - Returns EDSIGN_ECANCELED if the derivation was cancelled or ran
+ *   out of time
+ * - Returns EDSIGN_EPASSWD if the password is invalid
+ * - Returns EDSIGN_ERROR if memory could not be allocated
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_sk_unlock(edsign_kdf_ctx* ctx,
+                 const uint8_t* pass, const uint64_t passlen,
+                 const uint8_t* sk, edsign_sk** handle)
+{
+  uint8_t key[crypto_sign_ed25519_SECRETKEYBYTES];
+  edsign_region R;
+  edsign_sk* h;
+  int res;
+
+  if (handle == NULL) return EDSIGN_EINVAL;
+  *handle = NULL;
+
+  res = sign_open(ctx, pass, passlen, sk, key);
+  if (res != EDSIGN_OK) goto exit;
+
+  if ((h = edsign_secure_alloc(&R, sizeof(edsign_sk))) == NULL) {
+    res = EDSIGN_ERROR;
+    goto exit;
+  }
+
+  h->R = R;
+  crypto_sign_ed25519_expand(&h->k, key);
+  memcpy(h->fp, sk + SK_FP_OFFSET, sizeof(h->fp));
+  h->pool = NULL;
+  *handle = h;
+
+ exit:
+  edsign_bzero(key, sizeof(key));
+  return res;
+}
+
+/**
+ * edsign_sign_with(handle, msg, msglen, sig):
+ *
+ * Sign a message ${msg} with the secret key unlocked in ${handle} by
+ * edsign_sk_unlock, and return the signature ${sig}, exactly as
+ * edsign_sign would with the key and its password. The key is kept
+ * expanded in the handle, so neither the key digest nor its SHA-512
+ * expansion is recomputed: each signature costs two hashes and one
+ * base point multiplication. This makes handles worthwhile even for
+ * unencrypted keys. If the handle has a nonce pool (see edsign_sk_pool),
+ * the signature uses the next nonce from it instead, which leaves only
+ * the hashes. Several threads may sign with the same handle at once.
+ * ${handle}, ${msg} and ${sig} can not be NULL.
+ *
+ * The signature ${sig} must be at least edsign_sign_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EBUSY if the nonce pool is empty, and was set up
+ *   with EDSIGN_POOL_FAIL
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_sign_with(const edsign_sk* handle,
+                 const uint8_t* msg, const uint64_t msglen,
+                 uint8_t* out)
+{
+  uint8_t hash[crypto_hash_blake2b_BYTES];
+  crypto_sign_ed25519_nonce n;
+  uint8_t* pout;
+  int res = EDSIGN_EBUSY;
+
+  if (handle == NULL) return EDSIGN_EINVAL;
+  if (msg == NULL)    return EDSIGN_EINVAL;
+  if (out == NULL)    return EDSIGN_EINVAL;
+
+  if (handle->pool != NULL && !sk_pool_forked(handle->pool)) {
+    res = sk_pool_take(handle->pool, &n);
+    if (res != EDSIGN_OK && handle->pool->when_empty == EDSIGN_POOL_FAIL)
+      return res;
+  }
+
+  crypto_hash_blake2b(hash, msg, msglen);
+
+  pout = out;
+  memcpy(pout, PKALG, 2);       pout += 2;
+  memcpy(pout, handle->fp, 8);  pout += 8;
+  if (res == EDSIGN_OK) {
+    crypto_sign_ed25519_detached_nonce(pout, hash, sizeof(hash),
+                                       &handle->k, &n);
+    edsign_bzero((uint8_t*)&n, sizeof(n));
+  }
+  else
+    crypto_sign_ed25519_detached_expanded(pout, hash, sizeof(hash),
+                                          &handle->k);
+
+  edsign_bzero(hash, sizeof(hash));
+  return EDSIGN_OK;
+}
+
+/* The arguments of one edsign_sign_batch call, split into chunks of
+** SIGN_BATCH_CHUNK messages for edsign_parallel_for */
+struct sign_batch {
+  const edsign_sk* handle;
+  const uint8_t* const* msgs;
+  const uint64_t* msglens;
+  uint64_t n;
+  uint8_t* const* sigs;
+};
+
+/* Sign chunk ${chunk} of ${arg}, a struct sign_batch */
+static void
+sign_batch_chunk(void* arg, uint32_t worker, uint64_t chunk)
+{
+  const struct sign_batch* B = arg;
+  uint8_t hash[SIGN_BATCH_CHUNK][crypto_hash_blake2b_BYTES];
+  const uint8_t* bmsg[SIGN_BATCH_CHUNK];
+  uint8_t* bsig[SIGN_BATCH_CHUNK];
+  uint64_t i, j, k;
+
+  (void)worker;
+  i = chunk * SIGN_BATCH_CHUNK;
+  k = (B->n - i < SIGN_BATCH_CHUNK) ? (B->n - i) : SIGN_BATCH_CHUNK;
+
+  for (j = 0; j < k; ++j) {
+    crypto_hash_blake2b(hash[j], B->msgs[i+j], B->msglens[i+j]);
+    memcpy(B->sigs[i+j], PKALG, 2);
+    memcpy(B->sigs[i+j] + 2, B->handle->fp, 8);
+    bmsg[j] = hash[j];
+    bsig[j] = B->sigs[i+j] + 10;
+  }
+  crypto_sign_ed25519_detached_batch(bsig, bmsg, k, &B->handle->k);
+
+  edsign_bzero((uint8_t*)hash, sizeof(hash));
+}
+
+/**
+ * edsign_sign_batch(handle, msgs, msglens, n, sigs):
+ *
+ * Sign ${n} messages at once with the secret key unlocked in ${handle}:
+ * for each i, store in ${sigs}[i] the signature of the message
+ * ${msgs}[i] (of size ${msglens}[i]) that edsign_sign_with would make
+ * without a nonce pool. The key is set up once for all of them, their
+ * hashes are computed several messages at a time, and the points of
+ * their signatures are encoded together, which makes this faster than
+ * signing them one by one. The messages are signed in chunks of 64,
+ * spread over as many threads as edsign_set_threads allows. The nonce
+ * pool of ${handle}, if any, is not used. The arrays can not be NULL
+ * if ${n} is not zero, and each ${sigs}[i] must be at least
+ * edsign_sign_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_sign_batch(const edsign_sk* handle,
+                  const uint8_t* const* msgs, const uint64_t* msglens,
+                  const uint64_t n, uint8_t* const* sigs)
+{
+  struct sign_batch B;
+  uint64_t i;
+
+  if (n == 0) return EDSIGN_OK;
+  if (handle == NULL) return EDSIGN_EINVAL;
+  if (msgs == NULL || msglens == NULL || sigs == NULL) return EDSIGN_EINVAL;
+  for (i = 0; i < n; ++i)
+    if (msgs[i] == NULL || sigs[i] == NULL) return EDSIGN_EINVAL;
+
+  B.handle  = handle;
+  B.msgs    = msgs;
+  B.msglens = msglens;
+  B.n       = n;
+  B.sigs    = sigs;
+  edsign_parallel_for(edsign_thread_limit(),
+                      (n + SIGN_BATCH_CHUNK - 1) / SIGN_BATCH_CHUNK,
+                      sign_batch_chunk, &B);
+
+  return EDSIGN_OK;
+}
+
+/* The arguments of one edsign_sign_multi call, one key per item of
+** edsign_parallel_for */
+struct sign_multi {
+  const edsign_sk* const* handles;
+  const uint8_t* hash;
+  uint8_t* const* sigs;
+};
+
+static void
+sign_multi_one(void* arg, uint32_t worker, uint64_t i)
+{
+  const struct sign_multi* M = arg;
+  uint8_t* pout = M->sigs[i];
+
+  (void)worker;
+  memcpy(pout, PKALG, 2);               pout += 2;
+  memcpy(pout, M->handles[i]->fp, 8);   pout += 8;
+  crypto_sign_ed25519_detached_expanded(pout, M->hash,
+                                        crypto_hash_blake2b_BYTES,
+                                        &M->handles[i]->k);
+}
+
+/**
+ * edsign_sign_multi(handles, n, msg, msglen, sigs):
+ *
+ * Sign the one message ${msg} (of size ${msglen}) with each of the ${n}
+ * secret keys unlocked in ${handles}, and store in ${sigs}[i] the
+ * signature edsign_sign_with would make with ${handles}[i] without a
+ * nonce pool. The message is hashed once for all of them, so signing
+ * a large message with several keys costs little more than with one;
+ * the signatures are spread over as many threads as edsign_set_threads
+ * allows. The arrays can not be NULL if ${n} is not zero, and each
+ * ${sigs}[i] must be at least edsign_sign_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_sign_multi(const edsign_sk* const* handles, const uint64_t n,
+                  const uint8_t* msg, const uint64_t msglen,
+                  uint8_t* const* sigs)
+{
+  uint8_t hash[crypto_hash_blake2b_BYTES];
+  struct sign_multi M;
+  uint64_t i;
+
+  if (n == 0) return EDSIGN_OK;
+  if (handles == NULL || sigs == NULL) return EDSIGN_EINVAL;
+  if (msg == NULL) return EDSIGN_EINVAL;
+  for (i = 0; i < n; ++i)
+    if (handles[i] == NULL || sigs[i] == NULL) return EDSIGN_EINVAL;
+
+  crypto_hash_blake2b(hash, msg, msglen);
+
+  M.handles = handles;
+  M.hash    = hash;
+  M.sigs    = sigs;
+  edsign_parallel_for(edsign_thread_limit(), n, sign_multi_one, &M);
+
+  edsign_bzero(hash, sizeof(hash));
+  return EDSIGN_OK;
+}
+
+/**
+ * edsign_sk_pool(handle, size, refill, when_empty):
+ *
+ * Give the unlocked key ${handle} a pool of ${size} nonces, which a
+ * background thread precomputes from fresh randomness, the key, and a
+ * counter, and refills whenever only ${refill} are left. edsign_sign_with
+ * then makes each signature with the next nonce from the pool, so that
+ * only hashing is left to do while signing; each nonce is used once,
+ * and is wiped as it is taken. The pool is kept in memory locked into
+ * RAM like the key. Signatures made this way are valid, but no longer
+ * deterministic: signing the same message twice gives two different
+ * signatures. When the pool is empty, ${when_empty} says what
+ * edsign_sign_with does:
+ *
+ * - EDSIGN_POOL_WAIT: wait for the thread to make the next nonce.
+ *
+ * - EDSIGN_POOL_INLINE: sign without the pool, as edsign_sign would.
+ *
+ * - EDSIGN_POOL_FAIL: fail with EDSIGN_EBUSY.
+ *
+ * Any pool ${handle} had before is stopped and wiped first, and a
+ * ${size} of 0 leaves it with none; edsign_sk_lock stops it as well.
+ * A child process never uses the pool it inherits through fork(),
+ * whose nonces its parent hands out too: edsign_sign_with signs there
+ * as edsign_sign would, until edsign_sk_pool gives the handle a pool
+ * of the child's own.
+ * This can not be called while other threads sign with ${handle}.
+ * ${handle} can not be NULL, and ${refill} must be less than ${size}.
+ * On Windows, there are no pools, and only a ${size} of 0 is accepted.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ERROR if memory could not be allocated or the
+ *   thread could not be started
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_sk_pool(edsign_sk* handle, const uint32_t size,
+               const uint32_t refill, const uint32_t when_empty)
+{
+  if (handle == NULL) return EDSIGN_EINVAL;
+  if (when_empty > EDSIGN_POOL_FAIL) return EDSIGN_EINVAL;
+  if (size != 0 && refill >= size) return EDSIGN_EINVAL;
+#if defined(OS_WINDOWS)
+  if (size != 0) return EDSIGN_EINVAL;
+#endif
+
+  if (handle->pool != NULL) {
+    sk_pool_stop(handle->pool);
+    handle->pool = NULL;
+  }
+  if (size == 0) return EDSIGN_OK;
+
+  handle->pool = sk_pool_start(&handle->k, size, refill, when_empty);
+  return (handle->pool == NULL) ? EDSIGN_ERROR : EDSIGN_OK;
+}
+
+/**
+ * edsign_sk_lock(handle):
+ *
+ * Wipe the key unlocked in ${handle}, and its nonce pool if it has
+ * one, and free the handle. ${handle} may be NULL.
+ */
+void
+edsign_sk_lock(edsign_sk* handle)
+{
+  if (handle == NULL) return;
+  if (handle->pool != NULL) sk_pool_stop(handle->pool);
+  edsign_secure_free(&handle->R);
+}
+
 /**
  * edsign_signature_fingerprint(sig, fprint):
  *
@@ -146,4 +819,5 @@ edsign_signature_fingerprint(const uint8_t* sig, uint8_t* out)
 }
 
 #undef PKALG
-#undef KDFALG
+#undef SK_FP_OFFSET
+#undef SIGN_BATCH_CHUNK
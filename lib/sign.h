@@ -19,6 +19,44 @@ int edsign_sign(const uint8_t* pass, const uint64_t passlen,
                 const uint8_t* msg, const uint64_t msglen,
                 uint8_t* out);
 
+int edsign_sign_ctx(edsign_kdf_ctx* ctx,
+                    const uint8_t* pass, const uint64_t passlen,
+                    const uint8_t* sk,
+                    const uint8_t* msg, const uint64_t msglen,
+                    uint8_t* out);
+
+int edsign_digest(const uint8_t* msg, const uint64_t msglen, uint8_t* digest);
+
+int edsign_sign_digest(const uint8_t* pass, const uint64_t passlen,
+                       const uint8_t* sk, const uint8_t* digest,
+                       uint8_t* out);
+
+int edsign_sign_digest_ctx(edsign_kdf_ctx* ctx,
+                           const uint8_t* pass, const uint64_t passlen,
+                           const uint8_t* sk, const uint8_t* digest,
+                           uint8_t* out);
+
+int edsign_sk_unlock(edsign_kdf_ctx* ctx,
+                     const uint8_t* pass, const uint64_t passlen,
+                     const uint8_t* sk, edsign_sk** handle);
+
+int edsign_sign_with(const edsign_sk* handle,
+                     const uint8_t* msg, const uint64_t msglen,
+                     uint8_t* out);
+
+int edsign_sign_batch(const edsign_sk* handle,
+                      const uint8_t* const* msgs, const uint64_t* msglens,
+                      const uint64_t n, uint8_t* const* sigs);
+
+int edsign_sign_multi(const edsign_sk* const* handles, const uint64_t n,
+                      const uint8_t* msg, const uint64_t msglen,
+                      uint8_t* const* sigs);
+
+int edsign_sk_pool(edsign_sk* handle, const uint32_t size,
+                   const uint32_t refill, const uint32_t when_empty);
+
+void edsign_sk_lock(edsign_sk* handle);
+
 int
 edsign_signature_fingerprint(const uint8_t* sig, uint8_t* out);
 
@@ -0,0 +1,342 @@
+/*
+** Worker threads for parallel key derivation and batches.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#include "edsign-private.h"
+#include "thread.h"
+
+/* Written by edsign_set_threads and read at the start of every call,
+** so a racing update takes effect at the next call. */
+static volatile uint32_t edsign_threads = 1;
+
+/* Written by edsign_set_interleave, likewise. */
+static volatile uint32_t edsign_interleave = 4;
+
+/**
+ * edsign_set_threads(nthreads):
+ *
+ * Set the maximum number of threads, ${nthreads}, that a single call
+ * into the library may use for work that can run in parallel, such
+ * as the ${p} independent lanes of scrypt, or the chunks of 64
+ * messages edsign_sign_batch and edsign_verify_batch split their
+ * work into. Each thread interleaves as many scrypt lanes as the CPU
+ * and edsign_set_interleave allow, each needing its own
+ * 128*${r}*(2^${N}) bytes of memory, so this also bounds the memory
+ * used by a call. The threads are started for each
+ * call, unless an executor is set with edsign_set_executor. The
+ * default is 1, i.e. no extra threads.
+ *
+ * - Returns EDSIGN_EINVAL if ${nthreads} is 0 or above EDSIGN_MAX_THREADS
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_set_threads(const uint32_t nthreads)
+{
+  if (nthreads == 0 || nthreads > EDSIGN_MAX_THREADS) return EDSIGN_EINVAL;
+
+  edsign_threads = nthreads;
+  return EDSIGN_OK;
+}
+
+/**
+ * edsign_thread_limit():
+ * Return the maximum number of threads a single library call may use,
+ * as set by edsign_set_threads (1 by default).
+ */
+EDSIGN_STATIC uint32_t
+edsign_thread_limit(void)
+{
+  return edsign_threads;
+}
+
+/**
+ * edsign_set_interleave(lanes):
+ *
+ * Set the most scrypt lanes, ${lanes}, that a thread interleaves to
+ * hide memory latency. Each interleaved lane needs its own
+ * 128*${r}*(2^${N}) bytes of memory, so with ${p} > 1 this trades
+ * peak memory for speed. Lanes are only interleaved where the CPU has
+ * the instructions for it: up to 4 with AVX2, 2 with SSE2, and none
+ * otherwise. The default is 4, i.e. as many as the CPU allows; 1
+ * keeps one lane in memory per thread (see edsign_set_threads).
+ *
+ * - Returns EDSIGN_EINVAL if ${lanes} is 0 or above 4
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_set_interleave(const uint32_t lanes)
+{
+  if (lanes == 0 || lanes > 4) return EDSIGN_EINVAL;
+
+  edsign_interleave = lanes;
+  return EDSIGN_OK;
+}
+
+/**
+ * edsign_interleave_limit():
+ * Return the most scrypt lanes a thread may interleave, as set by
+ * edsign_set_interleave (4 by default).
+ */
+EDSIGN_STATIC uint32_t
+edsign_interleave_limit(void)
+{
+  return edsign_interleave;
+}
+
+/* Run every item on the calling thread. */
+static void
+parallel_for_serial(uint64_t n, edsign_task_fn fn, void* arg)
+{
+  uint64_t i;
+  for (i = 0; i < n; ++i) fn(arg, 0, i);
+}
+
+#if defined(OS_WINDOWS)
+
+/* Without threads, only the default of no executor is accepted */
+int
+edsign_set_executor(edsign_submit_fn submit, void* executor)
+{
+  (void)executor;
+  return (submit == NULL) ? EDSIGN_OK : EDSIGN_EINVAL;
+}
+
+EDSIGN_STATIC void
+edsign_parallel_for(uint32_t nworkers, uint64_t n,
+                    edsign_task_fn fn, void* arg)
+{
+  (void)nworkers;
+  parallel_for_serial(n, fn, arg);
+}
+
+#else
+
+/* The executor set with edsign_set_executor, if any, read under the
+** lock at the start of every edsign_parallel_for with workers. */
+static struct {
+  pthread_mutex_t lock;
+  edsign_submit_fn submit;
+  void* executor;
+} edsign_executor = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL };
+
+/**
+ * edsign_set_executor(submit, executor):
+ *
+ * Run the extra workers of parallel calls (see edsign_set_threads) on
+ * the caller's own thread pool instead of threads of the library's
+ * own: each worker a call wants is handed to submit(${executor}, fn,
+ * job), which must arrange for fn(job) to be called once, on any
+ * thread, and return 0, or return nonzero if it can not. A call never
+ * waits for a worker to start: the calling thread processes whatever
+ * work no worker has taken, so a busy or single-threaded executor
+ * only makes the call slower. A job which starts after its call has
+ * returned finds nothing left to do. A ${submit} of NULL goes back to
+ * threads of the library's own. On Windows, there are no executors,
+ * and only a ${submit} of NULL is accepted.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_set_executor(edsign_submit_fn submit, void* executor)
+{
+  pthread_mutex_lock(&edsign_executor.lock);
+  edsign_executor.submit   = submit;
+  edsign_executor.executor = executor;
+  pthread_mutex_unlock(&edsign_executor.lock);
+  return EDSIGN_OK;
+}
+
+/* Shared state of one edsign_parallel_for call: workers claim the
+** next unprocessed item under the lock until none are left. With an
+** executor, the state lives on the heap and is freed by whoever drops
+** the last of its ${refs}, as workers may start after the call is
+** over. */
+struct parallel_for {
+  pthread_mutex_t lock;
+  pthread_cond_t  done; /* Signalled once every item is processed */
+  uint64_t next;
+  uint64_t finished;
+  uint64_t n;
+  uint32_t refs;
+  edsign_task_fn fn;
+  void* arg;
+};
+
+struct parallel_worker {
+  struct parallel_for* pf;
+  uint32_t id;
+};
+
+static void
+parallel_for_run(struct parallel_for* pf, uint32_t id)
+{
+  uint64_t item;
+
+  pthread_mutex_lock(&pf->lock);
+  while (pf->next < pf->n) {
+    item = pf->next++;
+    pthread_mutex_unlock(&pf->lock);
+    pf->fn(pf->arg, id, item);
+    pthread_mutex_lock(&pf->lock);
+    if (++pf->finished == pf->n) pthread_cond_broadcast(&pf->done);
+  }
+  pthread_mutex_unlock(&pf->lock);
+}
+
+static void*
+parallel_for_thread(void* p)
+{
+  struct parallel_worker* w = p;
+  parallel_for_run(w->pf, w->id);
+  return NULL;
+}
+
+/* Drop a reference to the heap state ${pf}, freeing it with the last */
+static void
+parallel_for_unref(struct parallel_for* pf)
+{
+  uint32_t refs;
+
+  pthread_mutex_lock(&pf->lock);
+  refs = --pf->refs;
+  pthread_mutex_unlock(&pf->lock);
+  if (refs != 0) return;
+
+  pthread_cond_destroy(&pf->done);
+  pthread_mutex_destroy(&pf->lock);
+  free(pf);
+}
+
+static void
+parallel_for_job(void* p)
+{
+  struct parallel_worker* w = p;
+  struct parallel_for* pf = w->pf;
+
+  parallel_for_run(pf, w->id);
+  parallel_for_unref(pf);
+}
+
+/* edsign_parallel_for with the workers submitted to ${submit}. Return
+** 0, or -1 if nothing was done as the state could not be set up. */
+static int
+parallel_for_submit(uint32_t nworkers, uint64_t n,
+                    edsign_task_fn fn, void* arg,
+                    edsign_submit_fn submit, void* executor)
+{
+  struct parallel_for* pf;
+  struct parallel_worker* w;
+  uint32_t i;
+
+  pf = malloc(sizeof(struct parallel_for) +
+              nworkers * sizeof(struct parallel_worker));
+  if (pf == NULL) return -1;
+  w = (struct parallel_worker*)(pf + 1);
+
+  if (pthread_mutex_init(&pf->lock, NULL) != 0) {
+    free(pf);
+    return -1;
+  }
+  if (pthread_cond_init(&pf->done, NULL) != 0) {
+    pthread_mutex_destroy(&pf->lock);
+    free(pf);
+    return -1;
+  }
+
+  pf->next     = 0;
+  pf->finished = 0;
+  pf->n        = n;
+  pf->refs     = nworkers;
+  pf->fn       = fn;
+  pf->arg      = arg;
+
+  for (i = 1; i < nworkers; ++i) {
+    w[i].pf = pf;
+    w[i].id = i;
+    if (submit(executor, parallel_for_job, &w[i]) != 0)
+      parallel_for_unref(pf);
+  }
+
+  /* Wait for the items the workers took, but not for the workers */
+  parallel_for_run(pf, 0);
+  pthread_mutex_lock(&pf->lock);
+  while (pf->finished < pf->n) pthread_cond_wait(&pf->done, &pf->lock);
+  pthread_mutex_unlock(&pf->lock);
+
+  parallel_for_unref(pf);
+  return 0;
+}
+
+/**
+ * edsign_parallel_for(nworkers, n, fn, arg):
+ * Call fn(arg, worker, i) once for every i in [0, ${n}), spread over
+ * at most ${nworkers} workers, the calling thread being worker 0. Each
+ * worker runs one item at a time, so per-worker state indexed by
+ * ${worker} needs no locking. The other workers run on the executor
+ * set with edsign_set_executor if there is one, or else on threads
+ * started for the call. If threads can not be created, the remaining
+ * items run on the workers that did start, so every item is always
+ * processed; on Windows all items run on the calling thread.
+ */
+EDSIGN_STATIC void
+edsign_parallel_for(uint32_t nworkers, uint64_t n,
+                    edsign_task_fn fn, void* arg)
+{
+  struct parallel_for pf;
+  struct parallel_worker w[EDSIGN_MAX_THREADS];
+  pthread_t tid[EDSIGN_MAX_THREADS];
+  edsign_submit_fn submit;
+  void* executor;
+  uint32_t i, started;
+
+  if (nworkers > EDSIGN_MAX_THREADS) nworkers = EDSIGN_MAX_THREADS;
+  if (nworkers > n) nworkers = (uint32_t)n;
+  if (nworkers <= 1) {
+    parallel_for_serial(n, fn, arg);
+    return;
+  }
+
+  pthread_mutex_lock(&edsign_executor.lock);
+  submit   = edsign_executor.submit;
+  executor = edsign_executor.executor;
+  pthread_mutex_unlock(&edsign_executor.lock);
+  if (submit != NULL &&
+      parallel_for_submit(nworkers, n, fn, arg, submit, executor) == 0)
+    return;
+
+  if (pthread_mutex_init(&pf.lock, NULL) != 0) {
+    parallel_for_serial(n, fn, arg);
+    return;
+  }
+  if (pthread_cond_init(&pf.done, NULL) != 0) {
+    pthread_mutex_destroy(&pf.lock);
+    parallel_for_serial(n, fn, arg);
+    return;
+  }
+
+  pf.next     = 0;
+  pf.finished = 0;
+  pf.n        = n;
+  pf.refs     = 0;
+  pf.fn       = fn;
+  pf.arg      = arg;
+
+  for (started = 1; started < nworkers; ++started) {
+    w[started].pf = &pf;
+    w[started].id = started;
+    if (pthread_create(&tid[started], NULL, parallel_for_thread,
+                       &w[started]) != 0)
+      break;
+  }
+
+  parallel_for_run(&pf, 0);
+
+  for (i = 1; i < started; ++i) pthread_join(tid[i], NULL);
+  pthread_cond_destroy(&pf.done);
+  pthread_mutex_destroy(&pf.lock);
+}
+
+#endif /* !OS_WINDOWS */
@@ -0,0 +1,53 @@
+/*
+** Worker threads for parallel key derivation and batches.
+** Copyright (C) 2014 Austin Seipp, Well-Typed LLP.
+** See Copyright Notice in edsign.h
+*/
+
+#ifndef _EDSIGN_THREAD_H_
+#define _EDSIGN_THREAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A task run by edsign_parallel_for: process item ${item} on worker
+** ${worker}, where 0 <= ${worker} < the number of workers asked for. */
+typedef void (*edsign_task_fn)(void* arg, uint32_t worker, uint64_t item);
+
+/**
+ * edsign_thread_limit():
+ * Return the maximum number of threads a single library call may use,
+ * as set by edsign_set_threads (1 by default).
+ */
+EDSIGN_STATIC uint32_t
+edsign_thread_limit(void);
+
+/**
+ * edsign_interleave_limit():
+ * Return the most scrypt lanes a thread may interleave, as set by
+ * edsign_set_interleave (4 by default).
+ */
+EDSIGN_STATIC uint32_t
+edsign_interleave_limit(void);
+
+/**
+ * edsign_parallel_for(nworkers, n, fn, arg):
+ * Call fn(arg, worker, i) once for every i in [0, ${n}), spread over
+ * at most ${nworkers} workers, the calling thread being worker 0. Each
+ * worker runs one item at a time, so per-worker state indexed by
+ * ${worker} needs no locking. The other workers run on the executor
+ * set with edsign_set_executor if there is one, or else on threads
+ * started for the call. If threads can not be created, the remaining
+ * items run on the workers that did start, so every item is always
+ * processed; on Windows all items run on the calling thread.
+ */
+EDSIGN_STATIC void
+edsign_parallel_for(uint32_t nworkers, uint64_t n,
+                    edsign_task_fn fn, void* arg);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* !_EDSIGN_THREAD_H_ */
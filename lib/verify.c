@@ -12,9 +12,30 @@
 #include "ed25519.h"
 #include "sign.h"
 #include "util.h"
+#include "thread.h"
 
 #define PKALG "Ed"
 
+/* Number of messages whose digests are held at once by
+** edsign_verify_batch */
+#define VERIFY_BATCH_CHUNK 64
+
+/* Check the headers of the key ${pk} and signature ${sig}, and that
+** ${sig} claims to be made by ${pk}. */
+static int
+verify_header(const uint8_t* pk, const uint8_t* sig, const uint8_t* msg)
+{
+  if (pk  == NULL) return EDSIGN_EINVAL;
+  if (sig == NULL) return EDSIGN_EINVAL;
+  if (msg == NULL) return EDSIGN_EINVAL;
+
+  if (0 != edsign_memcmp(pk, (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
+  if (0 != edsign_memcmp(sig, (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
+  if (0 != edsign_memcmp(pk+2, sig+2, 8)) return EDSIGN_EKEY;
+
+  return EDSIGN_OK;
+}
+
 /**
  * edsign_verify(pk, sig, msg, msglen):
  *
@@ -32,29 +53,249 @@ edsign_verify(const uint8_t* pk, const uint8_t *sig,
               const uint8_t* msg,  const uint64_t msglen)
 {
   int res = EDSIGN_ERROR;
-  uint64_t tlen;
   uint8_t hash[crypto_hash_blake2b_BYTES];
-  uint8_t smsg[crypto_hash_blake2b_BYTES + crypto_sign_ed25519_BYTES];
-  uint8_t out[crypto_hash_blake2b_BYTES + crypto_sign_ed25519_BYTES];
 
-  if (pk  == NULL) return EDSIGN_EINVAL;
-  if (sig == NULL) return EDSIGN_EINVAL;
-  if (msg == NULL) return EDSIGN_EINVAL;
+  res = verify_header(pk, sig, msg);
+  if (res != EDSIGN_OK) return res;
 
-  if (0 != edsign_memcmp(pk, (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
-  if (0 != edsign_memcmp(sig, (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
-  if (0 != edsign_memcmp(pk+2, sig+2, 8)) return EDSIGN_EKEY;
+  /* Hash the message and verify the signature over the hash */
+  crypto_hash_blake2b(hash, msg, msglen);
+  res = crypto_sign_ed25519_verify_detached(sig+10, hash, sizeof(hash),
+                                            pk+10);
+  if (res != 0) res = EDSIGN_ESIG; /* Signature failure */
+  return res;
+}
 
-  /* Create ed25519 message */
-  crypto_hash_blake2b(hash, msg, msglen); /* Hash message */
-  memcpy(smsg,    sig+10, 64);            /* Copy signature */
-  memcpy(smsg+64, hash, sizeof(hash));    /* Copy hash */
+/**
+ * edsign_verify_digest(pk, sig, digest):
+ *
+ * As edsign_verify, but for a message whose digest ${digest} (see
+ * edsign_digest) is already known, without reading the message
+ * itself. ${digest}, ${pk} and ${sig} can not be NULL, and ${digest}
+ * must be edsign_digest_BYTES in size.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_EKEY if ${pk} is an incorrect public key for the signature
+ * - Returns EDSIGN_ESIG if the ${sig} and ${digest} failed to verify
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_verify_digest(const uint8_t* pk, const uint8_t* sig,
+                     const uint8_t* digest)
+{
+  int res;
+
+  res = verify_header(pk, sig, digest);
+  if (res != EDSIGN_OK) return res;
 
-  /* Verify signature */
-  res = crypto_sign_open(out, &tlen, smsg, sizeof(smsg), pk+10);
-  assert(tlen == crypto_hash_blake2b_BYTES);
+  res = crypto_sign_ed25519_verify_detached(sig+10, digest,
+                                            crypto_hash_blake2b_BYTES,
+                                            pk+10);
   if (res != 0) res = EDSIGN_ESIG; /* Signature failure */
   return res;
 }
 
+/* The arguments of one edsign_verify_batch call, split into chunks
+** of VERIFY_BATCH_CHUNK messages for edsign_parallel_for */
+struct verify_batch {
+  const uint8_t* const* pks;
+  const uint8_t* const* sigs;
+  const uint8_t* const* msgs;
+  const uint64_t* msglens;
+  uint64_t n;
+  int* results;
+};
+
+/* Verify chunk ${chunk} of ${arg}, a struct verify_batch */
+static void
+verify_batch_chunk(void* arg, uint32_t worker, uint64_t chunk)
+{
+  const struct verify_batch* V = arg;
+  uint8_t hash[VERIFY_BATCH_CHUNK][crypto_hash_blake2b_BYTES];
+  const uint8_t* bsig[VERIFY_BATCH_CHUNK];
+  const uint8_t* bmsg[VERIFY_BATCH_CHUNK];
+  const uint8_t* bpk[VERIFY_BATCH_CHUNK];
+  uint64_t bidx[VERIFY_BATCH_CHUNK];
+  int bres[VERIFY_BATCH_CHUNK];
+  uint64_t i, j, k, m;
+
+  (void)worker;
+  i = chunk * VERIFY_BATCH_CHUNK;
+  k = (V->n - i < VERIFY_BATCH_CHUNK) ? (V->n - i) : VERIFY_BATCH_CHUNK;
+
+  /* Check headers and hash the messages of this chunk, collecting
+  ** the well-formed items for the Ed25519 batch */
+  for (j = 0, m = 0; j < k; ++j) {
+    V->results[i+j] = verify_header(V->pks[i+j], V->sigs[i+j],
+                                    V->msgs[i+j]);
+    if (V->results[i+j] != EDSIGN_OK) continue;
+
+    crypto_hash_blake2b(hash[m], V->msgs[i+j], V->msglens[i+j]);
+    bsig[m] = V->sigs[i+j] + 10;
+    bpk[m]  = V->pks[i+j] + 10;
+    bmsg[m] = hash[m];
+    bidx[m] = i+j;
+    m++;
+  }
+
+  if (m == 0) return;
+  crypto_sign_ed25519_verify_batch(bres, bsig, bmsg, bpk, m);
+  for (j = 0; j < m; ++j)
+    V->results[bidx[j]] = (bres[j] == 0) ? EDSIGN_OK : EDSIGN_ESIG;
+}
+
+/**
+ * edsign_verify_batch(pks, sigs, msgs, msglens, n, results):
+ *
+ * Verify ${n} messages at once: for each i, check that the message
+ * ${msgs}[i] (of size ${msglens}[i]) with signature ${sigs}[i] was
+ * signed by the public key ${pks}[i], and store the result that
+ * edsign_verify would return for it in ${results}[i]. The same key may
+ * appear any number of times. The messages are verified in chunks of
+ * 64, spread over as many threads as edsign_set_threads allows; the
+ * results do not depend on how many there are. The arrays can not be
+ * NULL if ${n} is not zero, and ${results} must have room for ${n}
+ * entries.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ESIG if any of the messages failed to verify
+ * - Returns EDSIGN_OK if every message verified
+ */
+int
+edsign_verify_batch(const uint8_t* const* pks, const uint8_t* const* sigs,
+                    const uint8_t* const* msgs, const uint64_t* msglens,
+                    const uint64_t n, int* results)
+{
+  struct verify_batch V;
+  uint64_t i;
+
+  if (n == 0) return EDSIGN_OK;
+  if (pks  == NULL || sigs    == NULL) return EDSIGN_EINVAL;
+  if (msgs == NULL || msglens == NULL) return EDSIGN_EINVAL;
+  if (results == NULL) return EDSIGN_EINVAL;
+
+  V.pks     = pks;
+  V.sigs    = sigs;
+  V.msgs    = msgs;
+  V.msglens = msglens;
+  V.n       = n;
+  V.results = results;
+  edsign_parallel_for(edsign_thread_limit(),
+                      (n + VERIFY_BATCH_CHUNK - 1) / VERIFY_BATCH_CHUNK,
+                      verify_batch_chunk, &V);
+
+  for (i = 0; i < n; ++i)
+    if (results[i] != EDSIGN_OK) return EDSIGN_ESIG;
+  return EDSIGN_OK;
+}
+
+/* Whether the signature ${sig} claims to be made by the key ${pk} */
+static int
+policy_match(const uint8_t* pk, const uint8_t* sig)
+{
+  return (edsign_memcmp(sig, (uint8_t*)PKALG, 2) == 0 &&
+          edsign_memcmp(pk+2, sig+2, 8) == 0);
+}
+
+/* Whether the signature ${sig} claims to be made by the key
+** ${pks}[${i}], under the fingerprint of any of its copies in the
+** ${npks} keys of ${pks}. Copies are the same Ed25519 key, whatever
+** their fingerprints, which the signature does not cover. */
+static int
+policy_signed_by(const uint8_t* const* pks, uint64_t npks, uint64_t i,
+                 const uint8_t* sig)
+{
+  uint64_t j;
+
+  for (j = i; j < npks; ++j)
+    if (edsign_memcmp(pks[j]+10, pks[i]+10, 32) == 0 &&
+        policy_match(pks[j], sig))
+      return 1;
+
+  return 0;
+}
+
+/* Whether the key ${pks}[${i}] may count towards a policy: it is the
+** first copy of its Ed25519 key in ${pks}, and one of the ${nsigs}
+** signatures in ${sigs} claims to be made by it. */
+static int
+policy_candidate(const uint8_t* const* pks, uint64_t npks, uint64_t i,
+                 const uint8_t* const* sigs, uint64_t nsigs)
+{
+  uint64_t j;
+
+  for (j = 0; j < i; ++j)
+    if (edsign_memcmp(pks[j]+10, pks[i]+10, 32) == 0) return 0;
+  for (j = 0; j < nsigs; ++j)
+    if (policy_signed_by(pks, npks, i, sigs[j])) return 1;
+
+  return 0;
+}
+
+/**
+ * edsign_verify_policy(pks, npks, k, sigs, nsigs, msg, msglen):
+ *
+ * Verify that at least ${k} of the ${npks} public keys in ${pks} signed
+ * the message ${msg} (of size ${msglen}), given the ${nsigs} signatures
+ * in ${sigs}. The message is hashed once, each signature is checked
+ * only against the keys whose fingerprint it carries, and checking
+ * stops as soon as ${k} keys have signed or too few are left to reach
+ * ${k}. A key which appears several times, even under different
+ * fingerprints, or signed several times, counts once, and signatures
+ * by keys not in ${pks} or with a bad header are ignored. The arrays
+ * can not be NULL if their size is not zero, and ${k} can not be
+ * greater than ${npks}.
+ *
+ * - Returns EDSIGN_EINVAL if the arguments are invalid
+ * - Returns EDSIGN_ESIG if fewer than ${k} keys signed ${msg}
+ * - Returns EDSIGN_OK under normal circumstances
+ */
+int
+edsign_verify_policy(const uint8_t* const* pks, const uint64_t npks,
+                     const uint64_t k,
+                     const uint8_t* const* sigs, const uint64_t nsigs,
+                     const uint8_t* msg, const uint64_t msglen)
+{
+  uint8_t hash[crypto_hash_blake2b_BYTES];
+  uint64_t found = 0, left = 0, i, j;
+
+  if (k > npks) return EDSIGN_EINVAL;
+  if (msg == NULL) return EDSIGN_EINVAL;
+  if (npks  != 0 && pks  == NULL) return EDSIGN_EINVAL;
+  if (nsigs != 0 && sigs == NULL) return EDSIGN_EINVAL;
+  for (i = 0; i < npks; ++i) {
+    if (pks[i] == NULL) return EDSIGN_EINVAL;
+    if (0 != edsign_memcmp(pks[i], (uint8_t*)PKALG, 2)) return EDSIGN_EINVAL;
+  }
+  for (j = 0; j < nsigs; ++j)
+    if (sigs[j] == NULL) return EDSIGN_EINVAL;
+
+  if (k == 0) return EDSIGN_OK;
+
+  /* Count the keys which could sign at all, so an unreachable policy
+  ** fails without hashing the message */
+  for (i = 0; i < npks; ++i)
+    left += policy_candidate(pks, npks, i, sigs, nsigs);
+  if (left < k) return EDSIGN_ESIG;
+
+  crypto_hash_blake2b(hash, msg, msglen);
+  for (i = 0; i < npks && found < k && found + left >= k; ++i) {
+    if (!policy_candidate(pks, npks, i, sigs, nsigs)) continue;
+    left--;
+
+    for (j = 0; j < nsigs; ++j) {
+      if (!policy_signed_by(pks, npks, i, sigs[j])) continue;
+      if (crypto_sign_ed25519_verify_detached(sigs[j]+10, hash,
+                                              sizeof(hash),
+                                              pks[i]+10) == 0) {
+        found++;
+        break;
+      }
+    }
+  }
+
+  return (found >= k) ? EDSIGN_OK : EDSIGN_ESIG;
+}
+
 #undef PKALG
+#undef VERIFY_BATCH_CHUNK
@@ -17,6 +17,9 @@ extern "C" {
 int edsign_verify(const uint8_t* pk, const uint8_t *sig,
                   const uint8_t* msg,  const uint64_t msglen);
 
+int edsign_verify_digest(const uint8_t* pk, const uint8_t* sig,
+                         const uint8_t* digest);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -10,7 +10,7 @@ endef
 
 define test # args: $1 = dir, $2 = source file names
 $1/%.t: $1/%.o
-	$$(QLINK) $$(MY_CFLAGS) -o $$@ $$<
+	$$(QLINK) $$(MY_CFLAGS) -o $$@ $$< $$(LIBS)
 $1/%.o: $1/%.c amalg-src
 	$$(QCC) $$(MY_CFLAGS) -o $$@ -c $$<
 
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+/* Argon2id version 1.3 of "password" and "somesalt", as computed by
+   the reference implementation */
+static const struct {
+  uint32_t t, m, p;
+  size_t outlen;
+  const char* tag;
+} vectors[] = {
+  { 2, 256, 1, 32,
+    "9dfeb910e80bad0311fee20f9c0e2b12c17987b4cac90c2ef54d5b3021c68bfe" },
+  { 2, 256, 2, 32,
+    "6d093c501fd5999645e0ea3bf620d7b8be7fd2db59c20d9fff9539da2bf57037" },
+  { 1, 64, 4, 72,
+    "a832f7e6a8424d93d19ca5f80a8ecbb1900515e60cd2c24be6185f0391cecbb1"
+    "c003321b84c8320392af8fdbb8dc01592ff38049e00a06069578a0f54872b0bd"
+    "0e5d0b1f46d3a9ef" },
+  { 3, 1000, 3, 64,
+    "90b75eb2333229498827b13b9c94f361f4adcc93eb301d74f79a1b99086ce5b6"
+    "c6dc2e16ba2871ded1cc9877c0762df931b7060ae7fae44f0686f1a569b83948" },
+};
+
+static int
+check_vectors(void)
+{
+  uint8_t out[72];
+  char hex[2 * sizeof(out) + 1];
+  size_t i, j;
+
+  for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i) {
+    if (crypto_argon2id((uint8_t*)"password", 8, (uint8_t*)"somesalt", 8,
+                        vectors[i].t, vectors[i].m, vectors[i].p,
+                        out, vectors[i].outlen, NULL) != 0)
+      return -1;
+    for (j = 0; j < vectors[i].outlen; ++j)
+      sprintf(&hex[2 * j], "%02x", out[j]);
+    if (strcmp(hex, vectors[i].tag) != 0) return -1;
+  }
+
+  return 0;
+}
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sk2[edsign_SECRETKEYBYTES];
+  uint8_t sig[edsign_sign_BYTES];
+  uint8_t fp[edsign_fingerprint_BYTES];
+  uint8_t* msg = (uint8_t*)"Hello world!";
+  edsign_kdf_ctx* ctx;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  /* The lanes give the same tags whether or not they run in parallel */
+  if (check_vectors() != 0) goto out;
+  edsign_set_threads(4);
+  if (check_vectors() != 0) goto out;
+
+  /* Too little memory for the lanes, or no passes */
+  if (edsign_keypair_argon2id(NULL, pass, passlen, 1, 31, 4, pk, sk) !=
+      EDSIGN_EINVAL)
+    goto out;
+  if (edsign_keypair_argon2id(NULL, pass, passlen, 0, 64, 1, pk, sk) !=
+      EDSIGN_EINVAL)
+    goto out;
+
+  /* Keys are tagged with their KDF, and sign like any other */
+  if (edsign_keypair_argon2id(NULL, pass, passlen, 2, 4096, 4, pk, sk) !=
+      EDSIGN_OK)
+    goto out;
+  if (memcmp(sk + 2, "A2", 2) != 0) goto out;
+  if (edsign_secretkey_fingerprint(sk, fp) != EDSIGN_OK) goto out;
+  if (edsign_sign(pass, passlen, sk, msg, 12, sig) != EDSIGN_OK) goto out;
+  if (edsign_verify(pk, sig, msg, 12) != EDSIGN_OK) goto out;
+  if (edsign_sign((uint8_t*)"wrong", 5, sk, msg, 12, sig) != EDSIGN_EPASSWD)
+    goto out;
+
+  /* Rekeying moves keys between KDFs in both directions */
+  if (edsign_rekey_priv(pass, passlen, pass, passlen, 10, 8, 1, sk, sk2) !=
+      EDSIGN_OK)
+    goto out;
+  if (memcmp(sk2 + 2, "SK", 2) != 0) goto out;
+  if (edsign_rekey_priv_argon2id(NULL, pass, passlen, pass, passlen,
+                                 1, 1024, 2, sk2, sk) != EDSIGN_OK)
+    goto out;
+  if (memcmp(sk + 2, "A2", 2) != 0) goto out;
+  if (edsign_sign(pass, passlen, sk, msg, 12, sig) != EDSIGN_OK) goto out;
+  if (edsign_verify(pk, sig, msg, 12) != EDSIGN_OK) goto out;
+
+  /* Without a password, keys are stored just as before */
+  if (edsign_rekey_priv_argon2id(NULL, pass, passlen, NULL, 0,
+                                 1, 1024, 2, sk, sk2) != EDSIGN_OK)
+    goto out;
+  if (memcmp(sk2 + 2, "SK\0\0\0\0\0\0\0\0\0\0\0\0", 14) != 0) goto out;
+  if (edsign_sign(NULL, 0, sk2, msg, 12, sig) != EDSIGN_OK) goto out;
+  if (edsign_verify(pk, sig, msg, 12) != EDSIGN_OK) goto out;
+
+  /* Unknown tags are refused */
+  memcpy(sk + 2, "XX", 2);
+  if (edsign_sign(pass, passlen, sk, msg, 12, sig) != EDSIGN_EINVAL)
+    goto out;
+
+  /* The time limit of a context stops the lanes early */
+  if ((ctx = edsign_kdf_ctx_new(0, 0, 0)) == NULL) goto out;
+  edsign_kdf_ctx_set_timeout(ctx, 10);
+  if (edsign_keypair_argon2id(ctx, pass, passlen, 64, 262144, 4, pk, sk) !=
+      EDSIGN_ECANCELED)
+    goto free;
+  r = 0;
+
+free:
+  edsign_kdf_ctx_free(ctx);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
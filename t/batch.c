@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define NMSGS 11
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  int i;
+  uint8_t pk[2][edsign_PUBLICKEYBYTES];
+  uint8_t sk[2][edsign_SECRETKEYBYTES];
+  uint8_t sig[NMSGS][edsign_sign_BYTES];
+  uint8_t msg[NMSGS][32];
+
+  const uint8_t* pks[NMSGS];
+  const uint8_t* sigs[NMSGS];
+  const uint8_t* msgs[NMSGS];
+  uint64_t msglens[NMSGS];
+  int results[NMSGS];
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = NULL;
+    passlen = 0;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  edsign_keypair(pass, passlen, 14, 8, 1, pk[0], sk[0]);
+  edsign_keypair(pass, passlen, 14, 8, 1, pk[1], sk[1]);
+
+  for (i = 0; i < NMSGS; i++) {
+    memset(msg[i], 'a' + i, sizeof(msg[i]));
+    edsign_sign(pass, passlen, sk[i%2], msg[i], i, sig[i]);
+
+    pks[i]     = pk[i%2];
+    sigs[i]    = sig[i];
+    msgs[i]    = msg[i];
+    msglens[i] = i;
+  }
+
+  /* Everything should verify */
+  r = edsign_verify_batch(pks, sigs, msgs, msglens, NMSGS, results);
+  for (i = 0; i < NMSGS; i++)
+    if (results[i] != EDSIGN_OK) r = -1;
+
+  if (r == 0) {
+    /* Break a few entries: wrong key, tampered message, and a
+    ** corrupted signature */
+    pks[3] = pk[0];
+    msg[6][0] ^= 1;
+    sig[9][20] ^= 1;
+
+    r = edsign_verify_batch(pks, sigs, msgs, msglens, NMSGS, results);
+    if (r != EDSIGN_ESIG) r = -1;
+    else {
+      r = 0;
+      for (i = 0; i < NMSGS; i++) {
+        int expected = EDSIGN_OK;
+        if (i == 3) expected = EDSIGN_EKEY;
+        if (i == 6 || i == 9) expected = EDSIGN_ESIG;
+        if (results[i] != expected) r = -1;
+      }
+    }
+  }
+
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
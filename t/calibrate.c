@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sig[edsign_sign_BYTES];
+  uint32_t N, rr, p;
+  uint64_t ms, bytes, ms2, bytes2;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  uint8_t* msg = (uint8_t*)"Hello world!";
+
+  /* Invalid parameters and impossible budgets are rejected */
+  if (edsign_kdf_cost(0, 8, 1, &ms, &bytes) != EDSIGN_EINVAL) goto out;
+  if (edsign_kdf_cost(14, 8, 0, &ms, &bytes) != EDSIGN_EINVAL) goto out;
+  if (edsign_kdf_cost(14, 8, 1, NULL, &bytes) != EDSIGN_EINVAL) goto out;
+  if (edsign_kdf_calibrate(100, 1024, &N, &rr, &p) != EDSIGN_EINVAL) goto out;
+
+  /* 16MB for one lane of N = 14, r = 8, plus its XY and B */
+  if (edsign_kdf_cost(14, 8, 1, &ms, &bytes) != EDSIGN_OK) goto out;
+  if (bytes != (16 << 20) + 2112 + 1024) goto out;
+  /* One thread runs 4 lanes at once, so 8 take two rounds */
+  if (edsign_kdf_cost(14, 8, 4, &ms, &bytes) != EDSIGN_OK) goto out;
+  if (edsign_kdf_cost(14, 8, 8, &ms2, &bytes2) != EDSIGN_OK) goto out;
+  if (ms2 <= ms || ms2 > 2 * ms) goto out;
+  if (bytes2 != bytes + 4 * 1024) goto out;
+
+  /* Picked parameters fit their budgets, and a lane of twice the
+     memory either does not, or is no stronger (4 times the work) */
+  if (edsign_kdf_calibrate(200, 4 << 20, &N, &rr, &p) != EDSIGN_OK) goto out;
+  if (edsign_kdf_cost(N, rr, p, &ms, &bytes) != EDSIGN_OK) goto out;
+  if (rr != 8 || ms > 200 || bytes > (4 << 20)) goto out;
+  if (edsign_kdf_cost(N + 1, rr, 1, &ms2, &bytes2) != EDSIGN_OK) goto out;
+  if (ms2 <= 200 && bytes2 <= (4 << 20) && p < 4) goto out;
+
+  /* And they make working keys */
+  if (edsign_kdf_calibrate(20, 64 << 20, &N, &rr, &p) != EDSIGN_OK) goto out;
+  edsign_keypair(pass, passlen, N, rr, p, pk, sk);
+  edsign_sign(pass, passlen, sk, msg, 12, sig);
+  r = edsign_verify(pk, sig, msg, 12);
+
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
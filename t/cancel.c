@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+/* About a second or two of work, on 16MB per lane */
+#define SLOW_N 14
+#define SLOW_P 128
+
+static uint8_t* pass;
+static uint64_t passlen;
+
+struct job {
+  edsign_kdf_ctx* ctx;
+  int res;
+};
+
+static void*
+slow(void* arg)
+{
+  struct job* J = arg;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+
+  J->res = edsign_keypair_ctx(J->ctx, pass, passlen, SLOW_N, 8, SLOW_P,
+                              pk, sk);
+  return NULL;
+}
+
+static uint64_t
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+sleep_ms(long ms)
+{
+  struct timespec ts = { 0, ms * 1000000 };
+  nanosleep(&ts, NULL);
+}
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sig[edsign_sign_BYTES];
+  uint8_t* msg = (uint8_t*)"Hello world!";
+  edsign_kdf_ctx* ctx;
+  struct job A, B;
+  pthread_t ta, tb;
+  edsign_kdf_stats s;
+  uint64_t t0;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  if (edsign_kdf_ctx_set_timeout(NULL, 1) != EDSIGN_EINVAL) goto out;
+  if (edsign_kdf_ctx_cancel(NULL, 1) != EDSIGN_EINVAL) goto out;
+
+  /* A context without memory of its own still carries a time limit */
+  ctx = edsign_kdf_ctx_new(0, 0, 0);
+  if (ctx == NULL) goto out;
+
+  /* Out of time, a long derivation gives up early */
+  edsign_kdf_ctx_set_timeout(ctx, 10);
+  t0 = now_ms();
+  if (edsign_keypair_ctx(ctx, pass, passlen, SLOW_N, 8, SLOW_P, pk, sk) !=
+      EDSIGN_ECANCELED)
+    goto free;
+  if (now_ms() - t0 > 500) goto free;
+
+  /* With time to spare, keys work as usual */
+  edsign_kdf_ctx_set_timeout(ctx, 60000);
+  if (edsign_keypair_ctx(ctx, pass, passlen, 10, 8, 1, pk, sk) != EDSIGN_OK)
+    goto free;
+  if (edsign_sign_ctx(ctx, pass, passlen, sk, msg, 12, sig) != EDSIGN_OK)
+    goto free;
+  if (edsign_verify(pk, sig, msg, 12) != EDSIGN_OK) goto free;
+
+  /* Cancellation sticks until it is cleared */
+  edsign_kdf_ctx_cancel(ctx, 1);
+  if (edsign_sign_ctx(ctx, pass, passlen, sk, msg, 12, sig) !=
+      EDSIGN_ECANCELED)
+    goto free;
+  edsign_kdf_ctx_cancel(ctx, 0);
+  if (edsign_sign_ctx(ctx, pass, passlen, sk, msg, 12, sig) != EDSIGN_OK)
+    goto free;
+
+  /* Other threads can cancel derivations both running and waiting for
+     memory: with room for one, B queues behind A */
+  edsign_kdf_ctx_set_timeout(ctx, 0);
+  edsign_set_kdf_limits(crypto_scrypt_memory(1 << SLOW_N, 8, SLOW_P), 1);
+  A.ctx = edsign_kdf_ctx_new(0, 0, 0);
+  B.ctx = ctx;
+  if (A.ctx == NULL) goto free;
+  if (pthread_create(&ta, NULL, slow, &A) != 0) goto free;
+  sleep_ms(20);
+  if (pthread_create(&tb, NULL, slow, &B) != 0) goto free;
+  sleep_ms(20);
+
+  t0 = now_ms();
+  edsign_kdf_ctx_cancel(B.ctx, 1);
+  pthread_join(tb, NULL);
+  edsign_kdf_ctx_cancel(A.ctx, 1);
+  pthread_join(ta, NULL);
+  if (now_ms() - t0 > 500) goto free;
+  if (A.res != EDSIGN_ECANCELED || B.res != EDSIGN_ECANCELED) goto free;
+  edsign_kdf_ctx_free(A.ctx);
+
+  /* Both gave their memory back, and neither counts as refused */
+  edsign_get_kdf_stats(&s);
+  if (s.running != 0 || s.waiting != 0 || s.bytes_in_use != 0) goto free;
+  if (s.rejected != 0) goto free;
+  edsign_set_kdf_limits(0, 0);
+  r = 0;
+
+free:
+  edsign_kdf_ctx_free(ctx);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+/* BLAKE2b-512 of "abc", from RFC 7693 */
+static const char* abc =
+  "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d1"
+  "7d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923";
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t pk2[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sk2[edsign_SECRETKEYBYTES];
+  uint8_t sig1[edsign_sign_BYTES];
+  uint8_t sig2[edsign_sign_BYTES];
+  uint8_t digest[edsign_digest_BYTES];
+  char hex[2 * edsign_digest_BYTES + 1];
+  uint8_t* msg = (uint8_t*)"Hello world!";
+  edsign_kdf_ctx* ctx;
+  int i;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  /* The digest is plain BLAKE2b-512 */
+  if (edsign_digest(NULL, 0, digest) != EDSIGN_EINVAL) goto out;
+  if (edsign_digest((uint8_t*)"abc", 3, digest) != EDSIGN_OK) goto out;
+  for (i = 0; i < edsign_digest_BYTES; ++i)
+    sprintf(&hex[2 * i], "%02x", digest[i]);
+  if (strcmp(hex, abc) != 0) goto out;
+
+  if (edsign_keypair(pass, passlen, 14, 8, 1, pk, sk) != EDSIGN_OK) goto out;
+  if (edsign_keypair(NULL, 0, 0, 0, 0, pk2, sk2) != EDSIGN_OK) goto out;
+
+  /* Signing the digest gives the signature of the message... */
+  if (edsign_digest(msg, 12, digest) != EDSIGN_OK) goto out;
+  if (edsign_sign_digest(pass, passlen, sk, NULL, sig2) != EDSIGN_EINVAL)
+    goto out;
+  if (edsign_sign_digest((uint8_t*)"wrong", 5, sk, digest, sig2) !=
+      EDSIGN_EPASSWD)
+    goto out;
+  if (edsign_sign(pass, passlen, sk, msg, 12, sig1) != EDSIGN_OK) goto out;
+  if (edsign_sign_digest(pass, passlen, sk, digest, sig2) != EDSIGN_OK)
+    goto out;
+  if (memcmp(sig1, sig2, sizeof(sig1)) != 0) goto out;
+
+  /* ... through a context too, which can cancel it */
+  if ((ctx = edsign_kdf_ctx_new(14, 8, 1)) == NULL) goto out;
+  memset(sig2, 0, sizeof(sig2));
+  if (edsign_sign_digest_ctx(ctx, pass, passlen, sk, digest, sig2) !=
+      EDSIGN_OK)
+    goto free;
+  if (memcmp(sig1, sig2, sizeof(sig1)) != 0) goto free;
+  edsign_kdf_ctx_cancel(ctx, 1);
+  if (edsign_sign_digest_ctx(ctx, pass, passlen, sk, digest, sig2) !=
+      EDSIGN_ECANCELED)
+    goto free;
+
+  /* ... and either verifies through the digest */
+  if (edsign_verify_digest(pk, sig1, NULL) != EDSIGN_EINVAL) goto free;
+  if (edsign_verify_digest(pk, sig1, digest) != EDSIGN_OK) goto free;
+  if (edsign_verify(pk, sig2, msg, 12) != EDSIGN_OK) goto free;
+  if (edsign_verify_digest(pk2, sig1, digest) != EDSIGN_EKEY) goto free;
+  digest[7] ^= 1;
+  if (edsign_verify_digest(pk, sig1, digest) != EDSIGN_ESIG) goto free;
+  r = 0;
+
+free:
+  edsign_kdf_ctx_free(ctx);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
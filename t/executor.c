@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define NMSGS 300
+
+struct job {
+  edsign_job_fn fn;
+  void* job;
+};
+
+static volatile int submitted = 0;
+
+static void*
+run_job(void* p)
+{
+  struct job* j = p;
+  j->fn(j->job);
+  free(j);
+  return NULL;
+}
+
+/* An executor starting a detached thread for every job */
+static int
+spawn(void* executor, edsign_job_fn fn, void* job)
+{
+  struct job* j;
+  pthread_t tid;
+
+  (void)executor;
+  if ((j = malloc(sizeof(struct job))) == NULL) return -1;
+  j->fn  = fn;
+  j->job = job;
+  if (pthread_create(&tid, NULL, run_job, j) != 0) {
+    free(j);
+    return -1;
+  }
+  pthread_detach(tid);
+  __sync_fetch_and_add(&submitted, 1);
+  return 0;
+}
+
+/* An executor which runs jobs at once, on the submitting thread */
+static int
+inline_run(void* executor, edsign_job_fn fn, void* job)
+{
+  (void)executor;
+  fn(job);
+  return 0;
+}
+
+/* An executor which never has room */
+static int
+refuse(void* executor, edsign_job_fn fn, void* job)
+{
+  (void)executor;
+  (void)fn;
+  (void)job;
+  return -1;
+}
+
+static uint8_t buf[NMSGS][32];
+static uint8_t sigbuf[NMSGS][edsign_sign_BYTES];
+static uint8_t sigbuf2[NMSGS][edsign_sign_BYTES];
+static const uint8_t* msgs[NMSGS];
+static uint64_t msglens[NMSGS];
+static uint8_t* sigs[NMSGS];
+static uint8_t* sigs2[NMSGS];
+static const uint8_t* pks[NMSGS];
+static const uint8_t* csigs[NMSGS];
+static int results[NMSGS];
+
+/* Sign and verify the batch, with one bad signature, and check every
+   result is what it is with one thread */
+static int
+check(edsign_sk* h, const uint8_t* pk)
+{
+  int i;
+
+  if (edsign_sign_batch(h, msgs, msglens, NMSGS, sigs2) != EDSIGN_OK)
+    return -1;
+  if (memcmp(sigbuf, sigbuf2, sizeof(sigbuf)) != 0) return -1;
+
+  for (i = 0; i < NMSGS; ++i) {
+    pks[i]   = pk;
+    csigs[i] = sigs2[i];
+  }
+  sigbuf2[NMSGS - 7][20] ^= 1;
+  if (edsign_verify_batch(pks, csigs, msgs, msglens, NMSGS, results) !=
+      EDSIGN_ESIG)
+    return -1;
+  for (i = 0; i < NMSGS; ++i)
+    if (results[i] != ((i == NMSGS - 7) ? EDSIGN_ESIG : EDSIGN_OK))
+      return -1;
+
+  return 0;
+}
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  edsign_sk* h = NULL;
+  int i;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  for (i = 0; i < NMSGS; ++i) {
+    memset(buf[i], i, sizeof(buf[i]));
+    msgs[i]    = buf[i];
+    msglens[i] = sizeof(buf[i]);
+    sigs[i]    = sigbuf[i];
+    sigs2[i]   = sigbuf2[i];
+  }
+
+  if (edsign_keypair(pass, passlen, 14, 8, 1, pk, sk) != EDSIGN_OK) goto out;
+  if (edsign_sk_unlock(NULL, pass, passlen, sk, &h) != EDSIGN_OK) goto out;
+  if (edsign_sign_batch(h, msgs, msglens, NMSGS, sigs) != EDSIGN_OK)
+    goto lock;
+  if (check(h, pk) != 0) goto lock;
+
+  /* The threads of the library's own */
+  if (edsign_set_threads(4) != EDSIGN_OK) goto lock;
+  if (check(h, pk) != 0) goto lock;
+
+  /* The caller's threads, and executors which run nothing in parallel */
+  if (edsign_set_executor(spawn, NULL) != EDSIGN_OK) goto lock;
+  if (check(h, pk) != 0) goto lock;
+  if (submitted == 0) goto lock;
+  if (edsign_set_executor(inline_run, NULL) != EDSIGN_OK) goto lock;
+  if (check(h, pk) != 0) goto lock;
+  if (edsign_set_executor(refuse, NULL) != EDSIGN_OK) goto lock;
+  if (check(h, pk) != 0) goto lock;
+
+  if (edsign_set_executor(NULL, NULL) != EDSIGN_OK) goto lock;
+  r = 0;
+
+lock:
+  edsign_sk_lock(h);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
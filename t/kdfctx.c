@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t newsk[edsign_SECRETKEYBYTES];
+  uint8_t sig1[edsign_sign_BYTES];
+  uint8_t sig2[edsign_sign_BYTES];
+  uint8_t k1[64], k2[64];
+  edsign_kdf_ctx* ctx;
+  uint32_t N, p;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  uint8_t* msg = (uint8_t*)"Hello world!";
+
+  /* Invalid parameters are rejected */
+  if (edsign_kdf_ctx_new(64, 8, 1) != NULL) goto out;
+  if (edsign_kdf_ctx_new(12, 0, 1) != NULL) goto out;
+  edsign_kdf_ctx_free(NULL);
+
+  edsign_set_threads(2);
+  ctx = edsign_kdf_ctx_new(12, 8, 3);
+  if (ctx == NULL) goto out;
+
+  /* Reused memory gives the same keys, including for parameters the
+     context is too small for */
+  for (N = 10; N <= 13; ++N) {
+    for (p = 1; p <= 4; ++p) {
+      crypto_scrypt(pass, passlen, (uint8_t*)"salt", 4, 1 << N, 8, p, k1, 64);
+      crypto_scrypt_mem(ctx->mem, pass, passlen, (uint8_t*)"salt", 4,
+                        1 << N, 8, p, k2, 64, NULL);
+      if (memcmp(k1, k2, sizeof(k1)) != 0) goto free;
+    }
+  }
+
+  /* Keys made, unlocked, and rekeyed through the context work as usual */
+  if (edsign_keypair_ctx(ctx, pass, passlen, 12, 8, 2, pk, sk) != EDSIGN_OK)
+    goto free;
+  if (edsign_sign_ctx(ctx, pass, passlen, sk, msg, 12, sig1) != EDSIGN_OK)
+    goto free;
+  if (edsign_sign(pass, passlen, sk, msg, 12, sig2) != EDSIGN_OK) goto free;
+  if (memcmp(sig1, sig2, sizeof(sig1)) != 0) goto free;
+  if (edsign_sign_ctx(ctx, (uint8_t*)"x", 1, sk, msg, 12, sig2)
+      != EDSIGN_EPASSWD) goto free;
+
+  if (edsign_rekey_priv_ctx(ctx, pass, passlen, (uint8_t*)"x", 1, 11, 8, 1,
+                            sk, newsk) != EDSIGN_OK) goto free;
+  if (edsign_sign_ctx(ctx, (uint8_t*)"x", 1, newsk, msg, 12, sig2)
+      != EDSIGN_OK) goto free;
+  if (memcmp(sig1, sig2, sizeof(sig1)) != 0) goto free;
+
+  r = edsign_verify(pk, sig2, msg, 12);
+
+free:
+  edsign_kdf_ctx_free(ctx);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
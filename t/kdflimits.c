@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define JOBS 4
+
+static uint8_t* pass;
+static uint64_t passlen;
+static int finished;
+
+/* Make and use a key, which derives twice against the budget */
+static void*
+job(void* arg)
+{
+  int* res = arg;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sig[edsign_sign_BYTES];
+
+  *res = edsign_keypair(pass, passlen, 14, 8, 1, pk, sk);
+  if (*res == EDSIGN_OK)
+    *res = edsign_sign(pass, passlen, sk, (uint8_t*)"Hello world!", 12, sig);
+  if (*res == EDSIGN_OK)
+    *res = edsign_verify(pk, sig, (uint8_t*)"Hello world!", 12);
+
+  __atomic_fetch_add(&finished, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  int i, res[JOBS];
+  pthread_t tid[JOBS];
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  edsign_kdf_stats s;
+  uint64_t one;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  one = crypto_scrypt_memory(1 << 14, 8, 1);
+
+  if (edsign_get_kdf_stats(NULL) != EDSIGN_EINVAL) goto out;
+
+  /* A derivation bigger than the whole budget is refused at once */
+  edsign_set_kdf_limits(one - 1, JOBS);
+  if (edsign_keypair(pass, passlen, 14, 8, 1, pk, sk) != EDSIGN_EBUSY)
+    goto out;
+  edsign_get_kdf_stats(&s);
+  if (s.rejected != 1 || s.running != 0 || s.bytes_in_use != 0) goto out;
+
+  /* With room for one derivation, concurrent ones take turns, and the
+     budget is never exceeded. A job queues for its second derivation
+     as soon as its first is done, so all of them may be waiting at
+     once until the head of the queue wakes up. */
+  edsign_set_kdf_limits(one, JOBS);
+  for (i = 0; i < JOBS; ++i)
+    if (pthread_create(&tid[i], NULL, job, &res[i]) != 0) goto out;
+  while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < JOBS) {
+    edsign_get_kdf_stats(&s);
+    if (s.bytes_in_use > one || s.running > 1 || s.waiting > JOBS) {
+      for (i = 0; i < JOBS; ++i) pthread_join(tid[i], NULL);
+      goto out;
+    }
+    sched_yield();
+  }
+  for (i = 0; i < JOBS; ++i) {
+    pthread_join(tid[i], NULL);
+    if (res[i] != EDSIGN_OK) goto out;
+  }
+
+  /* Everything was handed back, and nothing else was refused */
+  edsign_get_kdf_stats(&s);
+  if (s.rejected != 1 || s.running != 0 || s.waiting != 0) goto out;
+  if (s.bytes_in_use != 0) goto out;
+
+  /* Without a limit, nothing is refused */
+  edsign_set_kdf_limits(0, 0);
+  if (edsign_keypair(pass, passlen, 14, 8, 1, pk, sk) != EDSIGN_OK) goto out;
+  r = 0;
+
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
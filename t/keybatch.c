@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define NKEYS 150
+
+static uint8_t pkbuf[NKEYS][edsign_PUBLICKEYBYTES];
+static uint8_t skbuf[NKEYS][edsign_SECRETKEYBYTES];
+static uint8_t* pks[NKEYS];
+static uint8_t* sks[NKEYS];
+
+/* Every key pair signs and verifies, under the password ${pass} */
+static int
+check(const uint8_t* pass, uint64_t passlen, uint64_t n)
+{
+  uint8_t sig[edsign_sign_BYTES];
+  uint8_t fp[edsign_fingerprint_BYTES];
+  uint8_t* msg = (uint8_t*)"Hello world!";
+  uint64_t i;
+
+  for (i = 0; i < n; ++i) {
+    if (edsign_sign(pass, passlen, sks[i], msg, 12, sig) != EDSIGN_OK)
+      return -1;
+    if (edsign_verify(pks[i], sig, msg, 12) != EDSIGN_OK) return -1;
+    if (edsign_secretkey_fingerprint(sks[i], fp) != EDSIGN_OK) return -1;
+    if (memcmp(fp, pks[i] + 2, sizeof(fp)) != 0) return -1;
+    if (i > 0 && memcmp(pks[i] + 10, pks[i-1] + 10, 32) == 0) return -1;
+  }
+
+  return 0;
+}
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  edsign_kdf_ctx* ctx;
+  uint64_t i;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  for (i = 0; i < NKEYS; ++i) {
+    pks[i] = pkbuf[i];
+    sks[i] = skbuf[i];
+  }
+
+  if (edsign_keypair_batch(NULL, NULL, 0, 0, 0, 0, 0, NULL, NULL) !=
+      EDSIGN_OK)
+    goto out;
+  if (edsign_keypair_batch(NULL, NULL, 0, 0, 0, 0, NKEYS, NULL, sks) !=
+      EDSIGN_EINVAL)
+    goto out;
+
+  /* Unencrypted keys, over several chunks and threads */
+  if (edsign_keypair_batch(NULL, NULL, 0, 0, 0, 0, NKEYS, pks, sks) !=
+      EDSIGN_OK)
+    goto out;
+  if (check(NULL, 0, NKEYS) != 0) goto out;
+  edsign_set_threads(4);
+  if (edsign_keypair_batch(NULL, NULL, 0, 0, 0, 0, NKEYS, pks, sks) !=
+      EDSIGN_OK)
+    goto out;
+  if (check(NULL, 0, NKEYS) != 0) goto out;
+
+  /* Encrypted keys, through one context, each with its own salt */
+  if ((ctx = edsign_kdf_ctx_new(10, 8, 1)) == NULL) goto out;
+  if (edsign_keypair_batch(ctx, pass, passlen, 10, 8, 1, 5, pks, sks) !=
+      EDSIGN_OK)
+    goto free;
+  if (check(pass, passlen, 5) != 0) goto free;
+  if (memcmp(sks[0] + 16, sks[1] + 16, 16) == 0) goto free;
+
+  /* A failed derivation wipes every key */
+  if (edsign_keypair_batch(ctx, pass, passlen, 10, 0, 1, 5, pks, sks) !=
+      EDSIGN_EINVAL)
+    goto free;
+  for (i = 0; i < sizeof(skbuf[0]); ++i)
+    if (skbuf[4][i] != 0) goto free;
+  r = 0;
+
+free:
+  edsign_kdf_ctx_free(ctx);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+static uint64_t
+regions(void)
+{
+  edsign_memory_stats s;
+  edsign_get_memory_stats(&s);
+  return s.hugetlb + s.thp + s.small + s.heap;
+}
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t k1[64], k2[64], k3[64];
+  uint64_t before;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  /* Unknown flags and NULL stats are rejected */
+  if (edsign_set_memory_flags(0x4) != EDSIGN_EINVAL) goto out;
+  if (edsign_get_memory_stats(NULL) != EDSIGN_EINVAL) goto out;
+
+  /* Every allocation path gives the same key, and each V array is
+     counted once: 2MB is big enough to try huge pages */
+  before = regions();
+  edsign_set_memory_flags(0);
+  crypto_scrypt(pass, passlen, (uint8_t*)"salt", 4, 1 << 11, 8, 1, k1, 64);
+  edsign_set_memory_flags(EDSIGN_MEM_HUGEPAGES | EDSIGN_MEM_NUMA_LOCAL);
+  crypto_scrypt(pass, passlen, (uint8_t*)"salt", 4, 1 << 11, 8, 1, k2, 64);
+  edsign_set_memory_flags(EDSIGN_MEM_DEFAULT);
+  crypto_scrypt(pass, passlen, (uint8_t*)"salt", 4, 1 << 11, 8, 1, k3, 64);
+
+  if (regions() - before != 3) goto out;
+  if (memcmp(k1, k2, sizeof(k1)) != 0) goto out;
+  if (memcmp(k1, k3, sizeof(k1)) != 0) goto out;
+  r = 0;
+
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define NKEYS 5
+#define MSGLEN (1 << 20)
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[NKEYS][edsign_PUBLICKEYBYTES];
+  uint8_t sk[NKEYS][edsign_SECRETKEYBYTES];
+  uint8_t sigbuf[NKEYS][edsign_sign_BYTES];
+  uint8_t sig[edsign_sign_BYTES];
+  uint8_t* sigs[NKEYS];
+  edsign_sk* h[NKEYS];
+  uint8_t* msg;
+  int i, nh = 0;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  if ((msg = malloc(MSGLEN)) == NULL) goto out;
+  for (i = 0; i < MSGLEN; ++i) msg[i] = (uint8_t)(i * 7);
+
+  for (nh = 0; nh < NKEYS; ++nh) {
+    sigs[nh] = sigbuf[nh];
+    if (edsign_keypair(pass, passlen, 10, 8, 1, pk[nh], sk[nh]) != EDSIGN_OK)
+      goto lock;
+    if (edsign_sk_unlock(NULL, pass, passlen, sk[nh], &h[nh]) != EDSIGN_OK)
+      goto lock;
+  }
+
+  if (edsign_sign_multi((const edsign_sk* const*)h, NKEYS, NULL, 0, sigs) !=
+      EDSIGN_EINVAL)
+    goto lock;
+
+  /* Each signature is the one its key makes alone, with or without
+     threads */
+  for (i = 0; i < 2; ++i) {
+    memset(sigbuf, 0, sizeof(sigbuf));
+    if (edsign_sign_multi((const edsign_sk* const*)h, NKEYS, msg, MSGLEN,
+                          sigs) != EDSIGN_OK)
+      goto lock;
+    for (nh = 0; nh < NKEYS; ++nh) {
+      if (edsign_sign(pass, passlen, sk[nh], msg, MSGLEN, sig) != EDSIGN_OK)
+        goto lock;
+      if (memcmp(sig, sigs[nh], sizeof(sig)) != 0) goto lock;
+      if (edsign_verify(pk[nh], sigs[nh], msg, MSGLEN) != EDSIGN_OK)
+        goto lock;
+    }
+    edsign_set_threads(3);
+  }
+  r = 0;
+
+lock:
+  while (nh-- > 0) edsign_sk_lock(h[nh]);
+  free(msg);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
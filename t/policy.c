@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define NKEYS 4
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[NKEYS + 1][edsign_PUBLICKEYBYTES];
+  uint8_t sk[NKEYS + 1][edsign_SECRETKEYBYTES];
+  uint8_t sigbuf[6][edsign_sign_BYTES];
+  uint8_t pkdup[edsign_PUBLICKEYBYTES];
+  uint8_t sigdup[edsign_sign_BYTES];
+  const uint8_t* pks[NKEYS + 1];
+  const uint8_t* sigs[6];
+  uint8_t* msg = (uint8_t*)"Hello world!";
+  int i;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  for (i = 0; i < NKEYS + 1; ++i) {
+    if (edsign_keypair(pass, passlen, 10, 8, 1, pk[i], sk[i]) != EDSIGN_OK)
+      goto out;
+    pks[i] = pk[i];
+  }
+  for (i = 0; i < 6; ++i) sigs[i] = sigbuf[i];
+
+  /* Keys 0 and 2 sign, key 0 twice; key 1 signs something else, and
+     the last key is not trusted */
+  if (edsign_sign(pass, passlen, sk[0], msg, 12, sigbuf[0]) != EDSIGN_OK)
+    goto out;
+  if (edsign_sign(pass, passlen, sk[0], msg, 12, sigbuf[1]) != EDSIGN_OK)
+    goto out;
+  if (edsign_sign(pass, passlen, sk[1], msg, 11, sigbuf[2]) != EDSIGN_OK)
+    goto out;
+  if (edsign_sign(pass, passlen, sk[2], msg, 12, sigbuf[3]) != EDSIGN_OK)
+    goto out;
+  if (edsign_sign(pass, passlen, sk[NKEYS], msg, 12, sigbuf[4]) != EDSIGN_OK)
+    goto out;
+  memset(sigbuf[5], 0, sizeof(sigbuf[5]));
+
+  if (edsign_verify_policy(pks, NKEYS, NKEYS + 1, sigs, 6, msg, 12) !=
+      EDSIGN_EINVAL)
+    goto out;
+  if (edsign_verify_policy(pks, NKEYS, 1, sigs, 6, NULL, 0) != EDSIGN_EINVAL)
+    goto out;
+  if (edsign_verify_policy(pks, NKEYS, 0, NULL, 0, msg, 12) != EDSIGN_OK)
+    goto out;
+
+  /* Two distinct keys signed, whatever the order of the signatures */
+  if (edsign_verify_policy(pks, NKEYS, 1, sigs, 6, msg, 12) != EDSIGN_OK)
+    goto out;
+  if (edsign_verify_policy(pks, NKEYS, 2, sigs, 6, msg, 12) != EDSIGN_OK)
+    goto out;
+  if (edsign_verify_policy(pks, NKEYS, 2, sigs + 1, 5, msg, 12) != EDSIGN_OK)
+    goto out;
+  if (edsign_verify_policy(pks, NKEYS, 3, sigs, 6, msg, 12) != EDSIGN_ESIG)
+    goto out;
+  if (edsign_verify_policy(pks, NKEYS, 2, sigs, 6, msg, 11) != EDSIGN_ESIG)
+    goto out;
+
+  /* The untrusted key counts once it is trusted */
+  if (edsign_verify_policy(pks, NKEYS + 1, 3, sigs, 6, msg, 12) != EDSIGN_OK)
+    goto out;
+
+  /* Neither a repeated key nor a repeated signature counts twice */
+  pks[1] = pk[0];
+  pks[2] = pk[0];
+  if (edsign_verify_policy(pks, 3, 2, sigs, 6, msg, 12) != EDSIGN_ESIG)
+    goto out;
+  if (edsign_verify_policy(pks, 3, 1, sigs, 2, msg, 12) != EDSIGN_OK)
+    goto out;
+
+  /* Nor does one key listed under two fingerprints, whichever its
+     signatures carry */
+  memcpy(pkdup, pk[0], sizeof(pkdup));
+  pkdup[2] ^= 1;
+  memcpy(sigdup, sigbuf[0], sizeof(sigdup));
+  sigdup[2] ^= 1;
+  pks[0] = pk[0];
+  pks[1] = pkdup;
+  pks[2] = pk[1];
+  sigs[0] = sigbuf[0];
+  sigs[1] = sigdup;
+  if (edsign_verify_policy(pks, 3, 2, sigs, 2, msg, 12) != EDSIGN_ESIG)
+    goto out;
+  if (edsign_verify_policy(pks, 3, 1, sigs + 1, 1, msg, 12) != EDSIGN_OK)
+    goto out;
+  r = 0;
+
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/wait.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define NSIGS 64
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sig[edsign_sign_BYTES];
+  uint8_t sig2[edsign_sign_BYTES];
+  uint8_t R[NSIGS][32];
+  uint8_t msg[32];
+  edsign_sk* h = NULL;
+  int i, j, res, status;
+  pid_t pid;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  if (edsign_keypair(pass, passlen, 14, 8, 1, pk, sk) != EDSIGN_OK) goto out;
+  if (edsign_sk_unlock(NULL, pass, passlen, sk, &h) != EDSIGN_OK) goto out;
+
+  if (edsign_sk_pool(NULL, 8, 2, EDSIGN_POOL_WAIT) != EDSIGN_EINVAL)
+    goto lock;
+  if (edsign_sk_pool(h, 8, 8, EDSIGN_POOL_WAIT) != EDSIGN_EINVAL) goto lock;
+  if (edsign_sk_pool(h, 8, 2, 3) != EDSIGN_EINVAL) goto lock;
+
+  /* Signatures from the pool verify, and never share a nonce, even
+     when signing the same message */
+  memset(msg, 0, sizeof(msg));
+  if (edsign_sk_pool(h, 8, 2, EDSIGN_POOL_WAIT) != EDSIGN_OK) goto lock;
+  for (i = 0; i < NSIGS; ++i) {
+    if (edsign_sign_with(h, msg, sizeof(msg), sig) != EDSIGN_OK) goto lock;
+    if (edsign_verify(pk, sig, msg, sizeof(msg)) != EDSIGN_OK) goto lock;
+    memcpy(R[i], sig + 10, 32);
+    for (j = 0; j < i; ++j)
+      if (memcmp(R[i], R[j], 32) == 0) goto lock;
+  }
+
+  /* Draining a pool which fails when empty gives EDSIGN_EBUSY */
+  if (edsign_sk_pool(h, 4, 0, EDSIGN_POOL_FAIL) != EDSIGN_OK) goto lock;
+  for (i = 0; i < 100000; ++i) {
+    res = edsign_sign_with(h, msg, sizeof(msg), sig);
+    if (res == EDSIGN_EBUSY) break;
+    if (res != EDSIGN_OK) goto lock;
+  }
+  if (res != EDSIGN_EBUSY) goto lock;
+
+  /* ... and signing inline instead gives deterministic signatures */
+  if (edsign_sk_pool(h, 1, 0, EDSIGN_POOL_INLINE) != EDSIGN_OK) goto lock;
+  if (edsign_sign(pass, passlen, sk, msg, sizeof(msg), sig2) != EDSIGN_OK)
+    goto lock;
+  for (i = 0; i < 100000; ++i) {
+    if (edsign_sign_with(h, msg, sizeof(msg), sig) != EDSIGN_OK) goto lock;
+    if (memcmp(sig, sig2, sizeof(sig)) == 0) break;
+  }
+  if (memcmp(sig, sig2, sizeof(sig)) != 0) goto lock;
+
+  /* Without a pool, signing is deterministic again */
+  if (edsign_sk_pool(h, 0, 0, EDSIGN_POOL_WAIT) != EDSIGN_OK) goto lock;
+  if (edsign_sign_with(h, msg, sizeof(msg), sig) != EDSIGN_OK) goto lock;
+  if (memcmp(sig, sig2, sizeof(sig)) != 0) goto lock;
+
+  /* A child signs deterministically rather than with the nonces its
+     parent hands out, and without a thread to wait for */
+  if (edsign_sk_pool(h, 2, 0, EDSIGN_POOL_WAIT) != EDSIGN_OK) goto lock;
+  if ((pid = fork()) == -1) goto lock;
+  if (pid == 0) {
+    for (i = 0; i < 8; ++i) {
+      if (edsign_sign_with(h, msg, sizeof(msg), sig) != EDSIGN_OK) _exit(1);
+      if (memcmp(sig, sig2, sizeof(sig)) != 0) _exit(1);
+    }
+    if (edsign_sk_pool(h, 4, 1, EDSIGN_POOL_WAIT) != EDSIGN_OK) _exit(1);
+    if (edsign_sign_with(h, msg, sizeof(msg), sig) != EDSIGN_OK) _exit(1);
+    if (edsign_verify(pk, sig, msg, sizeof(msg)) != EDSIGN_OK) _exit(1);
+    if (memcmp(sig, sig2, sizeof(sig)) == 0) _exit(1);
+    edsign_sk_lock(h);
+    _exit(0);
+  }
+  if (waitpid(pid, &status, 0) != pid) goto lock;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) goto lock;
+  if (edsign_sign_with(h, msg, sizeof(msg), sig) != EDSIGN_OK) goto lock;
+  if (memcmp(sig, sig2, sizeof(sig)) == 0) goto lock;
+
+  /* Locking the key stops its pool */
+  if (edsign_sk_pool(h, 16, 4, EDSIGN_POOL_WAIT) != EDSIGN_OK) goto lock;
+  r = 0;
+
+lock:
+  edsign_sk_lock(h);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
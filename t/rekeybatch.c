@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define NKEYS 80
+
+static uint8_t pkbuf[NKEYS][edsign_PUBLICKEYBYTES];
+static uint8_t skbuf[NKEYS][edsign_SECRETKEYBYTES];
+static uint8_t snbuf[NKEYS][edsign_SECRETKEYBYTES];
+static uint8_t* pks[NKEYS];
+static uint8_t* sks[NKEYS];
+static uint8_t* sns[NKEYS];
+static int results[NKEYS];
+static int derived;
+
+/* Derive a key with N = 16 against the budget, storing the result in
+   ${arg} */
+static void*
+derive(void* arg)
+{
+  const uint32_t params[3] = { 16, 8, 1 };
+  uint8_t out[64];
+
+  *(int*)arg = edsign_kdf(NULL, (uint8_t*)KDFALG_SCRYPT, (uint8_t*)"pw", 2,
+                          (uint8_t*)"0123456789abcdef", params, out, 64);
+  __atomic_fetch_add(&derived, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* Key ${i} signs under the password ${pass}, and verifies */
+static int
+check(const uint8_t* pass, uint64_t passlen, const uint8_t* sk, uint64_t i)
+{
+  uint8_t sig[edsign_sign_BYTES];
+  uint8_t* msg = (uint8_t*)"Hello world!";
+
+  if (edsign_sign(pass, passlen, sk, msg, 12, sig) != EDSIGN_OK) return -1;
+  return (edsign_verify(pks[i], sig, msg, 12) == EDSIGN_OK) ? 0 : -1;
+}
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t* newpass = (uint8_t*)"correct horse";
+  edsign_kdf_stats stats;
+  edsign_kdf_ctx* ctx = NULL;
+  pthread_t tid[2];
+  int res[2], rc;
+  uint64_t i;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  for (i = 0; i < NKEYS; ++i) {
+    pks[i] = pkbuf[i];
+    sks[i] = skbuf[i];
+    sns[i] = snbuf[i];
+  }
+
+  /* Keys under the password, but for one under another, one under
+     Argon2id, one unencrypted, and one which is not a key */
+  if (edsign_keypair_batch(NULL, pass, passlen, 10, 8, 1, NKEYS, pks, sks) !=
+      EDSIGN_OK)
+    goto out;
+  if (edsign_keypair(newpass, 13, 10, 8, 1, pks[3], sks[3]) != EDSIGN_OK)
+    goto out;
+  if (edsign_keypair_argon2id(NULL, pass, passlen, 1, 256, 1,
+                              pks[5], sks[5]) != EDSIGN_OK)
+    goto out;
+  if (edsign_keypair(NULL, 0, 0, 0, 0, pks[6], sks[6]) != EDSIGN_OK)
+    goto out;
+  memset(sks[70], 0, edsign_SECRETKEYBYTES);
+
+  if (edsign_rekey_batch(NULL, pass, passlen, newpass, 13, 11, 0, 1,
+                         NKEYS, (const uint8_t* const*)sks, sns, results) !=
+      EDSIGN_EINVAL)
+    goto out;
+
+  /* Every other key moves to the new password and parameters, with
+     the old and new derivations on several threads */
+  edsign_set_threads(4);
+  memset(snbuf, 0xAA, sizeof(snbuf));
+  if (edsign_rekey_batch(NULL, pass, passlen, newpass, 13, 11, 8, 1,
+                         NKEYS, (const uint8_t* const*)sks, sns, results) !=
+      EDSIGN_EPASSWD)
+    goto out;
+  for (i = 0; i < NKEYS; ++i) {
+    if (i == 3 || i == 70) {
+      if (results[i] != ((i == 3) ? EDSIGN_EPASSWD : EDSIGN_EINVAL))
+        goto out;
+      if (snbuf[i][0] != 0xAA || snbuf[i][40] != 0xAA) goto out;
+      continue;
+    }
+    if (results[i] != EDSIGN_OK) goto out;
+    if (memcmp(sns[i] + 2, "SK", 2) != 0) goto out;
+    if (edsign_le32dec(sns[i] + 4) != 11) goto out;
+    if (i % 16 == 0 || i == 5 || i == 6)
+      if (check(newpass, 13, sns[i], i) != 0) goto out;
+  }
+
+  /* The workers' memory is returned to the budget */
+  if (edsign_get_kdf_stats(&stats) != EDSIGN_OK) goto out;
+  if (stats.bytes_in_use != 0 || stats.running != 0) goto out;
+
+  /* In place, and back, under a budget with room for one worker; the
+     copy of key 3 was left as it was, and is not a key */
+  if (edsign_set_kdf_limits(crypto_scrypt_memory(1 << 11, 8, 1), 16) !=
+      EDSIGN_OK)
+    goto out;
+  if (edsign_rekey_batch(NULL, newpass, 13, pass, passlen, 10, 8, 1,
+                         5, (const uint8_t* const*)sns, sns, results) !=
+      EDSIGN_EINVAL)
+    goto out;
+  if (results[3] != EDSIGN_EINVAL) goto out;
+  if (check(pass, passlen, sns[4], 4) != 0) goto out;
+
+  /* Under a budget too small for a single derivation, each fails */
+  if (edsign_set_kdf_limits(1024, 16) != EDSIGN_OK) goto out;
+  if (edsign_rekey_batch(NULL, pass, passlen, NULL, 0, 0, 0, 0,
+                         3, (const uint8_t* const*)sks, sns, results) !=
+      EDSIGN_EBUSY)
+    goto out;
+  for (i = 0; i < 3; ++i)
+    if (results[i] != EDSIGN_EBUSY) goto out;
+
+  /* A scrypt key and an Argon2id key of 16 MiB each, under budgets
+     with room for one at a time, and for one worker with both; the
+     time limit fails the test rather than hanging it */
+  if (edsign_set_kdf_limits(0, 0) != EDSIGN_OK) goto out;
+  if (edsign_keypair(pass, passlen, 14, 8, 1, pks[0], sks[0]) != EDSIGN_OK)
+    goto out;
+  if (edsign_keypair_argon2id(NULL, pass, passlen, 1, 16384, 1,
+                              pks[1], sks[1]) != EDSIGN_OK)
+    goto out;
+  if ((ctx = edsign_kdf_ctx_new(0, 0, 0)) == NULL) goto out;
+  if (edsign_kdf_ctx_set_timeout(ctx, 60000) != EDSIGN_OK) goto free;
+  for (i = 24; i <= 40; i += 16) {
+    if (edsign_set_kdf_limits(i << 20, 8) != EDSIGN_OK) goto free;
+    memset(snbuf, 0xAA, 2 * sizeof(snbuf[0]));
+    if (edsign_rekey_batch(ctx, pass, passlen, newpass, 13, 14, 8, 1,
+                           2, (const uint8_t* const*)sks, sns, results) !=
+        EDSIGN_OK)
+      goto free;
+    if (check(newpass, 13, sns[0], 0) != 0) goto free;
+    if (check(newpass, 13, sns[1], 1) != 0) goto free;
+    if (edsign_get_kdf_stats(&stats) != EDSIGN_OK) goto free;
+    if (stats.bytes_in_use != 0 || stats.running != 0) goto free;
+  }
+  edsign_kdf_ctx_free(ctx);
+  ctx = NULL;
+
+  /* With one derivation running and another waiting for the budget,
+     the batch waits its turn too, rather than fail */
+  if (edsign_set_kdf_limits(crypto_scrypt_memory(1 << 16, 8, 1), 8) !=
+      EDSIGN_OK)
+    goto out;
+  for (i = 0; i < 2; ++i)
+    if (pthread_create(&tid[i], NULL, derive, &res[i]) != 0) goto out;
+  do {
+    sched_yield();
+    edsign_get_kdf_stats(&stats);
+  } while (stats.waiting == 0 &&
+           __atomic_load_n(&derived, __ATOMIC_ACQUIRE) < 2);
+  results[0] = results[1] = -1;
+  rc = edsign_rekey_batch(NULL, pass, passlen, newpass, 13, 10, 8, 1,
+                          2, (const uint8_t* const*)sks + 7, sns + 7, results);
+  pthread_join(tid[0], NULL);
+  pthread_join(tid[1], NULL);
+  if (rc != EDSIGN_OK || res[0] != EDSIGN_OK || res[1] != EDSIGN_OK)
+    goto out;
+  if (results[0] != EDSIGN_OK || results[1] != EDSIGN_OK) goto out;
+  if (check(newpass, 13, sns[8], 8) != 0) goto out;
+
+  /* An invalid call sets every result */
+  results[0] = results[1] = -1;
+  if (edsign_rekey_batch(NULL, pass, passlen, newpass, 13, 10, 0, 1,
+                         2, (const uint8_t* const*)sks, sns, results) !=
+      EDSIGN_EINVAL)
+    goto out;
+  if (results[0] != EDSIGN_EINVAL || results[1] != EDSIGN_EINVAL) goto out;
+  if (edsign_set_kdf_limits(0, 0) != EDSIGN_OK) goto out;
+
+  /* Cancelling the context cancels the workers */
+  if ((ctx = edsign_kdf_ctx_new(0, 0, 0)) == NULL) goto out;
+  edsign_kdf_ctx_cancel(ctx, 1);
+  if (edsign_rekey_batch(ctx, pass, passlen, newpass, 13, 10, 8, 1,
+                         NKEYS, (const uint8_t* const*)sks, sns, results) !=
+      EDSIGN_ECANCELED)
+    goto free;
+  if (results[7] != EDSIGN_ECANCELED) goto free;
+  r = 0;
+
+free:
+  edsign_kdf_ctx_free(ctx);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
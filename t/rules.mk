@@ -1,2 +1,2 @@
-TESTS=roundtrip rekey fingerprint
+TESTS=roundtrip rekey fingerprint batch threads kdfctx memory calibrate kdflimits cancel argon2 unlock pool signbatch executor keybatch multisign policy digest rekeybatch
 $(eval $(call test,t,$(TESTS)))
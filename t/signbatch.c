@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+#define NMSGS 71
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sig[edsign_sign_BYTES];
+  uint8_t buf[NMSGS][NMSGS];
+  uint8_t sigbuf[NMSGS][edsign_sign_BYTES];
+  const uint8_t* msgs[NMSGS];
+  uint64_t msglens[NMSGS];
+  uint8_t* sigs[NMSGS];
+  edsign_sk* h = NULL;
+  uint64_t i;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  /* Messages of every length up to NMSGS-1, spanning a full chunk and
+     a partial one */
+  for (i = 0; i < NMSGS; ++i) {
+    memset(buf[i], (int)i, sizeof(buf[i]));
+    msgs[i]    = buf[i];
+    msglens[i] = i;
+    sigs[i]    = sigbuf[i];
+  }
+
+  if (edsign_keypair(pass, passlen, 14, 8, 1, pk, sk) != EDSIGN_OK) goto out;
+  if (edsign_sk_unlock(NULL, pass, passlen, sk, &h) != EDSIGN_OK) goto out;
+
+  if (edsign_sign_batch(h, msgs, msglens, 0, NULL) != EDSIGN_OK) goto lock;
+  if (edsign_sign_batch(NULL, msgs, msglens, NMSGS, sigs) != EDSIGN_EINVAL)
+    goto lock;
+
+  /* Every signature is the one edsign_sign_with makes */
+  if (edsign_sign_batch(h, msgs, msglens, NMSGS, sigs) != EDSIGN_OK)
+    goto lock;
+  for (i = 0; i < NMSGS; ++i) {
+    if (edsign_sign_with(h, msgs[i], msglens[i], sig) != EDSIGN_OK) goto lock;
+    if (memcmp(sig, sigs[i], sizeof(sig)) != 0) goto lock;
+    if (edsign_verify(pk, sigs[i], msgs[i], msglens[i]) != EDSIGN_OK)
+      goto lock;
+  }
+  r = 0;
+
+lock:
+  edsign_sk_lock(h);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
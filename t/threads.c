@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sig[edsign_sign_BYTES];
+  uint8_t k1[64], k4[64];
+  uint64_t V = 128 * 8 * (1 << 14), XY = 256 * 8 + 64, B = 4 * 128 * 8;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  uint8_t* msg = (uint8_t*)"Hello world!";
+
+  /* Thread counts out of range are rejected */
+  if (edsign_set_threads(0) != EDSIGN_EINVAL) goto out;
+  if (edsign_set_threads(EDSIGN_MAX_THREADS+1) != EDSIGN_EINVAL) goto out;
+
+  /* The lanes give the same key however many threads run them */
+  edsign_set_threads(1);
+  crypto_scrypt(pass, passlen, (uint8_t*)"salt", 4, 1 << 10, 8, 5, k1, 64);
+  edsign_set_threads(4);
+  crypto_scrypt(pass, passlen, (uint8_t*)"salt", 4, 1 << 10, 8, 5, k4, 64);
+  if (memcmp(k1, k4, sizeof(k1)) != 0) goto out;
+
+  /* Interleave widths out of range are rejected */
+  if (edsign_set_interleave(0) != EDSIGN_EINVAL) goto out;
+  if (edsign_set_interleave(5) != EDSIGN_EINVAL) goto out;
+
+  /* Each thread keeps as many lanes in memory as it interleaves, which
+     the CPU and the interleave limit bound; one keeps a single V */
+  edsign_set_threads(1);
+  if (crypto_scrypt_memory(1 << 14, 8, 4) !=
+      crypto_scrypt_interleave() * (V + XY) + B)
+    goto out;
+  if (edsign_set_interleave(1) != EDSIGN_OK) goto out;
+  if (crypto_scrypt_interleave() != 1) goto out;
+  if (crypto_scrypt_memory(1 << 14, 8, 4) != V + XY + B)
+    goto out;
+
+  /* ... and gives the same key */
+  edsign_set_threads(4);
+  crypto_scrypt(pass, passlen, (uint8_t*)"salt", 4, 1 << 10, 8, 5, k4, 64);
+  if (memcmp(k1, k4, sizeof(k1)) != 0) goto out;
+  if (edsign_set_interleave(4) != EDSIGN_OK) goto out;
+
+  /* And keys made with several lanes in parallel round trip */
+  edsign_keypair(pass, passlen, 12, 8, 4, pk, sk);
+  edsign_sign(pass, passlen, sk, msg, 12, sig);
+  r = edsign_verify(pk, sig, msg, 12);
+
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../lib/edsign-amalg.c"
+
+int
+main(int ac, char** av)
+{
+  int r = -1;
+  uint8_t pk[edsign_PUBLICKEYBYTES];
+  uint8_t sk[edsign_SECRETKEYBYTES];
+  uint8_t sk2[edsign_SECRETKEYBYTES];
+  uint8_t sig1[edsign_sign_BYTES];
+  uint8_t sig2[edsign_sign_BYTES];
+  uint8_t msg[32];
+  edsign_sk* h = NULL;
+  int i;
+
+  uint8_t* pass;
+  uint64_t passlen;
+
+  if (ac < 2) {
+    pass = (uint8_t*)"hunter2";
+    passlen = 7;
+  }
+  else {
+    pass = (uint8_t*)av[1];
+    passlen = strlen(av[1]);
+  }
+
+  if (edsign_keypair(pass, passlen, 14, 8, 1, pk, sk) != EDSIGN_OK) goto out;
+
+  /* A wrong password unlocks nothing */
+  h = (edsign_sk*)sk;
+  if (edsign_sk_unlock(NULL, (uint8_t*)"wrong", 5, sk, &h) != EDSIGN_EPASSWD)
+    goto out;
+  if (h != NULL) goto out;
+  if (edsign_sk_unlock(NULL, pass, passlen, sk, NULL) != EDSIGN_EINVAL)
+    goto out;
+  if (edsign_sign_with(NULL, msg, sizeof(msg), sig1) != EDSIGN_EINVAL)
+    goto out;
+
+  /* Signatures from a handle are those edsign_sign makes */
+  if (edsign_sk_unlock(NULL, pass, passlen, sk, &h) != EDSIGN_OK) goto out;
+  for (i = 0; i < 64; ++i) {
+    memset(msg, i, sizeof(msg));
+    if (edsign_sign_with(h, msg, sizeof(msg), sig1) != EDSIGN_OK) goto lock;
+    if (edsign_verify(pk, sig1, msg, sizeof(msg)) != EDSIGN_OK) goto lock;
+    if (i % 16 == 0) {
+      if (edsign_sign(pass, passlen, sk, msg, sizeof(msg), sig2) != EDSIGN_OK)
+        goto lock;
+      if (memcmp(sig1, sig2, sizeof(sig1)) != 0) goto lock;
+    }
+  }
+  edsign_sk_lock(h);
+
+  /* Unencrypted keys unlock without a password */
+  if (edsign_rekey_priv(pass, passlen, NULL, 0, 0, 0, 0, sk, sk2) != EDSIGN_OK)
+    goto out;
+  if (edsign_sk_unlock(NULL, NULL, 0, sk2, &h) != EDSIGN_OK) goto out;
+  if (edsign_sign_with(h, msg, sizeof(msg), sig1) != EDSIGN_OK) goto lock;
+  if (edsign_verify(pk, sig1, msg, sizeof(msg)) != EDSIGN_OK) goto lock;
+  r = 0;
+
+lock:
+  edsign_sk_lock(h);
+  edsign_sk_lock(NULL);
+out:
+  printf("result: %s\n", (r == 0) ? "OK" : "FAIL");
+  return r;
+}